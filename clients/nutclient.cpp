@@ -27,6 +27,14 @@
 #include "nutclient.h"
 
 #include <sstream>
+#include <utility>	/* std::move */
+#include <functional>
+#include <memory>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
 /* TODO: Make it a run-time option like upsdebugx(),
  * probably with a verbosity level variable in each
@@ -152,6 +160,21 @@ static inline char *xstrdup(const char *string){return strdup(string);}
 
 #include "nut_stdint.h" /* PRIuMAX etc. */
 
+#ifdef WITH_OPENSSL
+# include <openssl/err.h>
+# include <openssl/ssl.h>
+# include <climits>
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+# include <nss.h>
+# include <prerror.h>
+# include <prinit.h>
+# include <pk11func.h>
+# include <prtypes.h>
+# include <ssl.h>
+# include <plstr.h>
+# include <private/pprio.h>
+#endif	/* WITH_OPENSSL | WITH_NSS */
+
 /* To stay in line with modern C++, we use nullptr (not numeric NULL
  * or shim __null on some systems) which was defined after C++98.
  * The NUT C++ interface is intended for C++11 and newer, so we
@@ -206,11 +229,83 @@ IOException::~IOException() noexcept {}
 UnknownHostException::~UnknownHostException() noexcept {}
 NotConnectedException::~NotConnectedException() noexcept {}
 TimeoutException::~TimeoutException() noexcept {}
+SslException::~SslException() noexcept {}
 
 
 namespace internal
 {
 
+/**
+ * Reply to a request which was sent: it takes the lines received for
+ * it, in order.
+ */
+class Reply
+{
+public:
+	virtual ~Reply();
+
+	/* Returns true if this was the last line of the reply */
+	virtual bool take(const char* line, size_t len) = 0;
+	/* The reply will not come (e.g. the connection was lost) */
+	virtual void fail(std::exception_ptr ex) = 0;
+};
+
+Reply::~Reply()
+{
+}
+
+/**
+ * Reply made into a T by a parser, which takes the lines one by one and
+ * returns true with the last one. The result, or an exception thrown by
+ * the parser (which ends the reply), is delivered through a future.
+ */
+template<typename T>
+class ReplyOf : public Reply
+{
+public:
+	typedef std::function<bool(T& res, const char* line, size_t len)> Parser;
+
+	explicit ReplyOf(const Parser& parser):_parser(parser),_res(){}
+
+	std::future<T> future(){return _promise.get_future();}
+
+	virtual bool take(const char* line, size_t len) override
+	{
+		try
+		{
+			if(!_parser(_res, line, len))
+			{
+				return false;
+			}
+			_promise.set_value(std::move(_res));
+		}
+		catch(...)
+		{
+			_promise.set_exception(std::current_exception());
+		}
+		return true;
+	}
+
+	virtual void fail(std::exception_ptr ex) override
+	{
+		_promise.set_exception(ex);
+	}
+
+private:
+	Parser _parser;
+	T _res;
+	std::promise<T> _promise;
+};
+
+/* Values of GET VARS, unless the server does not know that request */
+struct VarsReply
+{
+	VarsReply():unknown(false){}
+
+	bool unknown;
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > values;
+};
+
 /**
  * Internal socket wrapper.
  * Provides only client socket functions.
@@ -228,8 +323,13 @@ public:
 	bool isConnected()const;
 	void setDebugConnect(bool d);
 
+	void setSsl(SslMode mode, bool certVerify, const std::string& certPath,
+		const std::string& certName, const std::string& certPasswd);
+	bool isSsl()const;
+
 	void setTimeout(time_t timeout);
 	bool hasTimeout()const{return _tv.tv_sec>=0;}
+	time_t getTimeout()const{return _tv.tv_sec;}
 
 	size_t read(void* buf, size_t sz);
 	size_t write(const void* buf, size_t sz);
@@ -237,18 +337,98 @@ public:
 	std::string read();
 	void write(const std::string& str);
 
+	/* Next line (without the newline), where it was received: only
+	 * valid until the next read from this socket. */
+	void readLine(const char*& line, size_t& len);
+
+	/* Send a request; its reply (taking ownership of it) gets the lines
+	 * which come after those of the requests sent before. */
+	void request(const std::string& req, Reply* reply);
+	/* Hand the complete lines received already to their replies,
+	 * returns false if there were none */
+	bool dispatch();
+	/* Read some more (within the timeout) and hand it out; unless block,
+	 * only what can be read without waiting (for the reactor, which
+	 * calls again when there is more) */
+	void receive(bool block = true);
+	/* Fail all replies still to come */
+	void failReplies(std::exception_ptr ex);
+
+	/* Decrypted TLS data which select() does not know about */
+	bool hasPendingData()const;
+	SOCKET fd()const{std::lock_guard<std::recursive_mutex> lock(_ioMutex); return _sock;}
+
+	/* The reactor reading for this socket, if any */
+	std::atomic<TcpClientReactor*> reactor;
+	/* Only one thread reads at a time */
+	std::mutex readMutex;
 
 private:
+	/* Complete line in the buffer, if any */
+	bool nextLine(const char*& line, size_t& len);
+	/* Read new data into the buffer, false if nothing came (unless block) */
+	bool fill(bool block = true);
+	/* Read what came already, or wait for it if block; false if nothing
+	 * could be read without waiting (e.g. only a part of a TLS record) */
+	bool read(void* buf, size_t sz, size_t& len, bool block);
+
+	/* Wait until the socket can be read (or written) within the timeout,
+	 * with the I/O lock released meanwhile */
+	void wait(std::unique_lock<std::recursive_mutex>& lock, bool forWrite);
+	/* Switch to TLS after connecting, as configured */
+	void startTls(const std::string& host);
+	void sslFail(const std::string& msg);
+
 	SOCKET _sock;
 	bool _debugConnect;
 	struct timeval	_tv;
-	std::string _buffer; /* Received buffer, string because data should be text only. */
+
+	SslMode _sslMode;
+	bool _sslVerify;
+	std::string _certPath, _certName, _certPasswd;
+#ifdef WITH_OPENSSL
+	SSL_CTX* _sslCtx;
+	SSL* _ssl;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	PRFileDesc* _ssl;
+	static char* nssPassword(PK11SlotInfo* slot, PRBool retry, void* arg);
+#endif	/* WITH_OPENSSL | WITH_NSS */
+	/* Received data, not handed out yet between _bufStart and _bufEnd;
+	 * it grows if a line does not fit. */
+	std::vector<char> _buffer;
+	size_t _bufStart, _bufEnd;
+	/* Length of the partial line at _bufStart, looked at already */
+	size_t _scanned;
+
+	/* Held for any use of the socket (or TLS session, which can not be
+	 * read and written at once) and to disconnect, but not to wait */
+	mutable std::recursive_mutex _ioMutex;
+	/* Keeps the requests in the order of their replies */
+	std::mutex _writeMutex;
+	std::mutex _repliesMutex;
+	std::deque<std::unique_ptr<Reply> > _replies;
 };
 
+/* Initial size of the receive buffer */
+static const size_t SOCKET_BUFFER_SIZE = 4096;
+
 Socket::Socket():
+reactor(nullptr),
 _sock(INVALID_SOCKET),
 _debugConnect(false),
-_tv()
+_tv(),
+_sslMode(SSLMODE_NONE),
+_sslVerify(false),
+#ifdef WITH_OPENSSL
+_sslCtx(nullptr),
+_ssl(nullptr),
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+_ssl(nullptr),
+#endif	/* WITH_OPENSSL | WITH_NSS */
+_buffer(SOCKET_BUFFER_SIZE),
+_bufStart(0),
+_bufEnd(0),
+_scanned(0)
 {
 	_tv.tv_sec = -1;
 	_tv.tv_usec = 0;
@@ -257,6 +437,7 @@ _tv()
 Socket::~Socket()
 {
 	disconnect();
+	failReplies(std::make_exception_ptr(nut::NotConnectedException()));
 }
 
 void Socket::setTimeout(time_t timeout)
@@ -269,6 +450,25 @@ void Socket::setDebugConnect(bool d)
 	_debugConnect = d;
 }
 
+void Socket::setSsl(SslMode mode, bool certVerify, const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd)
+{
+	_sslMode = mode;
+	_sslVerify = certVerify;
+	_certPath = certPath;
+	_certName = certName;
+	_certPasswd = certPasswd;
+}
+
+bool Socket::isSsl()const
+{
+#ifdef WITH_SSL
+	return _ssl!=nullptr;
+#else
+	return false;
+#endif
+}
+
 void Socket::connect(const std::string& host, uint16_t port)
 {
 	int	sock_fd;
@@ -289,7 +489,9 @@ void Socket::connect(const std::string& host, uint16_t port)
 	WSAStartup(2,&WSAdata);
 #endif	/* WIN32 */
 
-	_sock = INVALID_SOCKET;
+	// Forget about an earlier connection, and what it left unread
+	disconnect();
+	_bufStart = _bufEnd = _scanned = 0;
 
 	if (host.empty()) {
 		if (_debugConnect) std::cerr <<
@@ -533,7 +735,7 @@ void Socket::connect(const std::string& host, uint16_t port)
 		throw nut::IOException("Cannot connect to host");
 	}
 
-	/* TODO? See upsclient.c for NSS/SSL connection handling */
+	startTls(host);
 
 #ifdef OLD
 	struct hostent *hostinfo = nullptr;
@@ -565,205 +767,766 @@ void Socket::connect(const std::string& host, uint16_t port)
 
 void Socket::disconnect()
 {
+	std::lock_guard<std::recursive_mutex> lock(_ioMutex);
+
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		SSL_shutdown(_ssl);
+		SSL_free(_ssl);
+		_ssl = nullptr;
+	}
+	if(_sslCtx)
+	{
+		SSL_CTX_free(_sslCtx);
+		_sslCtx = nullptr;
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if(_ssl)
+	{
+		// Closes the socket too
+		PR_Shutdown(_ssl, PR_SHUTDOWN_BOTH);
+		PR_Close(_ssl);
+		_ssl = nullptr;
+		_sock = INVALID_SOCKET;
+	}
+#endif	/* WITH_OPENSSL | WITH_NSS */
 	if(_sock != INVALID_SOCKET)
 	{
 		::closesocket(_sock);
 		_sock = INVALID_SOCKET;
 	}
-	_buffer.clear();
+	// The receive buffer is only reset by connect(): another thread
+	// may be reading into it
 }
 
-bool Socket::isConnected()const
+void Socket::sslFail(const std::string& msg)
 {
-	return _sock!=INVALID_SOCKET;
-}
+	std::string err = msg;
 
-size_t Socket::read(void* buf, size_t sz)
-{
-	if(!isConnected())
+#ifdef WITH_OPENSSL
+	unsigned long e;
+	char errmsg[256];
+	while ((e = ERR_get_error()) != 0)
 	{
-		throw nut::NotConnectedException();
+		ERR_error_string_n(e, errmsg, sizeof(errmsg));
+		err += std::string(": ") + errmsg;
 	}
-
-	if(_tv.tv_sec>=0)
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	char errmsg[256];
+	PRInt32 length = PR_GetErrorTextLength();
+	if (length > 0 && length < static_cast<PRInt32>(sizeof(errmsg)))
 	{
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, &fds, nullptr, nullptr, &_tv);
-		if (ret < 1) {
-			throw nut::TimeoutException();
-		}
+		PR_GetErrorText(errmsg);
+		err += std::string(": ") + errmsg;
 	}
+#endif	/* WITH_OPENSSL | WITH_NSS */
 
-	ssize_t res = sktread(_sock, buf, sz);
-	if(res==-1)
+	if (_debugConnect) std::cerr <<
+		"[D2] Socket::startTls(): " << err <<
+		std::endl << std::flush;
+
+	disconnect();
+	throw nut::SslException(err);
+}
+
+#ifdef WITH_NSS
+char* Socket::nssPassword(PK11SlotInfo* slot, PRBool retry, void* arg)
+{
+	const Socket* sock = static_cast<const Socket*>(arg);
+	NUT_UNUSED_VARIABLE(slot);
+
+	// Do not insist with a wrong one
+	if (retry || !sock || sock->_certPasswd.empty())
 	{
-		disconnect();
-		throw nut::IOException("Error while reading on socket");
+		return nullptr;
 	}
-	return static_cast<size_t>(res);
+	return PL_strdup(sock->_certPasswd.c_str());
 }
 
-size_t Socket::write(const void* buf, size_t sz)
+static SECStatus nssAuthCertificateDontVerify(void* arg, PRFileDesc* fd,
+	PRBool checksig, PRBool isServer)
 {
-	if(!isConnected())
+	NUT_UNUSED_VARIABLE(arg);
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(checksig);
+	NUT_UNUSED_VARIABLE(isServer);
+	return SECSuccess;
+}
+
+/* The certificate database belongs to the process, not a connection */
+static std::once_flag nssInitOnce;
+static SECStatus nssInitStatus = SECFailure;
+#endif	/* WITH_NSS */
+
+#if (defined WITH_OPENSSL) && (OPENSSL_VERSION_NUMBER < 0x10100000L)
+static std::once_flag opensslInitOnce;
+#endif
+
+void Socket::startTls(const std::string& host)
+{
+	if(_sslMode == SSLMODE_NONE)
 	{
-		throw nut::NotConnectedException();
+		return;
 	}
 
-	if(_tv.tv_sec>=0)
+#ifndef WITH_SSL
+	NUT_UNUSED_VARIABLE(host);
+	if(_sslMode == SSLMODE_FORCE)
+	{
+		sslFail("TLS support was not compiled in");
+	}
+#else	/* WITH_SSL */
+	// See if upsd even talks TLS
+	write(std::string("STARTTLS"));
+	std::string res = read();
+	if(res.compare(0, 11, "OK STARTTLS") != 0)
 	{
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, nullptr, &fds, nullptr, &_tv);
-		if (ret < 1) {
-			throw nut::TimeoutException();
+		if(_sslMode == SSLMODE_FORCE)
+		{
+			sslFail("TLS is not available from the server (" + res + ")");
 		}
+		return;
 	}
 
-	ssize_t res = sktwrite(_sock, buf, sz);
-	if(res==-1)
+# ifdef WITH_OPENSSL
+	NUT_UNUSED_VARIABLE(host);
+
+#  if OPENSSL_VERSION_NUMBER < 0x10100000L
+	std::call_once(opensslInitOnce, [](){
+		SSL_load_error_strings();
+		SSL_library_init();
+	});
+	_sslCtx = SSL_CTX_new(SSLv23_client_method());
+#  else
+	_sslCtx = SSL_CTX_new(TLS_client_method());
+#  endif
+	if(!_sslCtx)
 	{
-		disconnect();
-		throw nut::IOException("Error while writing on socket");
+		sslFail("Can not initialize SSL context");
 	}
-	return static_cast<size_t>(res);
-}
-
-std::string Socket::read()
-{
-	std::string res;
-	char buff[256];
 
-	while(true)
+#  if OPENSSL_VERSION_NUMBER < 0x10100000L
+	// Set minimum protocol TLSv1
+	SSL_CTX_set_options(_sslCtx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+#  else
+	if(SSL_CTX_set_min_proto_version(_sslCtx, TLS1_VERSION) != 1)
 	{
-		// Look at already read data in _buffer
-		if(!_buffer.empty())
-		{
-			size_t idx = _buffer.find('\n');
-			if(idx!=std::string::npos)
-			{
-				res += _buffer.substr(0, idx);
-				_buffer.erase(0, idx+1);
-				return res;
-			}
-			res += _buffer;
-		}
+		sslFail("Can not set minimum protocol to TLSv1");
+	}
+#  endif
 
-		// Read new buffer
-		size_t sz = read(&buff, 256);
-		if(sz==0)
+	if(!_certPath.empty())
+	{
+		if(SSL_CTX_load_verify_locations(_sslCtx, nullptr, _certPath.c_str()) != 1)
 		{
-			disconnect();
-			throw nut::IOException("Server closed connection unexpectedly");
+			sslFail("Failed to load certificates from " + _certPath);
 		}
-		_buffer.assign(buff, sz);
 	}
-}
-
-void Socket::write(const std::string& str)
-{
-//	write(str.c_str(), str.size());
-//	write("\n", 1);
-	std::string buff = str + "\n";
-	write(buff.c_str(), buff.size());
-}
+	else if(_sslVerify)
+	{
+		sslFail("Can not verify the server certificate without a certificate path");
+	}
 
-}/* namespace internal */
+	_ssl = SSL_new(_sslCtx);
+	if(!_ssl)
+	{
+		sslFail("Can not create SSL socket");
+	}
+	if(SSL_set_fd(_ssl, static_cast<int>(_sock)) != 1)
+	{
+		sslFail("Can not bind file descriptor to SSL socket");
+	}
+	SSL_set_verify(_ssl, _sslVerify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
 
+	if(SSL_connect(_ssl) != 1)
+	{
+		sslFail("TLS handshake failed");
+	}
 
-/*
- *
- * Client implementation
- *
- */
+	// From now on read() and write() wait for the session without
+	// holding the I/O lock: a record which carries no data (like a
+	// session ticket) must not leave SSL_read() blocked under it
+#ifndef WIN32
+	fcntl(_sock, F_SETFL, fcntl(_sock, F_GETFL) | O_NONBLOCK);
+#else	/* WIN32 */
+	{
+		u_long argp = 1;
+		ioctlsocket(_sock, FIONBIO, &argp);
+	}
+#endif	/* WIN32 */
 
-/* Pedantic builds complain about the static variable below...
- * It is assumed safe to ignore since it is a std::string with
- * no complex teardown at program exit.
- */
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
-#pragma GCC diagnostic push
-# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS
-#  pragma GCC diagnostic ignored "-Wglobal-constructors"
-# endif
-# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS
-#  pragma GCC diagnostic ignored "-Wexit-time-destructors"
-# endif
-#endif
-const Feature Client::TRACKING = "TRACKING";
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
-#pragma GCC diagnostic pop
-#endif
+	if (_debugConnect) std::cerr <<
+		"[D2] Socket::startTls(): SSL connected (" <<
+		SSL_get_version(_ssl) << ")" <<
+		std::endl << std::flush;
+
+# elif defined(WITH_NSS) /* WITH_OPENSSL */
+	std::call_once(nssInitOnce, [this](){
+		// Maybe libupsclient did it already
+		if (NSS_IsInitialized())
+		{
+			nssInitStatus = SECSuccess;
+			return;
+		}
+		PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
+		PK11_SetPasswordFunc(nssPassword);
+		nssInitStatus = _certPath.empty()
+			? NSS_NoDB_Init(nullptr)
+			: NSS_Init(_certPath.c_str());
+		if (nssInitStatus == SECSuccess)
+		{
+			nssInitStatus = NSS_SetDomesticPolicy();
+		}
+	});
+	if(nssInitStatus != SECSuccess)
+	{
+		sslFail("Can not initialize SSL context");
+	}
 
-Client::Client()
-{
-}
+	PRFileDesc* socket = PR_ImportTCPSocket(_sock);
+	if(!socket)
+	{
+		sslFail("Can not import the socket");
+	}
+	_ssl = SSL_ImportFD(nullptr, socket);
+	if(!_ssl)
+	{
+		// Closes the socket too
+		PR_Close(socket);
+		_sock = INVALID_SOCKET;
+		sslFail("Can not create SSL socket");
+	}
+	if(SSL_OptionSet(_ssl, SSL_HANDSHAKE_AS_CLIENT, PR_TRUE) != SECSuccess
+	 || SSL_SetPKCS11PinArg(_ssl, this) != SECSuccess
+	) {
+		sslFail("Can not set up SSL socket");
+	}
+	if(!_sslVerify
+	 && SSL_AuthCertificateHook(_ssl, nssAuthCertificateDontVerify, nullptr) != SECSuccess
+	) {
+		sslFail("Can not set up SSL socket");
+	}
+	if(!_certName.empty()
+	 && SSL_GetClientAuthDataHook(_ssl, NSS_GetClientAuthData,
+		const_cast<char*>(_certName.c_str())) != SECSuccess
+	) {
+		sslFail("Can not set up the client certificate");
+	}
+	if(SSL_SetURL(_ssl, host.c_str()) != SECSuccess
+	 || SSL_ResetHandshake(_ssl, PR_FALSE) != SECSuccess
+	 || SSL_ForceHandshake(_ssl) != SECSuccess
+	) {
+		sslFail("TLS handshake failed");
+	}
 
-Client::~Client()
-{
+	// As with OpenSSL, see above
+	PRSocketOptionData opt;
+	opt.option = PR_SockOpt_Nonblocking;
+	opt.value.non_blocking = PR_TRUE;
+	if(PR_SetSocketOption(_ssl, &opt) != PR_SUCCESS)
+	{
+		sslFail("Can not set up SSL socket");
+	}
+# endif	/* WITH_OPENSSL | WITH_NSS */
+#endif	/* WITH_SSL */
 }
 
-bool Client::hasDevice(const std::string& dev)
+bool Socket::isConnected()const
 {
-	std::set<std::string> devs = getDeviceNames();
-	return devs.find(dev) != devs.end();
+	std::lock_guard<std::recursive_mutex> lock(_ioMutex);
+	return _sock!=INVALID_SOCKET;
 }
 
-Device Client::getDevice(const std::string& name)
+void Socket::wait(std::unique_lock<std::recursive_mutex>& lock, bool forWrite)
 {
-	if(hasDevice(name))
-		return Device(this, name);
-	else
-		return Device(nullptr, "");
-}
+	// select() may change the timeout it was given
+	struct timeval tv = _tv;
+	SOCKET sock = _sock;
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(sock, &fds);
 
-std::set<Device> Client::getDevices()
-{
-	std::set<Device> res;
+	// Other threads may write (or read) meanwhile
+	lock.unlock();
+	int ret = forWrite
+		? select(sock+1, nullptr, &fds, nullptr, hasTimeout() ? &tv : nullptr)
+		: select(sock+1, &fds, nullptr, nullptr, hasTimeout() ? &tv : nullptr);
+	lock.lock();
 
-	std::set<std::string> devs = getDeviceNames();
-	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	if(!isConnected())
 	{
-		res.insert(Device(this, *it));
+		throw nut::NotConnectedException();
+	}
+	if (ret < 1) {
+		throw nut::TimeoutException();
 	}
-
-	return res;
 }
 
-bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)
+size_t Socket::read(void* buf, size_t sz)
 {
-	std::set<std::string> names = getDeviceVariableNames(dev);
-	return names.find(name) != names.end();
+	size_t len = 0;
+	read(buf, sz, len, true);
+	return len;
 }
 
-std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)
+bool Socket::read(void* buf, size_t sz, size_t& len, bool block)
 {
-	std::map<std::string,std::vector<std::string> > res;
+	std::unique_lock<std::recursive_mutex> lock(_ioMutex);
 
-	std::set<std::string> names = getDeviceVariableNames(dev);
-	for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+	if(!isConnected())
 	{
-		const std::string& name = *it;
-		res[name] = getDeviceVariableValue(dev, name);
+		throw nut::NotConnectedException();
 	}
 
-	return res;
-}
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		// The socket does not block (see startTls()): try first,
+		// wait for what the session asks for and retry
+		while(true)
+		{
+			int ret = SSL_read(_ssl, buf, static_cast<int>(sz > INT_MAX ? INT_MAX : sz));
+			if(ret>0)
+			{
+				len = static_cast<size_t>(ret);
+				return true;
+			}
+			switch(SSL_get_error(_ssl, ret))
+			{
+			case SSL_ERROR_WANT_READ:
+				if(!block)
+				{
+					return false;
+				}
+				wait(lock, false);
+				break;
+			case SSL_ERROR_WANT_WRITE:
+				wait(lock, true);
+				break;
+			case SSL_ERROR_ZERO_RETURN:
+				len = 0;
+				return true;
+			default:
+				disconnect();
+				throw nut::IOException("Error while reading on TLS socket");
+			}
+		}
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if(_ssl)
+	{
+		while(true)
+		{
+			PRInt32 ret = PR_Read(_ssl, buf, static_cast<PRInt32>(sz > PR_INT32_MAX ? PR_INT32_MAX : sz));
+			if(ret>=0)
+			{
+				len = static_cast<size_t>(ret);
+				return true;
+			}
+			if(PR_GetError()!=PR_WOULD_BLOCK_ERROR)
+			{
+				disconnect();
+				throw nut::IOException("Error while reading on TLS socket");
+			}
+			if(!block)
+			{
+				return false;
+			}
+			wait(lock, false);
+		}
+	}
+#endif	/* WITH_OPENSSL | WITH_NSS */
 
-std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::set<std::string>& devs)
-{
-	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+	ssize_t res;
 
-	for(std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+#if (defined MSG_DONTWAIT) && !(defined WIN32)
+	// Data which has arrived already needs no select() first
+	res = ::recv(_sock, buf, sz, MSG_DONTWAIT);
+	if(res>=0)
 	{
-		res[*it] = getDeviceVariableValues(*it);
+		len = static_cast<size_t>(res);
+		return true;
+	}
+	if(errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)
+	{
+		disconnect();
+		throw nut::IOException("Error while reading on socket");
+	}
+	if(!block)
+	{
+		return false;
 	}
+#endif	/* MSG_DONTWAIT && !WIN32 */
 
-	return res;
-}
+	// (if not to block, it was seen readable by the caller)
+	if(block)
+	{
+		wait(lock, false);
+	}
+
+	res = sktread(_sock, buf, sz);
+	if(res==-1)
+	{
+		disconnect();
+		throw nut::IOException("Error while reading on socket");
+	}
+	len = static_cast<size_t>(res);
+	return true;
+}
+
+size_t Socket::write(const void* buf, size_t sz)
+{
+	std::unique_lock<std::recursive_mutex> lock(_ioMutex);
+
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		// Same as in read(): the socket does not block
+		while(true)
+		{
+			int ret = SSL_write(_ssl, buf, static_cast<int>(sz > INT_MAX ? INT_MAX : sz));
+			if(ret>0)
+			{
+				return static_cast<size_t>(ret);
+			}
+			switch(SSL_get_error(_ssl, ret))
+			{
+			case SSL_ERROR_WANT_WRITE:
+				wait(lock, true);
+				break;
+			case SSL_ERROR_WANT_READ:
+				wait(lock, false);
+				break;
+			default:
+				disconnect();
+				throw nut::IOException("Error while writing on TLS socket");
+			}
+		}
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if(_ssl)
+	{
+		while(true)
+		{
+			PRInt32 ret = PR_Write(_ssl, buf, static_cast<PRInt32>(sz > PR_INT32_MAX ? PR_INT32_MAX : sz));
+			if(ret>=0)
+			{
+				return static_cast<size_t>(ret);
+			}
+			if(PR_GetError()!=PR_WOULD_BLOCK_ERROR)
+			{
+				disconnect();
+				throw nut::IOException("Error while writing on TLS socket");
+			}
+			wait(lock, true);
+		}
+	}
+#endif	/* WITH_OPENSSL | WITH_NSS */
+
+	wait(lock, true);
+
+	ssize_t res = sktwrite(_sock, buf, sz);
+	if(res==-1)
+	{
+		disconnect();
+		throw nut::IOException("Error while writing on socket");
+	}
+	return static_cast<size_t>(res);
+}
+
+bool Socket::nextLine(const char*& line, size_t& len)
+{
+	// Look at the data which was not looked at yet
+	const char* begin = &_buffer[0] + _bufStart;
+	const char* nl = static_cast<const char*>(
+		memchr(begin + _scanned, '\n', _bufEnd - _bufStart - _scanned));
+	if(!nl)
+	{
+		_scanned = _bufEnd - _bufStart;
+		return false;
+	}
+
+	line = begin;
+	len = static_cast<size_t>(nl - begin);
+	_bufStart += len + 1;
+	_scanned = 0;
+	if(_bufStart == _bufEnd)
+	{
+		// Everything was handed out: start over at the beginning
+		_bufStart = _bufEnd = 0;
+	}
+	return true;
+}
+
+bool Socket::fill(bool block)
+{
+	// A partial line: make room for the rest of it
+	if(_bufStart > 0)
+	{
+		memmove(&_buffer[0], &_buffer[_bufStart], _bufEnd - _bufStart);
+		_bufEnd -= _bufStart;
+		_bufStart = 0;
+	}
+	if(_bufEnd == _buffer.size())
+	{
+		_buffer.resize(_buffer.size() * 2);
+	}
+
+	size_t sz = 0;
+	if(!read(&_buffer[_bufEnd], _buffer.size() - _bufEnd, sz, block))
+	{
+		return false;
+	}
+	if(sz==0)
+	{
+		disconnect();
+		throw nut::IOException("Server closed connection unexpectedly");
+	}
+	_bufEnd += sz;
+	return true;
+}
+
+void Socket::readLine(const char*& line, size_t& len)
+{
+	while(!nextLine(line, len))
+	{
+		fill();
+	}
+}
+
+void Socket::request(const std::string& req, Reply* reply)
+{
+	std::unique_ptr<Reply> ptr(reply);
+	std::lock_guard<std::mutex> lock(_writeMutex);
+
+	// Queued first: the reply may be read before write() returns
+	{
+		std::lock_guard<std::mutex> lock2(_repliesMutex);
+		_replies.push_back(std::move(ptr));
+	}
+
+	try
+	{
+		write(req);
+	}
+	catch(...)
+	{
+		// The connection is gone, with the replies of the earlier ones
+		failReplies(std::current_exception());
+	}
+}
+
+bool Socket::dispatch()
+{
+	const char* line;
+	size_t len;
+	bool res = false;
+
+	std::lock_guard<std::mutex> lock(_repliesMutex);
+	while(nextLine(line, len))
+	{
+		res = true;
+		// Nothing was asked for this one: it is dropped
+		if(!_replies.empty() && _replies.front()->take(line, len))
+		{
+			_replies.pop_front();
+		}
+	}
+	return res;
+}
+
+void Socket::receive(bool block)
+{
+	if(dispatch())
+	{
+		return;
+	}
+
+	try
+	{
+		if(!fill(block))
+		{
+			return;
+		}
+	}
+	catch(nut::TimeoutException&)
+	{
+		// The replies may still come
+		throw;
+	}
+	catch(...)
+	{
+		failReplies(std::current_exception());
+		throw;
+	}
+	dispatch();
+}
+
+void Socket::failReplies(std::exception_ptr ex)
+{
+	std::lock_guard<std::mutex> lock(_repliesMutex);
+	while(!_replies.empty())
+	{
+		_replies.front()->fail(ex);
+		_replies.pop_front();
+	}
+}
+
+bool Socket::hasPendingData()const
+{
+	std::lock_guard<std::recursive_mutex> lock(_ioMutex);
+
+#ifdef WITH_OPENSSL
+	return _ssl && SSL_pending(_ssl) > 0;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	return _ssl && SSL_DataPending(_ssl) > 0;
+#else	/* !WITH_SSL */
+	return false;
+#endif	/* WITH_OPENSSL | WITH_NSS */
+}
+
+std::string Socket::read()
+{
+	const char* line;
+	size_t len;
+
+	readLine(line, len);
+	return std::string(line, len);
+}
+
+void Socket::write(const std::string& str)
+{
+//	write(str.c_str(), str.size());
+//	write("\n", 1);
+	std::string buff = str + "\n";
+	// All of it, or a partial request would pair with the next one
+	for(size_t off = 0; off < buff.size(); )
+	{
+		off += write(buff.c_str() + off, buff.size() - off);
+	}
+}
+
+}/* namespace internal */
+
+
+/*
+ *
+ * Client implementation
+ *
+ */
+
+/* Pedantic builds complain about the static variable below...
+ * It is assumed safe to ignore since it is a std::string with
+ * no complex teardown at program exit.
+ */
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic push
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS
+#  pragma GCC diagnostic ignored "-Wglobal-constructors"
+# endif
+# ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS
+#  pragma GCC diagnostic ignored "-Wexit-time-destructors"
+# endif
+#endif
+const Feature Client::TRACKING = "TRACKING";
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_EXIT_TIME_DESTRUCTORS || defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_GLOBAL_CONSTRUCTORS)
+#pragma GCC diagnostic pop
+#endif
+
+Client::Client()
+{
+}
+
+Client::~Client()
+{
+}
+
+bool Client::hasDevice(const std::string& dev)
+{
+	std::set<std::string> devs = getDeviceNames();
+	return devs.find(dev) != devs.end();
+}
+
+Device Client::getDevice(const std::string& name)
+{
+	if(hasDevice(name))
+		return Device(this, name);
+	else
+		return Device(nullptr, "");
+}
+
+std::set<Device> Client::getDevices()
+{
+	std::set<Device> res;
+
+	std::set<std::string> devs = getDeviceNames();
+	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
+	{
+		res.insert(Device(this, *it));
+	}
+
+	return res;
+}
+
+bool Client::hasDeviceVariable(const std::string& dev, const std::string& name)
+{
+	std::set<std::string> names = getDeviceVariableNames(dev);
+	return names.find(name) != names.end();
+}
+
+std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev)
+{
+	std::map<std::string,std::vector<std::string> > res;
+
+	std::set<std::string> names = getDeviceVariableNames(dev);
+	for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
+	{
+		const std::string& name = *it;
+		res[name] = getDeviceVariableValue(dev, name);
+	}
+
+	return res;
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::set<std::string>& devs)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+
+	for(std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	{
+		res[*it] = getDeviceVariableValues(*it);
+	}
+
+	return res;
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > Client::getDevicesVariableValues(const std::map<std::string,std::set<std::string> >& names)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res;
+
+	for(std::map<std::string,std::set<std::string> >::const_iterator it=names.cbegin(); it!=names.cend(); ++it)
+	{
+		for(std::set<std::string>::const_iterator it2=it->second.cbegin(); it2!=it->second.cend(); ++it2)
+		{
+			try
+			{
+				res[it->first][*it2] = getDeviceVariableValue(it->first, *it2);
+			}
+			catch (NutException&)
+			{
+				// Not available, left out
+			}
+		}
+	}
+
+	return res;
+}
 
 bool Client::hasDeviceCommand(const std::string& dev, const std::string& name)
 {
@@ -785,6 +1548,52 @@ bool Client::hasFeature(const Feature& feature)
 	}
 }
 
+/* The future of a request made right away */
+template<typename T, typename Request>
+static std::future<T> madeNow(Request req)
+{
+	std::promise<T> res;
+	try
+	{
+		res.set_value(req());
+	}
+	catch(...)
+	{
+		res.set_exception(std::current_exception());
+	}
+	return res.get_future();
+}
+
+std::future<std::set<std::string> > Client::getDeviceNamesAsync()
+{
+	return madeNow<std::set<std::string> >([this]()
+		{ return getDeviceNames(); });
+}
+
+std::future<std::vector<std::string> > Client::getDeviceVariableValueAsync(const std::string& dev, const std::string& name)
+{
+	return madeNow<std::vector<std::string> >([this, &dev, &name]()
+		{ return getDeviceVariableValue(dev, name); });
+}
+
+std::future<std::map<std::string,std::vector<std::string> > > Client::getDeviceVariableValuesAsync(const std::string& dev)
+{
+	return madeNow<std::map<std::string,std::vector<std::string> > >([this, &dev]()
+		{ return getDeviceVariableValues(dev); });
+}
+
+std::future<TrackingID> Client::setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::string& value)
+{
+	return madeNow<TrackingID>([this, &dev, &name, &value]()
+		{ return setDeviceVariable(dev, name, value); });
+}
+
+std::future<TrackingID> Client::executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param)
+{
+	return madeNow<TrackingID>([this, &dev, &name, &param]()
+		{ return executeDeviceCommand(dev, name, param); });
+}
+
 /*
  *
  * TCP Client implementation
@@ -811,9 +1620,91 @@ _socket(new internal::Socket)
 
 TcpClient::~TcpClient()
 {
+	TcpClientReactor* reactor = _socket->reactor;
+	if(reactor)
+	{
+		reactor->remove(*this);
+	}
 	delete _socket;
 }
 
+template<typename T, typename Parser>
+std::future<T> TcpClient::request(const std::string& req, Parser parser)
+{
+	internal::ReplyOf<T>* reply = new internal::ReplyOf<T>(parser);
+	std::future<T> res = reply->future();
+	_socket->request(req, reply);
+	return res;
+}
+
+template<typename T>
+std::future<T> TcpClient::listInto(const std::string& subcmd, const std::string& params,
+	void (*add)(T& res, std::vector<std::string>&& item))
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+
+	// The items are split into words right where they were received
+	const std::string begin = "BEGIN LIST " + req, end = "END LIST " + req;
+	bool begun = false;
+	return request<T>("LIST " + req,
+		[req, begin, end, begun, add](T& res, const char* line, size_t len) mutable
+		{
+			if(len >= 3 && memcmp(line, "ERR", 3) == 0)
+			{
+				detectError(std::string(line, len));
+			}
+			if(!begun)
+			{
+				if(len != begin.size() || memcmp(line, begin.data(), len) != 0)
+				{
+					throw NutException("Invalid response");
+				}
+				begun = true;
+				return false;
+			}
+			if(len == end.size() && memcmp(line, end.data(), len) == 0)
+			{
+				return true;
+			}
+			if(len < req.size() || memcmp(line, req.data(), req.size()) != 0)
+			{
+				throw NutException("Invalid response");
+			}
+			add(res, explode(line, len, req.size()));
+			return false;
+		});
+}
+
+template<typename T>
+T TcpClient::result(std::future<T> reply)
+{
+	if(_socket->reactor)
+	{
+		// Read by the reactor thread
+		if(!_socket->hasTimeout())
+		{
+			reply.wait();
+		}
+		else if(reply.wait_for(std::chrono::seconds(_socket->getTimeout())) != std::future_status::ready)
+		{
+			throw TimeoutException();
+		}
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(_socket->readMutex);
+		while(reply.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			_socket->receive();
+		}
+	}
+	return reply.get();
+}
+
 void TcpClient::connect(const std::string& host, uint16_t port)
 {
 	_host = host;
@@ -823,6 +1714,9 @@ void TcpClient::connect(const std::string& host, uint16_t port)
 
 void TcpClient::connect()
 {
+	_socket->failReplies(std::make_exception_ptr(NotConnectedException()));
+	// Not to be read by a reactor meanwhile (e.g. the STARTTLS reply)
+	std::lock_guard<std::mutex> lock(_socket->readMutex);
 	_socket->connect(_host, _port);
 }
 
@@ -831,6 +1725,17 @@ void TcpClient::setDebugConnect(bool d)
 	_socket->setDebugConnect(d);
 }
 
+void TcpClient::setSsl(SslMode mode, bool certVerify, const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd)
+{
+	_socket->setSsl(mode, certVerify, certPath, certName, certPasswd);
+}
+
+bool TcpClient::isSsl()const
+{
+	return _socket->isSsl();
+}
+
 std::string TcpClient::getHost()const
 {
 	return _host;
@@ -849,6 +1754,7 @@ bool TcpClient::isConnected()const
 void TcpClient::disconnect()
 {
 	_socket->disconnect();
+	_socket->failReplies(std::make_exception_ptr(NotConnectedException()));
 }
 
 void TcpClient::setTimeout(time_t timeout)
@@ -891,18 +1797,7 @@ Device TcpClient::getDevice(const std::string& name)
 
 std::set<std::string> TcpClient::getDeviceNames()
 {
-	std::set<std::string> res;
-
-	std::vector<std::vector<std::string> > devs = list("UPS");
-	for(std::vector<std::vector<std::string> >::iterator it=devs.begin();
-		it!=devs.end(); ++it)
-	{
-		std::string id = (*it)[0];
-		if(!id.empty())
-			res.insert(id);
-	}
-
-	return res;
+	return result(getDeviceNamesAsync());
 }
 
 std::string TcpClient::getDeviceDescription(const std::string& name)
@@ -943,24 +1838,12 @@ std::string TcpClient::getDeviceVariableDescription(const std::string& dev, cons
 
 std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
 {
-	return get("VAR", dev + " " + name);
+	return result(getDeviceVariableValueAsync(dev, name));
 }
 
 std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
 {
-
-	std::map<std::string,std::vector<std::string> >  map;
-
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
-	for(size_t n=0; n<res.size(); ++n)
-	{
-		std::vector<std::string>& vals = res[n];
-		std::string var = vals[0];
-		vals.erase(vals.begin());
-		map[var] = vals;
-	}
-
-	return map;
+	return result(getDeviceVariableValuesAsync(dev));
 }
 
 std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
@@ -975,27 +1858,19 @@ std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient
 		return map;
 	}
 
-	std::vector<std::string> queries;
+	// All the queries are sent before the first reply is read
+	std::vector<std::future<std::map<std::string,std::vector<std::string> > > > replies;
 	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
 	{
-		queries.push_back("LIST VAR " + *it);
+		replies.push_back(getDeviceVariableValuesAsync(*it));
 	}
-	sendAsyncQueries(queries);
 
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	size_t n = 0;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it, ++n)
 	{
 		try
 		{
-			std::map<std::string,std::vector<std::string> > map2;
-			std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
-			for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
-			{
-				std::vector<std::string>& vals = *it2;
-				std::string var = vals[0];
-				vals.erase(vals.begin());
-				map2[var] = vals;
-			}
-			map[*it] = map2;
+			map[*it] = result(std::move(replies[n]));
 		}
 		catch (NutException&)
 		{
@@ -1009,13 +1884,81 @@ std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient
 		throw NutException("Invalid device");
 	}
 
-	return map;
+	return map;
+}
+
+std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::map<std::string,std::set<std::string> >& names)
+{
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
+
+	// All of them in one request, and one reply (since protocol 1.4)
+	std::string req = "GET VARS";
+	size_t count = 0;
+	for (std::map<std::string,std::set<std::string> >::const_iterator it=names.cbegin(); it!=names.cend(); ++it)
+	{
+		for (std::set<std::string>::const_iterator it2=it->second.cbegin(); it2!=it->second.cend(); ++it2)
+		{
+			req += " " + it->first + " " + *it2;
+			count++;
+		}
+	}
+
+	if (count == 0)
+	{
+		return map;
+	}
+
+	bool begun = false;
+	internal::VarsReply res = result(request<internal::VarsReply>(req,
+		[begun](internal::VarsReply& reply, const char* line, size_t len) mutable
+		{
+			static const char begin[] = "BEGIN GET VARS", end[] = "END GET VARS";
+			if (!begun)
+			{
+				if (len >= 3 && memcmp(line, "ERR", 3) == 0)
+				{
+					reply.unknown = true;
+					return true;
+				}
+				if (len != sizeof(begin) - 1 || memcmp(line, begin, len) != 0)
+				{
+					throw NutException("Invalid response");
+				}
+				begun = true;
+				return false;
+			}
+			if (len == sizeof(end) - 1 && memcmp(line, end, len) == 0)
+			{
+				return true;
+			}
+
+			std::vector<std::string> vals = explode(line, len);
+			if (vals.size() >= 4 && vals[0] == "VAR")
+			{
+				// VAR <dev> <name> <value>
+				std::string dev = std::move(vals[1]), name = std::move(vals[2]);
+				vals.erase(vals.begin(), vals.begin() + 3);
+				reply.values[dev][std::move(name)] = std::move(vals);
+			}
+			else if (vals.size() < 4 || vals[0] != "ERR")
+			{
+				// ERR <message> <dev> <name> is one not available
+				throw NutException("Invalid response");
+			}
+			return false;
+		}));
+
+	if (res.unknown)
+	{
+		// Older upsd: ask for them one by one
+		return Client::getDevicesVariableValues(names);
+	}
+	return std::move(res.values);
 }
 
 TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
 {
-	std::string query = "SET VAR " + dev + " " + name + " " + escape(value);
-	return sendTrackingQuery(query);
+	return result(setDeviceVariableAsync(dev, name, value));
 }
 
 TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
@@ -1048,7 +1991,7 @@ std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const
 
 TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
 {
-	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+	return result(executeDeviceCommandAsync(dev, name, param));
 }
 
 std::map<std::string, std::set<std::string>> TcpClient::listDeviceClients(void)
@@ -1109,343 +2052,795 @@ void TcpClient::deviceMaster(const std::string& dev)
 	}
 }
 
-void TcpClient::devicePrimary(const std::string& dev)
+void TcpClient::devicePrimary(const std::string& dev)
+{
+	try {
+		detectError(sendQuery("PRIMARY " + dev));
+	} catch (NutException &exOrig) {
+		try {
+			detectError(sendQuery("MASTER " + dev));
+		} catch (NutException &exRetry) {
+			NUT_UNUSED_VARIABLE(exRetry);
+			throw exOrig;
+		}
+	}
+}
+
+void TcpClient::deviceForcedShutdown(const std::string& dev)
+{
+	detectError(sendQuery("FSD " + dev));
+}
+
+int TcpClient::deviceGetNumLogins(const std::string& dev)
+{
+	std::string num = get("NUMLOGINS", dev)[0];
+	return atoi(num.c_str());
+}
+
+TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
+{
+	if (id.empty())
+	{
+		return TrackingResult::SUCCESS;
+	}
+
+	std::string result = sendQuery("GET TRACKING " + id);
+
+	if (result == "PENDING")
+	{
+		return TrackingResult::PENDING;
+	}
+	else if (result == "SUCCESS")
+	{
+		return TrackingResult::SUCCESS;
+	}
+	else if (result == "ERR UNKNOWN")
+	{
+		return TrackingResult::UNKNOWN;
+	}
+	else if (result == "ERR INVALID-ARGUMENT")
+	{
+		return TrackingResult::INVALID_ARGUMENT;
+	}
+	else
+	{
+		return TrackingResult::FAILURE;
+	}
+}
+
+bool TcpClient::isFeatureEnabled(const Feature& feature)
+{
+	std::string result = sendQuery("GET " + feature);
+	detectError(result);
+
+	if (result == "ON")
+	{
+		return true;
+	}
+	else if (result == "OFF")
+	{
+		return false;
+	}
+	else
+	{
+		throw NutException("Unknown feature result " + result);
+	}
+}
+void TcpClient::setFeature(const Feature& feature, bool status)
+{
+	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
+	detectError(result);
+}
+
+std::vector<std::string> TcpClient::get
+	(const std::string& subcmd, const std::string& params)
+{
+	return result(getAsync(subcmd, params));
+}
+
+std::vector<std::vector<std::string> > TcpClient::list
+	(const std::string& subcmd, const std::string& params)
+{
+	return result(listAsync(subcmd, params));
+}
+
+std::string TcpClient::sendQuery(const std::string& req)
+{
+	return result(sendQueryAsync(req));
+}
+
+std::future<std::set<std::string> > TcpClient::getDeviceNamesAsync()
+{
+	return listInto<std::set<std::string> >("UPS", "",
+		[](std::set<std::string>& res, std::vector<std::string>&& item)
+		{
+			if(!item.empty() && !item[0].empty())
+			{
+				res.insert(std::move(item[0]));
+			}
+		});
+}
+
+std::future<std::vector<std::string> > TcpClient::getDeviceVariableValueAsync(const std::string& dev, const std::string& name)
+{
+	return getAsync("VAR", dev + " " + name);
+}
+
+std::future<std::map<std::string,std::vector<std::string> > > TcpClient::getDeviceVariableValuesAsync(const std::string& dev)
+{
+	return listInto<std::map<std::string,std::vector<std::string> > >("VAR", dev,
+		[](std::map<std::string,std::vector<std::string> >& res, std::vector<std::string>&& item)
+		{
+			if(!item.empty())
+			{
+				std::string var = std::move(item[0]);
+				item.erase(item.begin());
+				res[std::move(var)] = std::move(item);
+			}
+		});
+}
+
+std::future<TrackingID> TcpClient::setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::string& value)
+{
+	return sendTrackingQueryAsync("SET VAR " + dev + " " + name + " " + escape(value));
+}
+
+std::future<TrackingID> TcpClient::executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param)
+{
+	return sendTrackingQueryAsync("INSTCMD " + dev + " " + name + " " + param);
+}
+
+std::future<std::string> TcpClient::sendQueryAsync(const std::string& req)
+{
+	return request<std::string>(req,
+		[](std::string& res, const char* line, size_t len)
+		{
+			res.assign(line, len);
+			return true;
+		});
+}
+
+std::future<std::vector<std::string> > TcpClient::getAsync
+	(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req += " " + params;
+	}
+	return request<std::vector<std::string> >("GET " + req,
+		[req](std::vector<std::string>& res, const char* line, size_t len)
+		{
+			if(len >= 3 && memcmp(line, "ERR", 3) == 0)
+			{
+				detectError(std::string(line, len));
+			}
+			if(len < req.size() || memcmp(line, req.data(), req.size()) != 0)
+			{
+				throw NutException("Invalid response");
+			}
+			res = explode(line, len, req.size());
+			return true;
+		});
+}
+
+std::future<std::vector<std::vector<std::string> > > TcpClient::listAsync
+	(const std::string& subcmd, const std::string& params)
+{
+	return listInto<std::vector<std::vector<std::string> > >(subcmd, params,
+		[](std::vector<std::vector<std::string> >& res, std::vector<std::string>&& item)
+		{
+			res.push_back(std::move(item));
+		});
+}
+
+void TcpClient::detectError(const std::string& req)
+{
+	if(req.substr(0,3)=="ERR")
+	{
+		throw NutException(req.substr(4));
+	}
+}
+
+std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+{
+	return explode(str.data(), str.size(), begin);
+}
+
+std::vector<std::string> TcpClient::explode(const char* str, size_t len, size_t begin)
+{
+	std::vector<std::string> res;
+	std::string temp;
+	size_t idx = begin;
+
+	while(idx<len)
+	{
+		// Separators between the words
+		if(str[idx]==' ' /* || str[idx]=='\t' */)
+		{
+			++idx;
+			continue;
+		}
+
+		bool quoted = (str[idx]=='"');
+		bool ended = false;
+		if(quoted)
+		{
+			++idx;
+		}
+
+		while(idx<len)
+		{
+			// Take the run of ordinary characters in one go
+			size_t start = idx;
+			while(idx<len && str[idx]!='\\' && str[idx]!='"'
+			 && (quoted || str[idx]!=' '))
+			{
+				++idx;
+			}
+			temp.append(str + start, idx - start);
+			if(idx>=len)
+			{
+				break;
+			}
+
+			char c = str[idx];
+			if(c=='\\')
+			{
+				if(++idx>=len)
+				{
+					break;
+				}
+				c = str[idx++];
+				if(c=='\\' || c=='"' || (!quoted && c==' '))
+				{
+					temp += c;
+				}
+				else
+				{
+					temp += '\\' + c; // Really do this ?
+				}
+				continue;
+			}
+
+			// The closing quote, or the end of a simple string (where
+			// a quote starts the next, quoted one)
+			if(quoted)
+			{
+				++idx;
+			}
+			ended = true;
+			break;
+		}
+
+		/* What about bad characters ? */
+		if(ended || !temp.empty())
+		{
+			res.push_back(std::move(temp));
+			temp.clear();
+		}
+	}
+
+	return res;
+}
+
+std::string TcpClient::escape(const std::string& str)
+{
+	std::string res = "\"";
+
+	for(size_t n=0; n<str.size(); n++)
+	{
+		char c = str[n];
+		if(c=='"')
+			res += "\\\"";
+		else if(c=='\\')
+			res += "\\\\";
+		else
+			res += c;
+	}
+
+	res += '"';
+	return res;
+}
+
+TrackingID TcpClient::sendTrackingQuery(const std::string& req)
+{
+	return result(sendTrackingQueryAsync(req));
+}
+
+std::future<TrackingID> TcpClient::sendTrackingQueryAsync(const std::string& req)
+{
+	return request<TrackingID>(req,
+		[](TrackingID& res, const char* line, size_t len)
+		{
+			std::string reply(line, len);
+			detectError(reply);
+			std::vector<std::string> words = explode(reply);
+
+			if (words.size() == 1 && words[0] == "OK")
+			{
+				res = TrackingID("");
+			}
+			else if (words.size() == 3 && words[0] == "OK" && words[1] == "TRACKING")
+			{
+				res = TrackingID(words[2]);
+			}
+			else
+			{
+				throw NutException("Unknown query result");
+			}
+			return true;
+		});
+}
+
+/*
+ *
+ * TcpClientPool implementation
+ *
+ */
+
+TcpClientPool::Lease::Lease(TcpClientPool* pool, TcpClient* client):
+_pool(pool),
+_client(client),
+_discard(false)
+{
+}
+
+TcpClientPool::Lease::Lease(Lease&& lease) noexcept:
+_pool(lease._pool),
+_client(lease._client),
+_discard(lease._discard)
+{
+	lease._client = nullptr;
+}
+
+TcpClientPool::Lease::~Lease()
+{
+	if (_client)
+	{
+		_pool->release(_client, _discard);
+	}
+}
+
+void TcpClientPool::Lease::discard()
+{
+	_discard = true;
+}
+
+TcpClientPool::TcpClientPool(const std::string& host, uint16_t port, size_t maxClients):
+_host(host),
+_port(port),
+_maxClients(maxClients > 0 ? maxClients : 1),
+_timeout(0),
+_sslMode(SSLMODE_NONE),
+_sslVerify(false),
+_count(0)
+{
+}
+
+TcpClientPool::~TcpClientPool()
 {
-	try {
-		detectError(sendQuery("PRIMARY " + dev));
-	} catch (NutException &exOrig) {
-		try {
-			detectError(sendQuery("MASTER " + dev));
-		} catch (NutException &exRetry) {
-			NUT_UNUSED_VARIABLE(exRetry);
-			throw exOrig;
-		}
-	}
+	// The leases must not outlive the pool
+	clear();
 }
 
-void TcpClient::deviceForcedShutdown(const std::string& dev)
+void TcpClientPool::setCredentials(const std::string& user, const std::string& passwd)
 {
-	detectError(sendQuery("FSD " + dev));
+	std::lock_guard<std::mutex> lock(_mutex);
+	_user = user;
+	_passwd = passwd;
 }
 
-int TcpClient::deviceGetNumLogins(const std::string& dev)
+void TcpClientPool::setSsl(SslMode mode, bool certVerify, const std::string& certPath,
+	const std::string& certName, const std::string& certPasswd)
 {
-	std::string num = get("NUMLOGINS", dev)[0];
-	return atoi(num.c_str());
+	std::lock_guard<std::mutex> lock(_mutex);
+	_sslMode = mode;
+	_sslVerify = certVerify;
+	_certPath = certPath;
+	_certName = certName;
+	_certPasswd = certPasswd;
 }
 
-TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
+void TcpClientPool::setTimeout(time_t timeout)
 {
-	if (id.empty())
-	{
-		return TrackingResult::SUCCESS;
-	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	_timeout = timeout;
+}
 
-	std::string result = sendQuery("GET TRACKING " + id);
+TcpClient* TcpClientPool::create()
+{
+	TcpClient* client = new TcpClient;
 
-	if (result == "PENDING")
+	try
 	{
-		return TrackingResult::PENDING;
+		std::string user, passwd;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			client->setTimeout(_timeout);
+			client->setSsl(_sslMode, _sslVerify, _certPath, _certName, _certPasswd);
+			user = _user;
+			passwd = _passwd;
+		}
+
+		// Not holding the lock: other threads may use their clients
+		client->connect(_host, _port);
+		if (!user.empty())
+		{
+			client->authenticate(user, passwd);
+		}
 	}
-	else if (result == "SUCCESS")
+	catch (...)
 	{
-		return TrackingResult::SUCCESS;
+		delete client;
+		throw;
 	}
-	else if (result == "ERR UNKNOWN")
+
+	return client;
+}
+
+TcpClientPool::Lease TcpClientPool::acquire()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (true)
 	{
-		return TrackingResult::UNKNOWN;
+		while (!_idle.empty())
+		{
+			TcpClient* client = _idle.back();
+			_idle.pop_back();
+			if (client->isConnected())
+			{
+				return Lease(this, client);
+			}
+
+			// Lost meanwhile
+			delete client;
+			_count--;
+		}
+
+		if (_count < _maxClients)
+		{
+			break;
+		}
+
+		_released.wait(lock);
 	}
-	else if (result == "ERR INVALID-ARGUMENT")
+
+	// Count it in before connecting, so that no more are made
+	_count++;
+	lock.unlock();
+
+	try
 	{
-		return TrackingResult::INVALID_ARGUMENT;
+		return Lease(this, create());
 	}
-	else
+	catch (...)
 	{
-		return TrackingResult::FAILURE;
+		lock.lock();
+		_count--;
+		lock.unlock();
+		_released.notify_one();
+		throw;
 	}
 }
 
-bool TcpClient::isFeatureEnabled(const Feature& feature)
+void TcpClientPool::release(TcpClient* client, bool discard)
 {
-	std::string result = sendQuery("GET " + feature);
-	detectError(result);
-
-	if (result == "ON")
 	{
-		return true;
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!discard && client->isConnected())
+		{
+			_idle.push_back(client);
+			client = nullptr;
+		}
+		else
+		{
+			_count--;
+		}
 	}
-	else if (result == "OFF")
+
+	delete client;
+	_released.notify_one();
+}
+
+void TcpClientPool::clear()
+{
+	std::vector<TcpClient*> idle;
 	{
-		return false;
+		std::lock_guard<std::mutex> lock(_mutex);
+		idle.swap(_idle);
+		_count -= idle.size();
 	}
-	else
+
+	for (std::vector<TcpClient*>::iterator it = idle.begin(); it != idle.end(); ++it)
 	{
-		throw NutException("Unknown feature result " + result);
+		delete *it;
 	}
+	_released.notify_all();
 }
-void TcpClient::setFeature(const Feature& feature, bool status)
+
+size_t TcpClientPool::idle()
 {
-	std::string result = sendQuery("SET " + feature + " " + (status ? "ON" : "OFF"));
-	detectError(result);
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _idle.size();
 }
 
-std::vector<std::string> TcpClient::get
-	(const std::string& subcmd, const std::string& params)
+/*
+ *
+ * TcpClientReactor implementation
+ *
+ */
+
+/* Most milliseconds to wait without a way to be woken up by wake() */
+static const int REACTOR_WAKE_INTERVAL = 100;
+
+TcpClientReactor::TcpClientReactor():
+_stop(false)
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	_wake[0] = _wake[1] = -1;
+#ifndef WIN32
+	if(pipe(_wake) == 0)
 	{
-		req += " " + params;
+		fcntl(_wake[0], F_SETFL, fcntl(_wake[0], F_GETFL) | O_NONBLOCK);
+		fcntl(_wake[1], F_SETFL, fcntl(_wake[1], F_GETFL) | O_NONBLOCK);
 	}
-	std::string res = sendQuery("GET " + req);
-	detectError(res);
-	if(res.substr(0, req.size()) != req)
+	else
 	{
-		throw NutException("Invalid response");
+		_wake[0] = _wake[1] = -1;
 	}
+#endif	/* !WIN32 */
+}
 
-	return explode(res, req.size());
+TcpClientReactor::~TcpClientReactor()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for(size_t n = 0; n < _clients.size(); n++)
+	{
+		_clients[n]->_socket->reactor = nullptr;
+	}
+	_clients.clear();
+#ifndef WIN32
+	if(_wake[0] >= 0)
+	{
+		::close(_wake[0]);
+		::close(_wake[1]);
+	}
+#endif	/* !WIN32 */
 }
 
-std::vector<std::vector<std::string> > TcpClient::list
-	(const std::string& subcmd, const std::string& params)
+void TcpClientReactor::add(TcpClient& client)
 {
-	std::string req = subcmd;
-	if(!params.empty())
 	{
-		req += " " + params;
+		std::lock_guard<std::mutex> lock(_mutex);
+		TcpClientReactor* other = nullptr;
+		if(!client._socket->reactor.compare_exchange_strong(other, this))
+		{
+			if(other == this)
+			{
+				return;
+			}
+			throw NutException("Client is in another reactor already");
+		}
+		_clients.push_back(&client);
 	}
-	std::vector<std::string> query;
-	query.push_back("LIST " + req);
-	sendAsyncQueries(query);
-	return parseList(req);
+
+	// Its socket is to be waited for too
+	wake();
 }
 
-std::vector<std::vector<std::string> > TcpClient::parseList
-	(const std::string& req)
+void TcpClientReactor::remove(TcpClient& client)
 {
-	std::string res = _socket->read();
-	detectError(res);
-	if(res != ("BEGIN LIST " + req))
+	std::unique_lock<std::mutex> lock(_mutex);
+	std::vector<TcpClient*>::iterator it = std::find(_clients.begin(), _clients.end(), &client);
+	if(it != _clients.end())
 	{
-		throw NutException("Invalid response");
+		_clients.erase(it);
+		client._socket->reactor = nullptr;
 	}
 
-	std::vector<std::vector<std::string> > arr;
-	while(true)
+	// It may be read outside of the lock by runOnce() in another thread
+	// (it may even be destroyed once this returns)
+	if(std::this_thread::get_id() != _thread)
 	{
-		res = _socket->read();
-		detectError(res);
-		if(res == ("END LIST " + req))
-		{
-			return arr;
-		}
-		if(res.substr(0, req.size()) == req)
-		{
-			arr.push_back(explode(res, req.size()));
-		}
-		else
+		internal::Socket* socket = client._socket;
+		_done.wait(lock, [this, socket]{
+			return std::find(_reading.begin(), _reading.end(), socket) == _reading.end();
+		});
+	}
+}
+
+std::vector<internal::Socket*> TcpClientReactor::beginReading()
+{
+	std::vector<internal::Socket*> res;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_thread = std::this_thread::get_id();
+	for(std::vector<TcpClient*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		internal::Socket* socket = (*it)->_socket;
+		if(socket->isConnected())
 		{
-			throw NutException("Invalid response");
+			res.push_back(socket);
 		}
 	}
+	_reading = res;
+	return res;
 }
 
-std::string TcpClient::sendQuery(const std::string& req)
+void TcpClientReactor::doneReading(internal::Socket* socket)
 {
-	_socket->write(req);
-	return _socket->read();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::vector<internal::Socket*>::iterator it = std::find(_reading.begin(), _reading.end(), socket);
+		if(it != _reading.end())
+		{
+			_reading.erase(it);
+		}
+	}
+	_done.notify_all();
 }
 
-void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
+void TcpClientReactor::wake()
 {
-	for (std::vector<std::string>::const_iterator it = req.cbegin(); it != req.cend(); ++it)
+#ifndef WIN32
+	if(_wake[1] >= 0)
 	{
-		_socket->write(*it);
+		// A full pipe wakes up just as well
+		char c = 0;
+		ssize_t ret = ::write(_wake[1], &c, 1);
+		NUT_UNUSED_VARIABLE(ret);
 	}
+#endif	/* !WIN32 */
 }
 
-void TcpClient::detectError(const std::string& req)
+void TcpClientReactor::stop()
 {
-	if(req.substr(0,3)=="ERR")
 	{
-		throw NutException(req.substr(4));
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
 	}
+	wake();
 }
 
-std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+void TcpClientReactor::run()
 {
-	std::vector<std::string> res;
-	std::string temp;
-
-	enum STATE {
-		INIT,
-		SIMPLE_STRING,
-		QUOTED_STRING,
-		SIMPLE_ESCAPE,
-		QUOTED_ESCAPE
-	} state = INIT;
-
-	for(size_t idx=begin; idx<str.size(); ++idx)
+	while(true)
 	{
-		char c = str[idx];
-		switch(state)
 		{
-		case INIT:
-			if(c==' ' /* || c=='\t' */)
-			{ /* Do nothing */ }
-			else if(c=='"')
-			{
-				state = QUOTED_STRING;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-				state = SIMPLE_STRING;
-			}
-			break;
-		case SIMPLE_STRING:
-			if(c==' ' /* || c=='\t' */)
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = QUOTED_STRING;
-			}
-			/* What about bad characters ? */
-			else
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(_stop)
 			{
-				temp += c;
+				_stop = false;
+				return;
 			}
-			break;
-		case QUOTED_STRING:
-			if(c=='\\')
-			{
-				state = QUOTED_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case SIMPLE_ESCAPE:
-			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = SIMPLE_STRING;
-			break;
-		case QUOTED_ESCAPE:
-			if(c=='\\' || c=='"')
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = QUOTED_STRING;
-			break;
-
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-# pragma clang diagnostic push
-# pragma clang diagnostic ignored "-Wunreachable-code"
-# pragma clang diagnostic ignored "-Wcovered-switch-default"
-#endif
-		default:
-			/* Must not occur. */
-			break;
-#ifdef __clang__
-# pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
 		}
+		runOnce(-1);
 	}
+}
 
-	if(!temp.empty())
+/* Hand out what was received for a client, reading some more first if
+ * asked to; returns true if there was something */
+static bool readReplies(internal::Socket* socket, bool more)
+{
+	// Its blocking calls may still be reading for themselves
+	std::unique_lock<std::mutex> lock(socket->readMutex, std::try_to_lock);
+	if(!lock.owns_lock())
 	{
-		res.push_back(temp);
+		return false;
 	}
 
-	return res;
+	if(!more)
+	{
+		return socket->dispatch();
+	}
+	try
+	{
+		// Not to wait here for the rest of a TLS record, say, which
+		// would hold up the other clients (and stop())
+		socket->receive(false);
+	}
+	catch(NutException&)
+	{
+		// Its replies failed with it already
+	}
+	return true;
 }
 
-std::string TcpClient::escape(const std::string& str)
+bool TcpClientReactor::runOnce(int timeout)
 {
-	std::string res = "\"";
+	fd_set fds;
+	SOCKET maxfd = 0;
+	bool waiting = false, res = false;
 
-	for(size_t n=0; n<str.size(); n++)
+	FD_ZERO(&fds);
+	std::vector<internal::Socket*> sockets = beginReading();
+	std::vector<std::pair<internal::Socket*, SOCKET> > selected;
+	for(std::vector<internal::Socket*>::iterator it = sockets.begin(); it != sockets.end(); ++it)
 	{
-		char c = str[n];
-		if(c=='"')
-			res += "\\\"";
-		else if(c=='\\')
-			res += "\\\\";
-		else
-			res += c;
+		internal::Socket* socket = *it;
+
+		// Lines received earlier, and decrypted TLS data, need no select()
+		if(readReplies(socket, socket->hasPendingData()))
+		{
+			res = true;
+		}
+		// (it may get disconnected from another thread meanwhile)
+		SOCKET fd = socket->fd();
+		if(fd != INVALID_SOCKET)
+		{
+			FD_SET(fd, &fds);
+			if(fd > maxfd)
+			{
+				maxfd = fd;
+			}
+			selected.push_back(std::make_pair(socket, fd));
+			waiting = true;
+		}
+		doneReading(socket);
 	}
 
-	res += '"';
-	return res;
-}
+	if(res)
+	{
+		timeout = 0;
+	}
+#ifndef WIN32
+	if(_wake[0] >= 0)
+	{
+		FD_SET(_wake[0], &fds);
+		if(_wake[0] > maxfd)
+		{
+			maxfd = _wake[0];
+		}
+		waiting = true;
+	}
+	else
+#endif	/* !WIN32 */
+	if(timeout < 0 || timeout > REACTOR_WAKE_INTERVAL)
+	{
+		timeout = REACTOR_WAKE_INTERVAL;
+	}
 
-TrackingID TcpClient::sendTrackingQuery(const std::string& req)
-{
-	std::string reply = sendQuery(req);
-	detectError(reply);
-	std::vector<std::string> res = explode(reply);
+	if(!waiting)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		return res;
+	}
 
-	if (res.size() == 1 && res[0] == "OK")
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	if(select(maxfd+1, &fds, nullptr, nullptr, timeout < 0 ? nullptr : &tv) < 1)
 	{
-		return TrackingID("");
+		return res;
 	}
-	else if (res.size() == 3 && res[0] == "OK" && res[1] == "TRACKING")
+
+#ifndef WIN32
+	if(_wake[0] >= 0 && FD_ISSET(_wake[0], &fds))
 	{
-		return TrackingID(res[2]);
+		char buf[64];
+		while(::read(_wake[0], buf, sizeof(buf)) > 0)
+		{
+		}
 	}
-	else
+#endif	/* !WIN32 */
+
+	// Only those which were not removed (nor added) meanwhile
+	sockets = beginReading();
+	for(std::vector<internal::Socket*>::iterator it = sockets.begin(); it != sockets.end(); ++it)
 	{
-		throw NutException("Unknown query result");
+		internal::Socket* socket = *it;
+		for(size_t n = 0; n < selected.size(); n++)
+		{
+			if(selected[n].first == socket && FD_ISSET(selected[n].second, &fds)
+			 && socket->fd() == selected[n].second && readReplies(socket, true))
+			{
+				res = true;
+			}
+		}
+		doneReading(socket);
 	}
+	return res;
 }
 
 /*
@@ -1539,6 +2934,19 @@ std::map<std::string,std::vector<std::string> > Device::getVariableValues()
 	return getClient()->getDeviceVariableValues(getName());
 }
 
+std::map<std::string,std::vector<std::string> > Device::getVariableValues(const std::set<std::string>& names)
+{
+	if (!isOk()) throw NutException("Invalid device");
+
+	std::map<std::string,std::set<std::string> > req;
+	req[getName()] = names;
+
+	std::map<std::string,std::map<std::string,std::vector<std::string> > > res =
+		getClient()->getDevicesVariableValues(req);
+
+	return res[getName()];
+}
+
 std::set<std::string> Device::getVariableNames()
 {
 	if (!isOk()) throw NutException("Invalid device");
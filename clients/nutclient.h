@@ -30,6 +30,10 @@
 #include <exception>
 #include <cstdint>
 #include <ctime>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
 
 /* See include/common.h for details behind this */
 #ifndef NUT_UNUSED_VARIABLE
@@ -42,11 +46,14 @@ namespace nut
 namespace internal
 {
 class Socket;
+class Reply;
 } /* namespace internal */
 
 
 class Client;
 class TcpClient;
+class TcpClientPool;
+class TcpClientReactor;
 class Device;
 class Variable;
 class Command;
@@ -130,6 +137,18 @@ public:
 	virtual ~TimeoutException() noexcept override;
 };
 
+/**
+ * IO oriented nut exception when TLS could not be used as requested.
+ */
+class SslException : public IOException
+{
+public:
+	SslException(const std::string& msg):IOException(msg){}
+	SslException(const SslException&) = default;
+	SslException& operator=(SslException& rhs) = default;
+	virtual ~SslException() noexcept override;
+};
+
 /**
  * Cookie given when performing async action, used to redeem result at a later date.
  */
@@ -149,6 +168,16 @@ typedef enum
 
 typedef std::string Feature;
 
+/**
+ * Whether a TcpClient switches to TLS (with STARTTLS) when it connects.
+ */
+typedef enum
+{
+	SSLMODE_NONE,	/**< Plain text only. */
+	SSLMODE_TRY,	/**< TLS if the server supports it, plain text otherwise. */
+	SSLMODE_FORCE,	/**< TLS, or the connection fails. */
+} SslMode;
+
 /**
  * A nut client is the starting point to dialog to NUTD.
  * It can connect to an NUTD then retrieve its device list.
@@ -264,6 +293,13 @@ public:
 	 * \return Variable values indexed by variable names, indexed by device names.
 	 */
 	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs);
+	/**
+	 * Retrieve values of some variables of a set of devices.
+	 * \param names Variable names, indexed by device names
+	 * \return Variable values indexed by variable names, indexed by device names.
+	 * Variables which are not available are left out.
+	 */
+	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::map<std::string,std::set<std::string> >& names);
 	/**
 	 * Intend to set the value of a variable.
 	 * \param dev Device name
@@ -360,6 +396,21 @@ public:
 	virtual bool isFeatureEnabled(const Feature& feature) = 0;
 	virtual void setFeature(const Feature& feature, bool status) = 0;
 
+	/**
+	 * Asynchronous requests: the results (or exceptions) are delivered
+	 * through futures, so that many requests can be in flight at once.
+	 * Clients which can not do that (by default) make the request right
+	 * away, and return a future which is ready already.
+	 * \see TcpClientReactor
+	 * \{
+	 */
+	virtual std::future<std::set<std::string> > getDeviceNamesAsync();
+	virtual std::future<std::vector<std::string> > getDeviceVariableValueAsync(const std::string& dev, const std::string& name);
+	virtual std::future<std::map<std::string,std::vector<std::string> > > getDeviceVariableValuesAsync(const std::string& dev);
+	virtual std::future<TrackingID> setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::string& value);
+	virtual std::future<TrackingID> executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param="");
+	/** \} */
+
 	static const Feature TRACKING;
 
 protected:
@@ -376,6 +427,7 @@ class TcpClient : public Client
 	 * generally, but still want covered with integration tests
 	 */
 	friend class NutActiveClientTest;
+	friend class TcpClientReactor;
 
 public:
 	/**
@@ -411,6 +463,28 @@ public:
 	 */
 	void setDebugConnect(bool d);
 
+	/**
+	 * Set up TLS for the following connect() calls, like the CERTPATH,
+	 * CERTVERIFY and FORCESSL settings of upsmon.
+	 * With OpenSSL, certPath is a directory of (hashed) CA certificates;
+	 * with NSS, it is the certificate database, which is opened once per
+	 * process, and certName and certPasswd select the client certificate.
+	 * \param mode When to use TLS.
+	 * \param certVerify Fail if the certificate of the server can not be verified.
+	 * \param certPath Certificates to verify the server with.
+	 * \param certName Nickname of the client certificate (NSS only).
+	 * \param certPasswd Password of the certificate database (NSS only).
+	 */
+	void setSsl(SslMode mode, bool certVerify = false,
+		const std::string& certPath = "", const std::string& certName = "",
+		const std::string& certPasswd = "");
+
+	/**
+	 * Test if the connection is encrypted.
+	 * \return true if TLS is in use.
+	 */
+	bool isSsl()const;
+
 	/**
 	 * Test if the connection is active.
 	 * \return tru if the connection is active.
@@ -457,6 +531,7 @@ public:
 	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name) override;
 	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev) override;
 	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::set<std::string>& devs) override;
+	virtual std::map<std::string,std::map<std::string,std::vector<std::string> > > getDevicesVariableValues(const std::map<std::string,std::set<std::string> >& names) override;
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value) override;
 	virtual TrackingID setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values) override;
 
@@ -481,9 +556,22 @@ public:
 	virtual bool isFeatureEnabled(const Feature& feature) override;
 	virtual void setFeature(const Feature& feature, bool status) override;
 
+	/**
+	 * The requests are sent right away, and their replies are matched
+	 * to them in order as they come. They are read by the reactor the
+	 * client was added to, if any, or by the next blocking call which
+	 * waits for a reply otherwise.
+	 * \{
+	 */
+	virtual std::future<std::set<std::string> > getDeviceNamesAsync() override;
+	virtual std::future<std::vector<std::string> > getDeviceVariableValueAsync(const std::string& dev, const std::string& name) override;
+	virtual std::future<std::map<std::string,std::vector<std::string> > > getDeviceVariableValuesAsync(const std::string& dev) override;
+	virtual std::future<TrackingID> setDeviceVariableAsync(const std::string& dev, const std::string& name, const std::string& value) override;
+	virtual std::future<TrackingID> executeDeviceCommandAsync(const std::string& dev, const std::string& name, const std::string& param="") override;
+	/** \} */
+
 protected:
 	std::string sendQuery(const std::string& req);
-	void sendAsyncQueries(const std::vector<std::string>& req);
 	static void detectError(const std::string& req);
 	TrackingID sendTrackingQuery(const std::string& req);
 
@@ -491,18 +579,195 @@ protected:
 
 	std::vector<std::vector<std::string> > list(const std::string& subcmd, const std::string& params = "");
 
-	std::vector<std::vector<std::string> > parseList(const std::string& req);
+	std::future<std::string> sendQueryAsync(const std::string& req);
+	std::future<TrackingID> sendTrackingQueryAsync(const std::string& req);
+	std::future<std::vector<std::string> > getAsync(const std::string& subcmd, const std::string& params = "");
+	std::future<std::vector<std::vector<std::string> > > listAsync(const std::string& subcmd, const std::string& params = "");
 
 	static std::vector<std::string> explode(const std::string& str, size_t begin=0);
+	static std::vector<std::string> explode(const char* str, size_t len, size_t begin=0);
 	static std::string escape(const std::string& str);
 
 private:
+	/* Send a request, whose reply is made into a T by the parser */
+	template<typename T, typename Parser>
+	std::future<T> request(const std::string& req, Parser parser);
+	/* LIST request, with each item added to a T */
+	template<typename T>
+	std::future<T> listInto(const std::string& subcmd, const std::string& params,
+		void (*add)(T& res, std::vector<std::string>&& item));
+	/* Wait for a reply (reading it, if no reactor does) */
+	template<typename T>
+	T result(std::future<T> reply);
+
 	std::string _host;
 	uint16_t _port;
 	time_t _timeout;
 	internal::Socket* _socket;
 };
 
+/**
+ * Connected (and authenticated) TcpClients to one server, to be shared
+ * by threads. Each thread takes a client from the pool for a while; the
+ * connections are set up when needed, and reused afterwards.
+ */
+class TcpClientPool
+{
+public:
+	/**
+	 * A client taken from the pool; it goes back to the pool when the
+	 * Lease is destroyed, unless it was disconnected or discarded.
+	 */
+	class Lease
+	{
+	public:
+		Lease(Lease&& lease) noexcept;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		~Lease();
+
+		TcpClient* operator->()const{return _client;}
+		TcpClient& operator*()const{return *_client;}
+
+		/**
+		 * Do not return the client to the pool (e.g. when a reply
+		 * was not read completely because of a TimeoutException).
+		 */
+		void discard();
+
+	private:
+		friend class TcpClientPool;
+		Lease(TcpClientPool* pool, TcpClient* client);
+
+		TcpClientPool* _pool;
+		TcpClient* _client;
+		bool _discard;
+	};
+
+	/**
+	 * Construct a pool of clients of the specified server.
+	 * \param host Server host name.
+	 * \param port Server port.
+	 * \param maxClients Most connections to have at once.
+	 */
+	TcpClientPool(const std::string& host, uint16_t port = 3493, size_t maxClients = 4);
+	TcpClientPool(const TcpClientPool&) = delete;
+	TcpClientPool& operator=(const TcpClientPool&) = delete;
+	~TcpClientPool();
+
+	/**
+	 * Log the new connections in, see Client::authenticate().
+	 */
+	void setCredentials(const std::string& user, const std::string& passwd);
+
+	/**
+	 * TLS of the new connections, see TcpClient::setSsl().
+	 */
+	void setSsl(SslMode mode, bool certVerify = false,
+		const std::string& certPath = "", const std::string& certName = "",
+		const std::string& certPasswd = "");
+
+	/**
+	 * Timeout of the new connections, see TcpClient::setTimeout().
+	 */
+	void setTimeout(time_t timeout);
+
+	/**
+	 * Take a client from the pool, connecting a new one if there is
+	 * none to reuse. Waits for one to be returned if maxClients are in
+	 * use already.
+	 * \return The client, for the lifetime of the Lease.
+	 */
+	Lease acquire();
+
+	/**
+	 * Disconnect the clients which are not in use.
+	 */
+	void clear();
+
+	/**
+	 * Retrieve the amount of connected clients which are not in use.
+	 */
+	size_t idle();
+
+private:
+	void release(TcpClient* client, bool discard);
+	TcpClient* create();
+
+	std::string _host;
+	uint16_t _port;
+	size_t _maxClients;
+	time_t _timeout;
+	std::string _user, _passwd;
+	SslMode _sslMode;
+	bool _sslVerify;
+	std::string _certPath, _certName, _certPasswd;
+
+	std::mutex _mutex;
+	std::condition_variable _released;
+	std::vector<TcpClient*> _idle;
+	size_t _count;	/* clients of this pool, in use or not */
+};
+
+/**
+ * Reads the replies for TcpClients in one thread, so that (with their
+ * asynchronous methods) requests can be in flight on many connections
+ * at once, without a thread for each.
+ * The blocking methods of the clients added to it wait for the reactor
+ * to read their replies, so it must run in a thread of its own then.
+ */
+class TcpClientReactor
+{
+public:
+	TcpClientReactor();
+	TcpClientReactor(const TcpClientReactor&) = delete;
+	TcpClientReactor& operator=(const TcpClientReactor&) = delete;
+	~TcpClientReactor();
+
+	/**
+	 * Read the replies for a (connected) client from now on.
+	 * A client can only be added to one reactor.
+	 */
+	void add(TcpClient& client);
+	/**
+	 * Stop reading the replies for a client: those still to come are
+	 * read by its blocking methods again. If the reactor is reading for
+	 * this client in another thread, waits for it to be done.
+	 */
+	void remove(TcpClient& client);
+
+	/**
+	 * Read the replies which have come, or wait for some to come.
+	 * The reads are done without holding the lock of the reactor, so
+	 * add(), remove() (of other clients) and stop() need not wait.
+	 * \param timeout Most milliseconds to wait, negative to wait for ever.
+	 * \return true if something was received.
+	 */
+	bool runOnce(int timeout = -1);
+	/**
+	 * Read the replies as they come, until stop() is called.
+	 */
+	void run();
+	/**
+	 * Make run() return (from any thread).
+	 */
+	void stop();
+
+private:
+	void wake();
+	/* Sockets of the connected clients, in _reading until done with */
+	std::vector<internal::Socket*> beginReading();
+	void doneReading(internal::Socket* socket);
+
+	std::mutex _mutex;
+	std::condition_variable _done;	/* when a socket leaves _reading */
+	std::vector<TcpClient*> _clients;
+	std::vector<internal::Socket*> _reading;	/* read outside of the lock */
+	std::thread::id _thread;	/* which runs runOnce() */
+	bool _stop;
+	int _wake[2];	/* pipe to interrupt the wait in runOnce() */
+};
+
 /**
  * Device attached to a client.
  * Device is a lightweight class which can be copied easily.
@@ -573,6 +838,12 @@ public:
 	 * \return Map of all variables values indexed by their names.
 	 */
 	std::map<std::string,std::vector<std::string> > getVariableValues();
+	/**
+	 * Intend to retrieve values of some variables of the device at once.
+	 * \param names Names of the variables to get.
+	 * \return Map of the available variables values indexed by their names.
+	 */
+	std::map<std::string,std::vector<std::string> > getVariableValues(const std::set<std::string>& names);
 	/**
 	 * Retrieve all variables names supported by the device.
 	 * \return Set of available variable names.
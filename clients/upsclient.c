@@ -650,6 +650,16 @@ static ssize_t upscli_select_read(const int fd, void *buf, const size_t buflen,
 	fd_set		fds;
 	struct timeval	tv;
 
+#if (defined MSG_DONTWAIT) && !(defined WIN32)
+	/* data which has arrived already needs no select() first, e.g.
+	 * the rest of a long LIST which is read one buffer at a time */
+	ret = recv(fd, buf, buflen, MSG_DONTWAIT);
+
+	if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		return ret;
+	}
+#endif	/* MSG_DONTWAIT && !WIN32 */
+
 	FD_ZERO(&fds);
 	FD_SET(fd, &fds);
 
@@ -1272,6 +1282,72 @@ int upscli_connect(UPSCONN_t *ups, const char *host, uint16_t port, int flags)
 	return upscli_tryconnect(ups, host, port, flags, ptv);
 }
 
+/* find the next line in the received data, reading more as needed;
+ * returns its address in readbuf (it is not copied), its length without
+ * the newline in *linelen, and in *complete whether it had a newline
+ * (or filled the buffer); NULL if the connection failed */
+static char *upscli_peekline(UPSCONN_t *ups, const time_t timeout,
+	size_t *linelen, int *complete)
+{
+	char	*line = ups->readbuf + ups->readidx, *nl;
+	size_t	scanned = 0;
+	ssize_t	ret;
+
+	for (;;) {
+		/* only look at what was not looked at yet */
+		nl = memchr(line + scanned, '\n',
+			ups->readlen - ups->readidx - scanned);
+
+		if (nl) {
+			*linelen = (size_t)(nl - line);
+			*complete = 1;
+			return line;
+		}
+
+		scanned = ups->readlen - ups->readidx;
+
+		/* a partial line: make room for the rest of it */
+		if (ups->readidx > 0) {
+			memmove(ups->readbuf, line, scanned);
+			ups->readlen = scanned;
+			ups->readidx = 0;
+			line = ups->readbuf;
+		}
+
+		/* longer than the buffer: hand out what we have */
+		if (ups->readlen == UPSCLI_READBUF_LEN) {
+			*linelen = ups->readlen;
+			*complete = 0;
+			return line;
+		}
+
+		ret = net_read(ups, ups->readbuf + ups->readlen,
+			UPSCLI_READBUF_LEN - ups->readlen, timeout);
+
+		if (ret < 1) {
+			upscli_disconnect(ups);
+			return NULL;
+		}
+
+		/* Here ret is safe to cast since it is >=1 and certainly
+		 * fits under SIZE_MAX being it signed sibling
+		 */
+		ups->readlen += (size_t)ret;
+	}
+}
+
+/* done with len bytes of the received data */
+static void upscli_consume(UPSCONN_t *ups, size_t len)
+{
+	ups->readidx += len;
+
+	/* start over at the beginning when everything was handed out,
+	 * so that partial lines rarely have to be moved there */
+	if (ups->readidx >= ups->readlen) {
+		ups->readidx = ups->readlen = 0;
+	}
+}
+
 /* map upsd error strings back to upsclient internal numbers */
 static struct {
 	int	errnum;
@@ -1303,14 +1379,29 @@ static struct {
 	{ UPSCLI_ERR_INVPASSWORD,	"INVALID-PASSWORD"	},
 	{ UPSCLI_ERR_USERREQUIRED,	"USERNAME-REQUIRED"	},
 	{ UPSCLI_ERR_DRVNOTCONN,	"DRIVER-NOT-CONNECTED"	},
+	{ UPSCLI_ERR_INVALIDARG,	"INVALID-ARGUMENT"	},
 
 	{ 0,			NULL,		}
 };
 
-static int upscli_errcheck(UPSCONN_t *ups, char *buf)
+/* the upsclient number for an error name sent by upsd */
+static int upscli_errnum(const char *text)
 {
 	int	i;
 
+	for (i = 0; upsd_errlist[i].text != NULL; i++) {
+		if (!strncmp(text, upsd_errlist[i].text,
+			strlen(upsd_errlist[i].text))) {
+			return upsd_errlist[i].errnum;
+		}
+	}
+
+	/* hmm - don't know what upsd is telling us */
+	return UPSCLI_ERR_UNKNOWN;
+}
+
+static int upscli_errcheck(UPSCONN_t *ups, char *buf)
+{
 	if (!ups) {
 		return -1;
 	}
@@ -1326,17 +1417,55 @@ static int upscli_errcheck(UPSCONN_t *ups, char *buf)
 	}
 
 	/* look it up in the table */
-	for (i = 0; upsd_errlist[i].text != NULL; i++) {
-		if (!strncmp(&buf[4], upsd_errlist[i].text,
-			strlen(upsd_errlist[i].text))) {
-			ups->upserror = upsd_errlist[i].errnum;
-			return -1;
-		}
+	ups->upserror = upscli_errnum(&buf[4]);
+	return -1;
+}
+
+/* read the next line and split it into pc_ctx, straight from readbuf;
+ * returns -1 if that failed or the line is an error response */
+static int upscli_parseline(UPSCONN_t *ups, const time_t timeout)
+{
+	char	*line;
+	size_t	len;
+	int	complete;
+
+	if (!ups) {
+		return -1;
 	}
 
-	/* hmm - don't know what upsd is telling us */
-	ups->upserror = UPSCLI_ERR_UNKNOWN;
-	return -1;
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if ((line = upscli_peekline(ups, timeout, &len, &complete)) == NULL) {
+		return -1;
+	}
+
+	/* pc_ctx keeps copies of the words, so the buffer may be reused */
+	line[len] = '\0';
+	upscli_consume(ups, len + (size_t)complete);
+
+	if (!complete) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, line) != 0) {
+		return -1;
+	}
+
+	if (!pconf_line(&ups->pc_ctx, line)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	return 0;
 }
 
 static void build_cmd(char *buf, size_t bufsize, const char *cmdname,
@@ -1387,7 +1516,7 @@ static int verify_resp(size_t num, const char **q, char **a)
 int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer)
 {
-	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
+	char	cmd[UPSCLI_NETBUF_LEN];
 
 	if (!ups) {
 		return -1;
@@ -1405,16 +1534,22 @@ int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	return upscli_get_reply(ups, numq, query, numa, answer, DEFAULT_NETWORK_TIMEOUT);
+}
+
+int upscli_get_reply(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer, const time_t timeout)
+{
+	if (!ups) {
 		return -1;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
+	if (numq < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
-		ups->upserror = UPSCLI_ERR_PARSE;
+	if (upscli_parseline(ups, timeout) != 0) {
 		return -1;
 	}
 
@@ -1437,57 +1572,142 @@ int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 	return 0;
 }
 
-int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
+int upscli_get_multi(UPSCONN_t *ups, size_t numvars, const char **query,
+		char **value, size_t valuelen, int *err)
 {
-	char	cmd[UPSCLI_NETBUF_LEN], tmp[UPSCLI_NETBUF_LEN];
+	char	cmd[LARGEBUF];
+	size_t	len;
 
 	if (!ups) {
 		return -1;
 	}
 
-	if (numq < 1) {
+	if (numvars < 1) {
 		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-	/* create the string to send to upsd */
-	build_cmd(cmd, sizeof(cmd), "LIST", numq, query);
+	/* query has <upsname> <varname> pairs */
+	build_cmd(cmd, sizeof(cmd), "GET VARS", numvars * 2, query);
 
-	if (upscli_sendline(ups, cmd, strlen(cmd)) != 0) {
+	/* cut short? */
+	len = strlen(cmd);
+	if (!len || cmd[len - 1] != '\n') {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	if (upscli_sendline(ups, cmd, len) != 0) {
+		return -1;
+	}
+
+	return upscli_get_multi_reply(ups, numvars, query, value, valuelen,
+		err, DEFAULT_NETWORK_TIMEOUT);
+}
+
+/* read one line of a framed reply (BEGIN ... END) into pc_ctx, where
+ * ERR lines are a part of the reply */
+static int upscli_read_frame_line(UPSCONN_t *ups, const time_t timeout)
+{
+	char	*line;
+	size_t	len;
+	int	complete;
+
+	if (ups->fd < 0) {
+		ups->upserror = UPSCLI_ERR_DRVNOTCONN;
 		return -1;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
+	if ((line = upscli_peekline(ups, timeout, &len, &complete)) == NULL) {
 		return -1;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
+	line[len] = '\0';
+	upscli_consume(ups, len + (size_t)complete);
+
+	if (!complete || !pconf_line(&ups->pc_ctx, line)) {
 		ups->upserror = UPSCLI_ERR_PARSE;
 		return -1;
 	}
 
-	if (ups->pc_ctx.numargs < 2) {
+	if (ups->pc_ctx.numargs < 1) {
 		ups->upserror = UPSCLI_ERR_PROTOCOL;
 		return -1;
 	}
 
-	/* the response must start with BEGIN LIST */
-	if ((strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0) ||
-		(strcasecmp(ups->pc_ctx.arglist[1], "LIST") != 0)) {
+	return 0;
+}
+
+int upscli_get_multi_reply(UPSCONN_t *ups, size_t numvars, const char **query,
+		char **value, size_t valuelen, int *err, const time_t timeout)
+{
+	static const char	*begin[] = { "BEGIN", "GET", "VARS" };
+	static const char	*end[] = { "END", "GET", "VARS" };
+	char	**arg;
+	size_t	i;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (numvars < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* the request as a whole can fail, e.g. with an older upsd */
+	if (upscli_parseline(ups, timeout) != 0) {
+		return -1;
+	}
+
+	if (ups->pc_ctx.numargs < 3
+	 || !verify_resp(3, begin, ups->pc_ctx.arglist)
+	) {
 		ups->upserror = UPSCLI_ERR_PROTOCOL;
 		return -1;
 	}
 
-	/* q: [LIST] VAR <ups>       *
-	 * a: [BEGIN LIST] VAR <ups> */
+	/* then one line for each variable, in the order asked:
+	 * a: VAR <ups> <var> <val>
+	 * a: ERR <message> <ups> <var> */
+	for (i = 0; i < numvars; i++) {
+		if (upscli_read_frame_line(ups, timeout) != 0) {
+			return -1;
+		}
 
-	/* compare q[0]... to a[2]... */
+		arg = ups->pc_ctx.arglist;
 
-	if (!verify_resp(numq, query, &ups->pc_ctx.arglist[2])) {
+		if (ups->pc_ctx.numargs >= 4 && !strcmp(arg[0], "VAR")
+		 && verify_resp(2, &query[i * 2], &arg[1])
+		) {
+			snprintf(value[i], valuelen, "%s", arg[3]);
+			if (err) {
+				err[i] = UPSCLI_ERR_NONE;
+			}
+			continue;
+		}
+
+		if (ups->pc_ctx.numargs >= 4 && !strcmp(arg[0], "ERR")
+		 && verify_resp(2, &query[i * 2], &arg[2])
+		) {
+			value[i][0] = '\0';
+			if (err) {
+				err[i] = upscli_errnum(arg[1]);
+			}
+			continue;
+		}
+
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	if (upscli_read_frame_line(ups, timeout) != 0) {
+		return -1;
+	}
+
+	if (ups->pc_ctx.numargs < 3
+	 || !verify_resp(3, end, ups->pc_ctx.arglist)
+	) {
 		ups->upserror = UPSCLI_ERR_PROTOCOL;
 		return -1;
 	}
@@ -1495,25 +1715,60 @@ int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
 	return 0;
 }
 
-int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
-		size_t *numa, char ***answer)
+int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query)
 {
-	char	tmp[UPSCLI_NETBUF_LEN];
+	char	cmd[UPSCLI_NETBUF_LEN];
 
 	if (!ups) {
 		return -1;
 	}
 
-	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+	if (numq < 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	/* create the string to send to upsd */
+	build_cmd(cmd, sizeof(cmd), "LIST", numq, query);
+
+	if (upscli_sendline(ups, cmd, strlen(cmd)) != 0) {
 		return -1;
 	}
 
-	if (upscli_errcheck(ups, tmp) != 0) {
+	if (upscli_parseline(ups, DEFAULT_NETWORK_TIMEOUT) != 0) {
 		return -1;
 	}
 
-	if (!pconf_line(&ups->pc_ctx, tmp)) {
-		ups->upserror = UPSCLI_ERR_PARSE;
+	if (ups->pc_ctx.numargs < 2) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* the response must start with BEGIN LIST */
+	if ((strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0) ||
+		(strcasecmp(ups->pc_ctx.arglist[1], "LIST") != 0)) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* q: [LIST] VAR <ups>       *
+	 * a: [BEGIN LIST] VAR <ups> */
+
+	/* compare q[0]... to a[2]... */
+
+	if (!verify_resp(numq, query, &ups->pc_ctx.arglist[2])) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer)
+{
+	/* each item is parsed where it was received, without copying */
+	if (upscli_parseline(ups, DEFAULT_NETWORK_TIMEOUT) != 0) {
 		return -1;
 	}
 
@@ -1584,8 +1839,9 @@ ssize_t upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen)
 
 ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const time_t timeout)
 {
-	ssize_t	ret;
-	size_t	recv;
+	char	*line;
+	size_t	len;
+	int	complete;
 
 	if (!ups) {
 		return -1;
@@ -1606,32 +1862,20 @@ ssize_t upscli_readline_timeout(UPSCONN_t *ups, char *buf, size_t buflen, const
 		return -1;
 	}
 
-	for (recv = 0; recv < (buflen-1); recv++) {
-
-		if (ups->readidx == ups->readlen) {
-
-			ret = net_read(ups, ups->readbuf, sizeof(ups->readbuf), timeout);
-
-			if (ret < 1) {
-				upscli_disconnect(ups);
-				return -1;
-			}
-
-			/* Here ret is safe to cast since it is >=1 and certainly
-			 * fits under SIZE_MAX being it signed sibling
-			 */
-			ups->readlen = (size_t)ret;
-			ups->readidx = 0;
-		}
-
-		buf[recv] = ups->readbuf[ups->readidx++];
+	if ((line = upscli_peekline(ups, timeout, &len, &complete)) == NULL) {
+		return -1;
+	}
 
-		if (buf[recv] == '\n') {
-			break;
-		}
+	/* the rest of a line which does not fit comes with the next call */
+	if (len > buflen - 1) {
+		len = buflen - 1;
+		complete = 0;
 	}
 
-	buf[recv] = '\0';
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	upscli_consume(ups, len + (size_t)complete);
 	return 0;
 }
 
@@ -1835,6 +2079,34 @@ int upscli_fd(UPSCONN_t *ups)
 	return ups->fd;
 }
 
+int upscli_pending(UPSCONN_t *ups)
+{
+	if (!ups) {
+		return 0;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC || ups->fd < 0) {
+		return 0;
+	}
+
+	if (ups->readidx < ups->readlen) {
+		return 1;
+	}
+
+#ifdef WITH_SSL
+	/* the TLS layer may have decrypted more than we read from it */
+	if (ups->ssl) {
+# ifdef WITH_OPENSSL
+		return (SSL_pending(ups->ssl) > 0);
+# elif defined(WITH_NSS) /* WITH_OPENSSL */
+		return (SSL_DataPending(ups->ssl) > 0);
+# endif	/* WITH_OPENSSL | WITH_NSS */
+	}
+#endif	/* WITH_SSL */
+
+	return 0;
+}
+
 int upscli_upserror(UPSCONN_t *ups)
 {
 	if (!ups) {
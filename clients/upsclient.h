@@ -67,6 +67,7 @@ extern "C" {
 
 #define UPSCLI_ERRBUF_LEN	256
 #define UPSCLI_NETBUF_LEN	512	/* network i/o buffer */
+#define UPSCLI_READBUF_LEN	4096	/* received data, longest line parsed */
 
 #include "parseconf.h"
 
@@ -91,7 +92,10 @@ typedef struct {
 	void *ssl;
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-	char	readbuf[64];
+	/* received data which was not handed out yet is between readidx
+	 * and readlen; lines are parsed in place (the extra byte is for
+	 * terminating one which fills the buffer) */
+	char	readbuf[UPSCLI_READBUF_LEN + 1];
 	size_t	readlen;
 	size_t	readidx;
 
@@ -114,6 +118,21 @@ void upscli_add_host_cert(const char* hostname, const char* certname, int certve
 int upscli_get(UPSCONN_t *ups, size_t numq, const char **query,
 		size_t *numa, char ***answer);
 
+/* read the answer to a GET request which was sent earlier (e.g. along
+ * with others in one upscli_sendline() call) */
+int upscli_get_reply(UPSCONN_t *ups, size_t numq, const char **query,
+		size_t *numa, char ***answer, const time_t timeout);
+
+/* several variables (of one or more UPSes) in one request: query has
+ * numvars pairs of <upsname> <varname>, the values are copied into the
+ * numvars buffers of value, with the error for each one in err[] */
+int upscli_get_multi(UPSCONN_t *ups, size_t numvars, const char **query,
+		char **value, size_t valuelen, int *err);
+
+/* read the answer to a GET VARS request which was sent earlier */
+int upscli_get_multi_reply(UPSCONN_t *ups, size_t numvars, const char **query,
+		char **value, size_t valuelen, int *err, const time_t timeout);
+
 int upscli_list_start(UPSCONN_t *ups, size_t numq, const char **query);
 
 int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
@@ -135,6 +154,10 @@ int upscli_disconnect(UPSCONN_t *ups);
 /* these functions return elements from UPSCONN_t to avoid direct references */
 
 int upscli_fd(UPSCONN_t *ups);
+
+/* returns 1 if data was already received (and buffered) which can be
+ * read without waiting for upscli_fd() to become readable */
+int upscli_pending(UPSCONN_t *ups);
 int upscli_upserror(UPSCONN_t *ups);
 
 /* returns 1 if SSL mode is active for this connection */
@@ -157,7 +180,7 @@ int upscli_init_default_connect_timeout(const char *cli_secs, const char *config
 
 /* upsclient error list */
 
-#define UPSCLI_ERR_NONE		-1	/* No known error (internally used in tools like upsmon, not set by upsclient.c) */
+#define UPSCLI_ERR_NONE		-1	/* No known error (internally used in tools like upsmon, not set by upsclient.c other than in the err[] of upscli_get_multi()) */
 
 #define UPSCLI_ERR_UNKNOWN	0	/* Unknown error */
 #define UPSCLI_ERR_VARNOTSUPP	1	/* Variable not supported by UPS */
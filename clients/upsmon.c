@@ -1996,6 +1996,8 @@ static void addups(int reloading, const char *sys, const char *pvs,
 	tmp->pollfail_log_throttle_count = -1;
 	tmp->pollfail_log_throttle_state = UPSCLI_ERR_NONE;
 
+	tmp->nogetvars = 0;
+
 	tmp->lastpoll = 0;
 	tmp->lastnoncrit = 0;
 	tmp->lastrbwarn = 0;
@@ -2708,6 +2710,9 @@ static int try_connect(utype_t *ups)
 	/* we're definitely connected now */
 	setflag(&ups->status, ST_CLICONNECTED);
 
+	/* possibly to another upsd than before */
+	ups->nogetvars = 0;
+
 	/* prevent connection leaking to NOTIFYCMD */
 	set_close_on_exec(upscli_fd(&ups->conn));
 
@@ -2725,6 +2730,23 @@ static int try_connect(utype_t *ups)
 	return 0;
 }
 
+/* find the (alphanumerically) first status token last seen before cutoff */
+static st_tree_t *find_stale_status_token(st_tree_t *node, const st_tree_timespec_t *cutoff)
+{
+	st_tree_t	*sttmp;
+
+	if (!node)
+		return NULL;
+
+	if ((sttmp = find_stale_status_token(node->left, cutoff)) != NULL)
+		return sttmp;
+
+	if (st_tree_node_compare_timestamp(node, cutoff) < 0)
+		return node;
+
+	return find_stale_status_token(node->right, cutoff);
+}
+
 /* deal with the contents of STATUS or ups.status for this ups */
 static void parse_status(utype_t *ups, char *status, char *buzzword, char *buzzwordX)
 {
@@ -2925,43 +2947,19 @@ static void parse_status(utype_t *ups, char *status, char *buzzword, char *buzzw
 	}
 
 	if (ups->status_tokens) {
-		st_tree_t	*node = ups->status_tokens, *sttmp = node;
+		st_tree_t	*node;
 
-		/* Scroll to the leftmost entry for alphanumeric sorted processing */
-		while (sttmp) {
-			node = sttmp;
-			sttmp = sttmp->left;
-		}
+		/* Go in alphanumeric sorted order, on a freeing spree if need be;
+		 * re-scan from the top since deletions may rebalance the tree */
+		while ((node = find_stale_status_token(ups->status_tokens, &st_start)) != NULL) {
+			char	*var = xstrdup(node->var);
 
-		/* Go from left to right, on a freeing spree if need be */
-		while (node) {
-			sttmp = node->right;
-			if (st_tree_node_compare_timestamp(node, &st_start) < 0) {
-				upsdebugx(5, "Unexpected status token: [%s]: disappeared",
-					NUT_STRARG(node->var));
-				changed_other_stat_words++;
+			upsdebugx(5, "Unexpected status token: [%s]: disappeared",
+				NUT_STRARG(var));
+			changed_other_stat_words++;
 
-				/* whatever is on the left, hang it off current right */
-				if (node->right) {
-					node->right->left = node->left;	/* May be NULL*/
-				}
-				/* whatever is on the right, hang it off current left */
-				if (node->left) {
-					node->left->right = node->right;	/* May be NULL*/
-				}
-
-				if (node == ups->status_tokens) {
-					ups->status_tokens = node->left ? node->left : node->right;
-				}
-
-				/* forget the neighbors before dropping the remaining
-				 * "tree" of one node */
-				node->right = NULL;
-				node->left = NULL;
-
-				state_infofree(node);
-			}
-			node = sttmp;
+			state_delinfo(&(ups->status_tokens), var);
+			free(var);
 		}
 	}
 
@@ -2982,37 +2980,33 @@ static void parse_status(utype_t *ups, char *status, char *buzzword, char *buzzw
 	upsdebugx(3, "Handled %d status tokens", handled_stat_words);
 }
 
+/* variables read from each UPS in a polling cycle, in this order */
+static const char	*pollvars[] = {
+	"ups.status",
+	"ups.mode.buzzwords",
+	"experimental.ups.mode.buzzwords"
+};
+#define NUM_POLLVARS	(sizeof(pollvars) / sizeof(pollvars[0]))
+
+/* progress of one UPS through a polling cycle, see pollups() */
+typedef struct {
+	utype_t	*ups;
+	int	started;		/* queries sent in this cycle */
+	int	waiting;		/* not all answers read yet */
+	int	done;			/* results acted upon */
+	size_t	numreplies;		/* answers read so far */
+	int	gotany;			/* did any of them have a value? */
+	char	val[NUM_POLLVARS][SMALLBUF];
+	time_t	deadline;
+} upspoll_t;
+
 /* see what the status of the UPS is and handle any changes */
-static void pollups(utype_t *ups)
+static void pollups_result(utype_t *ups, int ok, char *status, char *buzzmode, char *buzzmodeX)
 {
-	char	status[SMALLBUF], buzzmode[SMALLBUF], buzzmodeX[SMALLBUF];
 	int	pollfail_log = 0;	/* if we throttle, only upsdebugx() but not upslogx() the failures */
-	int	upserror, got_status, got_buzzmode, got_buzzmodeX;
-
-	/* try a reconnect here */
-	if (!flag_isset(ups->status, ST_CLICONNECTED)) {
-		if (try_connect(ups) != 1) {
-			return;
-		}
-	}
-
-	if (upscli_ssl(&ups->conn) == 1)
-		upsdebugx(2, "%s: %s [SSL]", __func__, ups->sys);
-	else
-		upsdebugx(2, "%s: %s", __func__, ups->sys);
-
-	set_alarm();
-
-	if ((got_status = get_var(ups, "status", status, sizeof(status))))
-		status[0] = '\0';
-	if ((got_buzzmode = get_var(ups, "buzzword", buzzmode, sizeof(buzzmode))))
-		buzzmode[0] = '\0';
-	if ((got_buzzmodeX = get_var(ups, "X-buzzword", buzzmodeX, sizeof(buzzmodeX))))
-		buzzmodeX[0] = '\0';
-
-	if (got_status == 0 || got_buzzmode == 0 || got_buzzmodeX == 0) {
-		clear_alarm();
+	int	upserror;
 
+	if (ok) {
 		/* reset pollfail log throttling */
 #if 0
 		/* Note: last error is never cleared, so we reset it below */
@@ -3038,7 +3032,6 @@ static void pollups(utype_t *ups)
 	}
 
 	/* fallthrough: no communications */
-	clear_alarm();
 
 	/* try to make some of these a little friendlier */
 	upserror = upscli_upserror(&ups->conn);
@@ -3126,6 +3119,337 @@ static void pollups(utype_t *ups)
 	}
 }
 
+/* send all of the queries for one UPS in one go: as one GET VARS, or
+ * (for an older upsd) as one GET VAR each, which upsd answers in order,
+ * so they can be read back as they arrive */
+static int pollups_send(upspoll_t *p)
+{
+	char	cmd[LARGEBUF];
+	size_t	i;
+
+	/* this shouldn't happen */
+	if (!p->ups->upsname) {
+		upslogx(LOG_ERR, "%s: programming error: no UPS name set [%s]",
+			__func__, p->ups->sys);
+		return 0;
+	}
+
+	cmd[0] = '\0';
+	if (!p->ups->nogetvars) {
+		snprintfcat(cmd, sizeof(cmd), "GET VARS");
+		for (i = 0; i < NUM_POLLVARS; i++) {
+			snprintfcat(cmd, sizeof(cmd), " %s %s",
+				p->ups->upsname, pollvars[i]);
+		}
+		snprintfcat(cmd, sizeof(cmd), "\n");
+	} else {
+		for (i = 0; i < NUM_POLLVARS; i++) {
+			snprintfcat(cmd, sizeof(cmd), "GET VAR %s %s\n",
+				p->ups->upsname, pollvars[i]);
+		}
+	}
+
+	if (upscli_sendline(&p->ups->conn, cmd, strlen(cmd)) != 0) {
+		return 0;
+	}
+
+	p->waiting = 1;
+	return 1;
+}
+
+/* read the answer to GET VARS from one UPS; returns 0 as there is no
+ * point in waiting for more from it */
+static int pollups_read_multi(upspoll_t *p, time_t timeout)
+{
+	utype_t	*ups = p->ups;
+	const char	*query[NUM_POLLVARS * 2];
+	char	*value[NUM_POLLVARS];
+	int	err[NUM_POLLVARS];
+	size_t	i;
+
+	for (i = 0; i < NUM_POLLVARS; i++) {
+		query[i * 2] = ups->upsname;
+		query[i * 2 + 1] = pollvars[i];
+		value[i] = p->val[i];
+	}
+
+	upsdebugx(3, "%s: %s", __func__, ups->sys);
+
+	p->waiting = 0;
+	p->numreplies = NUM_POLLVARS;
+
+	if (upscli_get_multi_reply(&ups->conn, NUM_POLLVARS, query,
+		value, sizeof(p->val[0]), err, timeout) < 0
+	) {
+		/* an older upsd: ask for one value at a time from now on */
+		if (upscli_fd(&ups->conn) != -1
+		 && (upscli_upserror(&ups->conn) == UPSCLI_ERR_INVALIDARG
+		  || upscli_upserror(&ups->conn) == UPSCLI_ERR_UNKCOMMAND)
+		) {
+			upsdebugx(1, "UPS [%s]: upsd does not know GET VARS, "
+				"falling back to GET VAR", ups->sys);
+			ups->nogetvars = 1;
+			p->numreplies = 0;
+
+			if (pollups_send(p))
+				return 1;
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < NUM_POLLVARS; i++) {
+		if (err[i] == UPSCLI_ERR_NONE) {
+			p->gotany = 1;
+			continue;
+		}
+
+		/* e.g. the buzzwords are not served by every driver */
+		upsdebugx(3, "%s: %s: %s: error %d", __func__,
+			ups->sys, pollvars[i], err[i]);
+
+		/* pollups_result() reports the one of ups.status */
+		if (i == 0)
+			ups->conn.upserror = err[i];
+	}
+
+	return 0;
+}
+
+/* read the next answer from one UPS; returns 0 if there is no point
+ * in waiting for more from it (lost connection or done) */
+static int pollups_read(upspoll_t *p, time_t now)
+{
+	utype_t	*ups = p->ups;
+	const char	*query[3];
+	size_t	numa;
+	char	**answer;
+	time_t	timeout = p->deadline - now;
+
+	if (!ups->nogetvars)
+		return pollups_read_multi(p, timeout > 0 ? timeout : 1);
+
+	query[0] = "VAR";
+	query[1] = ups->upsname;
+	query[2] = pollvars[p->numreplies];
+
+	upsdebugx(3, "%s: %s / %s", __func__, ups->sys, query[2]);
+
+	/* only a partial line may have arrived: wait for the rest, but
+	 * not beyond the deadline of this UPS */
+	if (upscli_get_reply(&ups->conn, 3, query, &numa, &answer,
+		timeout > 0 ? timeout : 1) < 0
+	) {
+		/* connection dropped, nothing else will come */
+		if (upscli_fd(&ups->conn) == -1) {
+			p->waiting = 0;
+			return 0;
+		}
+
+		/* detect old upsd */
+		if (upscli_upserror(&ups->conn) == UPSCLI_ERR_UNKCOMMAND) {
+			upslogx(LOG_ERR, "UPS [%s]: Too old to monitor",
+				ups->sys);
+		}
+	} else if (numa < 4) {
+		upslogx(LOG_ERR, "%s: Error: insufficient data "
+			"(got %" PRIuSIZE " args, need at least %d)",
+			query[2], numa, 4);
+	} else {
+		snprintf(p->val[p->numreplies], sizeof(p->val[p->numreplies]),
+			"%s", answer[3]);
+		p->gotany = 1;
+	}
+
+	if (++p->numreplies == NUM_POLLVARS) {
+		p->waiting = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* send the queries for one UPS and start its clock */
+static void pollups_start(upspoll_t *p, time_t timeout)
+{
+	time_t	now;
+
+	if (upscli_ssl(&p->ups->conn) == 1)
+		upsdebugx(2, "%s: %s [SSL]", __func__, p->ups->sys);
+	else
+		upsdebugx(2, "%s: %s", __func__, p->ups->sys);
+
+	time(&now);
+	p->deadline = now + timeout;
+	p->started = 1;
+	pollups_send(p);
+}
+
+/* act on the answers of one UPS, once */
+static void pollups_finish(upspoll_t *p)
+{
+	if (!p->started || p->waiting || p->done)
+		return;
+
+	p->done = 1;
+	pollups_result(p->ups, p->gotany,
+		p->val[0], p->val[1], p->val[2]);
+}
+
+/* read the answers for all started UPSes as they arrive, and act on
+ * those of each UPS as soon as they are complete */
+static void pollups_wait(upspoll_t *polls, size_t numpolls)
+{
+	size_t	i, waiting;
+	time_t	now;
+	struct timeval	tv;
+
+	for (;;) {
+		fd_set	rfds;
+		int	maxfd = -1, ret, ready = 0;
+		time_t	wait = -1;
+
+		FD_ZERO(&rfds);
+		time(&now);
+		waiting = 0;
+
+		for (i = 0; i < numpolls; i++) {
+			upspoll_t	*p = &polls[i];
+			int	fd;
+
+			if (!p->waiting)
+				continue;
+
+			if (now >= p->deadline) {
+				upsdebugx(2, "%s: %s did not answer in time",
+					__func__, p->ups->sys);
+
+				/* late answers would get in the way of the next poll */
+				p->ups->conn.upserror = UPSCLI_ERR_READ;
+				p->ups->conn.syserrno = ETIMEDOUT;
+				upscli_disconnect(&p->ups->conn);
+				p->waiting = 0;
+				pollups_finish(p);
+				continue;
+			}
+
+			waiting++;
+			if (wait < 0 || p->deadline - now < wait)
+				wait = p->deadline - now;
+
+			fd = upscli_fd(&p->ups->conn);
+			if (upscli_pending(&p->ups->conn) || fd >= FD_SETSIZE) {
+				ready++;
+				continue;
+			}
+
+			FD_SET(fd, &rfds);
+			if (fd > maxfd)
+				maxfd = fd;
+		}
+
+		if (!waiting)
+			break;
+
+		tv.tv_sec = ready ? 0 : wait;
+		tv.tv_usec = 0;
+
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+		if (ret < 0 && errno != EINTR) {
+			upslog_with_errno(LOG_ERR, "%s: select", __func__);
+			break;
+		}
+
+		time(&now);
+
+		for (i = 0; i < numpolls; i++) {
+			upspoll_t	*p = &polls[i];
+			int	fd;
+
+			if (!p->waiting)
+				continue;
+
+			fd = upscli_fd(&p->ups->conn);
+			if (upscli_pending(&p->ups->conn) || fd >= FD_SETSIZE
+			 || (ret > 0 && FD_ISSET(fd, &rfds))
+			) {
+				/* everything that is already here; the alarm
+				 * is a last resort against blocking reads,
+				 * e.g. inside SSL */
+				set_alarm();
+				while (pollups_read(p, now) && upscli_pending(&p->ups->conn))
+					;
+				clear_alarm();
+
+				pollups_finish(p);
+			}
+		}
+	}
+
+	/* e.g. those which failed to send their queries */
+	for (i = 0; i < numpolls; i++) {
+		pollups_finish(&polls[i]);
+	}
+}
+
+/* poll all of the UPSes at once: the queries for each are sent first,
+ * then the answers are read from whichever connection has them ready,
+ * so a slow or unreachable upsd only holds up the UPSes it serves (each
+ * until its own deadline) rather than the whole polling cycle.
+ * Reconnecting (which includes a login dialogue) is done in turn, only
+ * after the UPSes which were still connected have been dealt with. */
+static void pollups(void)
+{
+	utype_t	*ups;
+	upspoll_t	*polls;
+	size_t	numpolls = 0, i;
+	int	reconnected = 0;
+	struct timeval	tv;
+	time_t	timeout;
+
+	for (ups = firstups; ups != NULL; ups = ups->next) {
+		numpolls++;
+	}
+
+	if (!numpolls) {
+		return;
+	}
+
+	polls = xcalloc(numpolls, sizeof(*polls));
+
+	upscli_get_default_connect_timeout(&tv);
+	timeout = (tv.tv_sec > 0) ? tv.tv_sec : DEFAULT_NETWORK_TIMEOUT;
+
+	for (ups = firstups, i = 0; ups != NULL; ups = ups->next, i++) {
+		polls[i].ups = ups;
+
+		if (flag_isset(ups->status, ST_CLICONNECTED))
+			pollups_start(&polls[i], timeout);
+	}
+
+	pollups_wait(polls, numpolls);
+
+	/* try a reconnect here */
+	for (i = 0; i < numpolls; i++) {
+		upspoll_t	*p = &polls[i];
+
+		if (p->started)
+			continue;
+
+		if (try_connect(p->ups) != 1)
+			continue;
+
+		pollups_start(p, timeout);
+		reconnected = 1;
+	}
+
+	if (reconnected)
+		pollups_wait(polls, numpolls);
+
+	free(polls);
+}
+
 /* see if the powerdownflag file is there and proper */
 static int pdflag_status(void)
 {
@@ -4015,14 +4339,14 @@ int main(int argc, char *argv[])
 		/* Reset the value, regardless of support */
 		sleep_inhibitor_status = -2;
 
-		for (ups = firstups; ups != NULL; ups = ups->next) {
-			if (isPreparingForSleepSupported() && (sleep_inhibitor_status = isPreparingForSleep()) >= 0) {
-				upsdebugx(2, "Aborting UPS polling sub-loop because OS is preparing for sleep or just woke up");
-				goto end_loop_cycle;
-			}
-			pollups(ups);
+		if (isPreparingForSleepSupported() && (sleep_inhibitor_status = isPreparingForSleep()) >= 0) {
+			upsdebugx(2, "Aborting UPS polling sub-loop because OS is preparing for sleep or just woke up");
+			goto end_loop_cycle;
 		}
 
+		/* all of them at once, see pollups() */
+		pollups();
+
 		recalc();
 
 		/* make sure the parent hasn't died */
@@ -91,6 +91,8 @@ typedef struct {
 	int	pollfail_log_throttle_state;	/* Last (error) state which we throttle */
 	int	pollfail_log_throttle_count;	/* How many pollfreq loops this UPS was in this state since last logged report? */
 
+	int	nogetvars;		/* upsd does not know GET VARS	*/
+
 	time_t	lastpoll;		/* time of last successful poll	*/
 	time_t  lastnoncrit;		/* time of last non-crit poll	*/
 	time_t	lastrbwarn;		/* time of last REPLBATT warning*/
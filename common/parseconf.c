@@ -27,7 +27,8 @@
  * All subsequent calls must have it as the first argument.  There are
  * two entry points for parsing lines.  You can have it read a file
  * (pconf_file_begin and pconf_file_next), take lines directly from
- * the caller (pconf_line), or go along a character at a time (pconf_char).
+ * the caller (pconf_line), go along a character at a time (pconf_char),
+ * or take whatever was received, a chunk at a time (pconf_chunk).
  * The parsing is identical no matter how you feed it.
  *
  * Since there are no more callbacks, you take the successful return
@@ -74,6 +75,12 @@
  * Finally, there is argsize, which remembers how long each of the
  * arglist elements are.  This is how we know when to expand them.
  *
+ * Whole lines of ordinary text (as sent over the sockets of upsd and
+ * the drivers) are split into words in one go by fastline() instead,
+ * straight from the caller's buffer.  Anything it is not sure about
+ * (lines joined with a backslash, unbalanced quotes, characters which
+ * addchar() would refuse, ...) is left to the state machine.
+ *
  */
 
 #include "config.h" /* should be first */
@@ -117,10 +124,10 @@ static void pconf_fatal(PCONF_CTX_t *ctx, const char *errtxt)
 	exit(EXIT_FAILURE);
 }
 
-static void add_arg_word(PCONF_CTX_t *ctx)
+/* commit a word of wbuflen bytes (not necessarily NUL-terminated) */
+static void add_arg(PCONF_CTX_t *ctx, const char *word, size_t wbuflen)
 {
 	size_t	argpos;
-	size_t	wbuflen;
 
 	/* this is where the new value goes */
 	argpos = ctx->numargs;
@@ -149,8 +156,6 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = 0;
 	}
 
-	wbuflen = strlen(ctx->wordbuf);
-
 	/* now see if the string itself grew compared to last time */
 	if (wbuflen >= ctx->argsize[argpos]) {
 		size_t	newlen;
@@ -168,11 +173,14 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = newlen;
 	}
 
-	/* strncpy doesn't give us a trailing NULL, so prep the space */
-	memset(ctx->arglist[argpos], '\0', ctx->argsize[argpos]);
-
 	/* finally copy the new value into the provided space */
-	strncpy(ctx->arglist[argpos], ctx->wordbuf, wbuflen);
+	memcpy(ctx->arglist[argpos], word, wbuflen);
+	ctx->arglist[argpos][wbuflen] = '\0';
+}
+
+static void add_arg_word(PCONF_CTX_t *ctx)
+{
+	add_arg(ctx, ctx->wordbuf, strlen(ctx->wordbuf));
 }
 
 static void addchar(PCONF_CTX_t *ctx)
@@ -491,6 +499,177 @@ static void parse_char(PCONF_CTX_t *ctx)
 	}	/* switch */
 }
 
+/* a word taken whole from the line: commit it like endofword() would */
+static void fast_word(PCONF_CTX_t *ctx, const char *word, size_t len)
+{
+	if (ctx->arg_limit != 0) {
+		if (ctx->numargs >= ctx->arg_limit)
+			return;
+	}
+
+	/* addchar() stops at the limit */
+	if (ctx->wordlen_limit != 0) {
+		if (len > ctx->wordlen_limit)
+			len = ctx->wordlen_limit;
+	}
+
+	add_arg(ctx, word, len);
+}
+
+/* a word turned out to have escapes in it: move what was taken so far
+ * to wordbuf (grown to fit the rest of the line), returns where the
+ * next character goes */
+static char *fast_copy(PCONF_CTX_t *ctx, const char *start, const char *p,
+	const char *end)
+{
+	size_t	need = (size_t)(end - start) + 1;
+
+	if (ctx->wordbufsize < need) {
+		ctx->wordbuf = realloc(ctx->wordbuf, need);
+
+		if (!ctx->wordbuf)
+			pconf_fatal(ctx, "realloc wordbuf failed");
+
+		ctx->wordbufsize = need;
+	}
+
+	memcpy(ctx->wordbuf, start, (size_t)(p - start));
+	return ctx->wordbuf + (p - start);
+}
+
+/* characters which addchar() takes */
+#define FAST_CHAR(ch)	((ch) >= 0x20 && (ch) <= 0x7f)
+
+/* whitespace, like isspace() in the C locale (without the newline) */
+#define FAST_SPACE(ch)	((ch) == ' ' || ((ch) >= '\t' && (ch) <= '\r'))
+
+/* split a whole line (without its newline) into words in one pass, as
+ * the state machine would; returns 0 if it has to do that itself */
+static int fastline(PCONF_CTX_t *ctx, const char *p, const char *end)
+{
+	const char	*start;
+	char	*out;
+	unsigned char	ch;
+	int	ret = 0;
+
+	ctx->numargs = 0;
+
+	while (p < end) {
+		ch = (unsigned char)*p;
+
+		/* not in a word yet */
+		if (FAST_SPACE(ch)) {
+			p++;
+			continue;
+		}
+
+		/* the rest of the line is a comment */
+		if (ch == '#') {
+			break;
+		}
+
+		/* a word of its own */
+		if (ch == '=') {
+			fast_word(ctx, p++, 1);
+			continue;
+		}
+
+		/* a word bounded by quotes (which may be empty) */
+		if (ch == '"') {
+			start = ++p;
+			out = NULL;
+
+			for (;;) {
+				/* unbalanced, so it goes on in the next line */
+				if (p >= end)
+					goto done;
+
+				ch = (unsigned char)*p;
+
+				if (ch == '"')
+					break;
+
+				/* a parse error, or characters to be refused */
+				if (ch == '#' || !FAST_CHAR(ch))
+					goto done;
+
+				if (ch == '\\') {
+					if (++p >= end)
+						goto done;
+
+					ch = (unsigned char)*p;
+					if (!FAST_CHAR(ch))
+						goto done;
+
+					if (!out)
+						out = fast_copy(ctx, start, p - 1, end);
+				}
+
+				if (out)
+					*out++ = (char)ch;
+				p++;
+			}
+
+			if (out)
+				fast_word(ctx, ctx->wordbuf, (size_t)(out - ctx->wordbuf));
+			else
+				fast_word(ctx, start, (size_t)(p - start));
+
+			/* after the closing quote */
+			p++;
+			continue;
+		}
+
+		/* an ordinary word, up to whitespace, a comment or a '=' */
+		start = p;
+		out = NULL;
+
+		while (p < end) {
+			ch = (unsigned char)*p;
+
+			if (FAST_SPACE(ch) || ch == '#' || ch == '=')
+				break;
+
+			if (!FAST_CHAR(ch))
+				goto done;
+
+			if (ch == '\\') {
+				/* joined with the next line */
+				if (++p >= end)
+					goto done;
+
+				ch = (unsigned char)*p;
+				if (!FAST_CHAR(ch))
+					goto done;
+
+				if (!out)
+					out = fast_copy(ctx, start, p - 1, end);
+			}
+
+			if (out)
+				*out++ = (char)ch;
+			p++;
+		}
+
+		if (out)
+			fast_word(ctx, ctx->wordbuf, (size_t)(out - ctx->wordbuf));
+		else
+			fast_word(ctx, start, (size_t)(p - start));
+	}
+
+	ret = 1;
+
+done:
+	/* wordbuf is the state machine's again */
+	ctx->wordptr = ctx->wordbuf;
+	*ctx->wordptr = '\0';
+
+	if (!ret)
+		ctx->numargs = 0;
+
+	return ret;
+}
+
 /* return 1 if an error occurred, but only do it once */
 int pconf_parse_error(PCONF_CTX_t *ctx)
 {
@@ -560,6 +739,7 @@ int pconf_file_next(PCONF_CTX_t *ctx)
 int pconf_line(PCONF_CTX_t *ctx, const char *line)
 {
 	size_t	i, linelen;
+	const char	*nl;
 
 	if (!check_magic(ctx))
 		return 0;
@@ -572,6 +752,11 @@ int pconf_line(PCONF_CTX_t *ctx, const char *line)
 
 	linelen = strlen(line);
 
+	/* most lines are done in one go */
+	nl = memchr(line, '\n', linelen);
+	if (fastline(ctx, line, nl ? nl : line + linelen))
+		return 1;
+
 	for (i = 0; i < linelen; i++) {
 		ctx->ch = line[i];
 
@@ -652,3 +837,51 @@ int pconf_char(PCONF_CTX_t *ctx, char ch)
 
 	return 0;
 }
+
+/* parse input a chunk at a time: goes up to the end of the first line
+ * completed in buf (or all of it), and tells how far in *used */
+int pconf_chunk(PCONF_CTX_t *ctx, const char *buf, size_t len, size_t *used)
+{
+	const char	*nl;
+	size_t	i;
+
+	*used = len;
+
+	if (!check_magic(ctx))
+		return -1;
+
+	/* if the last call finished a line, clean stuff up for another */
+	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR)) {
+		ctx->numargs = 0;
+		ctx->state = STATE_FINDWORDSTART;
+	}
+
+	/* a whole line, and none of it seen before: all in one go */
+	if ((ctx->state == STATE_FINDWORDSTART) && (ctx->numargs == 0)
+	 && (ctx->wordptr == ctx->wordbuf)
+	 && ((nl = memchr(buf, '\n', len)) != NULL)
+	 && fastline(ctx, buf, nl)
+	) {
+		ctx->state = STATE_ENDOFLINE;
+		*used = (size_t)(nl - buf) + 1;
+		return 1;
+	}
+
+	/* the rest of a line, the start of one, or an unusual one */
+	for (i = 0; i < len; i++) {
+		ctx->ch = buf[i];
+		parse_char(ctx);
+
+		if (ctx->state == STATE_ENDOFLINE) {
+			*used = i + 1;
+			return 1;
+		}
+
+		if (ctx->state == STATE_PARSEERR) {
+			*used = i + 1;
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -35,6 +35,7 @@
 #include "common.h"
 #include "state.h"
 #include "parseconf.h"
+#include "nut_stdint.h"
 
 /* internal helpers */
 
@@ -103,32 +104,194 @@ static void st_tree_node_free(st_tree_t *node)
 	free(node);
 }
 
-/* add a subtree to another subtree */
-static void st_tree_node_add(st_tree_t **nptr, st_tree_t *sptr)
+/* The tree is kept AVL-balanced: drivers tend to add variables in
+ * mostly sorted order (battery.*, input.*, outlet.N.*) which would
+ * otherwise degrade a plain binary search tree into a linked list.
+ * Nodes are relinked rather than having their payload copied around,
+ * so pointers to a node obtained via state_tree_find() remain valid
+ * until that very node is deleted.
+ */
+static size_t st_tree_node_height(const st_tree_t *node)
 {
-	if (!sptr) {
-		return;
+	return (node ? node->height : 0);
+}
+
+static void st_tree_node_update_height(st_tree_t *node)
+{
+	size_t	hl = st_tree_node_height(node->left),
+		hr = st_tree_node_height(node->right);
+
+	node->height = (hl > hr ? hl : hr) + 1;
+}
+
+static st_tree_t *st_tree_node_rotate_left(st_tree_t *node)
+{
+	st_tree_t	*pivot = node->right;
+
+	node->right = pivot->left;
+	pivot->left = node;
+
+	st_tree_node_update_height(node);
+	st_tree_node_update_height(pivot);
+
+	return pivot;
+}
+
+static st_tree_t *st_tree_node_rotate_right(st_tree_t *node)
+{
+	st_tree_t	*pivot = node->left;
+
+	node->left = pivot->right;
+	pivot->right = node;
+
+	st_tree_node_update_height(node);
+	st_tree_node_update_height(pivot);
+
+	return pivot;
+}
+
+/* restore the AVL property for a subtree whose children are balanced,
+ * returns the (possibly new) root of this subtree */
+static st_tree_t *st_tree_node_rebalance(st_tree_t *node)
+{
+	size_t	hl, hr;
+
+	if (!node) {
+		return NULL;
 	}
 
-	while (*nptr) {
+	st_tree_node_update_height(node);
 
-		st_tree_t	*node = *nptr;
+	hl = st_tree_node_height(node->left);
+	hr = st_tree_node_height(node->right);
 
-		if (strcasecmp(node->var, sptr->var) > 0) {
-			nptr = &node->left;
-			continue;
+	if (hl > hr + 1) {
+		if (st_tree_node_height(node->left->left)
+		  < st_tree_node_height(node->left->right)
+		) {
+			node->left = st_tree_node_rotate_left(node->left);
 		}
+		return st_tree_node_rotate_right(node);
+	}
 
-		if (strcasecmp(node->var, sptr->var) < 0) {
-			nptr = &node->right;
-			continue;
+	if (hr > hl + 1) {
+		if (st_tree_node_height(node->right->right)
+		  < st_tree_node_height(node->right->left)
+		) {
+			node->right = st_tree_node_rotate_right(node->right);
 		}
+		return st_tree_node_rotate_left(node);
+	}
+
+	return node;
+}
+
+/* add a new node to a subtree, returns the new root of that subtree */
+static st_tree_t *st_tree_node_add(st_tree_t *node, st_tree_t *sptr)
+{
+	int	cmp;
+
+	if (!node) {
+		sptr->left = NULL;
+		sptr->right = NULL;
+		sptr->height = 1;
+		return sptr;
+	}
 
+	cmp = strcasecmp(node->var, sptr->var);
+
+	if (cmp > 0) {
+		node->left = st_tree_node_add(node->left, sptr);
+	} else if (cmp < 0) {
+		node->right = st_tree_node_add(node->right, sptr);
+	} else {
 		upsdebugx(1, "%s: duplicate value (shouldn't happen)", __func__);
-		return;
+		return node;
 	}
 
-	*nptr = sptr;
+	return st_tree_node_rebalance(node);
+}
+
+/* detach the leftmost node of a subtree into *minp,
+ * returns the new root of that subtree */
+static st_tree_t *st_tree_node_unlink_min(st_tree_t *node, st_tree_t **minp)
+{
+	if (!node->left) {
+		*minp = node;
+		return node->right;
+	}
+
+	node->left = st_tree_node_unlink_min(node->left, minp);
+
+	return st_tree_node_rebalance(node);
+}
+
+/* detach a node from its children, returns the subtree to hang
+ * off its parent in its place */
+static st_tree_t *st_tree_node_unlink(st_tree_t *node)
+{
+	st_tree_t	*succ = NULL, *right;
+
+	if (!node->left) {
+		return node->right;
+	}
+
+	if (!node->right) {
+		return node->left;
+	}
+
+	/* put the in-order successor in place of the removed node */
+	right = st_tree_node_unlink_min(node->right, &succ);
+	succ->left = node->left;
+	succ->right = right;
+
+	return st_tree_node_rebalance(succ);
+}
+
+/* remove a variable from a subtree, optionally only if it was last
+ * updated before cutoff; except for variables with ST_FLAG_IMMUTABLE
+ * (for override.* to survive) per issue #737.
+ * Returns 1 if the node was deleted, 0 if not found or kept.
+ */
+static int st_tree_node_delete(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
+{
+	st_tree_t	*node = *nptr;
+	int	cmp, ret;
+
+	if (!node) {
+		return 0;	/* not found */
+	}
+
+	cmp = strcasecmp(node->var, var);
+
+	if (cmp) {
+		ret = st_tree_node_delete(cmp > 0 ? &node->left : &node->right, var, cutoff);
+
+		if (ret) {
+			*nptr = st_tree_node_rebalance(node);
+		}
+
+		return ret;
+	}
+
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
+		return 0;
+	}
+
+	if (cutoff) {
+		if (st_tree_node_compare_timestamp(node, cutoff) >= 0) {
+			upsdebugx(6, "%s: not deleting recently updated variable [%s]", __func__, var);
+			return 0;
+		}
+		upsdebugx(6, "%s: deleting variable [%s] last updated too long ago", __func__, var);
+	}
+
+	*nptr = st_tree_node_unlink(node);
+
+	st_tree_node_free(node);
+
+	return 1;
 }
 
 static int st_tree_node_refresh_timestamp(const st_tree_t *node)
@@ -196,96 +359,19 @@ int st_tree_node_compare_timestamp(
  */
 int state_delinfo(st_tree_t **nptr, const char *var)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
-
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
-			return 0;
-		}
-
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
-
-		/* now point the parent at the old right child */
-		*nptr = node->right;
-
-		st_tree_node_free(node);
-
-		return 1;
-	}
-
-	return 0;	/* not found */
+	return st_tree_node_delete(nptr, var, NULL);
 }
 
 int state_delinfo_olderthan(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
-
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			upsdebugx(6, "%s: not deleting immutable variable [%s]", __func__, var);
-			return 0;
-		}
-
-		if (st_tree_node_compare_timestamp(node, cutoff) >= 0) {
-			upsdebugx(6, "%s: not deleting recently updated variable [%s]", __func__, var);
-			return 0;
-		}
-		upsdebugx(6, "%s: deleting variable [%s] last updated too long ago", __func__, var);
-
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
-
-		/* now point the parent at the old right child */
-		*nptr = node->right;
-
-		st_tree_node_free(node);
-
-		return 1;
-	}
-
-	return 0;	/* not found */
+	return st_tree_node_delete(nptr, var, cutoff);
 }
 
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 {
-	while (*nptr) {
-
-		st_tree_t	*node = *nptr;
-
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
-
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
+	st_tree_t	*node = state_tree_find(*nptr, var);
 
+	if (node) {
 		/* refresh even if "skip-writing" same info value */
 		st_tree_node_refresh_timestamp(node);
 
@@ -314,14 +400,16 @@ int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 		return 1;	/* changed */
 	}
 
-	*nptr = xcalloc(1, sizeof(**nptr));
+	node = xcalloc(1, sizeof(*node));
+
+	node->var = xstrdup(var);
+	node->raw = xstrdup(val);
+	node->rawsize = strlen(val) + 1;
+	st_tree_node_refresh_timestamp(node);
 
-	(*nptr)->var = xstrdup(var);
-	(*nptr)->raw = xstrdup(val);
-	(*nptr)->rawsize = strlen(val) + 1;
-	st_tree_node_refresh_timestamp(*nptr);
+	val_escape(node);
 
-	val_escape(*nptr);
+	*nptr = st_tree_node_add(*nptr, node);
 
 	return 1;	/* added */
 }
@@ -717,13 +805,14 @@ int state_delrange(st_tree_t *root, const char *var, const int min, const int ma
 st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 {
 	while (node) {
+		int	cmp = strcasecmp(node->var, var);
 
-		if (strcasecmp(node->var, var) > 0) {
+		if (cmp > 0) {
 			node = node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			node = node->right;
 			continue;
 		}
@@ -733,3 +822,278 @@ st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 
 	return node;
 }
+
+/* binary framing of the driver socket protocol */
+
+static void st_bin_reserve(st_bin_buf_t *buf, size_t need)
+{
+	if (buf->len + need <= buf->size)
+		return;
+
+	if (!buf->size)
+		buf->size = ST_SOCK_BUF_LEN;
+
+	while (buf->len + need > buf->size)
+		buf->size *= 2;
+
+	buf->data = xrealloc(buf->data, buf->size);
+}
+
+static void st_bin_put(st_bin_buf_t *buf, uint32_t val, size_t bytes)
+{
+	while (bytes--)
+		buf->data[buf->len++] = (unsigned char)(val >> (8 * bytes));
+}
+
+static uint32_t st_bin_get(const unsigned char *p, size_t bytes)
+{
+	uint32_t	val = 0;
+
+	while (bytes--)
+		val = (val << 8) | *p++;
+
+	return val;
+}
+
+int st_bin_add(st_bin_buf_t *buf, int op, size_t id, const char *str, long num1, long num2)
+{
+	size_t	slen = str ? strlen(str) + 1 : 0;
+
+	if (slen > 0xFFFF)
+		return 0;
+
+	/* op, id, string, and two numbers at most */
+	st_bin_reserve(buf, ST_BIN_HEADER_LEN + 1 + 4 + 2 + slen + 8);
+
+	if (!buf->len)
+		buf->len = ST_BIN_HEADER_LEN;
+
+	buf->data[buf->len++] = (unsigned char)op;
+
+	switch (op)
+	{
+	case ST_BIN_DEFINE:
+	case ST_BIN_SETINFO:
+	case ST_BIN_DELINFO:
+	case ST_BIN_ADDENUM:
+	case ST_BIN_DELENUM:
+	case ST_BIN_ADDRANGE:
+	case ST_BIN_DELRANGE:
+	case ST_BIN_SETAUX:
+	case ST_BIN_SETFLAGS:
+	case ST_BIN_SHMINFO:
+		st_bin_put(buf, (uint32_t)id, 4);
+		break;
+
+	default:
+		break;
+	}
+
+	switch (op)
+	{
+	case ST_BIN_DEFINE:
+	case ST_BIN_SETINFO:
+	case ST_BIN_ADDENUM:
+	case ST_BIN_DELENUM:
+	case ST_BIN_ADDCMD:
+	case ST_BIN_DELCMD:
+	case ST_BIN_TEXT:
+		st_bin_put(buf, (uint32_t)slen, 2);
+		memcpy(buf->data + buf->len, str ? str : "", slen);
+		buf->len += slen;
+		break;
+
+	case ST_BIN_ADDRANGE:
+	case ST_BIN_DELRANGE:
+		st_bin_put(buf, (uint32_t)num1, 4);
+		st_bin_put(buf, (uint32_t)num2, 4);
+		break;
+
+	case ST_BIN_SETAUX:
+	case ST_BIN_SETFLAGS:
+		st_bin_put(buf, (uint32_t)num1, 4);
+		break;
+
+	default:
+		break;
+	}
+
+	return 1;
+}
+
+void st_bin_finish(st_bin_buf_t *buf)
+{
+	size_t	len = buf->len;
+
+	if (len < ST_BIN_HEADER_LEN)
+		return;
+
+	buf->len = 0;
+	st_bin_put(buf, (uint32_t)(len - ST_BIN_HEADER_LEN), ST_BIN_HEADER_LEN);
+	buf->len = len;
+}
+
+size_t st_bin_frame_len(const unsigned char *hdr)
+{
+	return (size_t)st_bin_get(hdr, ST_BIN_HEADER_LEN);
+}
+
+int st_bin_next(const unsigned char *payload, size_t len, size_t *pos, st_bin_rec_t *rec)
+{
+	size_t	p = *pos, slen;
+
+	if (p >= len)
+		return 0;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->op = payload[p++];
+
+	switch (rec->op)
+	{
+	case ST_BIN_DEFINE:
+	case ST_BIN_SETINFO:
+	case ST_BIN_DELINFO:
+	case ST_BIN_ADDENUM:
+	case ST_BIN_DELENUM:
+	case ST_BIN_ADDRANGE:
+	case ST_BIN_DELRANGE:
+	case ST_BIN_SETAUX:
+	case ST_BIN_SETFLAGS:
+	case ST_BIN_SHMINFO:
+		if (len - p < 4)
+			return -1;
+		rec->id = st_bin_get(payload + p, 4);
+		p += 4;
+		break;
+
+	case ST_BIN_ADDCMD:
+	case ST_BIN_DELCMD:
+	case ST_BIN_TEXT:
+		break;
+
+	default:
+		return -1;
+	}
+
+	switch (rec->op)
+	{
+	case ST_BIN_DEFINE:
+	case ST_BIN_SETINFO:
+	case ST_BIN_ADDENUM:
+	case ST_BIN_DELENUM:
+	case ST_BIN_ADDCMD:
+	case ST_BIN_DELCMD:
+	case ST_BIN_TEXT:
+		if (len - p < 2)
+			return -1;
+		slen = st_bin_get(payload + p, 2);
+		p += 2;
+		/* must be NUL-terminated in place */
+		if (slen < 1 || len - p < slen || payload[p + slen - 1] != '\0')
+			return -1;
+		rec->str = (const char *)(payload + p);
+		p += slen;
+		break;
+
+	case ST_BIN_ADDRANGE:
+	case ST_BIN_DELRANGE:
+		if (len - p < 8)
+			return -1;
+		rec->num1 = (int32_t)st_bin_get(payload + p, 4);
+		rec->num2 = (int32_t)st_bin_get(payload + p + 4, 4);
+		p += 8;
+		break;
+
+	case ST_BIN_SETAUX:
+	case ST_BIN_SETFLAGS:
+		if (len - p < 4)
+			return -1;
+		rec->num1 = (int32_t)st_bin_get(payload + p, 4);
+		p += 4;
+		break;
+
+	default:
+		break;
+	}
+
+	*pos = p;
+	return 1;
+}
+
+void st_bin_free(st_bin_buf_t *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = buf->size = 0;
+}
+
+#ifdef ST_SHM_SUPPORTED
+/* full barrier, for the compiler as well as the CPU */
+# define ST_SHM_BARRIER()	__sync_synchronize()
+
+size_t st_shm_size(size_t numslots)
+{
+	return sizeof(st_shm_header_t) + numslots * sizeof(st_shm_slot_t);
+}
+
+st_shm_slot_t *st_shm_slot(const st_shm_header_t *hdr, size_t id)
+{
+	return (st_shm_slot_t *)((const char *)hdr + sizeof(*hdr)) + id;
+}
+
+void st_shm_init(st_shm_header_t *hdr, size_t numslots)
+{
+	memcpy(hdr->magic, ST_SHM_MAGIC, sizeof(hdr->magic));
+	hdr->version = ST_SHM_VERSION;
+	hdr->numslots = (uint32_t)numslots;
+	hdr->slotsize = (uint32_t)sizeof(st_shm_slot_t);
+	hdr->reserved = 0;
+}
+
+int st_shm_valid(const st_shm_header_t *hdr, size_t size)
+{
+	if (size < sizeof(*hdr)
+	 || memcmp(hdr->magic, ST_SHM_MAGIC, sizeof(hdr->magic))
+	 || hdr->version != ST_SHM_VERSION
+	 || hdr->slotsize != sizeof(st_shm_slot_t)
+	) {
+		return 0;
+	}
+
+	return (size >= st_shm_size(hdr->numslots));
+}
+
+void st_shm_write(st_shm_slot_t *slot, const char *val)
+{
+	slot->seq++;
+	ST_SHM_BARRIER();
+	snprintf(slot->val, sizeof(slot->val), "%s", val);
+	ST_SHM_BARRIER();
+	slot->seq++;
+}
+
+int st_shm_read(const st_shm_slot_t *slot, char *buf, size_t bufsize)
+{
+	uint32_t	seq;
+	int	tries;
+
+	for (tries = 0; tries < ST_SHM_READ_RETRIES; tries++) {
+		seq = slot->seq;
+		ST_SHM_BARRIER();
+
+		if (!(seq & 1)) {
+			snprintf(buf, bufsize, "%.*s", (int)sizeof(slot->val) - 1, slot->val);
+			ST_SHM_BARRIER();
+
+			if (slot->seq == seq)
+				return 1;
+		}
+
+		/* the writer may have been preempted in the middle */
+		if (tries > 10)
+			usleep(1);
+	}
+
+	return 0;
+}
+#endif	/* ST_SHM_SUPPORTED */
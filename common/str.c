@@ -628,6 +628,48 @@ int str_ends_with(const char *s, const char *suff) {
 	return (slen >= sufflen) && (!memcmp(s + slen - sufflen, suff, sufflen));
 }
 
+/* FNV-1a, 32-bit variant */
+#define STR_FNV_OFFSET	2166136261U
+#define STR_FNV_PRIME	16777619U
+
+size_t str_hash_ci(const char *s) {
+	uint32_t	hash = STR_FNV_OFFSET;
+
+	if (!s) return (size_t)hash;
+
+	for (; *s; s++) {
+		hash ^= (uint32_t)tolower((unsigned char)*s);
+		hash *= STR_FNV_PRIME;
+	}
+
+	return (size_t)hash;
+}
+
+size_t str_hash_buf(const void *buf, size_t len) {
+	const unsigned char	*p = (const unsigned char *)buf;
+	uint32_t	hash = STR_FNV_OFFSET;
+
+	if (!p) return (size_t)hash;
+
+	for (; len > 0; len--, p++) {
+		hash ^= (uint32_t)*p;
+		hash *= STR_FNV_PRIME;
+	}
+
+	return (size_t)hash;
+}
+
+int str_key(const char *s) {
+	size_t	len;
+
+	if (!s) return 0;
+
+	len = strlen(s);
+	if (len > STR_KEY_MAXLEN) return 0;
+
+	return STR_KEY(len, toupper((unsigned char)*s));
+}
+
 #ifndef HAVE_STRTOF
 # include <errno.h>
 # include <stdio.h>
@@ -32,6 +32,7 @@
 # include <sys/types.h>
 # include <sys/socket.h>
 # include <sys/un.h>
+# include <fcntl.h>
 #else	/* WIN32 */
 # include <strings.h>
 # include "wincompat.h"
@@ -44,6 +45,10 @@
 #include "attribute.h"
 #include "nut_stdint.h"
 
+#ifdef ST_SHM_SUPPORTED
+# include <sys/mman.h>
+#endif	/* ST_SHM_SUPPORTED */
+
 	static TYPE_FD	sockfd = ERROR_FD;
 #ifndef WIN32
 	static char	*sockfn = NULL;
@@ -59,6 +64,44 @@
 	static st_tree_t	*dtree_root = NULL;
 	static cmdlist_t	*cmdhead = NULL;
 
+	/* variable names interned for the binary socket protocol: IDs are
+	 * given out in order and never reused, binvar_index is a hash
+	 * table of (ID + 1) with 0 for an empty slot */
+	static char	**binvar_names = NULL;
+	static size_t	binvar_count = 0, binvar_alloc = 0;
+	static size_t	*binvar_index = NULL, binvar_index_size = 0;
+
+	/* results of validate_formatting_string() for the formatting strings
+	 * of dstate_*_dynamic(), which mostly come from static mapping tables:
+	 * a hash table keyed by the pointers, with copies of the contents to
+	 * notice a buffer which got reused for another string */
+	typedef struct {
+		const char	*fmt_dynamic, *fmt_reference;
+		char	*copy_dynamic, *copy_reference;
+		int	result;
+	} fmtcache_t;
+	static fmtcache_t	*fmtcache = NULL;
+	static size_t	fmtcache_count = 0, fmtcache_size = 0;
+	static uintmax_t	fmtcache_lookups = 0, fmtcache_hits = 0;
+
+#ifndef WIN32
+	/* see dstate_poll_fd_add() */
+	static struct {
+		TYPE_FD	fd;
+		int	events;
+		int	(*handler)(TYPE_FD fd);
+	}	poll_extra[DSTATE_POLL_EXTRA_MAX];
+	static size_t	poll_extra_count = 0;
+#endif	/* !WIN32 */
+
+#ifdef ST_SHM_SUPPORTED
+	/* values published for the clients which asked for "PROTOCOL SHM",
+	 * in the file named like the socket with ".shm" appended */
+	static char	*shmfn = NULL;
+	static st_shm_header_t	*shm_hdr = NULL;
+	static size_t	shm_size = 0;
+#endif	/* ST_SHM_SUPPORTED */
+
 	struct ups_handler	upsh;
 
 #ifndef WIN32
@@ -244,6 +287,7 @@ static void sock_disconnect(conn_t *conn)
 
 	upsdebugx(5, "%s: finishing parsing context", __func__);
 	pconf_finish(&conn->ctx);
+	st_bin_free(&conn->binbuf);
 
 	upsdebugx(5, "%s: relinking the chain of connections", __func__);
 	if (conn->prev) {
@@ -262,15 +306,302 @@ static void sock_disconnect(conn_t *conn)
 	free(conn);
 }
 
-static void send_to_all(const char *fmt, ...)
+static void binvar_index_add(size_t id)
+{
+	size_t	mask = binvar_index_size - 1, i;
+
+	for (i = str_hash_ci(binvar_names[id]) & mask; binvar_index[i]; i = (i + 1) & mask)
+		;
+
+	binvar_index[i] = id + 1;
+}
+
+/* ID of a variable name for the binary protocol, interning it if new */
+static size_t binvar_id(const char *var)
+{
+	size_t	i, mask;
+
+	if (binvar_index_size) {
+		mask = binvar_index_size - 1;
+		for (i = str_hash_ci(var) & mask; binvar_index[i]; i = (i + 1) & mask) {
+			if (!strcasecmp(binvar_names[binvar_index[i] - 1], var))
+				return binvar_index[i] - 1;
+		}
+	}
+
+	if (binvar_count == binvar_alloc) {
+		binvar_alloc = binvar_alloc ? binvar_alloc * 2 : 64;
+		binvar_names = xrealloc(binvar_names, binvar_alloc * sizeof(*binvar_names));
+	}
+	binvar_names[binvar_count] = xstrdup(var);
+
+	/* keep the hash table at most half full */
+	if (binvar_index_size < 2 * (binvar_count + 1)) {
+		binvar_index_size = binvar_index_size ? binvar_index_size * 2 : 128;
+		free(binvar_index);
+		binvar_index = xcalloc(binvar_index_size, sizeof(*binvar_index));
+
+		for (i = 0; i < binvar_count; i++)
+			binvar_index_add(i);
+	}
+	binvar_index_add(binvar_count);
+
+	return binvar_count++;
+}
+
+static void binvar_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < binvar_count; i++)
+		free(binvar_names[i]);
+
+	free(binvar_names);
+	free(binvar_index);
+	binvar_names = NULL;
+	binvar_index = NULL;
+	binvar_count = binvar_alloc = binvar_index_size = 0;
+}
+
+static size_t fmtcache_hash(const char *fmt_dynamic, const char *fmt_reference)
+{
+	return (size_t)(((uintptr_t)fmt_dynamic >> 3) * 31 + ((uintptr_t)fmt_reference >> 3));
+}
+
+static void fmtcache_set(fmtcache_t *fc, const char *fmt_dynamic, const char *fmt_reference, int result)
+{
+	free(fc->copy_dynamic);
+	free(fc->copy_reference);
+
+	fc->fmt_dynamic = fmt_dynamic;
+	fc->fmt_reference = fmt_reference;
+	fc->copy_dynamic = xstrdup(fmt_dynamic);
+	fc->copy_reference = xstrdup(fmt_reference);
+	fc->result = result;
+}
+
+static void fmtcache_add(const char *fmt_dynamic, const char *fmt_reference, int result)
+{
+	fmtcache_t	*old = fmtcache;
+	size_t	oldsize = fmtcache_size, mask, i;
+
+	/* keep the hash table at most half full */
+	if (fmtcache_size < 2 * (fmtcache_count + 1)) {
+		fmtcache_size = fmtcache_size ? fmtcache_size * 2 : 64;
+		fmtcache = xcalloc(fmtcache_size, sizeof(*fmtcache));
+		mask = fmtcache_size - 1;
+
+		for (i = 0; i < oldsize; i++) {
+			size_t	j;
+
+			if (!old[i].fmt_dynamic)
+				continue;
+
+			for (j = fmtcache_hash(old[i].fmt_dynamic, old[i].fmt_reference) & mask;
+				fmtcache[j].fmt_dynamic; j = (j + 1) & mask)
+				;
+			fmtcache[j] = old[i];
+		}
+
+		free(old);
+	}
+
+	mask = fmtcache_size - 1;
+	for (i = fmtcache_hash(fmt_dynamic, fmt_reference) & mask; fmtcache[i].fmt_dynamic; i = (i + 1) & mask)
+		;
+
+	fmtcache_set(&fmtcache[i], fmt_dynamic, fmt_reference, result);
+	fmtcache_count++;
+}
+
+/* validate_formatting_string() only once for each pair of formatting
+ * strings; the errors which may go away (of memory) are not cached */
+static int dstate_validate_formatting_string(const char *fmt_dynamic, const char *fmt_reference)
+{
+	size_t	mask, i;
+	int	ret;
+
+	if (!fmt_dynamic || !fmt_reference)
+		return validate_formatting_string(fmt_dynamic, fmt_reference, NUT_DYNAMICFORMATTING_DEBUG_LEVEL);
+
+	fmtcache_lookups++;
+
+	if (fmtcache_size) {
+		mask = fmtcache_size - 1;
+		for (i = fmtcache_hash(fmt_dynamic, fmt_reference) & mask; fmtcache[i].fmt_dynamic; i = (i + 1) & mask) {
+			fmtcache_t	*fc = &fmtcache[i];
+
+			if (fc->fmt_dynamic != fmt_dynamic || fc->fmt_reference != fmt_reference)
+				continue;
+
+			if (!strcmp(fc->copy_dynamic, fmt_dynamic)
+			 && !strcmp(fc->copy_reference, fmt_reference)
+			) {
+				fmtcache_hits++;
+				if (fc->result < 0)
+					errno = EINVAL;
+				return fc->result;
+			}
+
+			/* same buffers, other strings */
+			ret = validate_formatting_string(fmt_dynamic, fmt_reference, NUT_DYNAMICFORMATTING_DEBUG_LEVEL);
+			if (ret >= 0 || ret == -3)
+				fmtcache_set(fc, fmt_dynamic, fmt_reference, ret);
+			return ret;
+		}
+	}
+
+	ret = validate_formatting_string(fmt_dynamic, fmt_reference, NUT_DYNAMICFORMATTING_DEBUG_LEVEL);
+	if (ret >= 0 || ret == -3)
+		fmtcache_add(fmt_dynamic, fmt_reference, ret);
+
+	return ret;
+}
+
+static void fmtcache_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < fmtcache_size; i++) {
+		free(fmtcache[i].copy_dynamic);
+		free(fmtcache[i].copy_reference);
+	}
+
+	free(fmtcache);
+	fmtcache = NULL;
+	fmtcache_count = fmtcache_size = 0;
+	fmtcache_lookups = fmtcache_hits = 0;
+}
+
+/* write out the frame pending for a binary protocol client; on failure
+ * the client is only marked for closing, so this is safe to call from
+ * anywhere, see conn_flush_all() */
+static int send_bin_flush(conn_t *conn)
+{
+	st_bin_buf_t	*bb = &conn->binbuf;
+	size_t	sent = 0;
+	ssize_t	ret;
+	int	tries = 0;
+#ifdef WIN32
+	DWORD	bytesWritten;
+#endif	/* WIN32 */
+
+	if (!bb->len) {
+		return 1;
+	}
+
+	if (conn->closing) {
+		bb->len = 0;
+		return 0;
+	}
+
+	st_bin_finish(bb);
+
+	while (sent < bb->len) {
+#ifndef WIN32
+		ret = write(conn->fd, bb->data + sent, bb->len - sent);
+#else	/* WIN32 */
+		bytesWritten = 0;
+		if (WriteFile(conn->fd, bb->data + sent, (DWORD)(bb->len - sent), &bytesWritten, NULL) == 0) {
+			ret = -1;
+		} else {
+			ret = (ssize_t)bytesWritten;
+		}
+#endif	/* WIN32 */
+
+		if (ret > 0) {
+			sent += (size_t)ret;
+			continue;
+		}
+
+		/* throttle down for the other side to read the frame */
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR)
+		 && tries++ < DSTATE_BIN_WRITE_RETRIES
+		) {
+			usleep(DSTATE_BIN_WRITE_THROTTLE_USEC);
+			continue;
+		}
+
+		upsdebug_with_errno(0, "WARNING: %s: write of a %" PRIuSIZE
+			"-byte frame failed after %" PRIuSIZE " bytes, disconnecting.",
+			__func__, bb->len, sent);
+		bb->len = 0;
+		conn->closing = 1;
+		return 0;
+	}
+
+	upsdebugx(6, "%s: wrote a frame of %" PRIuSIZE " bytes", __func__, bb->len);
+	bb->len = 0;
+
+	return 1;
+}
+
+/* add a record to the frame pending for a binary protocol client, with
+ * the definition of any variable IDs this client does not know yet */
+static void send_bin(conn_t *conn, int op, const char *var, const char *str, long num1, long num2)
+{
+	size_t	id = 0;
+
+	if (conn->closing) {
+		return;
+	}
+
+	if (var) {
+		id = binvar_id(var);
+
+		for (; conn->bindefined <= id; conn->bindefined++) {
+			st_bin_add(&conn->binbuf, ST_BIN_DEFINE, conn->bindefined,
+				binvar_names[conn->bindefined], 0, 0);
+		}
+	}
+
+	if (!st_bin_add(&conn->binbuf, op, id, str, num1, num2)) {
+		upsdebugx(1, "%s: value of %s is too long for a frame, skipped",
+			__func__, NUT_STRARG(var));
+	}
+
+	if (conn->binbuf.len > DSTATE_BIN_FLUSH_LEN) {
+		send_bin_flush(conn);
+	}
+}
+
+/* send out the pending frames, and drop the clients which failed or
+ * asked to be disconnected */
+static void conn_flush_all(void)
+{
+	conn_t	*conn, *cnext;
+
+	for (conn = connhead; conn; conn = cnext) {
+		cnext = conn->next;
+
+		if (conn->binary) {
+			send_bin_flush(conn);
+		}
+
+		if (conn->closing) {
+			sock_disconnect(conn);
+		}
+	}
+}
+
+/* send one line of the text protocol as a record of a binary frame */
+static void send_bin_line(conn_t *conn, const char *buf)
+{
+	char	line[ST_SOCK_BUF_LEN];
+
+	snprintf(line, sizeof(line), "%.*s", (int)strcspn(buf, "\n"), buf);
+	send_bin(conn, ST_BIN_TEXT, NULL, line, 0, 0);
+}
+
+/* clients which asked for binary frames get the line as a text record,
+ * unless textonly is set (the caller sends them something better) */
+static void vsend_to_all(int textonly, const char *fmt, va_list ap)
 {
 	ssize_t	ret;
 	char	buf[ST_SOCK_BUF_LEN];
 	size_t	buflen;
-	va_list	ap;
 	conn_t	*conn, *cnext;
 
-	va_start(ap, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
 #endif
@@ -288,7 +619,6 @@ static void send_to_all(const char *fmt, ...)
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
-	va_end(ap);
 
 	if (ret < 1) {
 		upsdebugx(2, "%s: nothing to write", __func__);
@@ -310,6 +640,12 @@ static void send_to_all(const char *fmt, ...)
 		if (conn->nobroadcast)
 			continue;
 
+		if (conn->binary) {
+			if (!textonly)
+				send_bin_line(conn, buf);
+			continue;
+		}
+
 #ifndef WIN32
 		ret = write(conn->fd, buf, buflen);
 #else	/* WIN32 */
@@ -359,6 +695,327 @@ static void send_to_all(const char *fmt, ...)
 	}
 }
 
+static void send_to_all(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+static void send_to_all(const char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsend_to_all(0, fmt, ap);
+	va_end(ap);
+}
+
+static void send_text_to_all(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+static void send_text_to_all(const char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsend_to_all(1, fmt, ap);
+	va_end(ap);
+}
+
+#ifdef ST_SHM_SUPPORTED
+static int st_tree_dump_conn(st_tree_t *node, conn_t *conn);
+
+static void shm_intern_tree(const st_tree_t *node)
+{
+	if (!node)
+		return;
+
+	shm_intern_tree(node->left);
+	binvar_id(node->var);
+	shm_intern_tree(node->right);
+}
+
+static void shm_write_tree(const st_tree_t *node)
+{
+	if (!node)
+		return;
+
+	shm_write_tree(node->left);
+	st_shm_write(st_shm_slot(shm_hdr, binvar_id(node->var)), node->raw);
+	shm_write_tree(node->right);
+}
+
+static void shm_unmap(void)
+{
+	if (shm_hdr) {
+		munmap((void *)shm_hdr, shm_size);
+		shm_hdr = NULL;
+		shm_size = 0;
+	}
+}
+
+/* (re)create the shared segment with room to spare for the variables
+ * known so far, and fill it in from the tree; the file is prepared
+ * under another name and renamed into place, so that clients only ever
+ * open complete segments (and those still mapping the old one are not
+ * disturbed until they are told to move on) */
+static int shm_create(void)
+{
+	size_t	numslots = ST_SHM_MIN_SLOTS, size;
+	char	tmpfn[NUT_PATH_MAX + 1];
+	void	*map;
+	int	fd;
+
+	if (!sockfn) {
+		return 0;
+	}
+
+	if (!shmfn) {
+		snprintf(tmpfn, sizeof(tmpfn), "%s.shm", sockfn);
+		shmfn = xstrdup(tmpfn);
+	}
+
+	shm_intern_tree(dtree_root);
+	while (numslots < 2 * binvar_count) {
+		numslots *= 2;
+	}
+	size = st_shm_size(numslots);
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.new", shmfn);
+	unlink(tmpfn);
+
+	/* upsd only needs to read it, as a member of our group */
+	fd = open(tmpfn, O_RDWR | O_CREAT | O_EXCL, 0640);
+
+	if (fd < 0) {
+		upslog_with_errno(LOG_WARNING, "Can't create shared state file %s", tmpfn);
+		return 0;
+	}
+
+	if (ftruncate(fd, (off_t)size) < 0) {
+		upslog_with_errno(LOG_WARNING, "Can't size shared state file %s", tmpfn);
+		close(fd);
+		unlink(tmpfn);
+		return 0;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		upslog_with_errno(LOG_WARNING, "Can't map shared state file %s", tmpfn);
+		unlink(tmpfn);
+		return 0;
+	}
+
+	shm_unmap();
+	shm_hdr = map;
+	shm_size = size;
+
+	st_shm_init(shm_hdr, numslots);
+	shm_write_tree(dtree_root);
+
+	if (rename(tmpfn, shmfn) < 0) {
+		upslog_with_errno(LOG_WARNING, "Can't rename %s to %s", tmpfn, shmfn);
+		shm_unmap();
+		unlink(tmpfn);
+		return 0;
+	}
+
+	upsdebugx(2, "%s: publishing values in %s (%" PRIuSIZE " slots)",
+		__func__, shmfn, numslots);
+
+	return 1;
+}
+
+/* stop publishing (if the segment could not grow): the clients which
+ * relied on it get the values in binary frames from now on */
+static void shm_stop(void)
+{
+	conn_t	*conn;
+	char	line[SMALLBUF];
+
+	snprintf(line, sizeof(line), "PROTOCOL BINARY %d", ST_BIN_PROTOCOL_VERSION);
+
+	for (conn = connhead; conn; conn = conn->next) {
+		if (!conn->shm)
+			continue;
+
+		conn->shm = 0;
+		send_bin(conn, ST_BIN_TEXT, NULL, line, 0, 0);
+		st_tree_dump_conn(dtree_root, conn);
+	}
+
+	shm_unmap();
+
+	if (shmfn) {
+		unlink(shmfn);
+	}
+}
+
+/* write a new value to its slot, moving to a bigger segment first if
+ * this is a variable we did not have room for */
+static void shm_publish(const char *var, const char *val)
+{
+	size_t	id;
+	conn_t	*conn;
+	char	line[SMALLBUF];
+
+	if (!shm_hdr) {
+		return;
+	}
+
+	id = binvar_id(var);
+
+	if (id < shm_hdr->numslots) {
+		st_shm_write(st_shm_slot(shm_hdr, id), val);
+		return;
+	}
+
+	if (!shm_create()) {
+		shm_stop();
+		return;
+	}
+
+	/* clients map the new file when they see this */
+	snprintf(line, sizeof(line), "PROTOCOL SHM %d", ST_SHM_VERSION);
+
+	for (conn = connhead; conn; conn = conn->next) {
+		if (conn->shm)
+			send_bin(conn, ST_BIN_TEXT, NULL, line, 0, 0);
+	}
+}
+#endif	/* ST_SHM_SUPPORTED */
+
+/* names of the ST_BIN_* records which have a text equivalent */
+static const char *st_bin_opname(int op)
+{
+	switch (op)
+	{
+	case ST_BIN_SETINFO:	return "SETINFO";
+	case ST_BIN_DELINFO:	return "DELINFO";
+	case ST_BIN_ADDENUM:	return "ADDENUM";
+	case ST_BIN_DELENUM:	return "DELENUM";
+	case ST_BIN_ADDRANGE:	return "ADDRANGE";
+	case ST_BIN_DELRANGE:	return "DELRANGE";
+	case ST_BIN_SETAUX:	return "SETAUX";
+	case ST_BIN_SETFLAGS:	return "SETFLAGS";
+	case ST_BIN_ADDCMD:	return "ADDCMD";
+	case ST_BIN_DELCMD:	return "DELCMD";
+	default:		return "UNKNOWN";
+	}
+}
+
+/* one change of the state tree, as a binary record */
+static void send_state_bin(conn_t *conn, int op, const char *var, const char *str, long num1, long num2)
+{
+	char	line[ST_SOCK_BUF_LEN];
+
+	switch (op)
+	{
+	case ST_BIN_ADDCMD:
+	case ST_BIN_DELCMD:
+		send_bin(conn, op, NULL, str, 0, 0);
+		return;
+
+	case ST_BIN_SETINFO:
+		/* the value itself is in the shared segment already */
+		if (conn->shm) {
+			send_bin(conn, ST_BIN_SHMINFO, var, NULL, 0, 0);
+			return;
+		}
+		break;
+
+	case ST_BIN_SETAUX:
+		/* records carry 32-bit numbers */
+		if (num1 > INT32_MAX || num1 < INT32_MIN) {
+			snprintf(line, sizeof(line), "SETAUX %s %ld", var, num1);
+			send_bin(conn, ST_BIN_TEXT, NULL, line, 0, 0);
+			return;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	send_bin(conn, op, var, str, num1, num2);
+}
+
+/* one change of the state tree, sent to each listener the way it asked
+ * for: as a line of text, or as a record of the next binary frame */
+static void send_state_to_all(int op, const char *var, const char *str, long num1, long num2)
+{
+	conn_t	*conn;
+	int	text = 0;
+	char	flist[SMALLBUF];
+
+#ifdef ST_SHM_SUPPORTED
+	if (op == ST_BIN_SETINFO) {
+		shm_publish(var, str);
+	}
+#endif	/* ST_SHM_SUPPORTED */
+
+	for (conn = connhead; conn; conn = conn->next) {
+		if (conn->nobroadcast)
+			continue;
+
+		if (!conn->binary) {
+			text = 1;
+			continue;
+		}
+
+		send_state_bin(conn, op, var, str, num1, num2);
+	}
+
+	if (!text)
+		return;
+
+	switch (op)
+	{
+	case ST_BIN_SETINFO:
+	case ST_BIN_ADDENUM:
+	case ST_BIN_DELENUM:
+		send_text_to_all("%s %s \"%s\"\n", st_bin_opname(op), var, str);
+		break;
+
+	case ST_BIN_DELINFO:
+		send_text_to_all("DELINFO %s\n", var);
+		break;
+
+	case ST_BIN_ADDRANGE:
+	case ST_BIN_DELRANGE:
+		send_text_to_all("%s %s %i %i\n", st_bin_opname(op), var, (int)num1, (int)num2);
+		break;
+
+	case ST_BIN_SETAUX:
+		send_text_to_all("SETAUX %s %ld\n", var, num1);
+		break;
+
+	case ST_BIN_SETFLAGS:
+		/* build the list */
+		snprintf(flist, sizeof(flist), "%s", var);
+
+		if (num1 & ST_FLAG_RW) {
+			snprintfcat(flist, sizeof(flist), " RW");
+		}
+
+		if (num1 & ST_FLAG_STRING) {
+			snprintfcat(flist, sizeof(flist), " STRING");
+		}
+
+		if (num1 & ST_FLAG_NUMBER) {
+			snprintfcat(flist, sizeof(flist), " NUMBER");
+		}
+
+		send_text_to_all("SETFLAGS %s\n", flist);
+		break;
+
+	case ST_BIN_ADDCMD:
+	case ST_BIN_DELCMD:
+		send_text_to_all("%s %s\n", st_bin_opname(op), str);
+		break;
+
+	default:
+		break;
+	}
+}
+
 static int send_to_one(conn_t *conn, const char *fmt, ...)
 {
 	ssize_t	ret;
@@ -403,6 +1060,12 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 		return 0;	/* failed */
 	}
 
+	if (conn->binary) {
+		/* goes out with the next frame, see conn_flush_all() */
+		send_bin_line(conn, buf);
+		return !conn->closing;
+	}
+
 	if (ret <= INT_MAX)
 		upsdebugx(5, "%s: %.*s", __func__, (int)(ret-1), buf);
 
@@ -625,11 +1288,58 @@ static void sock_connect(TYPE_FD sock)
 
 }
 
+/* enum values are kept escaped for the text protocol, while binary
+ * records carry them as they are (see pconf_encode()) */
+static void enum_decode(const char *enc, char *buf, size_t bufsize)
+{
+	size_t	i = 0;
+
+	for (; *enc && i + 1 < bufsize; enc++) {
+		if (*enc == '\\' && enc[1])
+			enc++;
+		buf[i++] = *enc;
+	}
+
+	buf[i] = '\0';
+}
+
+static int st_tree_dump_bin_one_node(st_tree_t *node, conn_t *conn)
+{
+	enum_t	*etmp;
+	range_t	*rtmp;
+	char	val[ST_MAX_VALUE_LEN];
+
+	send_state_bin(conn, ST_BIN_SETINFO, node->var, node->raw, 0, 0);
+
+	for (etmp = node->enum_list; etmp; etmp = etmp->next) {
+		enum_decode(etmp->val, val, sizeof(val));
+		send_state_bin(conn, ST_BIN_ADDENUM, node->var, val, 0, 0);
+	}
+
+	for (rtmp = node->range_list; rtmp; rtmp = rtmp->next) {
+		send_state_bin(conn, ST_BIN_ADDRANGE, node->var, NULL, rtmp->min, rtmp->max);
+	}
+
+	if (node->aux) {
+		send_state_bin(conn, ST_BIN_SETAUX, node->var, NULL, node->aux, 0);
+	}
+
+	if (node->flags) {
+		send_state_bin(conn, ST_BIN_SETFLAGS, node->var, NULL, node->flags, 0);
+	}
+
+	return !conn->closing;
+}
+
 static int st_tree_dump_conn_one_node(st_tree_t *node, conn_t *conn)
 {
 	enum_t	*etmp;
 	range_t	*rtmp;
 
+	if (conn->binary) {
+		return st_tree_dump_bin_one_node(node, conn);
+	}
+
 	if (!send_to_one(conn, "SETINFO %s \"%s\"\n", node->var, node->val)) {
 		return 0;	/* write failed, bail out */
 	}
@@ -711,6 +1421,11 @@ static int cmd_dump_conn(conn_t *conn)
 	cmdlist_t	*cmd;
 
 	for (cmd = cmdhead; cmd; cmd = cmd->next) {
+		if (conn->binary) {
+			send_state_bin(conn, ST_BIN_ADDCMD, NULL, cmd->name, 0, 0);
+			continue;
+		}
+
 		if (!send_to_one(conn, "ADDCMD %s\n", cmd->name)) {
 			return 0;
 		}
@@ -745,6 +1460,10 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 #else	/* WIN32 */
 		upsdebugx(2, "%s: received LOGOUT on handle %p, will be disconnecting", __func__, conn->fd);
 #endif	/* WIN32 */
+		if (conn->binary) {
+			send_bin_flush(conn);
+		}
+
 		/* Let the system flush the reply somehow (or the other
 		 * side to just see it) before we drop the pipe */
 		usleep(1000000);
@@ -838,6 +1557,44 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		return 0;
 	}
 
+	/* PROTOCOL SHM <version> | PROTOCOL BINARY <version> | PROTOCOL TEXT */
+	if (!strcasecmp(arg[0], "PROTOCOL")) {
+		int	version = (numarg > 2) ? atoi(arg[2]) : 0;
+		int	shm = (!strcasecmp(arg[1], "SHM") && version == ST_SHM_VERSION);
+		int	binary = (shm || (!strcasecmp(arg[1], "BINARY")
+			&& version == ST_BIN_PROTOCOL_VERSION));
+
+		/* binary frames at least, if the segment can not be set up */
+#ifdef ST_SHM_SUPPORTED
+		if (shm && !shm_hdr && !shm_create()) {
+			shm = 0;
+		}
+#else	/* !ST_SHM_SUPPORTED */
+		shm = 0;
+#endif	/* !ST_SHM_SUPPORTED */
+
+		/* the reply is still in the old protocol */
+		if (shm) {
+			send_to_one(conn, "PROTOCOL SHM %d\n", ST_SHM_VERSION);
+		} else if (binary) {
+			send_to_one(conn, "PROTOCOL BINARY %d\n", ST_BIN_PROTOCOL_VERSION);
+		} else {
+			send_to_one(conn, "PROTOCOL TEXT\n");
+		}
+
+		if (conn->binary) {
+			send_bin_flush(conn);
+		} else {
+			conn->bindefined = 0;
+		}
+		conn->binary = binary;
+		conn->shm = shm;
+
+		upsdebugx(2, "%s: client uses the %s protocol now",
+			__func__, shm ? "shared memory" : (binary ? "binary" : "text"));
+		return 1;
+	}
+
 	/* INSTCMD <cmdname> [<cmdparam>] [TRACKING <id>] */
 	if (!strcasecmp(arg[0], "INSTCMD")) {
 		int ret;
@@ -974,6 +1731,7 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 static void sock_read(conn_t *conn)
 {
 	ssize_t	ret, i;
+	size_t	used;
 	int	ret_arg = -1;
 
 #ifndef WIN32
@@ -1046,9 +1804,10 @@ static void sock_read(conn_t *conn)
 	}
 #endif	/* WIN32 */
 
-	for (i = 0; i < ret; i++) {
+	for (i = 0; i < ret; i += (ssize_t)used) {
 
-		switch(pconf_char(&conn->ctx, buf[i]))
+		/* whole lines at once, a partial one is kept for the next read */
+		switch(pconf_chunk(&conn->ctx, buf + i, (size_t)(ret - i), &used))
 		{
 		case 0: /* nothing to parse yet */
 			continue;
@@ -1065,7 +1824,7 @@ static void sock_read(conn_t *conn)
 				}
 			} else if (ret_arg == 2) {
 				/* closed by LOGOUT processing, conn is free()'d */
-				if (i < ret)
+				if (i + (ssize_t)used < ret)
 					upsdebugx(1, "%s: returning early, socket may be not valid anymore", __func__);
 				return;
 			}
@@ -1098,6 +1857,15 @@ static void sock_close(void)
 			free(sockfn);
 			sockfn = NULL;
 		}
+
+# ifdef ST_SHM_SUPPORTED
+		shm_unmap();
+		if (shmfn) {
+			unlink(shmfn);
+			free(shmfn);
+			shmfn = NULL;
+		}
+# endif	/* ST_SHM_SUPPORTED */
 #else	/* WIN32 */
 		FlushFileBuffers(sockfd);
 		CloseHandle(sockfd);
@@ -1155,6 +1923,96 @@ char * dstate_init(const char *prog, const char *devname)
 	return xstrdup(sockname);
 }
 
+int dstate_poll_fd_add(TYPE_FD fd, int events, int (*handler)(TYPE_FD fd))
+{
+#ifndef WIN32
+	size_t	i;
+
+	if (!VALID_FD(fd) || !handler) {
+		return -1;
+	}
+
+	for (i = 0; i < poll_extra_count; i++) {
+		if (poll_extra[i].fd == fd) {
+			break;
+		}
+	}
+
+	if (i == poll_extra_count) {
+		if (poll_extra_count == DSTATE_POLL_EXTRA_MAX) {
+			upslogx(LOG_ERR, "%s: too many descriptors to poll", __func__);
+			return -1;
+		}
+		poll_extra_count++;
+	}
+
+	upsdebugx(3, "%s: fd %d events 0x%x", __func__, fd, (unsigned int)events);
+	poll_extra[i].fd = fd;
+	poll_extra[i].events = events;
+	poll_extra[i].handler = handler;
+
+	return 0;
+#else	/* WIN32 */
+	/* the waiting is done on event handles there, see below */
+	NUT_UNUSED_VARIABLE(fd);
+	NUT_UNUSED_VARIABLE(events);
+	NUT_UNUSED_VARIABLE(handler);
+
+	return -1;
+#endif	/* WIN32 */
+}
+
+void dstate_poll_fd_remove(TYPE_FD fd)
+{
+#ifndef WIN32
+	size_t	i;
+
+	for (i = 0; i < poll_extra_count; i++) {
+		if (poll_extra[i].fd == fd) {
+			upsdebugx(3, "%s: fd %d", __func__, fd);
+			poll_extra[i] = poll_extra[--poll_extra_count];
+			return;
+		}
+	}
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(fd);
+#endif	/* WIN32 */
+}
+
+#ifndef WIN32
+/* call the handlers of the extra descriptors which are ready, once each
+ * (or all of them with ERROR_FD if rfds is NULL), non-zero if one has
+ * events for the driver; they may add or remove descriptors meanwhile */
+static int poll_extra_handle(fd_set *rfds, fd_set *wfds)
+{
+	int	(*called[DSTATE_POLL_EXTRA_MAX])(TYPE_FD fd);
+	size_t	i, j, ncalled = 0;
+	int	ret = 0;
+
+	for (i = 0; i < poll_extra_count; i++) {
+		TYPE_FD	fd = poll_extra[i].fd;
+		int	(*handler)(TYPE_FD fd) = poll_extra[i].handler;
+
+		if (rfds && !FD_ISSET(fd, rfds) && !FD_ISSET(fd, wfds)) {
+			continue;
+		}
+
+		for (j = 0; j < ncalled && called[j] != handler; j++)
+			;
+		if (j < ncalled) {
+			continue;
+		}
+		called[ncalled++] = handler;
+
+		if (handler(rfds ? fd : ERROR_FD)) {
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
+#endif	/* !WIN32 */
+
 /* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
 int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 {
@@ -1164,14 +2022,36 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 	struct timeval	now;
 
 #ifndef WIN32
-	int	ret;
-	fd_set	rfds;
+	int	ret, extra_ret;
+	fd_set	rfds, wfds;
+	size_t	i;
+
+	/* send what the driver changed since the last call */
+	conn_flush_all();
+
+	/* events which came while the driver was busy */
+	if (poll_extra_count && poll_extra_handle(NULL, NULL)) {
+		return 1;
+	}
 
 	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
 	FD_SET(sockfd, &rfds);
 
 	maxfd = sockfd;
 
+	for (i = 0; i < poll_extra_count; i++) {
+		if (poll_extra[i].events & DSTATE_POLL_READ) {
+			FD_SET(poll_extra[i].fd, &rfds);
+		}
+		if (poll_extra[i].events & DSTATE_POLL_WRITE) {
+			FD_SET(poll_extra[i].fd, &wfds);
+		}
+		if (poll_extra[i].fd > maxfd) {
+			maxfd = poll_extra[i].fd;
+		}
+	}
+
 	if (VALID_FD(arg_extrafd)) {
 		FD_SET(arg_extrafd, &rfds);
 
@@ -1205,7 +2085,7 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		timeout.tv_usec -= now.tv_usec;
 	}
 
-	ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+	ret = select(maxfd + 1, &rfds, &wfds, NULL, &timeout);
 
 	if (ret == 0) {
 		return 1;	/* timer expired */
@@ -1238,19 +2118,20 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
+	extra_ret = poll_extra_count ? poll_extra_handle(&rfds, &wfds) : 0;
 
-		if (conn->closing) {
-			sock_disconnect(conn);
-		}
-	}
+	/* replies to the requests above, and cleanup */
+	conn_flush_all();
 
 	/* tell the caller if that fd woke up */
 	if (VALID_FD(arg_extrafd) && (FD_ISSET(arg_extrafd, &rfds))) {
 		return 1;
 	}
 
+	if (extra_ret) {
+		return 1;
+	}
+
 #else /* WIN32 */
 
 	DWORD	ret;
@@ -1259,6 +2140,10 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 
 	/* FIXME: Should such table (and limit) be used in reality? */
 	NUT_UNUSED_VARIABLE(arg_extrafd);
+	NUT_UNUSED_VARIABLE(cnext);
+
+	/* send what the driver changed since the last call */
+	conn_flush_all();
 /*
 	if (VALID_FD(arg_extrafd)) {
 		rfds[maxfd] = arg_extrafd;
@@ -1327,13 +2212,8 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 		}
 	}
 
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
-
-		if (conn->closing) {
-			sock_disconnect(conn);
-		}
-	}
+	/* replies to the requests above, and cleanup */
+	conn_flush_all();
 
 	/* tell the caller if that fd woke up */
 /*
@@ -1377,7 +2257,7 @@ int vdstate_setinfo(const char *var, const char *fmt, va_list ap)
 	ret = state_setinfo(&dtree_root, var, value);
 
 	if (ret == 1) {
-		send_to_all("SETINFO %s \"%s\"\n", var, value);
+		send_state_to_all(ST_BIN_SETINFO, var, value, 0, 0);
 	}
 
 	return ret;
@@ -1414,7 +2294,7 @@ int dstate_setinfo(const char *var, const char *fmt, ...)
 
 int dstate_setinfo_dynamic(const char *var, const char *fmt_dynamic, const char *fmt_reference, ...)
 {
-	if (!var || validate_formatting_string(fmt_dynamic, fmt_reference, NUT_DYNAMICFORMATTING_DEBUG_LEVEL) < 0) {
+	if (!var || dstate_validate_formatting_string(fmt_dynamic, fmt_reference) < 0) {
 		return -1;
 	} else {
 		int	ret;
@@ -1468,7 +2348,7 @@ int vdstate_addenum(const char *var, const char *fmt, va_list ap)
 	ret = state_addenum(dtree_root, var, value);
 
 	if (ret == 1) {
-		send_to_all("ADDENUM %s \"%s\"\n", var, value);
+		send_state_to_all(ST_BIN_ADDENUM, var, value, 0, 0);
 	}
 
 	return ret;
@@ -1505,7 +2385,7 @@ int dstate_addenum(const char *var, const char *fmt, ...)
 
 int dstate_addenum_dynamic(const char *var, const char *fmt_dynamic, const char *fmt_reference, ...)
 {
-	if (!var || validate_formatting_string(fmt_dynamic, fmt_reference, NUT_DYNAMICFORMATTING_DEBUG_LEVEL) < 0) {
+	if (!var || dstate_validate_formatting_string(fmt_dynamic, fmt_reference) < 0) {
 		return -1;
 	} else {
 		int	ret;
@@ -1539,7 +2419,7 @@ int dstate_addrange(const char *var, const int min, const int max)
 	ret = state_addrange(dtree_root, var, min, max);
 
 	if (ret == 1) {
-		send_to_all("ADDRANGE %s %i %i\n", var, min, max);
+		send_state_to_all(ST_BIN_ADDRANGE, var, NULL, min, max);
 		/* Also add the "NUMBER" flag for ranges */
 		dstate_addflags(var, ST_FLAG_NUMBER);
 	}
@@ -1550,7 +2430,6 @@ int dstate_addrange(const char *var, const int min, const int max)
 void dstate_setflags(const char *var, int flags)
 {
 	st_tree_t	*sttmp;
-	char	flist[SMALLBUF];
 
 	/* find the dtree node for var */
 	sttmp = state_tree_find(dtree_root, var);
@@ -1571,23 +2450,8 @@ void dstate_setflags(const char *var, int flags)
 
 	sttmp->flags = flags;
 
-	/* build the list */
-	snprintf(flist, sizeof(flist), "%s", var);
-
-	if (flags & ST_FLAG_RW) {
-		snprintfcat(flist, sizeof(flist), " RW");
-	}
-
-	if (flags & ST_FLAG_STRING) {
-		snprintfcat(flist, sizeof(flist), " STRING");
-	}
-
-	if (flags & ST_FLAG_NUMBER) {
-		snprintfcat(flist, sizeof(flist), " NUMBER");
-	}
-
 	/* update listeners */
-	send_to_all("SETFLAGS %s\n", flist);
+	send_state_to_all(ST_BIN_SETFLAGS, var, NULL, flags, 0);
 }
 
 void dstate_addflags(const char *var, const int addflags)
@@ -1645,7 +2509,7 @@ void dstate_setaux(const char *var, long aux)
 	sttmp->aux = aux;
 
 	/* update listeners */
-	send_to_all("SETAUX %s %ld\n", var, aux);
+	send_state_to_all(ST_BIN_SETAUX, var, NULL, aux, 0);
 }
 
 const char *dstate_getinfo(const char *var)
@@ -1661,7 +2525,7 @@ void dstate_addcmd(const char *cmdname)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("ADDCMD %s\n", cmdname);
+		send_state_to_all(ST_BIN_ADDCMD, NULL, cmdname, 0, 0);
 	}
 }
 
@@ -1673,7 +2537,7 @@ int dstate_delinfo(const char *var)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELINFO %s\n", var);
+		send_state_to_all(ST_BIN_DELINFO, var, NULL, 0, 0);
 	}
 
 	return ret;
@@ -1687,7 +2551,7 @@ int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELINFO %s\n", var);
+		send_state_to_all(ST_BIN_DELINFO, var, NULL, 0, 0);
 	}
 
 	return ret;
@@ -1701,7 +2565,7 @@ int dstate_delenum(const char *var, const char *val)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELENUM %s \"%s\"\n", var, val);
+		send_state_to_all(ST_BIN_DELENUM, var, val, 0, 0);
 	}
 
 	return ret;
@@ -1715,7 +2579,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELRANGE %s %i %i\n", var, min, max);
+		send_state_to_all(ST_BIN_DELRANGE, var, NULL, min, max);
 	}
 
 	return ret;
@@ -1729,7 +2593,7 @@ int dstate_delcmd(const char *cmd)
 
 	/* update listeners */
 	if (ret == 1) {
-		send_to_all("DELCMD %s\n", cmd);
+		send_state_to_all(ST_BIN_DELCMD, NULL, cmd, 0, 0);
 	}
 
 	return ret;
@@ -1744,6 +2608,8 @@ void dstate_free(void)
 	cmdhead = NULL;
 
 	sock_close();
+	binvar_free();
+	fmtcache_free();
 }
 
 const st_tree_t *dstate_getroot(void)
@@ -2306,6 +3172,14 @@ void dstate_dump(void)
 
 	dstate_tree_dump(node);
 
+	if (fmtcache_lookups) {
+		upsdebugx(1, "%s: dynamic formatting strings: %" PRIuSIZE
+			" validated, taken from cache %" PRIuMAX " times of %" PRIuMAX
+			" (%" PRIuMAX "%%)",
+			__func__, fmtcache_count, fmtcache_hits, fmtcache_lookups,
+			fmtcache_hits * 100 / fmtcache_lookups);
+	}
+
 	/* Make sure it lands in one piece and is logged where called */
 	fflush(stdout);
 	fflush(stderr);
@@ -55,6 +55,10 @@ typedef struct conn_s {
 	int	nobroadcast;	/* connections can request to ignore send_to_all() updates */
 	int	readzero;	/* how many times in a row we had zero bytes read; see DSTATE_CONN_READZERO_THROTTLE_USEC and DSTATE_CONN_READZERO_THROTTLE_MAX */
 	int	closing;	/* raised during LOGOUT processing, to close the socket when time is right */
+	int	binary;		/* client asked for binary frames ("PROTOCOL BINARY") */
+	size_t	bindefined;	/* interned variable IDs already defined to this client */
+	st_bin_buf_t	binbuf;	/* frame being built for this client */
+	int	shm;		/* ...and reads values from the shared segment ("PROTOCOL SHM") */
 } conn_t;
 
 /* sleep after read()ing zero bytes */
@@ -63,6 +67,14 @@ typedef struct conn_s {
 /* close socket after read()ing zero bytes this many times in a row */
 #define DSTATE_CONN_READZERO_THROTTLE_MAX	5
 
+/* send a pending binary frame early when it grows beyond this size */
+#define DSTATE_BIN_FLUSH_LEN	(64 * 1024)
+
+/* sleep between attempts to write the rest of a binary frame, and
+ * give up on the client after this many attempts (about a second) */
+#define DSTATE_BIN_WRITE_THROTTLE_USEC	200
+#define DSTATE_BIN_WRITE_RETRIES	5000
+
 #include "main.h"	/* for set_exit_flag(); uses conn_t itself */
 
 	extern	struct	ups_handler	upsh;
@@ -73,6 +85,18 @@ typedef struct conn_s {
 
 char * dstate_init(const char *prog, const char *devname);
 int dstate_poll_fds(struct timeval timeout, TYPE_FD extrafd);
+
+/* More descriptors for dstate_poll_fds() to wait on, like those of a
+ * library doing asynchronous I/O for the driver (not on WIN32). When one
+ * is ready, its handler is called with it; before waiting, the handlers
+ * are also called with ERROR_FD, to tell of events they already have.
+ * dstate_poll_fds() returns early (like for extrafd) if a handler returns
+ * non-zero. Up to DSTATE_POLL_EXTRA_MAX descriptors can be added. */
+#define DSTATE_POLL_EXTRA_MAX	16
+#define DSTATE_POLL_READ	0x01
+#define DSTATE_POLL_WRITE	0x02
+int dstate_poll_fd_add(TYPE_FD fd, int events, int (*handler)(TYPE_FD fd));
+void dstate_poll_fd_remove(TYPE_FD fd);
 int vdstate_setinfo(const char *var, const char *fmt, va_list ap);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
@@ -70,6 +70,30 @@ size_t max_report_size = 0;
 /* Tweaks for Powercom, at least */
 int interrupt_only = 0;
 size_t interrupt_size = 0;
+/* Interrupt transfer kept queued, see HIDGetEvents() */
+int interrupt_async = 0;
+
+/* How many reports HIDGetEvents() takes at once in that case */
+#define HID_EVENTS_MAX_REPORTS	16
+
+/* Walks which the refresh of a report whose data do not change may be
+ * deferred by, at most (0: never), see HIDPrefetchReports() */
+unsigned int report_backoff = 0;
+
+hid_report_stats_t	hid_report_stats;
+
+/* Index of the usage tables in use, so converting a usage name to its
+ * code (or back) does not scan each table: open-addressing hash tables
+ * with linear probing. For duplicate names or codes, the first entry
+ * in table order is kept - same as the linear scan would find. */
+typedef struct {
+	usage_tables_t	*utab;	/* tables this index was built for */
+	size_t	size;	/* slots in each hash table, a power of 2 */
+	const usage_lkp_t	**byname;
+	const usage_lkp_t	**bycode;
+} usage_index_t;
+
+static usage_index_t	usage_index = { NULL, 0, NULL, NULL };
 
 #define SMIN(a, b) ( ((intmax_t)(a) < (intmax_t)(b)) ? (a) : (b) )
 #define UMIN(a, b) ( ((uintmax_t)(a) < (uintmax_t)(b)) ? (a) : (b) )
@@ -147,14 +171,65 @@ reportbuf_t *new_report_buffer(HIDDesc_t *arg_pDesc)
 	return rbuf;
 }
 
+/* seconds on a clock which does not follow changes of the wall clock,
+   where the system has one: reports are timestamped with it */
+static double report_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+#else
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+#endif
+}
+
+/* a walk which starts a bit sooner than "age" seconds after the
+   previous one must still get fresh reports */
+#define HID_REPORT_SLACK	0.5
+
+/* refreshes in a row which get the same data before deferring more */
+#define HID_REPORT_STEADY	2
+
+/* note that the report with the given id was (re)filled: refresh it
+   less often if its data keep the same, up to report_backoff walks
+   later, or as asked again as soon as they change */
+static void report_filed(reportbuf_t *rbuf, int id)
+{
+	size_t	h = str_hash_buf(rbuf->data[id], rbuf->len[id]);
+
+	rbuf->ts[id] = report_clock();
+
+	if (h != rbuf->hash[id]) {
+		rbuf->hash[id] = h;
+		rbuf->steady[id] = 0;
+		rbuf->defer[id] = 0;
+		rbuf->deferred[id] = 0;
+		return;
+	}
+
+	if (++rbuf->steady[id] < HID_REPORT_STEADY || rbuf->pinned[id])
+		return;
+
+	rbuf->steady[id] = 0;
+	rbuf->defer[id] = rbuf->defer[id] ? rbuf->defer[id] * 2 : 1;
+	if (rbuf->defer[id] > report_backoff) {
+		rbuf->defer[id] = report_backoff;
+	}
+}
+
 /* ---------------------------------------------------------------------- */
 /* the functions in this next group operate on buffered reports, but
    operate on individual items, not whole reports. */
 
 /* refresh the report with the given id in the report buffer rbuf.  If
    the report is not yet in the buffer, or if it is older than "age"
-   seconds, then the report is freshly read from the USB
-   device. Otherwise, it is unchanged.
+   seconds (on a monotonic clock), then the report is freshly read
+   from the USB device. Otherwise, it is unchanged.
    Return 0 on success, -1 on error with errno set. */
 /* because buggy firmwares from APC return wrong report size, we either
    ask the report with the found report size or with the whole buffer size
@@ -165,12 +240,18 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	int	ret;
 	size_t	r;
 
-	if (interrupt_only || rbuf->ts[id] + age > time(NULL)) {
+	if (interrupt_only || (rbuf->ts[id] > 0
+	 && report_clock() - rbuf->ts[id] < (double)age - HID_REPORT_SLACK)
+	) {
 		/* buffered report is still good; nothing to do */
 		upsdebug_hex(3, "Report[buf]", rbuf->data[id], rbuf->len[id]);
+		hid_report_stats.hits++;
 		return 0;
 	}
 
+	hid_report_stats.misses++;
+	hid_report_stats.transfers++;
+
 	r = max_report_size ? sizeof(rbuf->data[id]) : rbuf->len[id];
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TYPE_LIMITS) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_CONSTANT_OUT_OF_RANGE_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_UNSIGNED_ZERO_COMPARE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_TAUTOLOGICAL_TYPE_LIMIT_COMPARE) )
 # pragma GCC diagnostic push
@@ -251,7 +332,8 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	report_filed(rbuf, id);
+	rbuf->deferred[id] = rbuf->defer[id];
 
 	return 0;
 }
@@ -336,6 +418,8 @@ static int set_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t
 # pragma GCC diagnostic pop
 #endif
 
+	hid_report_stats.transfers++;
+
 	ret = comm_driver->set_report(udev, id,
 		(usb_ctrl_charbuf)rbuf->data[id],
 		(usb_ctrl_charbufsize)r);
@@ -347,6 +431,8 @@ static int set_item_buffered(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDData_t
 
 	/* expire report */
 	rbuf->ts[id] = 0;
+	rbuf->defer[id] = 0;
+	rbuf->deferred[id] = 0;
 
 	return 0;
 }
@@ -372,7 +458,8 @@ static int file_report_buffer(reportbuf_t *rbuf, unsigned char *buf, size_t bufl
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	hid_report_stats.interrupts++;
+	report_filed(rbuf, id);
 
 	return 0;
 }
@@ -544,6 +631,84 @@ int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, ti
 	return 1;
 }
 
+/* Retrieve the reports which a walk is going to read in a row, rather
+ * than as its items come. Reports are not requested sooner than "age"
+ * seconds after the previous time (as for HIDGetDataValue()), and the
+ * ones whose data did not change lately (see report_filed()) only once
+ * in a few walks, unless they are flagged HID_REPORT_VOLATILE.
+ * A report which can not be retrieved is skipped, unless the error
+ * means that the device is to be reconnected (as in usbhid-ups).
+ */
+int HIDPrefetchReports(hid_dev_handle_t udev, const unsigned char *plan, time_t age)
+{
+	HIDData_t	data;
+	double	now;
+	int	id, ret, count = 0;
+
+	if (!reportbuf || interrupt_only)
+		return 0;
+
+	memset(&data, 0, sizeof(data));
+	now = report_clock();
+
+	for (id = 0; id < 256; id++) {
+		if (!(plan[id] & HID_REPORT_READ) || !reportbuf->data[id])
+			continue;
+
+		if (plan[id] & HID_REPORT_VOLATILE) {
+			reportbuf->pinned[id] = 1;
+			reportbuf->defer[id] = 0;
+			reportbuf->deferred[id] = 0;
+		}
+
+		if (reportbuf->ts[id] > 0
+		 && now - reportbuf->ts[id] < (double)age - HID_REPORT_SLACK
+		) {
+			continue;
+		}
+
+		if (reportbuf->ts[id] > 0 && reportbuf->deferred[id] > 0) {
+			/* keep its data for this walk */
+			upsdebugx(4, "%s: report %02x deferred (%u more walks)",
+				__func__, (unsigned int)id, reportbuf->deferred[id] - 1);
+			reportbuf->deferred[id]--;
+			reportbuf->ts[id] = now;
+			hid_report_stats.deferred++;
+			continue;
+		}
+
+		data.ReportID = (uint8_t)id;
+		if (refresh_report_buffer(reportbuf, udev, &data, age) < 0) {
+			ret = -errno;
+			upsdebug_with_errno(1, "%s: can't retrieve Report %02x", __func__, (unsigned int)id);
+
+			switch (ret)
+			{
+			case LIBUSB_ERROR_BUSY:
+#if WITH_LIBUSB_0_1 /* limit to libusb 0.1 implementation */
+			case -EPERM:
+			case -ENXIO:
+#endif
+			case LIBUSB_ERROR_NO_DEVICE:
+			case LIBUSB_ERROR_ACCESS:
+			case LIBUSB_ERROR_NOT_FOUND:
+			case LIBUSB_ERROR_NO_MEM:
+			case LIBUSB_ERROR_IO:
+				/* the device is to be reconnected */
+				return ret;
+
+			default:
+				/* its items will try again on their own */
+				continue;
+			}
+		}
+		count++;
+	}
+
+	upsdebugx(3, "%s: retrieved %d reports", __func__, count);
+	return count;
+}
+
 /* Return the physical value associated with the given path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
@@ -677,6 +842,8 @@ int HIDSetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double Value)
 
 	/* flush the report buffer (data may have changed) */
 	memset(reportbuf->ts, 0, sizeof(reportbuf->ts));
+	memset(reportbuf->defer, 0, sizeof(reportbuf->defer));
+	memset(reportbuf->deferred, 0, sizeof(reportbuf->deferred));
 
 	upsdebugx(4, "Set report succeeded");
 	return 1;
@@ -697,7 +864,7 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
 {
 	unsigned char	buf[SMALLBUF];
 	int		itemCount = 0;
-	int		buflen, ret;
+	int		buflen, ret, reports;
 	size_t	i, r;
 	HIDData_t	*pData;
 
@@ -760,45 +927,66 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
 # pragma GCC diagnostic pop
 #endif
 
-	buflen = comm_driver->get_interrupt(
-		udev, (usb_ctrl_charbuf)buf,
-		(usb_ctrl_charbufsize)r,
-		750);
+	/* with a transfer kept queued, take all the reports which came
+	 * since the last call (the latest one of each report ID is kept
+	 * in reportbuf); otherwise wait for one */
+	for (reports = 0; reports < HID_EVENTS_MAX_REPORTS; reports++) {
+		int	reportItems = 0;
+
+#if !((defined SHUT_MODE) && SHUT_MODE)
+		if (interrupt_async) {
+			buflen = comm_driver->get_interrupt_async(
+				udev, (usb_ctrl_charbuf)buf,
+				(usb_ctrl_charbufsize)r);
+		} else
+#endif	/* !SHUT_MODE */
+		buflen = comm_driver->get_interrupt(
+			udev, (usb_ctrl_charbuf)buf,
+			(usb_ctrl_charbufsize)r,
+			750);
+
+		if (buflen <= 0) {
+			/* an error stays, and is seen on the next call */
+			if (itemCount > 0)
+				break;
+			return buflen;	/* propagate "error" or "no event" code */
+		}
 
-	if (buflen <= 0) {
-		return buflen;	/* propagate "error" or "no event" code */
-	}
+		ret = file_report_buffer(reportbuf, buf, (size_t)buflen);
+		if (ret < 0) {
+			upsdebug_with_errno(1, "%s: failed to buffer report", __func__);
+			return -errno;
+		}
 
-	ret = file_report_buffer(reportbuf, buf, (size_t)buflen);
-	if (ret < 0) {
-		upsdebug_with_errno(1, "%s: failed to buffer report", __func__);
-		return -errno;
-	}
+		/* now read all items that are part of this report */
+		for (i=0; i<pDesc->nitems; i++) {
 
-	/* now read all items that are part of this report */
-	for (i=0; i<pDesc->nitems; i++) {
+			pData = &pDesc->item[i];
 
-		pData = &pDesc->item[i];
+			/* Variable not part of this report */
+			if (pData->ReportID != buf[0])
+				continue;
 
-		/* Variable not part of this report */
-		if (pData->ReportID != buf[0])
-			continue;
+			/* Not an input report */
+			if (pData->Type != ITEM_INPUT)
+				continue;
 
-		/* Not an input report */
-		if (pData->Type != ITEM_INPUT)
-			continue;
+			/* maximum number of events reached? */
+			if (itemCount >= eventsize) {
+				upsdebugx(1, "%s: too many events (truncated)", __func__);
+				break;
+			}
 
-		/* maximum number of events reached? */
-		if (itemCount >= eventsize) {
-			upsdebugx(1, "%s: too many events (truncated)", __func__);
-			break;
+			event[itemCount++] = pData;
+			reportItems++;
 		}
 
-		event[itemCount++] = pData;
-	}
+		if (reportItems == 0) {
+			upsdebugx(1, "%s: unexpected input report (ignored)", __func__);
+		}
 
-	if (itemCount == 0) {
-		upsdebugx(1, "%s: unexpected input report (ignored)", __func__);
+		if (!interrupt_async || itemCount >= eventsize)
+			break;
 	}
 
 	return itemCount;
@@ -1021,23 +1209,107 @@ static int path_to_string(char *string, size_t size, const HIDPath_t *path, usag
 	return i;
 }
 
+static size_t hid_hash_code(const HIDNode_t usage)
+{
+	/* Knuth's multiplicative hash, with the high half (where the
+	 * usage page has its effect) folded into the low bits we use */
+	uint32_t	hash = (uint32_t)usage * 2654435761U;
+
+	return (size_t)(hash ^ (hash >> 16));
+}
+
+void HIDFreeUsageIndex(void)
+{
+	free(usage_index.byname);
+	free(usage_index.bycode);
+	usage_index.byname = NULL;
+	usage_index.bycode = NULL;
+	usage_index.size = 0;
+	usage_index.utab = NULL;
+}
+
+void HIDIndexUsageTables(usage_tables_t *utab)
+{
+	size_t	count = 0, slot, mask;
+	int	i, j;
+
+	if (utab == usage_index.utab && usage_index.size) {
+		return;
+	}
+
+	HIDFreeUsageIndex();
+
+	if (!utab) {
+		return;
+	}
+
+	for (i = 0; utab[i] != NULL; i++) {
+		for (j = 0; utab[i][j].usage_name != NULL; j++) {
+			count++;
+		}
+	}
+
+	/* keep the tables at most half full */
+	for (usage_index.size = 64; usage_index.size < 2 * count; usage_index.size *= 2)
+		;
+	mask = usage_index.size - 1;
+
+	usage_index.byname = xcalloc(usage_index.size, sizeof(*usage_index.byname));
+	usage_index.bycode = xcalloc(usage_index.size, sizeof(*usage_index.bycode));
+
+	for (i = 0; utab[i] != NULL; i++) {
+		for (j = 0; utab[i][j].usage_name != NULL; j++) {
+			const usage_lkp_t	*entry = &utab[i][j];
+
+			for (slot = str_hash_ci(entry->usage_name) & mask;
+			     usage_index.byname[slot];
+			     slot = (slot + 1) & mask
+			) {
+				if (!strcasecmp(usage_index.byname[slot]->usage_name, entry->usage_name))
+					break;
+			}
+			if (!usage_index.byname[slot])
+				usage_index.byname[slot] = entry;
+
+			for (slot = hid_hash_code(entry->usage_code) & mask;
+			     usage_index.bycode[slot];
+			     slot = (slot + 1) & mask
+			) {
+				if (usage_index.bycode[slot]->usage_code == entry->usage_code)
+					break;
+			}
+			if (!usage_index.bycode[slot])
+				usage_index.bycode[slot] = entry;
+		}
+	}
+
+	usage_index.utab = utab;
+
+	upsdebugx(3, "%s: indexed %" PRIuSIZE " usages in %" PRIuSIZE " slots",
+		__func__, count, usage_index.size);
+}
+
 /* usage conversion string -> numeric
  * Returns -1 for error, or a (HIDNode_t) ranged code value
  */
 static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 {
-	int i, j;
+	size_t	slot, mask;
 
-	for (i = 0; utab[i] != NULL; i++)
-	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (strcasecmp(utab[i][j].usage_name, name))
+	HIDIndexUsageTables(utab);
+
+	if (usage_index.size) {
+		mask = usage_index.size - 1;
+		for (slot = str_hash_ci(name) & mask;
+		     usage_index.byname[slot];
+		     slot = (slot + 1) & mask
+		) {
+			if (strcasecmp(usage_index.byname[slot]->usage_name, name))
 				continue;
 
 			/* Note: currently per hidtypes.h, HIDNode_t == uint32_t */
-			upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)utab[i][j].usage_code);
-			return (long)(utab[i][j].usage_code);
+			upsdebugx(5, "hid_lookup_usage: %s -> %08x", name, (uint32_t)usage_index.byname[slot]->usage_code);
+			return (long)(usage_index.byname[slot]->usage_code);
 		}
 	}
 
@@ -1048,17 +1320,21 @@ static long hid_lookup_usage(const char *name, usage_tables_t *utab)
 /* usage conversion numeric -> string */
 static const char *hid_lookup_path(const HIDNode_t usage, usage_tables_t *utab)
 {
-	int i, j;
+	size_t	slot, mask;
 
-	for (i = 0; utab[i] != NULL; i++)
-	{
-		for (j = 0; utab[i][j].usage_name != NULL; j++)
-		{
-			if (utab[i][j].usage_code != usage)
+	HIDIndexUsageTables(utab);
+
+	if (usage_index.size) {
+		mask = usage_index.size - 1;
+		for (slot = hid_hash_code(usage) & mask;
+		     usage_index.bycode[slot];
+		     slot = (slot + 1) & mask
+		) {
+			if (usage_index.bycode[slot]->usage_code != usage)
 				continue;
 
-			upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, utab[i][j].usage_name);
-			return utab[i][j].usage_name;
+			upsdebugx(5, "hid_lookup_path: %08x -> %s", (unsigned int)usage, usage_index.bycode[slot]->usage_name);
+			return usage_index.bycode[slot]->usage_name;
 		}
 	}
 
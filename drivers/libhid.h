@@ -92,16 +92,38 @@ extern HIDDesc_t	*pDesc;	/* parsed Report Descriptor */
 /* report buffer structure: holds data about most recent report for
    each given report id */
 typedef struct reportbuf_s {
-	time_t	ts[256];			/* timestamp when report was retrieved */
+	double	ts[256];			/* monotonic time when report was retrieved, 0 if expired */
 	size_t	len[256];			/* size of report data */
 	unsigned char	*data[256];		/* report data (allocated) */
+	size_t	hash[256];			/* hash of report data, to tell if they changed */
+	unsigned int	steady[256];		/* refreshes in a row which got the same data */
+	unsigned int	defer[256];		/* walks to defer the next refresh by */
+	unsigned int	deferred[256];		/* walks still to defer it by */
+	unsigned char	pinned[256];		/* never defer (HID_REPORT_VOLATILE) */
 } reportbuf_t;
 
 extern reportbuf_t	*reportbuf;	/* buffer for most recent reports */
 
+/* report buffer statistics, for the driver.report.* diagnostics */
+typedef struct hid_report_stats_s {
+	uintmax_t	hits;		/* reads served from the report buffer */
+	uintmax_t	misses;		/* reports retrieved from the device */
+	uintmax_t	transfers;	/* control transfers (get or set report) */
+	uintmax_t	interrupts;	/* reports received on interrupt pipe */
+	uintmax_t	deferred;	/* refreshes deferred to a later walk */
+} hid_report_stats_t;
+
+extern hid_report_stats_t	hid_report_stats;
+
+/* flags of each report ID in the plan given to HIDPrefetchReports() */
+#define HID_REPORT_READ		0x01	/* read by the walk */
+#define HID_REPORT_VOLATILE	0x02	/* holds status or alarms: never defer */
+
 extern size_t max_report_size;
 extern int interrupt_only;
 extern size_t interrupt_size;
+extern int interrupt_async;	/* use comm_driver->get_interrupt_async() */
+extern unsigned int report_backoff;	/* max walks to defer steady reports by */
 
 /* ---------------------------------------------------------------------- */
 
@@ -135,6 +157,15 @@ char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab);
  * -------------------------------------------------------------------------- */
 int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, time_t age);
 
+/*
+ * HIDPrefetchReports
+ * Retrieve the reports flagged in plan[] (indexed by report ID) which
+ * are older than age seconds, before a walk reads their items.
+ * Return the number of reports retrieved, or -errno on a failure which
+ * calls for a reconnect (reports which fail otherwise are skipped).
+ * -------------------------------------------------------------------------- */
+int HIDPrefetchReports(hid_dev_handle_t udev, const unsigned char *plan, time_t age);
+
 /*
  * HIDSetDataValue
  * -------------------------------------------------------------------------- */
@@ -156,6 +187,11 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventlen);
 void HIDDumpTree(hid_dev_handle_t udev, HIDDevice_t *hd, usage_tables_t *utab);
 const char *HIDDataType(const HIDData_t *hiddata);
 
+/* Index the usage tables for the name <-> code conversions of HID paths
+ * (built on first use otherwise), and drop that index when done */
+void HIDIndexUsageTables(usage_tables_t *utab);
+void HIDFreeUsageIndex(void);
+
 void free_report_buffer(reportbuf_t *rbuf);
 reportbuf_t *new_report_buffer(HIDDesc_t *pDesc);
 
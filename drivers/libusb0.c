@@ -1023,5 +1023,6 @@ usb_communication_subdriver_t usb_subdriver = {
 	LIBUSB_DEFAULT_INTERFACE,
 	LIBUSB_DEFAULT_DESC_INDEX,
 	LIBUSB_DEFAULT_HID_EP_IN,
-	LIBUSB_DEFAULT_HID_EP_OUT
+	LIBUSB_DEFAULT_HID_EP_OUT,
+	NULL	/* get_interrupt_async: not with libusb 0.1 */
 };
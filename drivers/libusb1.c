@@ -32,6 +32,10 @@
 #include "nut_libusb.h"
 #include "nut_stdint.h"
 
+#ifndef WIN32
+# include <poll.h>	/* for the events of libusb_pollfd */
+#endif
+
 #define USB_DRIVER_NAME		"USB communication driver (libusb 1.0)"
 #define USB_DRIVER_VERSION	"0.50"
 
@@ -1116,12 +1120,308 @@ static int nut_libusb_get_interrupt(
 	return nut_libusb_strerror(ret, __func__);
 }
 
+#ifndef WIN32
+/* An interrupt transfer kept queued for nut_libusb_get_interrupt_async():
+ * the reports it gets wait in a small ring for the driver, which is woken
+ * up by dstate_poll_fds() watching the descriptors of libusb. A failure
+ * is kept until the driver asks for the next report, which clears a stall
+ * or else gets the failure (once) and starts over with the call after. */
+#define ASYNC_REPORTS_MAX	8
+
+/* libusb_free_pollfds() came with libusb 1.0.20 */
+#if (defined LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+# define nut_libusb_free_pollfds(pollfds)	libusb_free_pollfds(pollfds)
+#else
+# define nut_libusb_free_pollfds(pollfds)	free((void *)(pollfds))
+#endif
+
+static struct libusb_transfer	*async_transfer = NULL;
+static libusb_device_handle	*async_udev = NULL;
+static int	async_active = 0, async_error = LIBUSB_SUCCESS;
+static unsigned char	*async_reports[ASYNC_REPORTS_MAX];
+static int	async_lengths[ASYNC_REPORTS_MAX];
+static size_t	async_first = 0, async_count = 0, async_size = 0;
+
+static void LIBUSB_CALL nut_libusb_async_done(struct libusb_transfer *transfer)
+{
+	size_t	i;
+	int	ret;
+
+	async_active = 0;
+
+	switch (transfer->status)
+	{
+	case LIBUSB_TRANSFER_COMPLETED:
+		if (transfer->actual_length <= 0) {
+			break;
+		}
+
+		if (async_count == ASYNC_REPORTS_MAX) {
+			/* the driver did not keep up: drop the oldest */
+			upsdebugx(1, "%s: too many reports waiting, dropped one", __func__);
+			async_first = (async_first + 1) % ASYNC_REPORTS_MAX;
+			async_count--;
+		}
+
+		i = (async_first + async_count) % ASYNC_REPORTS_MAX;
+		memcpy(async_reports[i], transfer->buffer, (size_t)transfer->actual_length);
+		async_lengths[i] = transfer->actual_length;
+		async_count++;
+		break;
+
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		break;
+
+	case LIBUSB_TRANSFER_CANCELLED:
+		return;
+
+	case LIBUSB_TRANSFER_STALL:
+		/* cleared outside of the callback, see below */
+		async_error = LIBUSB_ERROR_PIPE;
+		return;
+
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		async_error = LIBUSB_ERROR_NO_DEVICE;
+		return;
+
+	case LIBUSB_TRANSFER_OVERFLOW:
+		upsdebugx(2, "%s: %s", __func__, libusb_strerror(LIBUSB_ERROR_OVERFLOW));
+		break;
+
+	case LIBUSB_TRANSFER_ERROR:
+	default:
+		async_error = LIBUSB_ERROR_IO;
+		return;
+	}
+
+	/* and wait for the next one */
+	ret = libusb_submit_transfer(transfer);
+	if (ret < 0) {
+		async_error = ret;
+		return;
+	}
+	async_active = 1;
+}
+
+/* called by dstate_poll_fds() when a descriptor of libusb is ready, or
+ * with ERROR_FD before waiting: wake the driver up for reports (and for
+ * errors, to reconnect) */
+static int nut_libusb_async_events(TYPE_FD fd)
+{
+	struct timeval	tv = { 0, 0 };
+
+	if (VALID_FD(fd)) {
+		libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+	}
+
+	return (async_count > 0 || async_error != LIBUSB_SUCCESS);
+}
+
+static int nut_libusb_async_pollfd_events(short events)
+{
+	return ((events & POLLIN) ? DSTATE_POLL_READ : 0)
+		| ((events & POLLOUT) ? DSTATE_POLL_WRITE : 0);
+}
+
+static void LIBUSB_CALL nut_libusb_async_pollfd_added(int fd, short events, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+	dstate_poll_fd_add(fd, nut_libusb_async_pollfd_events(events), nut_libusb_async_events);
+}
+
+static void LIBUSB_CALL nut_libusb_async_pollfd_removed(int fd, void *user_data)
+{
+	NUT_UNUSED_VARIABLE(user_data);
+	dstate_poll_fd_remove(fd);
+}
+
+/* set up the queued transfer and the watching of the descriptors of
+ * libusb; timeouts are not watched for, as the transfer has none */
+static int nut_libusb_async_start(libusb_device_handle *udev, size_t size)
+{
+	const struct libusb_pollfd	**pollfds;
+	size_t	i;
+	int	ret;
+
+	pollfds = libusb_get_pollfds(NULL);
+	if (!pollfds) {
+		upslogx(LOG_WARNING, "%s: libusb can not tell which descriptors to watch here", __func__);
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+
+	for (i = 0; pollfds[i]; i++) {
+		if (dstate_poll_fd_add(pollfds[i]->fd,
+			nut_libusb_async_pollfd_events(pollfds[i]->events),
+			nut_libusb_async_events) < 0
+		) {
+			nut_libusb_free_pollfds(pollfds);
+			return LIBUSB_ERROR_NOT_SUPPORTED;
+		}
+	}
+	nut_libusb_free_pollfds(pollfds);
+	libusb_set_pollfd_notifiers(NULL, nut_libusb_async_pollfd_added,
+		nut_libusb_async_pollfd_removed, NULL);
+
+	async_transfer = libusb_alloc_transfer(0);
+	if (!async_transfer) {
+		return LIBUSB_ERROR_NO_MEM;
+	}
+
+	async_size = size;
+	for (i = 0; i < ASYNC_REPORTS_MAX; i++) {
+		async_reports[i] = xcalloc(1, async_size);
+	}
+
+	libusb_fill_interrupt_transfer(async_transfer, udev,
+		(unsigned char)(LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in),
+		xcalloc(1, async_size), (int)async_size,
+		nut_libusb_async_done, NULL, 0);
+	async_transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+	async_udev = udev;
+	async_first = async_count = 0;
+	async_error = LIBUSB_SUCCESS;
+
+	ret = libusb_submit_transfer(async_transfer);
+	if (ret < 0) {
+		return ret;
+	}
+	async_active = 1;
+
+	upsdebugx(2, "%s: interrupt transfer queued, for up to %" PRIuSIZE " bytes",
+		__func__, async_size);
+	return LIBUSB_SUCCESS;
+}
+
+static void nut_libusb_async_stop(void)
+{
+	const struct libusb_pollfd	**pollfds;
+	struct timeval	tv = { 1, 0 };
+	size_t	i;
+	int	tries;
+
+	if (async_transfer) {
+		if (async_active && libusb_cancel_transfer(async_transfer) == LIBUSB_SUCCESS) {
+			for (tries = 0; async_active && tries < 5; tries++) {
+				libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+			}
+		}
+
+		if (async_active) {
+			/* libusb still has it: better leak than free */
+			upsdebugx(1, "%s: interrupt transfer could not be cancelled", __func__);
+		} else {
+			libusb_free_transfer(async_transfer);
+		}
+		async_transfer = NULL;
+		async_active = 0;
+	}
+
+	libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+	pollfds = libusb_get_pollfds(NULL);
+	if (pollfds) {
+		for (i = 0; pollfds[i]; i++) {
+			dstate_poll_fd_remove(pollfds[i]->fd);
+		}
+		nut_libusb_free_pollfds(pollfds);
+	}
+
+	for (i = 0; i < ASYNC_REPORTS_MAX; i++) {
+		free(async_reports[i]);
+		async_reports[i] = NULL;
+	}
+
+	async_udev = NULL;
+	async_first = async_count = async_size = 0;
+	async_error = LIBUSB_SUCCESS;
+}
+
+/* Expected evaluated types for the API:
+ * static int nut_libusb_get_interrupt_async(libusb_device_handle *udev,
+ *	unsigned char *buf, int bufsize)
+ */
+static int nut_libusb_get_interrupt_async(
+	libusb_device_handle *udev,
+	usb_ctrl_charbuf buf,
+	usb_ctrl_charbufsize bufsize)
+{
+	int	ret;
+
+	if (!udev || !bufsize) {
+		return -1;
+	}
+
+	if (udev != async_udev) {
+		if (async_udev) {
+			nut_libusb_async_stop();
+		}
+
+		/* the first call queues the transfer */
+		ret = nut_libusb_async_start(udev, (size_t)bufsize);
+		if (ret != LIBUSB_SUCCESS) {
+			nut_libusb_async_stop();
+			return nut_libusb_strerror(ret, __func__);
+		}
+	}
+
+	/* pick up what came meanwhile */
+	if (!async_count) {
+		struct timeval	tv = { 0, 0 };
+		libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+	}
+
+	if (async_count > 0) {
+		size_t	i = async_first, len = (size_t)async_lengths[i];
+
+		if (len > (size_t)bufsize) {
+			len = (size_t)bufsize;
+		}
+		memcpy(buf, async_reports[i], len);
+		async_first = (async_first + 1) % ASYNC_REPORTS_MAX;
+		async_count--;
+
+		return (int)len;
+	}
+
+	if (async_error == LIBUSB_ERROR_PIPE) {
+		/* clear the stall, and queue the transfer again */
+		async_error = LIBUSB_SUCCESS;
+		ret = libusb_clear_halt(udev, (unsigned char)(LIBUSB_ENDPOINT_IN + usb_subdriver.hid_ep_in));
+		if (ret == LIBUSB_SUCCESS) {
+			ret = libusb_submit_transfer(async_transfer);
+		}
+		if (ret < 0) {
+			async_error = ret;
+		} else {
+			async_active = 1;
+		}
+	}
+
+	if (async_error != LIBUSB_SUCCESS) {
+		/* with no transfer queued, the failure would keep waking the
+		 * driver up (if it is not one to reconnect for): stop, and
+		 * queue a new transfer in the next call */
+		ret = async_error;
+		nut_libusb_async_stop();
+		return nut_libusb_strerror(ret, __func__);
+	}
+
+	/* no report yet */
+	return 0;
+}
+#endif	/* !WIN32 */
+
 static void nut_libusb_close(libusb_device_handle *udev)
 {
 	if (!udev) {
 		return;
 	}
 
+#ifndef WIN32
+	if (udev == async_udev) {
+		nut_libusb_async_stop();
+	}
+#endif	/* !WIN32 */
+
 	/* usb_release_interface() sometimes blocks and goes
 	 * into uninterruptible sleep.  So don't do it.
 	 */
@@ -1143,5 +1443,10 @@ usb_communication_subdriver_t usb_subdriver = {
 	LIBUSB_DEFAULT_INTERFACE,
 	LIBUSB_DEFAULT_DESC_INDEX,
 	LIBUSB_DEFAULT_HID_EP_IN,
-	LIBUSB_DEFAULT_HID_EP_OUT
+	LIBUSB_DEFAULT_HID_EP_OUT,
+#ifndef WIN32
+	nut_libusb_get_interrupt_async
+#else
+	NULL
+#endif
 };
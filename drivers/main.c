@@ -772,6 +772,131 @@ void addvar(int vartype, const char *name, const char *desc)
 	do_addvar(vartype, name, desc, 0);
 }
 
+/* spread the refreshes of a class by up to this share of its interval,
+ * so that drivers started together do not read their slow data at once */
+#define REFRESH_JITTER	0.1
+
+static struct {
+	double	interval;	/* seconds between refreshes, 0: each update, <0: never */
+	double	deadline;	/* when the next refresh is due (monotonic time) */
+	int	due;		/* whether it is due in the current update */
+} refresh_classes[REFRESH_CLASSES] = {
+	{ 0, 0, 1 },	/* REFRESH_STATUS */
+	{ 0, 0, 1 },	/* REFRESH_FAST */
+	{ 0, 0, 1 },	/* REFRESH_SLOW */
+	{ -1, 0, 0 }	/* REFRESH_STATIC */
+};
+
+/* start of the current update, and how many refreshes began later than
+ * a poll interval past their deadline (published as driver.update.late) */
+static double	refresh_now = 0;
+static uintmax_t	refresh_late = 0;
+static uint32_t	refresh_seed = 0;
+
+static double refresh_clock(void)
+{
+	st_tree_timespec_t	now;
+
+	state_get_timestamp(&now);
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+#else
+	return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+#endif
+}
+
+/* a random share (up to REFRESH_JITTER) of the interval */
+static double refresh_jitter(double interval)
+{
+	if (!refresh_seed) {
+		refresh_seed = (uint32_t)(refresh_clock() * 1000000.0) | 1;
+	}
+
+	/* xorshift32 */
+	refresh_seed ^= refresh_seed << 13;
+	refresh_seed ^= refresh_seed >> 17;
+	refresh_seed ^= refresh_seed << 5;
+
+	return interval * REFRESH_JITTER * ((double)refresh_seed / 4294967296.0);
+}
+
+void refresh_set_interval(refresh_class_t rc, double interval)
+{
+	if ((unsigned int)rc >= REFRESH_CLASSES)
+		return;
+
+	refresh_classes[rc].interval = interval;
+	refresh_classes[rc].deadline = refresh_clock() + interval;
+	refresh_classes[rc].due = !(interval < 0) && !(interval > 0);
+
+	upsdebugx(2, "%s: class %d every %.3f seconds", __func__, (int)rc, interval);
+
+	if (interval > 0) {
+		dstate_setinfo("driver.update.late", "%" PRIuMAX, refresh_late);
+	}
+}
+
+void refresh_request(refresh_class_t rc)
+{
+	if ((unsigned int)rc >= REFRESH_CLASSES || refresh_classes[rc].interval < 0)
+		return;
+
+	refresh_classes[rc].deadline = refresh_clock();
+	refresh_classes[rc].due = 1;
+}
+
+int refresh_due(refresh_class_t rc)
+{
+	if ((unsigned int)rc >= REFRESH_CLASSES)
+		return 0;
+
+	return refresh_classes[rc].due;
+}
+
+void refresh_done(refresh_class_t rc)
+{
+	double	late;
+
+	if ((unsigned int)rc >= REFRESH_CLASSES || !(refresh_classes[rc].interval > 0))
+		return;
+
+	late = refresh_now - refresh_classes[rc].deadline;
+	if (late > (double)poll_interval) {
+		refresh_late++;
+		upsdebugx(1, "%s: class %d refreshed %.3f seconds past its deadline",
+			__func__, (int)rc, late);
+		dstate_setinfo("driver.update.late", "%" PRIuMAX, refresh_late);
+	}
+
+	refresh_classes[rc].deadline = refresh_now + refresh_classes[rc].interval
+		- refresh_jitter(refresh_classes[rc].interval);
+	refresh_classes[rc].due = 0;
+}
+
+/* work out which classes are due in the update about to begin: those
+ * whose deadline is closer than half a poll interval, so that refreshes
+ * happen in the update nearest to their deadline rather than after it */
+# ifndef DRIVERS_MAIN_WITHOUT_MAIN
+static
+# endif /* DRIVERS_MAIN_WITHOUT_MAIN */
+void refresh_begin(void)
+{
+	size_t	i;
+
+	refresh_now = refresh_clock();
+
+	for (i = 0; i < REFRESH_CLASSES; i++) {
+		if (refresh_classes[i].interval < 0) {
+			refresh_classes[i].due = 0;
+		} else if (!(refresh_classes[i].interval > 0)) {
+			refresh_classes[i].due = 1;
+		} else {
+			refresh_classes[i].due = (refresh_now
+				>= refresh_classes[i].deadline - (double)poll_interval / 2.0);
+		}
+	}
+}
+
 /* Try each instant command in the comma-separated list of
  * sdcmds, until the first one that reports it was handled.
  * Returns STAT_INSTCMD_HANDLED if one of those was accepted
@@ -2873,6 +2998,7 @@ int main(int argc, char **argv)
 	/* Note: a few drivers also call their upsdrv_updateinfo() during
 	 * their upsdrv_initinfo(), possibly to impact the initialization */
 	dstate_setinfo("driver.state", "init.updateinfo");
+	refresh_begin();
 	upsdrv_updateinfo();
 	dstate_setinfo("driver.state", "init.quiet");
 
@@ -3097,6 +3223,7 @@ sockname_ownership_finished:
 		timeout.tv_sec += poll_interval;
 
 		dstate_setinfo("driver.state", "updateinfo");
+		refresh_begin();
 		upsdrv_updateinfo();
 		dstate_setinfo("driver.state", "quiet");
 
@@ -29,6 +29,29 @@ void upsdrv_cleanup(void);	/* free any resources before shutdown */
 
 void set_exit_flag(int sig);
 
+/* --- refresh classes of the polled data --- */
+
+/* The driver core schedules the refresh of each class of data at its own
+ * cadence: upsdrv_updateinfo() reads the classes which refresh_due() says
+ * are due in this update, and calls refresh_done() for those it did read
+ * (so a failed refresh is tried again in the next update).
+ */
+typedef enum {
+	REFRESH_STATUS = 0,	/* status and alarms: each update */
+	REFRESH_FAST,		/* fast-changing metrics: each update by default */
+	REFRESH_SLOW,		/* slow metrics: e.g. each "pollfreq" seconds */
+	REFRESH_STATIC,		/* static data: never after initinfo by default */
+	REFRESH_CLASSES		/* (count of the classes) */
+} refresh_class_t;
+
+/* set the seconds between refreshes of a class (0: each update, <0: never);
+ * the next one is due that long from now */
+void refresh_set_interval(refresh_class_t rc, double interval);
+/* make a class due in the next update (unless it is never refreshed) */
+void refresh_request(refresh_class_t rc);
+int refresh_due(refresh_class_t rc);
+void refresh_done(refresh_class_t rc);
+
 /* --- details for the variable/value sharing --- */
 
 /* Try each instant command in the comma-separated list of
@@ -154,6 +177,7 @@ void dparam_setinfo(const char *var, const char *val);
 void storeval(const char *var, char *val);
 void vartab_free(void);
 void setup_signals(void);
+void refresh_begin(void);
 #endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 
 #ifndef WIN32
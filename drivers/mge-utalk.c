@@ -968,8 +968,9 @@ static ssize_t mge_command(char *reply, size_t replylen, const char *fmt, ...)
 	 * http://old.networkupstools.org/protocols/mge/9261zwfa.pdf § 6.1. Timings */
 	usleep(500000);
 
-	/* flush received, unread data */
-	tcflush(upsfd, TCIFLUSH);
+	/* flush received, unread data (also what serial.c kept of the
+	 * previous answer) */
+	ser_flush_in(upsfd, "", 0);
 
 	/* send command */
 	for (p = command; *p; p++) {
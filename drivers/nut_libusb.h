@@ -114,6 +114,14 @@ typedef struct usb_communication_subdriver_s {
 	usb_ctrl_descindex hid_desc_index;		/* HID descriptor is at this index (non-trivial for composite USB devices); see comments above */
 	usb_ctrl_endpoint hid_ep_in;			/* Input interrupt endpoint. Default is 1	*/
 	usb_ctrl_endpoint hid_ep_out;			/* Output interrupt endpoint. Default is 1	*/
+
+	/* Like get_interrupt, but with a transfer kept queued on the
+	 * interrupt endpoint from the first call on, whose completion wakes
+	 * up dstate_poll_fds(): does not wait, but returns the size of a
+	 * report received meanwhile, 0 if there is none, or an error code.
+	 * NULL where it is not supported (libusb 0.1, WIN32). */
+	int (*get_interrupt_async)(usb_dev_handle *sdev,
+		usb_ctrl_charbuf buf, usb_ctrl_charbufsize bufsize);
 } usb_communication_subdriver_t;
 
 extern usb_communication_subdriver_t	usb_subdriver;
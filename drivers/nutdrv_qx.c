@@ -147,8 +147,6 @@ static long	pollfreq = DEFAULT_POLLFREQ;
 static unsigned int	ups_status = 0;
 static bool_t	data_has_changed = FALSE;	/* for SEMI_STATIC data polling */
 
-static time_t	lastpoll;	/* Timestamp the last polling */
-
 #if defined(QX_USB) && !defined(TESTING)
 static int	hunnox_step = 0;
 #endif	/* QX_USB && !TESTING */
@@ -157,10 +155,27 @@ static int	hunnox_step = 0;
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
 #endif	/* QX_USB && QX_SERIAL */
 
-static struct {
-	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
-	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
+/* == Command plan == */
+/* Each distinct command sent to the UPS to get the data of qx2nut items
+ * (with the functions preprocessing it and its answer), so that a walk
+ * sends it only once, whatever the order of the items using it */
+typedef struct {
+	const char	*command;
+	int	(*preprocess_command)(item_t *item, char *command, const size_t commandlen);
+	int	(*preprocess_answer)(item_t *item, const int len);
+	int	state;			/* QX_QUERY_* in the current walk */
+	char	answer[SMALLBUF];	/* Answer from the UPS, if QX_QUERY_ANSWERED */
+} qx_query_t;
+
+#define QX_QUERY_UNSENT		0
+#define QX_QUERY_ANSWERED	1
+#define QX_QUERY_FAILED		2
+
+static qx_query_t	*qx_queries = NULL;	/* Distinct commands of the qx2nut table */
+static size_t	qx_queries_count = 0;
+static size_t	*qx_item_query = NULL;	/* Index in qx_queries of each qx2nut item, qx_queries_count if none */
+static item_t	**qx_plan[QX_WALKMODE_FULL_UPDATE + 1];	/* Items each update walk may read, NULL-terminated (none for QX_WALKMODE_INIT) */
+static size_t	qx_requests = 0;	/* Commands sent to the UPS in the current walk */
 
 
 /* == Support functions == */
@@ -168,6 +183,9 @@ static int	subdriver_matcher(void);
 static ssize_t	qx_command(const char *cmd, char *buf, size_t buflen);
 static int	qx_process_answer(item_t *item, const size_t len); /* returns just 0 or -1 */
 static bool_t	qx_ups_walk(walkmode_t mode);
+static void	qx_plan_compile(void);
+static void	qx_plan_free(void);
+static int	qx_query(item_t *item, walkmode_t mode);
 static void	ups_status_set(void);
 static void	ups_alarm_set(void);
 static void	qx_set_var(item_t *item);
@@ -3148,20 +3166,17 @@ void	upsdrv_makevartable(void)
 /* Update UPS status/infos */
 void	upsdrv_updateinfo(void)
 {
-	time_t		now;
 	static int	retry = 0;
 
 	upsdebugx(1, "%s...", __func__);
 
-	time(&now);
-
 	/* Clear status buffer before beginning */
 	status_init();
 	buzzmode_init();
 
-	/* Do a full update (polling) every pollfreq or upon data change
-	 * (i.e. setvar/instcmd) */
-	if ((now > (lastpoll + pollfreq)) || (data_has_changed == TRUE)) {
+	/* Do a full update (polling) when the driver core says the slow data
+	 * are due (every pollfreq) or upon data change (i.e. setvar/instcmd) */
+	if (refresh_due(REFRESH_SLOW) || (data_has_changed == TRUE)) {
 
 		upsdebugx(1, "Full update...");
 
@@ -3183,7 +3198,7 @@ void	upsdrv_updateinfo(void)
 			return;
 		}
 
-		lastpoll = now;
+		refresh_done(REFRESH_SLOW);
 		data_has_changed = FALSE;
 
 		ups_alarm_set();
@@ -3282,7 +3297,7 @@ void	upsdrv_initinfo(void)
 
 	dstate_setinfo("driver.parameter.pollfreq", "%ld", pollfreq);
 
-	time(&lastpoll);
+	refresh_set_interval(REFRESH_SLOW, (double)pollfreq);
 
 	/* Install handlers */
 	upsh.setvar = setvar;
@@ -3617,6 +3632,7 @@ void	upsdrv_cleanup(void)
 
 #endif	/* TESTING */
 
+	qx_plan_free();
 }
 
 
@@ -4026,8 +4042,12 @@ static void	qx_set_var(item_t *item)
 /* Walk UPS variables and set elements of the qx2nut array. */
 static bool_t	qx_ups_walk(walkmode_t mode)
 {
-	item_t	*item;
+	item_t	*item, **planned;
 	int	retcode;
+	size_t	i;
+	struct timeval	start, now;
+
+	gettimeofday(&start, NULL);
 
 	/* Clear batt.{chrg,runt}.act for guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE) {
@@ -4036,15 +4056,27 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		battery_voltage_reports_one_pack_considered = 0;
 	}
 
-	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
-	memset(previous_item.answer, 0, sizeof(previous_item.answer));
+	/* No command has been sent yet in this walk */
+	if (!qx_queries) {
+		qx_plan_compile();
+	}
+	for (i = 0; i < qx_queries_count; i++) {
+		qx_queries[i].state = QX_QUERY_UNSENT;
+	}
+	qx_requests = 0;
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE
 	 *      and QX_WALKMODE_FULL_UPDATE */
 
+	/* Updates only go through the items they may read (in table order) */
+	planned = (mode == QX_WALKMODE_INIT) ? NULL : qx_plan[mode];
+
 	/* Device data walk */
-	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+	for (i = 0; ; i++) {
+
+		item = planned ? planned[i] : &subdriver->qx2nut[i];
+		if (item == NULL || item->info_type == NULL)
+			break;
 
 		/* Skip this item */
 		if (item->qxflags & QX_FLAG_SKIP)
@@ -4157,31 +4189,8 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Check whether the previous item uses the same command
-		 * and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0
-		&&  strlen(previous_item.answer) > 0
-		&&  !strcasecmp(previous_item.command, item->command)
-		) {
-
-			snprintf(item->answer, sizeof(item->answer), "%s",
-				previous_item.answer);
-
-			/* Process the answer */
-			retcode = qx_process_answer(item, strlen(item->answer));
-
-		/* ..otherwise: execute command to get answer from the UPS */
-		} else {
-
-			retcode = qx_process(item, NULL);
-
-		}
-
-		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s",
-			item->command);
-		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s",
-			item->answer);
+		/* Get the answer to the command of this item */
+		retcode = qx_query(item, mode);
 
 		if (retcode) {
 
@@ -4227,6 +4236,15 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 	}
 
+	upsdebugx(1, "%s: sent %" PRIuSIZE " commands to the UPS", __func__, qx_requests);
+
+	if (mode != QX_WALKMODE_INIT) {
+		/* Diagnostics of the update cycle */
+		gettimeofday(&now, NULL);
+		dstate_setinfo("driver.update.duration", "%.3f", difftimeval(now, start));
+		dstate_setinfo("driver.update.requests", "%" PRIuSIZE, qx_requests);
+	}
+
 	/* Update battery guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE
 	&&  (d_equal(batt.runt.act, -1) || d_equal(batt.chrg.act, -1))
@@ -4319,6 +4337,147 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 	return TRUE;
 }
 
+/* Whether the item is read by walks in the given (update) mode.
+ * Only the flags of the table count: QX_FLAG_SKIP may still be cleared
+ * by subdrivers at runtime, so it is checked by the walk itself. */
+static int	qx_plan_wants(const item_t *item, walkmode_t mode)
+{
+	switch (mode)
+	{
+	case QX_WALKMODE_QUICK_UPDATE:
+		return (item->qxflags & QX_FLAG_QUICK_POLL) != 0;
+
+	case QX_WALKMODE_FULL_UPDATE:
+		/* QX_FLAG_SEMI_STATIC items are sorted out during the walk */
+		return !(item->qxflags & (QX_FLAG_ABSENT | QX_FLAG_CMD | QX_FLAG_SETVAR | QX_FLAG_STATIC));
+
+	case QX_WALKMODE_INIT:
+	default:
+		return 1;
+	}
+}
+
+/* Compile the qx2nut table of the subdriver into the distinct commands
+ * its items send and the list of items each update walk may read */
+static void	qx_plan_compile(void)
+{
+	item_t	*item;
+	size_t	i, q, count = 0, planned[QX_WALKMODE_FULL_UPDATE + 1];
+	int	mode;
+
+	qx_plan_free();
+
+	for (item = subdriver->qx2nut; item->info_type != NULL; item++) {
+		count++;
+	}
+
+	qx_queries = xcalloc(count + 1, sizeof(*qx_queries));
+	qx_item_query = xcalloc(count + 1, sizeof(*qx_item_query));
+	for (mode = QX_WALKMODE_QUICK_UPDATE; mode <= QX_WALKMODE_FULL_UPDATE; mode++) {
+		qx_plan[mode] = xcalloc(count + 1, sizeof(*qx_plan[mode]));
+		planned[mode] = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		item = &subdriver->qx2nut[i];
+
+		for (mode = QX_WALKMODE_QUICK_UPDATE; mode <= QX_WALKMODE_FULL_UPDATE; mode++) {
+			if (qx_plan_wants(item, (walkmode_t)mode))
+				qx_plan[mode][planned[mode]++] = item;
+		}
+
+		/* Instant commands and setvars send their commands on demand */
+		if (!item->command || (item->qxflags & (QX_FLAG_ABSENT | QX_FLAG_CMD | QX_FLAG_SETVAR))) {
+			qx_item_query[i] = count;
+			continue;
+		}
+
+		for (q = 0; q < qx_queries_count; q++) {
+			if (!strcasecmp(qx_queries[q].command, item->command)
+			&&  qx_queries[q].preprocess_command == item->preprocess_command
+			&&  qx_queries[q].preprocess_answer == item->preprocess_answer
+			) {
+				break;
+			}
+		}
+
+		if (q == qx_queries_count) {
+			qx_queries[q].command = item->command;
+			qx_queries[q].preprocess_command = item->preprocess_command;
+			qx_queries[q].preprocess_answer = item->preprocess_answer;
+			qx_queries_count++;
+		}
+
+		qx_item_query[i] = q;
+	}
+
+	upsdebugx(2, "%s: %" PRIuSIZE " items, %" PRIuSIZE " distinct commands, "
+		"%" PRIuSIZE " items in quick updates, %" PRIuSIZE " in full updates",
+		__func__, count, qx_queries_count,
+		planned[QX_WALKMODE_QUICK_UPDATE], planned[QX_WALKMODE_FULL_UPDATE]);
+}
+
+static void	qx_plan_free(void)
+{
+	int	mode;
+
+	free(qx_queries);
+	qx_queries = NULL;
+	qx_queries_count = 0;
+
+	free(qx_item_query);
+	qx_item_query = NULL;
+
+	for (mode = QX_WALKMODE_INIT; mode <= QX_WALKMODE_FULL_UPDATE; mode++) {
+		free(qx_plan[mode]);
+		qx_plan[mode] = NULL;
+	}
+}
+
+/* Get the answer to the command of the item and process it, sending the
+ * command to the UPS only if no other item did so yet in the current walk.
+ * A command which failed in an update walk is not sent again until the
+ * next one; in the init walk each item tries it, as it would be skipped
+ * from then on.
+ * Return -1 on errors, 0 on success (like qx_process()). */
+static int	qx_query(item_t *item, walkmode_t mode)
+{
+	qx_query_t	*query = NULL;
+	size_t	i = (size_t)(item - subdriver->qx2nut);
+	int	ret;
+
+	if (qx_item_query && qx_item_query[i] < qx_queries_count) {
+		query = &qx_queries[qx_item_query[i]];
+	}
+
+	if (query && query->state == QX_QUERY_ANSWERED) {
+		snprintf(item->answer, sizeof(item->answer), "%s", query->answer);
+		return qx_process_answer(item, strlen(item->answer));
+	}
+
+	if (query && query->state == QX_QUERY_FAILED) {
+		upsdebugx(4, "%s: %s - no answer to its command in this walk",
+			__func__, item->info_type);
+		memset(item->answer, 0, sizeof(item->answer));
+		return -1;
+	}
+
+	qx_requests++;
+	ret = qx_process(item, NULL);
+
+	if (!query)
+		return ret;
+
+	if (strlen(item->answer) > 0) {
+		query->state = QX_QUERY_ANSWERED;
+		snprintf(query->answer, sizeof(query->answer), "%s", item->answer);
+	} else if (mode != QX_WALKMODE_INIT) {
+		query->state = QX_QUERY_FAILED;
+	}
+
+	return ret;
+}
+
 /* Convert the local status information to NUT format and set NUT alarms. */
 static void	ups_alarm_set(void)
 {
@@ -41,6 +41,120 @@
 
 	static unsigned int	comm_failures = 0;
 
+/* Bytes received on a serial port but not consumed yet by the reading
+ * functions below (e.g. what came after the end of a line, or the next
+ * replies to pipelined queries), kept for the next call rather than
+ * lost. Replies are framed from contiguous bytes: unread bytes are moved
+ * to the start of the buffer when more room is needed at its end. */
+#define SER_RBUF_SIZE	512	/* largest reply ser_get_frame() can frame */
+#define SER_RBUF_MAX	4	/* ports with unread bytes at a time */
+
+typedef struct {
+	TYPE_FD_SER	fd;
+	size_t	start, len;		/* unread bytes: data[start .. start+len-1] */
+	unsigned char	data[SER_RBUF_SIZE];
+} ser_rbuf_t;
+
+static ser_rbuf_t	ser_rbufs[SER_RBUF_MAX];
+
+/* the buffer holding unread bytes of the port, if any */
+static ser_rbuf_t *ser_rbuf_find(TYPE_FD_SER fd)
+{
+	size_t	i;
+
+	for (i = 0; i < SER_RBUF_MAX; i++) {
+		if (ser_rbufs[i].len > 0 && ser_rbufs[i].fd == fd)
+			return &ser_rbufs[i];
+	}
+
+	return NULL;
+}
+
+/* a buffer to read bytes of the port into */
+static ser_rbuf_t *ser_rbuf_get(TYPE_FD_SER fd)
+{
+	static size_t	evict = 0;
+	ser_rbuf_t	*rb = ser_rbuf_find(fd);
+	size_t	i;
+
+	if (rb)
+		return rb;
+
+	for (i = 0; i < SER_RBUF_MAX; i++) {
+		if (ser_rbufs[i].len == 0) {
+			rb = &ser_rbufs[i];
+			break;
+		}
+	}
+
+	if (!rb) {
+		/* should not happen with the usual one port per driver */
+		rb = &ser_rbufs[evict++ % SER_RBUF_MAX];
+		upsdebugx(1, "%s: dropping %" PRIuSIZE " unread bytes of another port",
+			__func__, rb->len);
+	}
+
+	rb->fd = fd;
+	rb->start = 0;
+	rb->len = 0;
+
+	return rb;
+}
+
+static void ser_rbuf_drop(TYPE_FD_SER fd)
+{
+	ser_rbuf_t	*rb = ser_rbuf_find(fd);
+
+	if (rb) {
+		rb->start = 0;
+		rb->len = 0;
+	}
+}
+
+/* wait for more bytes of the port (up to the timeout) and add what came
+ * to its buffer; returns like select_read(), or -1 with EMSGSIZE if the
+ * buffer is full */
+static ssize_t ser_rbuf_fill(ser_rbuf_t *rb, time_t d_sec, useconds_t d_usec)
+{
+	ssize_t	ret;
+
+	if (rb->start + rb->len == SER_RBUF_SIZE) {
+		if (rb->start == 0) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		memmove(rb->data, rb->data + rb->start, rb->len);
+		rb->start = 0;
+	}
+
+	ret = select_read(rb->fd, rb->data + rb->start + rb->len,
+		SER_RBUF_SIZE - rb->start - rb->len, d_sec, (suseconds_t)d_usec);
+
+	if (ret > 0) {
+		rb->len += (size_t)ret;
+	}
+
+	return ret;
+}
+
+/* consume up to buflen unread bytes of the buffer (into buf, if any) */
+static size_t ser_rbuf_take(ser_rbuf_t *rb, void *buf, size_t buflen)
+{
+	size_t	n = (buflen < rb->len) ? buflen : rb->len;
+
+	if (buf && n > 0) {
+		memcpy(buf, rb->data + rb->start, n);
+	}
+
+	rb->start += n;
+	rb->len -= n;
+	if (rb->len == 0) {
+		rb->start = 0;
+	}
+
+	return n;
+}
+
 static void ser_open_error(const char *port)
 	__attribute__((noreturn));
 
@@ -195,7 +309,9 @@ int ser_set_speed_nf(TYPE_FD_SER fd, const char *port, speed_t speed)
 #error This system lacks cfsetispeed() and has no other means to set the speed
 #endif
 
+	/* what came at the old speed is garbage at the new one */
 	tcflush(fd, TCIFLUSH);
+	ser_rbuf_drop(fd);
 	tcsetattr(fd, TCSANOW, &tio);
 
 	return 0;
@@ -325,6 +441,8 @@ int ser_close(TYPE_FD_SER fd, const char *port)
 #endif	/* WIN32 */
 	}
 
+	ser_rbuf_drop(fd);
+
 	if (close(fd) != 0)
 		return -1;
 
@@ -467,17 +585,35 @@ ssize_t ser_send_buf_pace(TYPE_FD_SER fd, useconds_t d_usec, const void *buf,
 
 ssize_t ser_get_char(TYPE_FD_SER fd, void *ch, time_t d_sec, useconds_t d_usec)
 {
-	/* Per standard below, we can cast here, because required ranges are
-	 * effectively the same (and signed -1 for suseconds_t), and at most long:
-	 * https://pubs.opengroup.org/onlinepubs/009604599/basedefs/sys/types.h.html
-	 */
-	return select_read(fd, ch, 1, d_sec, (suseconds_t)d_usec);
+	ser_rbuf_t	*rb = ser_rbuf_get(fd);
+	ssize_t	ret;
+
+	/* take what came along with the char too, for the next calls */
+	if (rb->len == 0) {
+		ret = ser_rbuf_fill(rb, d_sec, d_usec);
+		if (ret < 1) {
+			return ret;
+		}
+	}
+
+	return (ssize_t)ser_rbuf_take(rb, ch, 1);
 }
 
 ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec)
 {
+	ser_rbuf_t	*rb = ser_rbuf_find(fd);
+
 	memset(buf, '\0', buflen);
 
+	if (rb) {
+		assert(buflen < SSIZE_MAX);
+		return (ssize_t)ser_rbuf_take(rb, buf, buflen);
+	}
+
+	/* Per standard below, we can cast here, because required ranges are
+	 * effectively the same (and signed -1 for suseconds_t), and at most long:
+	 * https://pubs.opengroup.org/onlinepubs/009604599/basedefs/sys/types.h.html
+	 */
 	return select_read(fd, buf, buflen, d_sec, (suseconds_t)d_usec);
 }
 
@@ -487,11 +623,15 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 	ssize_t	ret;
 	ssize_t	recv;
 	char	*data = buf;
+	ser_rbuf_t	*rb;
 
 	assert(buflen < SSIZE_MAX);
 	memset(buf, '\0', buflen);
 
-	for (recv = 0; recv < (ssize_t)buflen; recv += ret) {
+	rb = ser_rbuf_find(fd);
+	recv = rb ? (ssize_t)ser_rbuf_take(rb, buf, buflen) : 0;
+
+	for (; recv < (ssize_t)buflen; recv += ret) {
 
 		ret = select_read(fd, &data[recv],
 			(size_t)((ssize_t)buflen - recv),
@@ -505,49 +645,78 @@ ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec,
 	return recv;
 }
 
-/* reads a line up to <endchar>, discarding anything else that may follow,
-   with callouts to the handler if anything matches the alertset */
+/* reads a line up to <endchar>, with callouts to the handler if anything
+   matches the alertset; what follows is kept for the next read */
 ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, const char *alertset, void handler(char ch),
 	time_t d_sec, useconds_t d_usec)
 {
-	ssize_t	i, ret;
-	char	tmp[64];
+	ssize_t	ret;
 	char	*data = buf;
 	ssize_t	count = 0, maxcount;
+	ser_rbuf_t	*rb;
+	unsigned char	ch, class[256];
+	const char	*p;
 
 	assert(buflen < SSIZE_MAX && buflen > 0);
 	memset(buf, '\0', buflen);
 
 	maxcount = (ssize_t)buflen - 1;		/* for trailing \0 */
 
+	/* what to do with each char, rather than looking it up in each set */
+	memset(class, 0, sizeof(class));
+	for (p = alertset; *p; p++) {
+		class[(unsigned char)*p] = 2;
+	}
+	for (p = ignset; *p; p++) {
+		class[(unsigned char)*p] = 1;
+	}
+	/* NUL was always ignored (found by strchr() in any set) */
+	class[0] = 1;
+	class[(unsigned char)endchar] = 3;
+
+	rb = ser_rbuf_get(fd);
+
 	while (count < maxcount) {
-		ret = select_read(fd, tmp, sizeof(tmp), d_sec, (suseconds_t)d_usec);
+		if (rb->len == 0) {
+			ret = ser_rbuf_fill(rb, d_sec, d_usec);
 
-		if (ret < 1) {
-			return ret;
+			if (ret < 1) {
+				return ret;
+			}
 		}
 
-		for (i = 0; i < ret; i++) {
+		while (rb->len > 0 && count < maxcount) {
+			ch = rb->data[rb->start];
+			ser_rbuf_take(rb, NULL, 1);
 
-			if ((count == maxcount) || (tmp[i] == endchar)) {
+			switch (class[ch]) {
+			case 3:
 				return count;
-			}
 
-			if (strchr(ignset, tmp[i]))
-				continue;
-
-			if (strchr(alertset, tmp[i])) {
+			case 2:
 				if (handler)
-					handler(tmp[i]);
+					handler((char)ch);
+				break;
 
-				continue;
-			}
+			case 1:
+				break;
 
-			data[count++] = tmp[i];
+			default:
+				data[count++] = (char)ch;
+			}
 		}
 	}
 
+	/* the line did not fit: discard the rest of it which came already
+	 * (or all that came, if its end did not) */
+	while (rb->len > 0) {
+		ch = rb->data[rb->start];
+		ser_rbuf_take(rb, NULL, 1);
+		if (class[ch] == 3)
+			break;
+	}
+
 	return count;
 }
 
@@ -559,6 +728,91 @@ ssize_t ser_get_line(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 		d_sec, d_usec);
 }
 
+ssize_t ser_frame_endchar(const unsigned char *data, size_t len, void *arg)
+{
+	const unsigned char	*end = memchr(data, *(const unsigned char *)arg, len);
+
+	return end ? (ssize_t)(end - data) + 1 : 0;
+}
+
+ssize_t ser_frame_length(const unsigned char *data, size_t len, void *arg)
+{
+	size_t	want = *(const size_t *)arg;
+
+	NUT_UNUSED_VARIABLE(data);
+
+	assert(want > 0 && want <= SER_RBUF_SIZE);
+	return (len >= want) ? (ssize_t)want : 0;
+}
+
+ssize_t ser_get_frame(TYPE_FD_SER fd, void *buf, size_t buflen,
+	ser_frame_t frame, void *arg, time_t d_sec, useconds_t d_usec)
+{
+	ser_rbuf_t	*rb = ser_rbuf_get(fd);
+	ssize_t	ret, len;
+
+	assert(buflen < SSIZE_MAX);
+
+	for (;;) {
+		/* a complete reply among the bytes which came already? */
+		while (rb->len > 0) {
+			len = frame(rb->data + rb->start, rb->len, arg);
+
+			if (len > 0) {
+				if ((size_t)len > buflen) {
+					upsdebugx(1, "%s: reply of %" PRIiSIZE " bytes does not fit in %" PRIuSIZE,
+						__func__, len, buflen);
+					ser_rbuf_take(rb, NULL, (size_t)len);
+					errno = ENOBUFS;
+					return -1;
+				}
+				return (ssize_t)ser_rbuf_take(rb, buf, (size_t)len);
+			}
+
+			if (len == 0)
+				break;
+
+			/* not the start of a reply: skip a byte to resync */
+			upsdebugx(5, "%s: skipping 0x%02x", __func__, rb->data[rb->start]);
+			ser_rbuf_take(rb, NULL, 1);
+		}
+
+		ret = ser_rbuf_fill(rb, d_sec, d_usec);
+
+		if (ret < 1) {
+			if (ret < 0 && errno == EMSGSIZE) {
+				upsdebugx(1, "%s: no reply framed in %d bytes, dropped",
+					__func__, SER_RBUF_SIZE);
+				ser_rbuf_take(rb, NULL, rb->len);
+			}
+			return ret;
+		}
+	}
+}
+
+ssize_t ser_get_frames(TYPE_FD_SER fd, void *buf, size_t buflen, size_t *lens,
+	size_t count, ser_frame_t frame, void *arg, time_t d_sec, useconds_t d_usec)
+{
+	unsigned char	*data = buf;
+	size_t	i, used = 0;
+	ssize_t	ret;
+
+	for (i = 0; i < count; i++) {
+		ret = ser_get_frame(fd, data + used, buflen - used, frame, arg,
+			d_sec, d_usec);
+
+		if (ret < 1) {
+			/* the replies which came before the error or timeout */
+			return i ? (ssize_t)i : ret;
+		}
+
+		lens[i] = (size_t)ret;
+		used += (size_t)ret;
+	}
+
+	return (ssize_t)count;
+}
+
 ssize_t ser_flush_in(TYPE_FD_SER fd, const char *ignset, int verbose)
 {
 	ssize_t	ret, extra = 0;
@@ -585,6 +839,8 @@ ssize_t ser_flush_in(TYPE_FD_SER fd, const char *ignset, int verbose)
 
 int ser_flush_io(TYPE_FD_SER fd)
 {
+	ser_rbuf_drop(fd);
+
 	return tcflush(fd, TCIOFLUSH);
 }
 
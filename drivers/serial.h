@@ -85,8 +85,9 @@ ssize_t ser_get_buf(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, usec
 /* keep reading until buflen bytes are received or a timeout occurs */
 ssize_t ser_get_buf_len(TYPE_FD_SER fd, void *buf, size_t buflen, time_t d_sec, useconds_t d_usec);
 
-/* reads a line up to <endchar>, discarding anything else that may follow,
-   with callouts to the handler if anything matches the alertset */
+/* reads a line up to <endchar>, with callouts to the handler if anything
+   matches the alertset; anything else that came after it is kept for the
+   next read (unless the line did not fit in buf) */
 ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, const char *alertset, void handler (char ch),
 	time_t d_sec, useconds_t d_usec);
@@ -95,6 +96,29 @@ ssize_t ser_get_line_alert(TYPE_FD_SER fd, void *buf, size_t buflen, char endcha
 ssize_t ser_get_line(TYPE_FD_SER fd, void *buf, size_t buflen, char endchar,
 	const char *ignset, time_t d_sec, useconds_t d_usec);
 
+/* framing of the replies read by ser_get_frame(): given the len bytes
+   received so far from the start of a reply, return the length of the
+   reply once complete, 0 if more bytes are needed, or -1 if these bytes
+   can not start a reply (the first one is then skipped, e.g. to resync
+   after a checksum error); a reply must be at most 512 bytes long */
+typedef ssize_t (*ser_frame_t)(const unsigned char *data, size_t len, void *arg);
+
+/* framing callbacks for replies ending with a char (arg: const char *),
+   or of a fixed length (arg: const size_t *) */
+ssize_t ser_frame_endchar(const unsigned char *data, size_t len, void *arg);
+ssize_t ser_frame_length(const unsigned char *data, size_t len, void *arg);
+
+/* read the next reply as framed by the callback; what follows is kept
+   for the next read (as with the other ser_get_* functions), so that
+   several queries can be sent before their replies are read */
+ssize_t ser_get_frame(TYPE_FD_SER fd, void *buf, size_t buflen,
+	ser_frame_t frame, void *arg, time_t d_sec, useconds_t d_usec);
+
+/* read count replies into buf, one after the other, and their lengths
+   into lens; returns how many came (or the error, if none did) */
+ssize_t ser_get_frames(TYPE_FD_SER fd, void *buf, size_t buflen, size_t *lens,
+	size_t count, ser_frame_t frame, void *arg, time_t d_sec, useconds_t d_usec);
+
 ssize_t ser_flush_in(TYPE_FD_SER fd, const char *ignset, int verbose);
 int ser_flush_io(TYPE_FD_SER fd);
 
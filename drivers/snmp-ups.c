@@ -177,7 +177,7 @@ static const char *mibname;
 static const char *mibvers;
 
 #define DRIVER_NAME	"Generic SNMP UPS driver"
-#define DRIVER_VERSION	"1.37"
+#define DRIVER_VERSION	"1.38"
 
 /* driver description structure */
 upsdrv_info_t	upsdrv_info = {
@@ -195,8 +195,6 @@ upsdrv_info_t	upsdrv_info = {
 };
 /* FIXME: integrate MIBs info? do the same as for usbhid-ups! */
 
-static time_t lastpoll = 0;
-
 /* Communication status handling */
 #define COMM_UNKNOWN 0
 #define COMM_OK      1
@@ -216,8 +214,75 @@ static int device_template_offset = -1;
 /* sysOID location */
 #define SYSOID_OID	".1.3.6.1.2.1.1.2.0"
 
+/* Name index over snmp_info for su_find_info(): a hash table with linear
+ * probing, holding the first entry for each name (as a scan would find).
+ * The table is (re-)built on first lookup after snmp_info changes, e.g.
+ * while probing MIBs. Entries instantiated from templates are temporary
+ * copies, so lookups are always by the "%i" template names in the array. */
+static snmp_info_t	*su_info_indexed = NULL;	/* array the index is for */
+static snmp_info_t	**su_info_byname = NULL;
+static size_t	su_info_index_size = 0;
+
+/* Parsed binary forms of the textual OIDs we have requested, so polls
+ * do not run each of them through snmp_parse_oid() every time. Keyed
+ * by the OID string, which also covers OIDs instantiated from templates
+ * (which are re-built from the template on each poll). */
+typedef struct {
+	char	*OID;
+	oid	*name;
+	size_t	name_len;
+	unsigned int	polled;	/* update cycle it was last asked for in */
+	struct snmp_pdu	*prefetched;	/* its value from a batched request */
+} su_oid_cache_t;
+
+static su_oid_cache_t	*su_oid_cache = NULL;
+static size_t	su_oid_cache_size = 0;	/* slots, a power of 2 */
+static size_t	su_oid_cache_count = 0;	/* used slots */
+
+/* Batched polling: with snmp_max_varbinds > 1, the OIDs which were read
+ * one by one in the previous update cycle are requested together (up to
+ * max_varbinds per PDU) at the start of the next one, and walks use
+ * GETBULK with SNMPv2c/v3. Single GETs during the cycle are answered
+ * from the responses where possible, so the SU_FLAG_* logic which acts
+ * on their results stays the same. */
+static int max_varbinds = DEFAULT_MAXVARBINDS;
+static bool_t	su_batching = FALSE;	/* in an update cycle, with batching */
+static unsigned int	su_poll_cycle = 0;	/* current update cycle */
+static size_t	su_requests = 0;	/* requests sent in this update cycle */
+static size_t	su_varbinds = 0;	/* OIDs asked for in these requests */
+static double	su_latency = 0;	/* total time waited for their responses */
+static double	su_latency_max = 0;	/* longest wait for a response */
+
+/* Asynchronous prefetch: with snmp_max_inflight > 1, the requests above
+ * are sent without waiting for each response, keeping up to that many
+ * in flight, so an update cycle of a daisy-chain (or a device far away)
+ * takes about as long as its slowest responses rather than their sum. */
+static int max_inflight = DEFAULT_MAXINFLIGHT;
+
+/* One request of the asynchronous prefetch, for OIDs batch[0..count) */
+typedef struct {
+	su_oid_cache_t	**batch;
+	size_t	count;
+	struct timeval	sent;
+} su_async_req_t;
+
+/* Ranges of OIDs waiting to be sent (a ring buffer: ranges never overlap,
+ * so there are at most as many as OIDs), and requests in flight */
+static struct {
+	su_async_req_t	*queue;
+	size_t	size, head, len;
+	size_t	inflight;
+	size_t	done;	/* OIDs answered */
+	bool_t	failed;	/* the device stopped answering */
+} su_async;
+
 /* Forward functions declarations */
 static void disable_transfer_oids(void);
+static void su_info_index_free(void);
+static void su_oid_cache_free(void);
+static void su_prefetch(void);
+static void su_prefetch_free(void);
+static void su_request_done(size_t count, struct timeval *sent);
 bool_t get_and_process_data(int mode, snmp_info_t *su_info_p);
 int extract_template_number(snmp_info_flags_t template_type, const char* varname);
 snmp_info_flags_t get_template_type(const char* varname);
@@ -302,9 +367,9 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1,"SNMP UPS driver: entering %s()", __func__);
 
-	/* only update every pollfreq */
+	/* only update every pollfreq (as scheduled by the driver core) */
 	/* FIXME: only update status (SU_STATUS_*), à la usbhid-ups, in between */
-	if (time(NULL) > (lastpoll + pollfreq)) {
+	if (refresh_due(REFRESH_SLOW)) {
 
 		alarm_init();
 		status_init();
@@ -330,8 +395,7 @@ void upsdrv_updateinfo(void)
 		if (daisychain_enabled == TRUE)
 			alarm_commit();
 
-		/* store timestamp */
-		lastpoll = time(NULL);
+		refresh_done(REFRESH_SLOW);
 	}
 	else {
 		/* Just tell the same status to upsd */
@@ -409,6 +473,10 @@ void upsdrv_makevartable(void)
 		"Specifies the number of Net-SNMP retries to be used in the requests (default=5)");
 	addvar(VAR_VALUE, SU_VAR_TIMEOUT,
 		"Specifies the Net-SNMP timeout in seconds between retries (default=1)");
+	addvar(VAR_VALUE, SU_VAR_MAXVARBINDS,
+		"Set the maximum amount of OIDs requested in one PDU, to poll in batches (default=0, disabled)");
+	addvar(VAR_VALUE, SU_VAR_MAXINFLIGHT,
+		"Set the maximum amount of requests sent at once (without waiting for responses) when polling (default=1)");
 	addvar(VAR_FLAG, "notransferoids",
 		"Disable transfer OIDs (use on APCC Symmetras)");
 	addvar(VAR_FLAG, "symmetrathreephase",
@@ -637,11 +705,20 @@ void upsdrv_initups(void)
 	/* Load the SNMP to NUT translation data */
 	load_mib2nut(mibs);
 
-	/* init polling frequency */
-	if (getval(SU_VAR_POLLFREQ))
-		pollfreq = atoi(getval(SU_VAR_POLLFREQ));
-	else
-		pollfreq = DEFAULT_POLLFREQ;
+	/* init polling frequency (0: update at each call, but the
+	 * driver core takes a negative interval as "never") */
+	pollfreq = DEFAULT_POLLFREQ;
+	if (getval(SU_VAR_POLLFREQ)) {
+		if (!str_to_int(getval(SU_VAR_POLLFREQ), &pollfreq, 10) || pollfreq < 0) {
+			pollfreq = DEFAULT_POLLFREQ;
+			upslogx(LOG_WARNING, "Invalid setting for %s: '%s', defaulting to %d",
+				SU_VAR_POLLFREQ, getval(SU_VAR_POLLFREQ), pollfreq);
+		}
+	}
+
+	/* the first update commits the status got by initinfo */
+	refresh_set_interval(REFRESH_SLOW, (double)pollfreq);
+	refresh_request(REFRESH_SLOW);
 
 	/* init semistatic update frequency */
 	if (getval(SU_VAR_SEMISTATICFREQ))
@@ -654,6 +731,29 @@ void upsdrv_initups(void)
 	}
 	semistatic_countdown = semistaticfreq;
 
+	/* init batched polling */
+	if (getval(SU_VAR_MAXVARBINDS)) {
+		max_varbinds = atoi(getval(SU_VAR_MAXVARBINDS));
+		if (max_varbinds < 0) {
+			upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_MAXVARBINDS);
+			max_varbinds = DEFAULT_MAXVARBINDS;
+		}
+	}
+	upsdebugx(1, "Batched polling is %s (%s=%d)",
+		(max_varbinds > 1) ? "enabled" : "disabled",
+		SU_VAR_MAXVARBINDS, max_varbinds);
+
+	if (getval(SU_VAR_MAXINFLIGHT)) {
+		max_inflight = atoi(getval(SU_VAR_MAXINFLIGHT));
+		if (max_inflight < 1) {
+			upsdebugx(1, "Bad %s value provided, setting to default", SU_VAR_MAXINFLIGHT);
+			max_inflight = DEFAULT_MAXINFLIGHT;
+		}
+	}
+	upsdebugx(1, "Asynchronous polling is %s (%s=%d)",
+		(max_inflight > 1) ? "enabled" : "disabled",
+		SU_VAR_MAXINFLIGHT, max_inflight);
+
 	/* Get UPS Model node to see if there's a MIB */
 /* FIXME: extend and use match_model_OID(char *model) */
 	su_info_p = su_find_info("ups.model");
@@ -786,6 +886,8 @@ void upsdrv_cleanup(void)
 	if (daisychain_info)
 		free(daisychain_info);
 
+	su_info_index_free();
+
 	/* Net-SNMP specific cleanup */
 	nut_snmp_cleanup();
 }
@@ -1073,9 +1175,419 @@ void nut_snmp_cleanup(void)
 		snmp_close(g_snmp_sess_p);
 		g_snmp_sess_p = NULL;
 	}
+	su_oid_cache_free();
 	SOCK_CLEANUP; /* wrapper not needed on Unix! */
 }
 
+static void su_oid_cache_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < su_oid_cache_size; i++) {
+		free(su_oid_cache[i].OID);
+		free(su_oid_cache[i].name);
+		if (su_oid_cache[i].prefetched)
+			snmp_free_pdu(su_oid_cache[i].prefetched);
+	}
+
+	free(su_oid_cache);
+	su_oid_cache = NULL;
+	su_oid_cache_size = 0;
+	su_oid_cache_count = 0;
+}
+
+/* Return the slot for OID in the cache: either the one holding it,
+ * or the empty one where it should be added */
+static su_oid_cache_t *su_oid_cache_slot(const char *OID)
+{
+	size_t	slot, mask = su_oid_cache_size - 1;
+
+	for (slot = str_hash_ci(OID) & mask;
+	     su_oid_cache[slot].OID;
+	     slot = (slot + 1) & mask
+	) {
+		if (!strcmp(su_oid_cache[slot].OID, OID))
+			break;
+	}
+
+	return &su_oid_cache[slot];
+}
+
+/* Like snmp_parse_oid() for a name[] buffer of MAX_OID_LEN, but only
+ * really parses each OID string once. Returns FALSE if it can not be
+ * parsed (snmp_errno tells why), and does not remember such failures. */
+static bool_t su_parse_oid(const char *OID, oid *name, size_t *name_len)
+{
+	su_oid_cache_t	*entry;
+
+	if (su_oid_cache) {
+		entry = su_oid_cache_slot(OID);
+		if (entry->OID) {
+			memcpy(name, entry->name, entry->name_len * sizeof(oid));
+			*name_len = entry->name_len;
+			return TRUE;
+		}
+	}
+
+	*name_len = MAX_OID_LEN;
+	if (!snmp_parse_oid(OID, name, name_len)) {
+		return FALSE;
+	}
+
+	/* keep the table at most half full */
+	if (2 * (su_oid_cache_count + 1) > su_oid_cache_size) {
+		su_oid_cache_t	*old_cache = su_oid_cache;
+		size_t	i, old_size = su_oid_cache_size;
+
+		su_oid_cache_size = old_size ? old_size * 2 : 256;
+		su_oid_cache = xcalloc(su_oid_cache_size, sizeof(*su_oid_cache));
+
+		for (i = 0; i < old_size; i++) {
+			if (old_cache[i].OID) {
+				*su_oid_cache_slot(old_cache[i].OID) = old_cache[i];
+			}
+		}
+		free(old_cache);
+	}
+
+	entry = su_oid_cache_slot(OID);
+	entry->OID = xstrdup(OID);
+	entry->name = xcalloc(*name_len ? *name_len : 1, sizeof(oid));
+	memcpy(entry->name, name, *name_len * sizeof(oid));
+	entry->name_len = *name_len;
+	entry->polled = 0;
+	entry->prefetched = NULL;
+	su_oid_cache_count++;
+
+	upsdebugx(5, "%s: cached %s (%" PRIuSIZE " OIDs known)",
+		__func__, OID, su_oid_cache_count);
+
+	return TRUE;
+}
+
+/* Drop the responses of batched requests at the end of an update cycle */
+static void su_prefetch_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < su_oid_cache_size; i++) {
+		if (su_oid_cache[i].prefetched) {
+			snmp_free_pdu(su_oid_cache[i].prefetched);
+			su_oid_cache[i].prefetched = NULL;
+		}
+	}
+}
+
+/* Account for a request of count OIDs, sent at the given time */
+static void su_request_done(size_t count, struct timeval *sent)
+{
+	struct timeval	now;
+	double	d;
+
+	gettimeofday(&now, NULL);
+	d = difftimeval(now, *sent);
+
+	su_requests++;
+	su_varbinds += count;
+	su_latency += d;
+	if (d > su_latency_max)
+		su_latency_max = d;
+}
+
+/* Make a GET request PDU for the OIDs batch[0..count) */
+static struct snmp_pdu *su_prefetch_pdu(su_oid_cache_t **batch, size_t count)
+{
+	size_t	i;
+	struct snmp_pdu	*pdu;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+
+	for (i = 0; i < count; i++) {
+		snmp_add_null_var(pdu, batch[i]->name, batch[i]->name_len);
+	}
+
+	return pdu;
+}
+
+/* Keep the values in a response to a request for the OIDs batch[0..count)
+ * with each OID. Returns how many of these OIDs are done with (so a caller
+ * can carry on with the rest), or -1 if we can not use the response (the
+ * single GETs will retry and report that as usual). */
+static int su_prefetch_response(su_oid_cache_t **batch, size_t count, struct snmp_pdu *response)
+{
+	int	ret = -1;
+	size_t	i;
+	long	errindex = response->errindex;
+	struct variable_list	*var;
+
+	switch (response->errstat)
+	{
+		case SNMP_ERR_NOERROR:
+			/* Values come in the order they were asked for; with
+			 * SNMPv2c/v3 missing ones are noSuchObject/noSuchInstance
+			 * exceptions, which nut_snmp_walk() reports as usual */
+			for (i = 0, var = response->variables;
+			     i < count && var != NULL;
+			     i++, var = var->next_variable
+			) {
+				if (snmp_oid_compare(var->name, var->name_length,
+					batch[i]->name, batch[i]->name_len)
+				) {
+					upsdebugx(2, "%s: response for %s is out of order, ignored",
+						__func__, batch[i]->OID);
+					continue;
+				}
+				batch[i]->prefetched = snmp_split_pdu(response, (int)i, 1);
+			}
+			ret = (int)count;
+			break;
+
+		case SNMP_ERR_TOOBIG:
+			if (count > 1) {
+				/* Remember a size this device can handle, and
+				 * have the caller retry with that */
+				max_varbinds = (int)(count / 2);
+				upsdebugx(1, "%s: response to %" PRIuSIZE " OIDs is too big, "
+					"reduced %s to %d", __func__, count,
+					SU_VAR_MAXVARBINDS, max_varbinds);
+				ret = 0;
+			} else {
+				ret = 1;
+			}
+			break;
+
+		default:
+			/* With SNMPv1 a missing OID (noSuchName) fails the whole
+			 * request, and errindex points at that varbind (from 1).
+			 * Answer a single GET for it like the device would, and
+			 * let the caller ask again for the others. Other errors
+			 * are left for the single GET to report. */
+			if (errindex < 1 || (size_t)errindex > count) {
+				upsdebugx(2, "%s: error %li for a request of %" PRIuSIZE " OIDs",
+					__func__, response->errstat, count);
+				break;
+			}
+			upsdebugx(3, "%s: error %li for OID %s, requesting others again",
+				__func__, response->errstat, batch[errindex - 1]->OID);
+
+			if (response->errstat == SNMP_ERR_NOSUCHNAME) {
+				batch[errindex - 1]->prefetched = snmp_clone_pdu(response);
+			}
+			if (errindex > 1) {
+				su_oid_cache_t	*tmp = batch[0];
+				batch[0] = batch[errindex - 1];
+				batch[errindex - 1] = tmp;
+			}
+			ret = 1;
+			break;
+	}
+
+	return ret;
+}
+
+/* Request the values of count OIDs in one PDU and wait for the response;
+ * returns like su_prefetch_response() */
+static int su_prefetch_batch(su_oid_cache_t **batch, size_t count)
+{
+	int	status, ret = -1;
+	struct snmp_pdu	*response = NULL;
+	struct timeval	sent;
+
+	gettimeofday(&sent, NULL);
+	status = snmp_synch_response(g_snmp_sess_p, su_prefetch_pdu(batch, count), &response);
+	su_request_done(count, &sent);
+
+	if (!response || status != STAT_SUCCESS) {
+		upsdebugx(2, "%s: no response to a request for %" PRIuSIZE " OIDs",
+			__func__, count);
+	}
+	else {
+		ret = su_prefetch_response(batch, count, response);
+	}
+
+	if (response)
+		snmp_free_pdu(response);
+
+	return ret;
+}
+
+/* Add a range of OIDs to be (re-)sent by su_prefetch_async() */
+static void su_async_queue(su_oid_cache_t **batch, size_t count)
+{
+	su_async_req_t	*req;
+
+	if (!count)
+		return;
+
+	req = &su_async.queue[(su_async.head + su_async.len) % su_async.size];
+	req->batch = batch;
+	req->count = count;
+	su_async.len++;
+}
+
+/* Net-SNMP calls this with the response to (or the time-out of)
+ * a request sent by su_prefetch_async() */
+static int su_async_callback(int operation, struct snmp_session *sp,
+	int reqid, struct snmp_pdu *pdu, void *magic)
+{
+	su_async_req_t	*req = (su_async_req_t *)magic;
+	int	ret = -1;
+
+	NUT_UNUSED_VARIABLE(sp);
+
+	su_async.inflight--;
+	su_request_done(req->count, &req->sent);
+
+	if (operation == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE && pdu != NULL) {
+		ret = su_prefetch_response(req->batch, req->count, pdu);
+	}
+	else {
+		upsdebugx(2, "%s: no response to request %i for %" PRIuSIZE " OIDs",
+			__func__, reqid, req->count);
+	}
+
+	if (ret < 0) {
+		su_async.failed = TRUE;
+	}
+	else {
+		su_async.done += (size_t)ret;
+		/* ask again for any we did not get (e.g. too big, noSuchName) */
+		su_async_queue(req->batch + ret, req->count - (size_t)ret);
+	}
+
+	free(req);
+
+	/* the library frees the pdu */
+	return 1;
+}
+
+/* Prefetch the OIDs batch[0..count) with up to max_inflight requests
+ * at a time; returns how many were answered */
+static size_t su_prefetch_async(su_oid_cache_t **batch, size_t count)
+{
+	su_async_req_t	*req, *next;
+	struct snmp_pdu	*pdu;
+	size_t	n;
+
+	memset(&su_async, 0, sizeof(su_async));
+	su_async.size = count;
+	su_async.queue = xcalloc(count, sizeof(*su_async.queue));
+	su_async_queue(batch, count);
+
+	/* Keep going until all requests in flight are answered or have
+	 * timed out, even after a failure: their callbacks refer to data
+	 * which must stay around till then */
+	while (su_async.inflight || (su_async.len && !su_async.failed)) {
+		fd_set	fdset;
+		struct timeval	timeout;
+		int	numfds = 0, block = 1, ret;
+
+		while (su_async.len && !su_async.failed
+		 && su_async.inflight < (size_t)max_inflight
+		) {
+			next = &su_async.queue[su_async.head];
+			n = (max_varbinds > 1) ? (size_t)max_varbinds : 1;
+			if (n > next->count)
+				n = next->count;
+
+			req = xcalloc(1, sizeof(*req));
+			req->batch = next->batch;
+			req->count = n;
+
+			/* the rest of this range (if any) goes next */
+			next->batch += n;
+			next->count -= n;
+			if (!next->count) {
+				su_async.head = (su_async.head + 1) % su_async.size;
+				su_async.len--;
+			}
+
+			pdu = su_prefetch_pdu(req->batch, req->count);
+			gettimeofday(&req->sent, NULL);
+			if (!snmp_async_send(g_snmp_sess_p, pdu, su_async_callback, req)) {
+				upsdebugx(1, "%s: could not send a request: %s",
+					__func__, snmp_api_errstring(snmp_errno));
+				snmp_free_pdu(pdu);
+				free(req);
+				su_async.failed = TRUE;
+				break;
+			}
+			su_async.inflight++;
+		}
+
+		if (!su_async.inflight)
+			break;
+
+		FD_ZERO(&fdset);
+		snmp_select_info(&numfds, &fdset, &timeout, &block);
+		ret = select(numfds, &fdset, NULL, NULL, block ? NULL : &timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/* let the requests time out */
+			upsdebugx(1, "%s: select failed: %s", __func__, strerror(errno));
+			snmp_timeout();
+		}
+		else if (ret > 0) {
+			snmp_read(&fdset);
+		}
+		else {
+			snmp_timeout();
+		}
+	}
+
+	free(su_async.queue);
+	su_async.queue = NULL;
+
+	return su_async.done;
+}
+
+/* At the start of an update cycle, fetch the OIDs which were asked for
+ * in the previous one in as few requests as possible */
+static void su_prefetch(void)
+{
+	su_oid_cache_t	**batch;
+	size_t	i, count = 0, done = 0;
+	int	ret;
+
+	for (i = 0; i < su_oid_cache_size; i++) {
+		if (su_oid_cache[i].OID && su_oid_cache[i].polled + 1 == su_poll_cycle)
+			count++;
+	}
+
+	if (!count)
+		return;
+
+	/* Nothing is added to the cache while we work, so entries stay put */
+	batch = xcalloc(count, sizeof(*batch));
+	for (i = 0, count = 0; i < su_oid_cache_size; i++) {
+		if (su_oid_cache[i].OID && su_oid_cache[i].polled + 1 == su_poll_cycle)
+			batch[count++] = &su_oid_cache[i];
+	}
+
+	if (max_inflight > 1) {
+		done = su_prefetch_async(batch, count);
+	}
+	else while (done < count && max_varbinds > 1) {
+		i = count - done;
+		if (i > (size_t)max_varbinds)
+			i = (size_t)max_varbinds;
+
+		ret = su_prefetch_batch(batch + done, i);
+		if (ret < 0)
+			break;
+		done += (size_t)ret;
+	}
+
+	upsdebugx(2, "%s: prefetched %" PRIuSIZE " of %" PRIuSIZE " OIDs in %" PRIuSIZE " requests",
+		__func__, done, count, su_requests);
+
+	free(batch);
+}
+
 /* Free a struct snmp_pdu * returned by nut_snmp_walk */
 static void nut_snmp_free(struct snmp_pdu ** array_to_free)
 {
@@ -1106,17 +1618,29 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 	int nb_iteration = 0;
 	struct snmp_pdu ** ret_array = NULL;
 	int type = SNMP_MSG_GET;
+	su_oid_cache_t *cached;
+	struct snmp_pdu *prefetched = NULL;
+	struct variable_list *var;
+	struct timeval sent;
 
 	upsdebugx(3, "%s(%s)", __func__, OID);
 	upsdebugx(4, "%s: max. iteration = %i", __func__, max_iteration);
 
 	/* create and send request. */
-	if (!snmp_parse_oid(OID, name, &name_len)) {
+	if (!su_parse_oid(OID, name, &name_len)) {
 		upsdebugx(2, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
 		return NULL;
 	}
 
+	/* Batched polling: note single GETs of this update cycle to request
+	 * them together in the next one, and use what we prefetched now */
+	if (su_batching && max_iteration == 1) {
+		cached = su_oid_cache_slot(OID);
+		cached->polled = su_poll_cycle;
+		prefetched = cached->prefetched;
+	}
+
 	current_name = name;
 	current_name_len = name_len;
 
@@ -1128,15 +1652,40 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			break;
 		}
 
-		pdu = snmp_pdu_create(type);
-
-		if (pdu == NULL) {
-			fatalx(EXIT_FAILURE, "Not enough memory");
+		if (prefetched) {
+			upsdebugx(4, "%s: using the response of a batched request", __func__);
+			response = snmp_clone_pdu(prefetched);
+			status = (response ? STAT_SUCCESS : STAT_ERROR);
+			prefetched = NULL;
 		}
+		else {
+			/* Continue a walk with GETBULK where the protocol has it */
+			if (type == SNMP_MSG_GETNEXT
+			 && max_varbinds > 1
+			 && g_snmp_sess_p->version != SNMP_VERSION_1
+			) {
+				type = SNMP_MSG_GETBULK;
+			}
 
-		snmp_add_null_var(pdu, current_name, current_name_len);
+			pdu = snmp_pdu_create(type);
 
-		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+			if (pdu == NULL) {
+				fatalx(EXIT_FAILURE, "Not enough memory");
+			}
+
+			if (type == SNMP_MSG_GETBULK) {
+				pdu->non_repeaters = 0;
+				pdu->max_repetitions = max_iteration - nb_iteration;
+				if (pdu->max_repetitions > max_varbinds)
+					pdu->max_repetitions = max_varbinds;
+			}
+
+			snmp_add_null_var(pdu, current_name, current_name_len);
+
+			gettimeofday(&sent, NULL);
+			status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+			su_request_done(1, &sent);
+		}
 
 		if (!response) {
 			break;
@@ -1170,7 +1719,7 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			}
 
 			if ((numerr < SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
-				if (type == SNMP_MSG_GETNEXT) {
+				if (type != SNMP_MSG_GET) {
 					upsdebugx(2, "=> No more OID, walk complete");
 				}
 				else {
@@ -1202,6 +1751,50 @@ static struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			}
 		}
 
+		if (type == SNMP_MSG_GETBULK) {
+			/* Keep one value per PDU in the array, as from GETNEXT,
+			 * and stop where the sub-tree or the MIB view ends */
+			int	i = 0, last = nb_iteration;
+
+			for (var = response->variables;
+			     var != NULL && nb_iteration < max_iteration;
+			     var = var->next_variable, i++
+			) {
+				if (var->name_length < name_len
+				 || var->type == SNMP_ENDOFMIBVIEW
+				) {
+					break;
+				}
+
+				new_ret_array = realloc(
+					ret_array,
+					sizeof(struct snmp_pdu*) * ((size_t)nb_iteration+2)
+					);
+				if (new_ret_array == NULL) {
+					upsdebugx(1, "%s: Failed to realloc thread", __func__);
+					break;
+				}
+				ret_array = new_ret_array;
+				ret_array[nb_iteration] = snmp_split_pdu(response, i, 1);
+				if (ret_array[nb_iteration] == NULL) {
+					break;
+				}
+				nb_iteration++;
+				ret_array[nb_iteration] = NULL;
+			}
+
+			snmp_free_pdu(response);
+
+			/* Nothing more (or usable) in this sub-tree */
+			if (var != NULL || nb_iteration == last) {
+				break;
+			}
+
+			current_name = ret_array[nb_iteration-1]->variables->name;
+			current_name_len = ret_array[nb_iteration-1]->variables->name_length;
+			continue;
+		}
+
 		nb_iteration++;
 		/* +1 is for the terminating NULL */
 		new_ret_array = realloc(
@@ -1474,10 +2067,11 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 	struct snmp_pdu *pdu, *response = NULL;
 	oid name[MAX_OID_LEN];
 	size_t name_len = MAX_OID_LEN;
+	struct timeval sent;
 
 	upsdebugx(1, "entering %s(%s, %c, %s)", __func__, OID, type, value);
 
-	if (!snmp_parse_oid(OID, name, &name_len)) {
+	if (!su_parse_oid(OID, name, &name_len)) {
 		upslogx(LOG_ERR, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
 		return FALSE;
@@ -1494,7 +2088,9 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 		return FALSE;
 	}
 
+	gettimeofday(&sent, NULL);
 	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	su_request_done(1, &sent);
 
 	if ((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))
 		ret = TRUE;
@@ -1819,10 +2415,54 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 	/* TODO: else */
 }
 
+static void su_info_index_free(void)
+{
+	free(su_info_byname);
+	su_info_byname = NULL;
+	su_info_index_size = 0;
+	su_info_indexed = NULL;
+}
+
+static void su_info_index_build(void)
+{
+	snmp_info_t	*su_info_p;
+	size_t	count = 0, slot, mask;
+
+	su_info_index_free();
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++)
+		count++;
+
+	/* keep the table at most half full */
+	for (su_info_index_size = 64; su_info_index_size < 2 * count; su_info_index_size *= 2)
+		;
+	mask = su_info_index_size - 1;
+
+	su_info_byname = xcalloc(su_info_index_size, sizeof(*su_info_byname));
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++) {
+		for (slot = str_hash_ci(su_info_p->info_type) & mask;
+		     su_info_byname[slot];
+		     slot = (slot + 1) & mask
+		) {
+			if (!strcasecmp(su_info_byname[slot]->info_type, su_info_p->info_type))
+				break;
+		}
+		if (!su_info_byname[slot])
+			su_info_byname[slot] = su_info_p;
+	}
+
+	su_info_indexed = snmp_info;
+
+	upsdebugx(3, "%s: indexed %" PRIuSIZE " entries in %" PRIuSIZE " slots",
+		__func__, count, su_info_index_size);
+}
+
 /* find info element definition in my info array. */
 snmp_info_t *su_find_info(const char *type)
 {
 	snmp_info_t *su_info_p;
+	size_t	slot, mask;
 
 	if (snmp_info == NULL) {
 		fatalx(EXIT_FAILURE, "%s: snmp_info is not initialized", __func__);
@@ -1832,11 +2472,19 @@ snmp_info_t *su_find_info(const char *type)
 		upsdebugx(1, "%s: WARNING: snmp_info is empty", __func__);
 	}
 
-	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++)
+	if (su_info_indexed != snmp_info)
+		su_info_index_build();
+
+	mask = su_info_index_size - 1;
+	for (slot = str_hash_ci(type) & mask;
+	     (su_info_p = su_info_byname[slot]) != NULL;
+	     slot = (slot + 1) & mask
+	) {
 		if (!strcasecmp(su_info_p->info_type, type)) {
 			upsdebugx(3, "%s: \"%s\" found", __func__, type);
 			return su_info_p;
 		}
+	}
 
 	upsdebugx(3, "%s: unknown info type (%s)", __func__, type);
 	return NULL;
@@ -3105,11 +3753,24 @@ bool_t snmp_ups_walk(int mode)
 #endif
 	snmp_info_t *su_info_p;
 	bool_t status = FALSE;
+	struct timeval start, now;
+
+	gettimeofday(&start, NULL);
+	su_requests = 0;
+	su_varbinds = 0;
+	su_latency = 0;
+	su_latency_max = 0;
 
 	if (mode == SU_WALKMODE_UPDATE) {
 		semistatic_countdown--;
 		if (semistatic_countdown < 0)
 			semistatic_countdown = semistaticfreq;
+
+		if (max_varbinds > 1 || max_inflight > 1) {
+			su_batching = TRUE;
+			su_poll_cycle++;
+			su_prefetch();
+		}
 	}
 
 	/* Loop through all device(s) */
@@ -3186,6 +3847,8 @@ bool_t snmp_ups_walk(int mode)
 			/* Check if we are asked to stop (reactivity++) */
 			if (exit_flag != 0) {
 				upsdebugx(1, "%s: aborting because exit_flag was set", __func__);
+				su_prefetch_free();
+				su_batching = FALSE;
 				return TRUE;
 			}
 
@@ -3349,6 +4012,24 @@ bool_t snmp_ups_walk(int mode)
 	iterations++;
 #endif
 
+	if (su_batching) {
+		su_prefetch_free();
+		su_batching = FALSE;
+	}
+
+	upsdebugx(1, "%s: sent %" PRIuSIZE " SNMP requests for %" PRIuSIZE " OIDs",
+		__func__, su_requests, su_varbinds);
+
+	/* Diagnostics of the update cycle, e.g. to tune the settings above */
+	if (mode == SU_WALKMODE_UPDATE) {
+		gettimeofday(&now, NULL);
+		dstate_setinfo("driver.update.duration", "%.3f", difftimeval(now, start));
+		dstate_setinfo("driver.update.requests", "%" PRIuSIZE, su_requests);
+		dstate_setinfo("driver.update.latency", "%.3f",
+			su_requests ? su_latency / (double)su_requests : 0.0);
+		dstate_setinfo("driver.update.latency.max", "%.3f", su_latency_max);
+	}
+
 	return status;
 }
 
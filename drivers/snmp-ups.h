@@ -139,6 +139,8 @@
 #define DEFAULT_NETSNMP_RETRIES   5
 #define DEFAULT_NETSNMP_TIMEOUT   1    /* in seconds */
 #define DEFAULT_SEMISTATICFREQ    10   /* in snmpwalk update cycles */
+#define DEFAULT_MAXVARBINDS       0    /* OIDs per request, 0 or 1 to not batch */
+#define DEFAULT_MAXINFLIGHT       1    /* requests sent at once, 1 to wait for each */
 
 /* use explicit booleans */
 #ifndef FALSE
@@ -370,6 +372,8 @@ typedef struct {
 #define SU_VAR_SEMISTATICFREQ	"semistaticfreq"
 #define SU_VAR_MIBS			"mibs"
 #define SU_VAR_POLLFREQ		"pollfreq"
+#define SU_VAR_MAXVARBINDS	"snmp_max_varbinds"
+#define SU_VAR_MAXINFLIGHT	"snmp_max_inflight"
 /* SNMP v3 related parameters */
 #define SU_VAR_SECLEVEL		"secLevel"
 #define SU_VAR_SECNAME		"secName"
@@ -136,6 +136,10 @@ static HIDDeviceMatcher_t *regex_matcher = NULL;
 static int pollfreq = DEFAULT_POLLFREQ;
 static unsigned ups_status = 0;
 static bool_t data_has_changed = FALSE; /* for SEMI_STATIC data polling */
+
+/* Reports read by the last walk in each mode (HID_REPORT_* flags by
+ * report ID), to retrieve them all at the start of the next such walk */
+static unsigned char walk_plan[HU_WALKMODE_FULL_UPDATE + 1][256];
 #ifndef SUN_LIBUSB
 bool_t use_interrupt_pipe = TRUE;
 #else
@@ -248,7 +252,19 @@ static int lbrb_log_delay_without_calibrating = 0;
 static time_t last_lb_start = 0;
 static time_t last_rb_start = 0;
 
+/* Indexes over subdriver->hid2nut for find_nut_info() and find_hid_info(),
+ * so these do not scan the whole table (e.g. for each interrupt event).
+ * Hash tables with linear probing, rebuilt after each HU_WALKMODE_INIT
+ * walk which maps the entries to HID data items; they hold the same
+ * (first suitable) entries that a linear scan would find. */
+static hid_info_t	*hid2nut_indexed = NULL;	/* table the index is for */
+static hid_info_t	**hid2nut_byname = NULL;
+static hid_info_t	**hid2nut_bydata = NULL;
+static size_t	hid2nut_index_size = 0;
+
 /* support functions */
+static void hid2nut_index_free(void);
+static void hid2nut_index_build(void);
 static hid_info_t *find_nut_info(const char *varname);
 static hid_info_t *find_hid_info(const HIDData_t *hiddata);
 static const char *hu_find_infoval(info_lkp_t *hid2info, const double value);
@@ -1128,6 +1144,10 @@ void upsdrv_makevartable(void)
 
 	addvar(VAR_VALUE, "interrupt_pipe_no_events_tolerance", "How many times in a row do we tolerate \"Got 0 HID objects\" from USB interrupts?");
 
+	addvar(VAR_VALUE, "report_backoff", "Read reports whose data do not change in up to this many updates only once (default 0: in each update)");
+
+	addvar(VAR_VALUE, "pollstatic", "Interval (in seconds) between full updates which also read static data (default 0: never, only at startup)");
+
 	addvar(VAR_FLAG, "onlinedischarge",
 		"Set to treat discharging while online as being offline/on-battery (DEPRECATED, use onlinedischarge_onbattery)");
 
@@ -1169,6 +1189,8 @@ void upsdrv_makevartable(void)
 		"Don't use polling, only use interrupt pipe");
 	addvar(VAR_VALUE, "interruptsize",
 		"Number of bytes to read from interrupt pipe");
+	addvar(VAR_FLAG, "asyncinterrupt",
+		"Keep a transfer queued on interrupt pipe, to handle events as they come (libusb 1.0)");
 	addvar(VAR_VALUE, HU_VAR_WAITBEFORERECONNECT,
 		"Seconds to wait before trying to reconnect");
 
@@ -1228,6 +1250,15 @@ void upsdrv_updateinfo(void)
 	/* Get HID notifications on Interrupt pipe first */
 	if (use_interrupt_pipe == TRUE) {
 		evtCount = HIDGetEvents(udev, event, MAX_EVENT_NUM);
+#if !((defined SHUT_MODE) && SHUT_MODE)
+		if (interrupt_async && evtCount == LIBUSB_ERROR_NOT_SUPPORTED) {
+			/* e.g. libusb can not tell which descriptors to watch */
+			upslogx(LOG_WARNING, "Can not keep a transfer queued on interrupt pipe, "
+				"waiting for events in each poll instead");
+			interrupt_async = 0;
+			evtCount = HIDGetEvents(udev, event, MAX_EVENT_NUM);
+		}
+#endif	/* !SHUT_MODE */
 		switch (evtCount)
 		{
 		case LIBUSB_ERROR_BUSY:      /* Device or resource busy */
@@ -1320,9 +1351,9 @@ void upsdrv_updateinfo(void)
 	status_init();
 	buzzmode_init();
 
-	/* Do a full update (polling) every pollfreq
-	 * or upon data change (ie setvar/instcmd) */
-	if ((now > (lastpoll + pollfreq)) || (data_has_changed == TRUE)) {
+	/* Do a full update (polling) when the driver core says the slow data
+	 * are due (every pollfreq) or upon data change (ie setvar/instcmd) */
+	if (refresh_due(REFRESH_SLOW) || (data_has_changed == TRUE)) {
 		upsdebugx(1, "Full update...");
 
 		alarm_init();
@@ -1332,6 +1363,9 @@ void upsdrv_updateinfo(void)
 
 		lastpoll = now;
 		data_has_changed = FALSE;
+		refresh_done(REFRESH_SLOW);
+		if (refresh_due(REFRESH_STATIC))
+			refresh_done(REFRESH_STATIC);
 
 		ups_alarm_set();
 		alarm_commit();
@@ -1401,7 +1435,31 @@ void upsdrv_initinfo(void)
 	}
 	dstate_setinfo("driver.parameter.interrupt_pipe_no_events_tolerance", "%ld", interrupt_pipe_no_events_tolerance);
 
+	val = getval("report_backoff");
+	if (val && !str_to_uint(val, &report_backoff, 10)) {
+		report_backoff = 0;
+		upslogx(LOG_WARNING, "Invalid setting for report_backoff: '%s', defaulting to %u",
+			val, report_backoff);
+	}
+
 	time(&lastpoll);
+	refresh_set_interval(REFRESH_SLOW, (double)pollfreq);
+
+	/* re-read static data (e.g. after a firmware upgrade) every pollstatic */
+	val = getval("pollstatic");
+	if (val) {
+		long	pollstatic = 0;
+
+		if (!str_to_long(val, &pollstatic, 10) || pollstatic < 0) {
+			pollstatic = 0;
+			upslogx(LOG_WARNING, "Invalid setting for pollstatic: '%s', defaulting to %ld",
+				val, pollstatic);
+		}
+		if (pollstatic > 0) {
+			refresh_set_interval(REFRESH_STATIC, (double)pollstatic);
+		}
+		dstate_setinfo("driver.parameter.pollstatic", "%ld", pollstatic);
+	}
 
 	/* install handlers */
 	upsh.setvar = setvar;
@@ -1503,6 +1561,17 @@ void upsdrv_initups(void)
 		}
 	}
 
+#if !((defined SHUT_MODE) && SHUT_MODE)
+	if (testvar("asyncinterrupt")) {
+		if (comm_driver->get_interrupt_async) {
+			interrupt_async = 1;
+		} else {
+			upslogx(LOG_WARNING, "'asyncinterrupt' is not supported by %s, ignored",
+				comm_driver->name);
+		}
+	}
+#endif	/* !SHUT_MODE => USB */
+
 	if (testvar("disable_fix_report_desc")) {
 		disable_fix_report_desc = 1;
 	}
@@ -1736,6 +1805,8 @@ void upsdrv_cleanup(void)
 	comm_driver->close_dev(udev);
 	Free_ReportDesc(pDesc);
 	free_report_buffer(reportbuf);
+	hid2nut_index_free();
+	HIDFreeUsageIndex();
 #if !((defined SHUT_MODE) && SHUT_MODE)
 	USBFreeExactMatcher(exact_matcher);
 	USBFreeRegexMatcher(regex_matcher);
@@ -1877,6 +1948,7 @@ static int callback(
 	if (subdriver->fix_report_desc(arghd, pDesc)) {
 		upsdebugx(2, "Report Descriptor Fixed");
 	}
+	HIDIndexUsageTables(subdriver->utab);
 	HIDDumpTree(udev, arghd, subdriver->utab);
 
 #if !((defined SHUT_MODE) && SHUT_MODE)
@@ -1954,6 +2026,7 @@ static bool_t hid_ups_walk(walkmode_t mode)
 	hid_info_t	*item;
 	double		value;
 	int		retcode;
+	unsigned char	plan[256];
 
 #if !((defined SHUT_MODE) && SHUT_MODE)
 	/* extract the VendorId for further testing */
@@ -1964,6 +2037,30 @@ static bool_t hid_ups_walk(walkmode_t mode)
 	/* 3 modes: HU_WALKMODE_INIT, HU_WALKMODE_QUICK_UPDATE
 	 * and HU_WALKMODE_FULL_UPDATE */
 
+	/* (re)mapping entries to HID data, lookups scan the table meanwhile */
+	if (mode == HU_WALKMODE_INIT) {
+		hid2nut_index_free();
+		memset(walk_plan, 0, sizeof(walk_plan));
+	} else {
+		/* get the reports which the walk is going to read in a row;
+		 * those which failed are tried again by their items */
+		retcode = HIDPrefetchReports(udev, walk_plan[mode], poll_interval);
+		if (retcode < 0) {
+			if (retcode == LIBUSB_ERROR_BUSY) {
+				upslog_with_errno(LOG_CRIT, "Got disconnected by another driver");
+			} else if (retcode == LIBUSB_ERROR_IO) {
+				/* with the suggestion of the walk below */
+				interrupt_pipe_EIO_count++;
+			}
+
+			/* Uh oh, got to reconnect! */
+			dstate_setinfo("driver.state", "reconnect.trying");
+			hd = NULL;
+			return FALSE;
+		}
+	}
+	memset(plan, 0, sizeof(plan));
+
 	/* Device data walk ----------------------------- */
 	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
 
@@ -2065,9 +2162,11 @@ static bool_t hid_ups_walk(walkmode_t mode)
 
 			/* These don't need polling after initinfo() normally
 			 * However in "pollonly" mode we use these to detect "Data stale"
-			 * condition (e.g. cable disconnected) by failing the reads:
+			 * condition (e.g. cable disconnected) by failing the reads,
+			 * and they are read again every "pollstatic" seconds if set:
 			 */
-			if ((item->hidflags & HU_FLAG_STATIC) && use_interrupt_pipe)
+			if ((item->hidflags & HU_FLAG_STATIC) && use_interrupt_pipe
+			 && !refresh_due(REFRESH_STATIC))
 				continue;
 
 			/* These need to be polled after user changes (setvar / instcmd)
@@ -2119,6 +2218,11 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 #endif	/* !SHUT_MODE => USB */
 
+		if (item->hiddata) {
+			plan[item->hiddata->ReportID] |= HID_REPORT_READ
+				| ((item->hidflags & HU_FLAG_QUICK_POLL) ? HID_REPORT_VOLATILE : 0);
+		}
+
 		retcode = HIDGetDataValue(udev, item->hiddata, &value, poll_interval);
 
 		switch (retcode)
@@ -2220,6 +2324,25 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 	}
 
+	if (mode == HU_WALKMODE_INIT) {
+		hid2nut_index_build();
+	} else {
+		/* a full update after a change also reads SEMI_STATIC data,
+		 * and one every pollstatic also reads STATIC data: keep the
+		 * plan of the usual ones */
+		if (mode != HU_WALKMODE_FULL_UPDATE
+		 || (data_has_changed == FALSE && !refresh_due(REFRESH_STATIC))) {
+			memcpy(walk_plan[mode], plan, sizeof(plan));
+		}
+
+		/* Diagnostics of the report buffer, e.g. to tune report_backoff */
+		dstate_setinfo("driver.report.hits", "%" PRIuMAX, hid_report_stats.hits);
+		dstate_setinfo("driver.report.misses", "%" PRIuMAX, hid_report_stats.misses);
+		dstate_setinfo("driver.report.transfers", "%" PRIuMAX, hid_report_stats.transfers);
+		dstate_setinfo("driver.report.interrupts", "%" PRIuMAX, hid_report_stats.interrupts);
+		dstate_setinfo("driver.report.deferred", "%" PRIuMAX, hid_report_stats.deferred);
+	}
+
 	return TRUE;
 }
 
@@ -2637,12 +2760,86 @@ static void ups_status_set(void)
 	}
 }
 
+static size_t hid2nut_hash_data(const HIDData_t *hiddata)
+{
+	/* items are allocated in an array, the low bits would vary little */
+	uint32_t	hash = (uint32_t)((uintptr_t)hiddata / sizeof(*hiddata)) * 2654435761U;
+
+	return (size_t)(hash ^ (hash >> 16));
+}
+
+static void hid2nut_index_free(void)
+{
+	free(hid2nut_byname);
+	free(hid2nut_bydata);
+	hid2nut_byname = NULL;
+	hid2nut_bydata = NULL;
+	hid2nut_index_size = 0;
+	hid2nut_indexed = NULL;
+}
+
+static void hid2nut_index_build(void)
+{
+	hid_info_t	*item;
+	size_t	count = 0, slot, mask;
+
+	hid2nut_index_free();
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		count++;
+	}
+
+	/* keep the tables at most half full */
+	for (hid2nut_index_size = 64; hid2nut_index_size < 2 * count; hid2nut_index_size *= 2)
+		;
+	mask = hid2nut_index_size - 1;
+
+	hid2nut_byname = xcalloc(hid2nut_index_size, sizeof(*hid2nut_byname));
+	hid2nut_bydata = xcalloc(hid2nut_index_size, sizeof(*hid2nut_bydata));
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		/* find_nut_info() only returns mapped entries */
+		if (item->hiddata == NULL)
+			continue;
+
+		for (slot = str_hash_ci(item->info_type) & mask;
+		     hid2nut_byname[slot];
+		     slot = (slot + 1) & mask
+		) {
+			if (!strcasecmp(hid2nut_byname[slot]->info_type, item->info_type))
+				break;
+		}
+		if (!hid2nut_byname[slot])
+			hid2nut_byname[slot] = item;
+
+		/* Skip server side vars */
+		if (item->hidflags & HU_FLAG_ABSENT)
+			continue;
+
+		for (slot = hid2nut_hash_data(item->hiddata) & mask;
+		     hid2nut_bydata[slot];
+		     slot = (slot + 1) & mask
+		) {
+			if (hid2nut_bydata[slot]->hiddata == item->hiddata)
+				break;
+		}
+		if (!hid2nut_bydata[slot])
+			hid2nut_bydata[slot] = item;
+	}
+
+	hid2nut_indexed = subdriver->hid2nut;
+
+	upsdebugx(3, "%s: indexed %" PRIuSIZE " entries in %" PRIuSIZE " slots",
+		__func__, count, hid2nut_index_size);
+}
+
 /* find info element definition in info array
  * by NUT varname, or NULL if not found.
  */
 static hid_info_t *find_nut_info(const char *varname)
 {
 	hid_info_t *hidups_item;
+	size_t	slot, mask;
 
 	if (!varname) {
 		upsdebugx(2, "%s: varname == NULL", __func__);
@@ -2656,14 +2853,28 @@ static hid_info_t *find_nut_info(const char *varname)
 		return NULL;
 	}
 
-	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
-		if (strcasecmp(hidups_item->info_type, varname))
-			continue;
+	if (hid2nut_indexed && hid2nut_indexed == subdriver->hid2nut) {
+		mask = hid2nut_index_size - 1;
+		for (slot = str_hash_ci(varname) & mask;
+		     (hidups_item = hid2nut_byname[slot]) != NULL;
+		     slot = (slot + 1) & mask
+		) {
+			if (strcasecmp(hidups_item->info_type, varname))
+				continue;
 
-		if (hidups_item->hiddata != NULL) {
 			errno = 0;
 			return hidups_item;
 		}
+	} else {
+		for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
+			if (strcasecmp(hidups_item->info_type, varname))
+				continue;
+
+			if (hidups_item->hiddata != NULL) {
+				errno = 0;
+				return hidups_item;
+			}
+		}
 	}
 
 	upsdebugx(2, "%s: unknown info type: %s", __func__, varname);
@@ -2677,6 +2888,7 @@ static hid_info_t *find_nut_info(const char *varname)
 static hid_info_t *find_hid_info(const HIDData_t *hiddata)
 {
 	hid_info_t *hidups_item;
+	size_t	slot, mask;
 
 	if (!hiddata) {
 		upsdebugx(2, "%s: hiddata == NULL", __func__);
@@ -2684,6 +2896,22 @@ static hid_info_t *find_hid_info(const HIDData_t *hiddata)
 		return NULL;
 	}
 
+	if (hid2nut_indexed && hid2nut_indexed == subdriver->hid2nut) {
+		mask = hid2nut_index_size - 1;
+		for (slot = hid2nut_hash_data(hiddata) & mask;
+		     (hidups_item = hid2nut_bydata[slot]) != NULL;
+		     slot = (slot + 1) & mask
+		) {
+			if (hidups_item->hiddata == hiddata) {
+				errno = 0;
+				return hidups_item;
+			}
+		}
+
+		errno = EINVAL;
+		return NULL;
+	}
+
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 		/* Skip server side vars */
 		if (hidups_item->hidflags & HU_FLAG_ABSENT)
@@ -33,6 +33,7 @@ extern "C" {
 #define ST_SOCK_BUF_LEN 512
 
 #include "timehead.h"
+#include "nut_stdint.h"
 
 #if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
 typedef struct timespec	st_tree_timespec_t;
@@ -53,6 +54,13 @@ typedef struct st_tree_s {
 	int	flags;
 	long	aux;
 
+	/* upsd: 1 + ID of the slot holding the current value in the
+	 * shared segment of the driver (see ST_SHM_*), 0 if it is val */
+	size_t	shmslot;
+
+	/* upsd: number of the last change of the value, see WATCH */
+	uintmax_t	watchseq;
+
 	/* When was this entry last written (meaning that
 	 * val/raw/safe, flags, aux, enum or range value
 	 * was added, changed or deleted)?
@@ -64,6 +72,7 @@ typedef struct st_tree_s {
 
 	struct st_tree_s	*left;
 	struct st_tree_s	*right;
+	size_t	height;		/* of this subtree, for AVL balancing */
 } st_tree_t;
 
 int state_get_timestamp(st_tree_timespec_t *now);
@@ -88,6 +97,103 @@ int state_delenum(st_tree_t *root, const char *var, const char *val);
 int state_delrange(st_tree_t *root, const char *var, const int min, const int max);
 st_tree_t *state_tree_find(st_tree_t *node, const char *var);
 
+/* Optional binary framing of the driver socket protocol (negotiated
+ * with "PROTOCOL BINARY <version>", see docs/sock-protocol.txt).
+ * A frame is a 4-byte big-endian payload length followed by records;
+ * each record starts with one of the ST_BIN_* opcodes below. Variable
+ * names are interned: the sender defines a numeric ID once per
+ * connection (ST_BIN_DEFINE) and refers to it in later records.
+ * Strings are sent with a 2-byte length which counts a trailing NUL
+ * that is also sent, so the receiver uses them in place. */
+#define ST_BIN_PROTOCOL_VERSION	1
+#define ST_BIN_HEADER_LEN	4
+#define ST_BIN_FRAME_MAX	(4 * 1024 * 1024)
+
+#define ST_BIN_DEFINE		1	/* id, name */
+#define ST_BIN_SETINFO		2	/* id, value */
+#define ST_BIN_DELINFO		3	/* id */
+#define ST_BIN_ADDENUM		4	/* id, value */
+#define ST_BIN_DELENUM		5	/* id, value */
+#define ST_BIN_ADDRANGE		6	/* id, min, max */
+#define ST_BIN_DELRANGE		7	/* id, min, max */
+#define ST_BIN_SETAUX		8	/* id, aux */
+#define ST_BIN_SETFLAGS		9	/* id, flags */
+#define ST_BIN_ADDCMD		10	/* name */
+#define ST_BIN_DELCMD		11	/* name */
+#define ST_BIN_TEXT		12	/* one line of the text protocol */
+#define ST_BIN_SHMINFO		13	/* id: value changed in the shared segment */
+
+typedef struct st_bin_buf_s {
+	unsigned char	*data;
+	size_t	len;
+	size_t	size;
+} st_bin_buf_t;
+
+typedef struct st_bin_rec_s {
+	int	op;
+	size_t	id;
+	const char	*str;	/* points into the frame */
+	long	num1;		/* range min, aux or flags */
+	long	num2;		/* range max */
+} st_bin_rec_t;
+
+/* append a record to the frame being built in buf (starting a new frame
+ * if buf is empty); returns 0 if str is too long to be encoded */
+int st_bin_add(st_bin_buf_t *buf, int op, size_t id, const char *str, long num1, long num2);
+/* fill in the header of the frame in buf, ready to be written out */
+void st_bin_finish(st_bin_buf_t *buf);
+/* payload length from a frame header */
+size_t st_bin_frame_len(const unsigned char *hdr);
+/* decode the record at *pos of the payload, and advance *pos past it;
+ * returns 1 for a record, 0 at the end of the payload, -1 if malformed */
+int st_bin_next(const unsigned char *payload, size_t len, size_t *pos, st_bin_rec_t *rec);
+void st_bin_free(st_bin_buf_t *buf);
+
+/* Optional publication of the values in a memory-mapped file (negotiated
+ * with "PROTOCOL SHM <version>", on top of binary frames): the segment is
+ * a header and an array of fixed-size slots, indexed by the variable IDs
+ * of the binary protocol. Each slot is guarded by a sequence counter that
+ * the writer makes odd while it changes the value (a seqlock): readers
+ * retry until they copy out a value with the same even count before and
+ * after. Frames still carry everything else, and ST_BIN_SHMINFO records
+ * tell which slots have changed. */
+#if (defined HAVE_SYS_MMAN_H) && (defined HAVE_MMAP) && !(defined WIN32) \
+ && ((defined __GNUC__) || (defined __clang__))
+# define ST_SHM_SUPPORTED	1
+#endif
+
+#define ST_SHM_VERSION		1
+#define ST_SHM_MAGIC		"NUTSTSHM"
+#define ST_SHM_MIN_SLOTS	256
+#define ST_SHM_READ_RETRIES	1000
+
+typedef struct st_shm_header_s {
+	char	magic[8];	/* ST_SHM_MAGIC, without the NUL */
+	uint32_t	version;
+	uint32_t	numslots;
+	uint32_t	slotsize;	/* sizeof(st_shm_slot_t) of the writer */
+	uint32_t	reserved;
+} st_shm_header_t;
+
+typedef struct st_shm_slot_s {
+	volatile uint32_t	seq;	/* odd while being written */
+	char	val[ST_MAX_VALUE_LEN];
+} st_shm_slot_t;
+
+#ifdef ST_SHM_SUPPORTED
+/* bytes needed for a segment of numslots slots */
+size_t st_shm_size(size_t numslots);
+/* slot number id of the segment starting at hdr */
+st_shm_slot_t *st_shm_slot(const st_shm_header_t *hdr, size_t id);
+/* fill in the header of a new (zeroed) segment */
+void st_shm_init(st_shm_header_t *hdr, size_t numslots);
+/* check that a mapped segment of size bytes is one we can read */
+int st_shm_valid(const st_shm_header_t *hdr, size_t size);
+void st_shm_write(st_shm_slot_t *slot, const char *val);
+/* copy out a consistent value; returns 0 if the writer kept changing it */
+int st_shm_read(const st_shm_slot_t *slot, char *buf, size_t bufsize);
+#endif	/* ST_SHM_SUPPORTED */
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
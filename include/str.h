@@ -135,6 +135,24 @@ int	str_to_double_strict(const char *string, double *number, const int base);
  */
 int	str_ends_with(const char *s, const char *suff);
 
+/* Return a hash of the string which ignores the case of ASCII letters,
+ * so strings that strcasecmp() considers equal hash the same (e.g. for
+ * lookup tables keyed by NUT variable names). NULL hashes as "". */
+size_t	str_hash_ci(const char *s);
+
+/* Return the same kind of hash of len bytes of buf (e.g. to tell if some
+ * data changed). NULL hashes as no bytes. */
+size_t	str_hash_buf(const void *buf, size_t len);
+
+/* Return a key made of the length and the first character (as upper case)
+ * of the string, so that a keyword (like a protocol command) can be looked
+ * up with a switch() over the STR_KEY() of those it may be, and only the
+ * few with the same key need to be compared with strcasecmp(). Strings
+ * longer than STR_KEY_MAXLEN characters (or NULL) have the key 0. */
+#define STR_KEY_MAXLEN	0xff
+#define STR_KEY(len, ch)	((int)(((len) << 8) | (unsigned char)(ch)))
+int	str_key(const char *s);
+
 #ifndef HAVE_STRSEP
 /* Makefile should add the implem to libcommon(client).la */
 char *strsep(char **stringp, const char *delim);
@@ -77,6 +77,7 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 		return;
 	}
 #endif	/* WIN32 */
+	temp->ev_fd = ERROR_FD;
 	temp->sock_fd = sstate_connect(temp);
 
 	/* preload this to the current time to avoid false staleness */
@@ -190,6 +191,28 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		}
 	}
 
+	/* DRIVER_PROTOCOL <text|binary|shm> */
+	if (!strcmp(arg[0], "DRIVER_PROTOCOL")) {
+		if (!strcasecmp(arg[1], "text")) {
+			driver_protocol = DRIVER_PROTOCOL_TEXT;
+			return 1;
+		}
+		if (!strcasecmp(arg[1], "binary")) {
+			driver_protocol = DRIVER_PROTOCOL_BINARY;
+			return 1;
+		}
+		if (!strcasecmp(arg[1], "shm")) {
+#ifndef ST_SHM_SUPPORTED
+			upslogx(LOG_WARNING, "DRIVER_PROTOCOL shm is not supported "
+				"in this build, using binary instead");
+#endif	/* !ST_SHM_SUPPORTED */
+			driver_protocol = DRIVER_PROTOCOL_SHM;
+			return 1;
+		}
+		upslogx(LOG_ERR, "DRIVER_PROTOCOL has unknown value (%s)!", arg[1]);
+		return 0;
+	}
+
 	/* TRACKINGDELAY <seconds> */
 	if (!strcmp(arg[0], "TRACKINGDELAY")) {
 		if (isdigit((size_t)arg[1][0])) {
@@ -301,6 +324,24 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		upslogx(LOG_ERR, "DISABLE_WEAK_SSL has non boolean value (%s)!", arg[1]);
 		return 0;
 	}
+
+	/* SSL_HANDSHAKE_WORKERS <num> */
+	if (!strcmp(arg[0], "SSL_HANDSHAKE_WORKERS")) {
+		if (isdigit((size_t)arg[1][0])) {
+			ssl_handshake_workers = atoi(arg[1]);
+#ifndef NETSSL_WITH_WORKERS
+			if (ssl_handshake_workers > 0) {
+				upslogx(LOG_WARNING, "SSL_HANDSHAKE_WORKERS is not supported "
+					"in this build, handshakes will be done in the main loop");
+			}
+#endif	/* NETSSL_WITH_WORKERS */
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "SSL_HANDSHAKE_WORKERS has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
 #endif /* WITH_OPENSSL | WITH_NSS */
 
 	/* ACCEPT <aclname> [<aclname>...] */
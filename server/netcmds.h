@@ -34,6 +34,7 @@
 #include "netmisc.h"
 #include "netuser.h"
 #include "netinstcmd.h"
+#include "netwatch.h"
 
 #define FLAG_USER	0x0001		/* username and password must be set */
 
@@ -43,6 +44,29 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* the entries of netcmds[], in the same order (checked below) */
+enum {
+	NETCMD_VER = 0,
+	NETCMD_NETVER,
+	NETCMD_PROTVER,
+	NETCMD_HELP,
+	NETCMD_STARTTLS,
+	NETCMD_GET,
+	NETCMD_LIST,
+	NETCMD_USERNAME,
+	NETCMD_PASSWORD,
+	NETCMD_LOGIN,
+	NETCMD_LOGOUT,
+	NETCMD_PRIMARY,
+	NETCMD_MASTER,
+	NETCMD_FSD,
+	NETCMD_SET,
+	NETCMD_INSTCMD,
+	NETCMD_WATCH,
+	NETCMD_UNWATCH,
+	NETCMD_COUNT	/* not a command: the number of them */
+};
+
 static struct {
 	const	char	*name;
 	void	(*func)(nut_ctype_t *client, size_t numargs, const char **arg);
@@ -73,9 +97,54 @@ static struct {
 	{ "SET",	net_set,	FLAG_USER	},
 	{ "INSTCMD",	net_instcmd,	FLAG_USER	},
 
+	{ "WATCH",	net_watch,	FLAG_USER	},
+	{ "UNWATCH",	net_unwatch,	0		},
+
 	{ NULL,		(void(*)(struct nut_ctype_s *, size_t,  const char **))(NULL), 0		}
 };
 
+/* fails to build (negative array size) if an entry was added to or
+ * removed from netcmds[], but not to the enum above */
+typedef char netcmds_match_the_enum[(SIZEOF_ARRAY(netcmds) - 1 == NETCMD_COUNT) ? 1 : -1];
+
+/* find the entry of netcmds[] for a command, or -1: only the (at most two)
+ * entries with the same length and first letter are compared */
+static int netcmd_find(const char *name)
+{
+	int	i, j = -1;
+
+	switch (str_key(name))
+	{
+	case STR_KEY(3, 'V'):	i = NETCMD_VER;		break;
+	case STR_KEY(6, 'N'):	i = NETCMD_NETVER;	break;
+	case STR_KEY(7, 'P'):	i = NETCMD_PROTVER;	j = NETCMD_PRIMARY;	break;
+	case STR_KEY(4, 'H'):	i = NETCMD_HELP;	break;
+	case STR_KEY(8, 'S'):	i = NETCMD_STARTTLS;	break;
+	case STR_KEY(3, 'G'):	i = NETCMD_GET;		break;
+	case STR_KEY(4, 'L'):	i = NETCMD_LIST;	break;
+	case STR_KEY(8, 'U'):	i = NETCMD_USERNAME;	break;
+	case STR_KEY(8, 'P'):	i = NETCMD_PASSWORD;	break;
+	case STR_KEY(5, 'L'):	i = NETCMD_LOGIN;	break;
+	case STR_KEY(6, 'L'):	i = NETCMD_LOGOUT;	break;
+	case STR_KEY(6, 'M'):	i = NETCMD_MASTER;	break;
+	case STR_KEY(3, 'F'):	i = NETCMD_FSD;		break;
+	case STR_KEY(3, 'S'):	i = NETCMD_SET;		break;
+	case STR_KEY(7, 'I'):	i = NETCMD_INSTCMD;	break;
+	case STR_KEY(5, 'W'):	i = NETCMD_WATCH;	break;
+	case STR_KEY(7, 'U'):	i = NETCMD_UNWATCH;	break;
+	default:
+		return -1;
+	}
+
+	if (!strcasecmp(netcmds[i].name, name))
+		return i;
+
+	if (j >= 0 && !strcasecmp(netcmds[j].name, name))
+		return j;
+
+	return -1;
+}
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
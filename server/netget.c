@@ -183,7 +183,8 @@ static void get_type(nut_ctype_t *client, const char *upsname, const char *var)
 	sendback(client, "%s NUMBER\n", buf);
 }
 
-static void get_var_server(nut_ctype_t *client, const char *upsname, const char *var)
+/* the value of a server.* variable, or NULL if there is no such one */
+static const char *get_var_server(const char *var, char *buf, size_t buflen)
 {
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
 #pragma GCC diagnostic push
@@ -202,15 +203,15 @@ static void get_var_server(nut_ctype_t *client, const char *upsname, const char
 		 * NUT_VERSION_IS_RELEASE make one of codepaths unreachable in
 		 * a particular build. So we pragmatically handwave this away.
 		 */
-		sendback(client, "VAR %s server.info "
-			"\"Network UPS Tools upsd %s - "
-			"%s%s%s\"\n",
-			upsname, UPS_VERSION,
+		snprintf(buf, buflen,
+			"Network UPS Tools upsd %s - "
+			"%s%s%s",
+			UPS_VERSION,
 			PACKAGE_URL ? PACKAGE_URL : "",
 			(PACKAGE_URL && !pkgurlHasNutOrg) ? " or " : "",
 			pkgurlHasNutOrg ? "" : "https://www.networkupstools.org/"
 			);
-		return;
+		return buf;
 	}
 #ifdef __clang__
 #pragma clang diagnostic pop
@@ -220,47 +221,109 @@ static void get_var_server(nut_ctype_t *client, const char *upsname, const char
 #endif
 
 	if (!strcasecmp(var, "server.version")) {
-		sendback(client, "VAR %s server.version \"%s\"\n",
-			upsname, UPS_VERSION);
-		return;
+		return UPS_VERSION;
 	}
 
-	send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
+	return NULL;
 }
 
-static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
+/* the value of a variable as it is sent in a VAR line (buf is used if
+ * it has to be put together), or NULL with the reason in *err */
+static const char *get_var_value(const char *upsname, const char *var,
+	char *buf, size_t buflen, const char **err)
 {
 	const	upstype_t	*ups;
 	const	char	*val;
 
+	*err = NUT_ERR_VAR_NOT_SUPPORTED;
+
 	/* ignore upsname for server.* variables */
 	if (!strncasecmp(var, "server.", 7)) {
-		get_var_server(client, upsname, var);
-		return;
+		return get_var_server(var, buf, buflen);
 	}
 
 	ups = get_ups_ptr(upsname);
 
 	if (!ups) {
-		send_err(client, NUT_ERR_UNKNOWN_UPS);
-		return;
+		*err = NUT_ERR_UNKNOWN_UPS;
+		return NULL;
 	}
 
-	if (!ups_available(ups, client))
-		return;
+	/* same as ups_available(), for replies with several values */
+	if (INVALID_FD(ups->sock_fd)) {
+		*err = NUT_ERR_DRIVER_NOT_CONNECTED;
+		return NULL;
+	}
+
+	if (ups->stale) {
+		*err = NUT_ERR_DATA_STALE;
+		return NULL;
+	}
 
 	val = sstate_getinfo(ups, var);
 
 	if (!val) {
-		send_err(client, NUT_ERR_VAR_NOT_SUPPORTED);
-		return;
+		return NULL;
 	}
 
 	/* handle special case for status */
-	if ((!strcasecmp(var, "ups.status")) && (ups->fsd))
-		sendback(client, "VAR %s %s \"FSD %s\"\n", upsname, var, val);
-	else
-		sendback(client, "VAR %s %s \"%s\"\n", upsname, var, val);
+	if ((!strcasecmp(var, "ups.status")) && (ups->fsd)) {
+		snprintf(buf, buflen, "FSD %s", val);
+		return buf;
+	}
+
+	return val;
+}
+
+static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
+{
+	char	buf[LARGEBUF];
+	const	char	*val, *err;
+
+	val = get_var_value(upsname, var, buf, sizeof(buf), &err);
+
+	if (!val) {
+		send_err(client, err);
+		return;
+	}
+
+	sendback(client, "VAR %s %s \"%s\"\n", upsname, var, val);
+}
+
+/* several variables (of one or more UPSes) in one reply, in the order
+ * they were asked for; the ones which are not available get an ERR line
+ * (naming them) instead of failing the whole request */
+static void get_vars(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	char	buf[LARGEBUF];
+	const	char	*val, *err;
+	size_t	i;
+
+	if (numarg % 2) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!sendback(client, "BEGIN GET VARS\n")) {
+		return;
+	}
+
+	for (i = 0; i < numarg; i += 2) {
+		val = get_var_value(arg[i], arg[i + 1], buf, sizeof(buf), &err);
+
+		if (!val) {
+			if (!sendback(client, "ERR %s %s %s\n", err, arg[i], arg[i + 1])) {
+				return;
+			}
+			continue;
+		}
+
+		if (!sendback(client, "VAR %s %s \"%s\"\n", arg[i], arg[i + 1], val)) {
+			return;
+		}
+	}
+
+	sendback(client, "END GET VARS\n");
 }
 
 void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
@@ -270,8 +333,14 @@ void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* only the subcommand of the same length and first letter is tried */
+	switch (str_key(arg[0]))
+	{
 	/* GET TRACKING [ID] */
-	if (!strcasecmp(arg[0], "TRACKING")) {
+	case STR_KEY(8, 'T'):
+		if (strcasecmp(arg[0], "TRACKING"))
+			break;
+
 		if (numarg < 2) {
 			sendback(client, "%s\n", (client->tracking) ? "ON" : "OFF");
 		}
@@ -282,52 +351,65 @@ void net_get(nut_ctype_t *client, size_t numarg, const char **arg)
 				send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
 		}
 		return;
-	}
-
-	if (numarg < 2) {
-		send_err(client, NUT_ERR_INVALID_ARGUMENT);
-		return;
-	}
 
 	/* GET NUMLOGINS UPS */
-	if (!strcasecmp(arg[0], "NUMLOGINS")) {
-		get_numlogins(client, arg[1]);
-		return;
-	}
+	case STR_KEY(9, 'N'):
+		if (!strcasecmp(arg[0], "NUMLOGINS") && numarg >= 2) {
+			get_numlogins(client, arg[1]);
+			return;
+		}
+		break;
 
 	/* GET UPSDESC UPS */
-	if (!strcasecmp(arg[0], "UPSDESC")) {
-		get_upsdesc(client, arg[1]);
-		return;
-	}
+	case STR_KEY(7, 'U'):
+		if (!strcasecmp(arg[0], "UPSDESC") && numarg >= 2) {
+			get_upsdesc(client, arg[1]);
+			return;
+		}
+		break;
 
-	if (numarg < 3) {
-		send_err(client, NUT_ERR_INVALID_ARGUMENT);
-		return;
-	}
+	/* GET VARS UPS VARNAME [UPS VARNAME ...] */
+	case STR_KEY(4, 'V'):
+		if (!strcasecmp(arg[0], "VARS") && numarg >= 3) {
+			get_vars(client, numarg - 1, &arg[1]);
+			return;
+		}
+		break;
 
 	/* GET VAR UPS VARNAME */
-	if (!strcasecmp(arg[0], "VAR")) {
-		get_var(client, arg[1], arg[2]);
-		return;
-	}
+	case STR_KEY(3, 'V'):
+		if (!strcasecmp(arg[0], "VAR") && numarg >= 3) {
+			get_var(client, arg[1], arg[2]);
+			return;
+		}
+		break;
 
 	/* GET TYPE UPS VARNAME */
-	if (!strcasecmp(arg[0], "TYPE")) {
-		get_type(client, arg[1], arg[2]);
-		return;
-	}
+	case STR_KEY(4, 'T'):
+		if (!strcasecmp(arg[0], "TYPE") && numarg >= 3) {
+			get_type(client, arg[1], arg[2]);
+			return;
+		}
+		break;
 
 	/* GET DESC UPS VARNAME */
-	if (!strcasecmp(arg[0], "DESC")) {
-		get_desc(client, arg[1], arg[2]);
-		return;
-	}
+	case STR_KEY(4, 'D'):
+		if (!strcasecmp(arg[0], "DESC") && numarg >= 3) {
+			get_desc(client, arg[1], arg[2]);
+			return;
+		}
+		break;
 
 	/* GET CMDDESC UPS CMDNAME */
-	if (!strcasecmp(arg[0], "CMDDESC")) {
-		get_cmddesc(client, arg[1], arg[2]);
-		return;
+	case STR_KEY(7, 'C'):
+		if (!strcasecmp(arg[0], "CMDDESC") && numarg >= 3) {
+			get_cmddesc(client, arg[1], arg[2]);
+			return;
+		}
+		break;
+
+	default:
+		break;
 	}
 
 	send_err(client, NUT_ERR_INVALID_ARGUMENT);
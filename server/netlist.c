@@ -31,27 +31,32 @@
 extern	upstype_t	*firstups;	/* for list_ups */
 extern	nut_ctype_t *firstclient;	/* for list_clients */
 
-static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
-	int rw, int fsd)
+static int tree_dump(st_tree_t *node, nut_ctype_t *client, const upstype_t *ups,
+	const char *upsname, int rw, int fsd)
 {
 	int	ret;
+	const char	*val;
 
 	if (!node)
 		return 1;	/* not an error */
 
 	if (node->left) {
-		ret = tree_dump(node->left, client, ups, rw, fsd);
+		ret = tree_dump(node->left, client, ups, upsname, rw, fsd);
 
 		if (!ret)
 			return 0;		/* write failed in child */
 	}
 
-	if (rw) {
+	/* not available right now (see sstate_getnodeval) */
+	if ((val = sstate_getnodeval(ups, node)) == NULL) {
+		ret = 1;
+
+	} else if (rw) {
 
 		/* only send this back if it's been flagged RW */
 		if (node->flags & ST_FLAG_RW) {
 			ret = sendback(client, "RW %s %s \"%s\"\n",
-				ups, node->var, node->val);
+				upsname, node->var, val);
 
 		} else {
 			ret = 1;	/* dummy */
@@ -64,11 +69,11 @@ static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
 		/* status is always a special case */
 		if ((fsd == 1) && (!strcasecmp(node->var, "ups.status"))) {
 			ret = sendback(client, "VAR %s %s \"FSD %s\"\n",
-				ups, node->var, node->val);
+				upsname, node->var, val);
 
 		} else {
 			ret = sendback(client, "VAR %s %s \"%s\"\n",
-				ups, node->var, node->val);
+				upsname, node->var, val);
 		}
 	}
 
@@ -76,7 +81,7 @@ static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
 		return 0;
 
 	if (node->right)
-		return tree_dump(node->right, client, ups, rw, fsd);
+		return tree_dump(node->right, client, ups, upsname, rw, fsd);
 
 	return 1;
 }
@@ -98,7 +103,7 @@ static void list_rw(nut_ctype_t *client, const char *upsname)
 	if (!sendback(client, "BEGIN LIST RW %s\n", upsname))
 		return;
 
-	if (!tree_dump(ups->inforoot, client, upsname, 1, ups->fsd))
+	if (!tree_dump(ups->inforoot, client, ups, upsname, 1, ups->fsd))
 		return;
 
 	sendback(client, "END LIST RW %s\n", upsname);
@@ -121,7 +126,7 @@ static void list_var(nut_ctype_t *client, const char *upsname)
 	if (!sendback(client, "BEGIN LIST VAR %s\n", upsname))
 		return;
 
-	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd))
+	if (!tree_dump(ups->inforoot, client, ups, upsname, 0, ups->fsd))
 		return;
 
 	sendback(client, "END LIST VAR %s\n", upsname);
@@ -292,56 +297,67 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* only the subcommand of the same length and first letter is tried */
+	switch (str_key(arg[0]))
+	{
 	/* LIST UPS */
-	if (!strcasecmp(arg[0], "UPS")) {
-		list_ups(client);
-		return;
-	}
-
-	if (numarg < 2) {
-		send_err(client, NUT_ERR_INVALID_ARGUMENT);
-		return;
-	}
+	case STR_KEY(3, 'U'):
+		if (!strcasecmp(arg[0], "UPS")) {
+			list_ups(client);
+			return;
+		}
+		break;
 
 	/* LIST VAR UPS */
-	if (!strcasecmp(arg[0], "VAR")) {
-		list_var(client, arg[1]);
-		return;
-	}
+	case STR_KEY(3, 'V'):
+		if (!strcasecmp(arg[0], "VAR") && numarg >= 2) {
+			list_var(client, arg[1]);
+			return;
+		}
+		break;
 
 	/* LIST RW UPS */
-	if (!strcasecmp(arg[0], "RW")) {
-		list_rw(client, arg[1]);
-		return;
-	}
+	case STR_KEY(2, 'R'):
+		if (!strcasecmp(arg[0], "RW") && numarg >= 2) {
+			list_rw(client, arg[1]);
+			return;
+		}
+		break;
 
 	/* LIST CMD UPS */
-	if (!strcasecmp(arg[0], "CMD")) {
-		list_cmd(client, arg[1]);
-		return;
-	}
+	case STR_KEY(3, 'C'):
+		if (!strcasecmp(arg[0], "CMD") && numarg >= 2) {
+			list_cmd(client, arg[1]);
+			return;
+		}
+		break;
 
 	/* LIST CLIENT UPS */
-	if (!strcasecmp(arg[0], "CLIENT")) {
-		list_clients(client, arg[1]);
-		return;
-	}
-
-	if (numarg < 3) {
-		send_err(client, NUT_ERR_INVALID_ARGUMENT);
-		return;
-	}
+	case STR_KEY(6, 'C'):
+		if (!strcasecmp(arg[0], "CLIENT") && numarg >= 2) {
+			list_clients(client, arg[1]);
+			return;
+		}
+		break;
 
 	/* LIST ENUM UPS VARNAME */
-	if (!strcasecmp(arg[0], "ENUM")) {
-		list_enum(client, arg[1], arg[2]);
-		return;
-	}
+	case STR_KEY(4, 'E'):
+		if (!strcasecmp(arg[0], "ENUM") && numarg >= 3) {
+			list_enum(client, arg[1], arg[2]);
+			return;
+		}
+		break;
 
 	/* LIST RANGE UPS VARNAME */
-	if (!strcasecmp(arg[0], "RANGE")) {
-		list_range(client, arg[1], arg[2]);
-		return;
+	case STR_KEY(5, 'R'):
+		if (!strcasecmp(arg[0], "RANGE") && numarg >= 3) {
+			list_range(client, arg[1], arg[2]);
+			return;
+		}
+		break;
+
+	default:
+		break;
 	}
 
 	send_err(client, NUT_ERR_INVALID_ARGUMENT);
@@ -28,6 +28,7 @@
 #include "neterr.h"
 
 #include "netmisc.h"
+#include "netwatch.h"
 
 void net_ver(nut_ctype_t *client, size_t numarg, const char **arg)
 {
@@ -93,13 +94,14 @@ void net_help(nut_ctype_t *client, size_t numarg, const char **arg)
 	}
 
 	sendback(client, "Commands: HELP VER PROTVER GET LIST SET INSTCMD"
-		" LOGIN LOGOUT USERNAME PASSWORD STARTTLS\n");
+		" LOGIN LOGOUT USERNAME PASSWORD STARTTLS WATCH UNWATCH\n");
 	/* Not exposed: PRIMARY/MASTER FSD */
 }
 
 void net_fsd(nut_ctype_t *client, size_t numarg, const char **arg)
 {
 	upstype_t	*ups;
+	st_tree_t	*node;
 
 	if (numarg != 1) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
@@ -123,6 +125,12 @@ void net_fsd(nut_ctype_t *client, size_t numarg, const char **arg)
 		client->username, client->addr, ups->name);
 
 	ups->fsd = 1;
+
+	/* the status shown to clients changed (see watch_sendvar) */
+	if ((node = state_tree_find(ups->inforoot, "ups.status")) != NULL) {
+		watch_changed(ups, node);
+	}
+
 	sendback(client, "OK FSD-SET\n");
 }
 
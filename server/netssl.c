@@ -39,6 +39,12 @@
 #include "netssl.h"
 #include "nut_stdint.h"
 
+#ifdef NETSSL_WITH_WORKERS
+#	include <pthread.h>
+#	include <signal.h>
+#	include <fcntl.h>
+#endif /* NETSSL_WITH_WORKERS */
+
 #ifdef WITH_NSS
 #	include <pk11pub.h>
 #	include <prinit.h>
@@ -66,6 +72,12 @@ char	*certpasswd = NULL;
  */
 int	disable_weak_ssl = 0;
 
+/* Amount of threads to do TLS handshakes with, so a slow or stalled
+ * client does not hold up the main loop; 0 = handshake inline (as
+ * before). See upsd.conf option SSL_HANDSHAKE_WORKERS.
+ */
+int	ssl_handshake_workers = 0;
+
 #ifdef WITH_CLIENT_CERTIFICATE_VALIDATION
 int certrequest = 0;
 #endif /* WITH_CLIENT_CERTIFICATE_VALIDATION */
@@ -274,14 +286,322 @@ static void HandshakeCallback(PRFileDesc *fd, nut_ctype_t *client_data)
 
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+/* give up on a client that stalls in the middle of a handshake after
+ * this many seconds (same as upsd sheds inactive clients) */
+#define SSL_HANDSHAKE_TIMEOUT	60
+
+#ifdef WITH_OPENSSL
+/* limit how long blocking socket I/O may take, 0 = no limit */
+static void ssl_set_timeout(nut_ctype_t *client, time_t sec)
+{
+#ifndef WIN32
+	struct timeval	tv;
+
+	tv.tv_sec = sec;
+	tv.tv_usec = 0;
+
+	if (setsockopt(client->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+	 || setsockopt(client->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0
+	) {
+		upsdebug_with_errno(1, "%s: could not set socket timeout for %s",
+			__func__, client->addr);
+	}
+#else	/* WIN32 */
+	NUT_UNUSED_VARIABLE(client);
+	NUT_UNUSED_VARIABLE(sec);
+#endif	/* WIN32 */
+}
+#endif /* WITH_OPENSSL */
+
+/* do the server side of the TLS handshake with a client that was told
+ * "OK STARTTLS"; this blocks until the client completes it (or fails,
+ * or times out), so can be called from a worker thread - it only
+ * touches the SSL state of this client */
+static void ssl_handshake(nut_ctype_t *client)
 {
 #ifdef WITH_OPENSSL
 	int ret;
+
+	ssl_set_timeout(client, SSL_HANDSHAKE_TIMEOUT);
+	ret = SSL_accept(client->ssl);
+	ssl_set_timeout(client, 0);
+
+	switch (ret)
+	{
+	case 1:
+		client->ssl_connected = 1;
+		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
+		break;
+
+	case 0:
+		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
+		ssl_error(client->ssl, ret);
+		break;
+
+	case -1:
+		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
+		ssl_error(client->ssl, ret);
+		break;
+	default:
+		break;
+	}
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 	SECStatus	status;
-	PRFileDesc	*socket;
+
+	/* Note: this call can generate memory leaks not resolvable
+	 * by any release function.
+	 * Probably SSL session key object allocation. */
+	status = SSL_ForceHandshakeWithTimeout(client->ssl,
+		PR_SecondsToInterval(SSL_HANDSHAKE_TIMEOUT));
+	if (status != SECSuccess) {
+		PRErrorCode code = PR_GetError();
+		if (code==SSL_ERROR_NO_CERTIFICATE) {
+			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
+				client->addr);
+		} else {
+			nss_error("net_starttls / SSL_ForceHandshake");
+			/* TODO : Close the connection. */
+			return;
+		}
+	}
+	client->ssl_connected = 1;
 #endif /* WITH_OPENSSL | WITH_NSS */
+}
+
+#ifdef NETSSL_WITH_WORKERS
+/* The handshake worker pool: clients are queued by net_starttls() and
+ * are not watched by the main loop until a worker is done with them.
+ * Workers only run the handshake, all protocol commands (and so all
+ * access to the driver state trees) stay in the main thread.
+ * Completed clients are listed for ssl_handshake_done(), and a byte
+ * is written into a pipe to wake up the main loop.
+ */
+static pthread_t	*ssl_workers = NULL;
+static size_t	ssl_workers_count = 0;
+static int	ssl_workers_stop = 0;
+static pthread_mutex_t	ssl_workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	ssl_workers_cond = PTHREAD_COND_INITIALIZER;
+
+/* waiting for a worker (FIFO), in a handshake, done (for the main loop) */
+static nut_ctype_t	*ssl_queue_todo = NULL, *ssl_queue_todo_last = NULL;
+static nut_ctype_t	*ssl_queue_busy = NULL;
+static nut_ctype_t	*ssl_queue_done = NULL;
+
+static int	ssl_notify_pipe[2] = { -1, -1 };
+
+static void *ssl_worker(void *arg)
+{
+	nut_ctype_t	*client, **cpp;
+	ssize_t	ret;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	pthread_mutex_lock(&ssl_workers_mutex);
+
+	while (!ssl_workers_stop) {
+		if (!ssl_queue_todo) {
+			pthread_cond_wait(&ssl_workers_cond, &ssl_workers_mutex);
+			continue;
+		}
+
+		client = ssl_queue_todo;
+		ssl_queue_todo = client->ssl_queue_next;
+		if (!ssl_queue_todo) {
+			ssl_queue_todo_last = NULL;
+		}
+
+		client->ssl_queue_next = ssl_queue_busy;
+		ssl_queue_busy = client;
+
+		pthread_mutex_unlock(&ssl_workers_mutex);
+
+		upsdebugx(3, "%s: TLS handshake with %s", __func__, client->addr);
+		ssl_handshake(client);
+
+		pthread_mutex_lock(&ssl_workers_mutex);
+
+		for (cpp = &ssl_queue_busy; *cpp; cpp = &(*cpp)->ssl_queue_next) {
+			if (*cpp == client) {
+				*cpp = client->ssl_queue_next;
+				break;
+			}
+		}
+
+		client->ssl_queue_next = ssl_queue_done;
+		ssl_queue_done = client;
+
+		/* a full pipe is as good, the main loop has yet to read it */
+		do {
+			ret = write(ssl_notify_pipe[1], "", 1);
+		} while (ret < 0 && errno == EINTR);
+	}
+
+	pthread_mutex_unlock(&ssl_workers_mutex);
+
+	return NULL;
+}
+
+static void ssl_workers_start(void)
+{
+	size_t	i;
+	int	i_pipe;
+	sigset_t	set, oldset;
+
+	if (ssl_handshake_workers < 1) {
+		return;
+	}
+
+	if (pipe(ssl_notify_pipe) != 0) {
+		upslog_with_errno(LOG_ERR, "Could not create a pipe for TLS workers, "
+			"handshakes will be done in the main loop");
+		ssl_notify_pipe[0] = ssl_notify_pipe[1] = -1;
+		return;
+	}
+
+	for (i_pipe = 0; i_pipe < 2; i_pipe++) {
+		int	flags = fcntl(ssl_notify_pipe[i_pipe], F_GETFL, 0);
+
+		if (flags == -1 || fcntl(ssl_notify_pipe[i_pipe], F_SETFL, flags | O_NONBLOCK) == -1) {
+			upslog_with_errno(LOG_WARNING, "%s: fcntl(O_NONBLOCK)", __func__);
+		}
+		set_close_on_exec(ssl_notify_pipe[i_pipe]);
+	}
+
+	ssl_workers = xcalloc((size_t)ssl_handshake_workers, sizeof(*ssl_workers));
+	ssl_workers_stop = 0;
+
+	/* signals (e.g. to reload or exit) are for the main loop to handle */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+
+	for (i = 0; i < (size_t)ssl_handshake_workers; i++) {
+		if (pthread_create(&ssl_workers[i], NULL, ssl_worker, NULL) != 0) {
+			upslog_with_errno(LOG_ERR, "Could not start TLS worker thread #%" PRIuSIZE, i);
+			break;
+		}
+		ssl_workers_count++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	upslogx(LOG_INFO, "Started %" PRIuSIZE " thread(s) for TLS handshakes",
+		ssl_workers_count);
+}
+
+/* let the workers finish up and exit; clients still queued or
+ * handled by them become plain members of the client list again */
+static void ssl_workers_end(void)
+{
+	nut_ctype_t	*client, *cnext;
+	size_t	i;
+
+	if (!ssl_workers) {
+		return;
+	}
+
+	pthread_mutex_lock(&ssl_workers_mutex);
+	ssl_workers_stop = 1;
+	/* interrupt handshakes in progress */
+	for (client = ssl_queue_busy; client; client = client->ssl_queue_next) {
+		shutdown(client->sock_fd, 2);
+	}
+	pthread_cond_broadcast(&ssl_workers_cond);
+	pthread_mutex_unlock(&ssl_workers_mutex);
+
+	for (i = 0; i < ssl_workers_count; i++) {
+		pthread_join(ssl_workers[i], NULL);
+	}
+
+	free(ssl_workers);
+	ssl_workers = NULL;
+	ssl_workers_count = 0;
+
+	for (client = ssl_queue_todo; client; client = cnext) {
+		cnext = client->ssl_queue_next;
+		client->ssl_queue_next = NULL;
+		client->ssl_handshaking = 0;
+	}
+
+	for (client = ssl_queue_done; client; client = cnext) {
+		cnext = client->ssl_queue_next;
+		client->ssl_queue_next = NULL;
+		client->ssl_handshaking = 0;
+	}
+
+	ssl_queue_todo = ssl_queue_todo_last = ssl_queue_done = NULL;
+
+	close(ssl_notify_pipe[0]);
+	close(ssl_notify_pipe[1]);
+	ssl_notify_pipe[0] = ssl_notify_pipe[1] = -1;
+}
+
+/* hand the client over to a worker, if there are any;
+ * returns 1 if queued, 0 if the caller should do the handshake */
+static int ssl_workers_queue(nut_ctype_t *client)
+{
+	if (!ssl_workers_count) {
+		return 0;
+	}
+
+	client->ssl_handshaking = 1;
+	client->ssl_queue_next = NULL;
+
+	pthread_mutex_lock(&ssl_workers_mutex);
+	if (ssl_queue_todo_last) {
+		ssl_queue_todo_last->ssl_queue_next = client;
+	} else {
+		ssl_queue_todo = client;
+	}
+	ssl_queue_todo_last = client;
+	pthread_cond_signal(&ssl_workers_cond);
+	pthread_mutex_unlock(&ssl_workers_mutex);
+
+	upsdebugx(3, "%s: queued TLS handshake with %s", __func__, client->addr);
+
+	return 1;
+}
+
+int ssl_handshake_notify_fd(void)
+{
+	return ssl_workers_count ? ssl_notify_pipe[0] : -1;
+}
+
+nut_ctype_t *ssl_handshake_done(void)
+{
+	nut_ctype_t	*client;
+	char	buf[SMALLBUF];
+
+	if (!ssl_workers_count) {
+		return NULL;
+	}
+
+	/* drain the wake-up calls, the list below is what matters */
+	while (read(ssl_notify_pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&ssl_workers_mutex);
+	client = ssl_queue_done;
+	if (client) {
+		ssl_queue_done = client->ssl_queue_next;
+	}
+	pthread_mutex_unlock(&ssl_workers_mutex);
+
+	if (client) {
+		client->ssl_queue_next = NULL;
+		client->ssl_handshaking = 0;
+	}
+
+	return client;
+}
+#endif /* NETSSL_WITH_WORKERS */
+
+void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+#ifdef WITH_NSS
+	SECStatus	status;
+	PRFileDesc	*socket;
+#endif /* WITH_NSS */
 
 	NUT_UNUSED_VARIABLE(numarg);
 	NUT_UNUSED_VARIABLE(arg);
@@ -313,6 +633,13 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* the reply must be out in plain text before the handshake begins */
+	if (sendback_flush(client) != 1) {
+		upslogx(LOG_ERR, "Could not confirm STARTTLS to client %s", client->addr);
+		client->last_heard = 0;
+		return;
+	}
+
 #ifdef WITH_OPENSSL
 
 	client->ssl = SSL_new(ssl_ctx);
@@ -329,27 +656,6 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
-	ret = SSL_accept(client->ssl);
-	switch (ret)
-	{
-	case 1:
-		client->ssl_connected = 1;
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
-		break;
-
-	case 0:
-		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
-		ssl_error(client->ssl, ret);
-		break;
-
-	case -1:
-		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
-		ssl_error(client->ssl, ret);
-		break;
-	default:
-		break;
-	}
-
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
 	socket = PR_ImportTCPSocket(client->sock_fd);
@@ -416,24 +722,15 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 		nss_error("net_starttls / SSL_ResetHandshake");
 		return;
 	}
+#endif /* WITH_OPENSSL | WITH_NSS */
 
-	/* Note: this call can generate memory leaks not resolvable
-	 * by any release function.
-	 * Probably SSL session key object allocation. */
-	status = SSL_ForceHandshake(client->ssl);
-	if (status != SECSuccess) {
-		PRErrorCode code = PR_GetError();
-		if (code==SSL_ERROR_NO_CERTIFICATE) {
-			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
-				client->addr);
-		} else {
-			nss_error("net_starttls / SSL_ForceHandshake");
-			/* TODO : Close the connection. */
-			return;
-		}
+#ifdef NETSSL_WITH_WORKERS
+	if (ssl_workers_queue(client)) {
+		return;
 	}
-	client->ssl_connected = 1;
-#endif /* WITH_OPENSSL | WITH_NSS */
+#endif /* NETSSL_WITH_WORKERS */
+
+	ssl_handshake(client);
 }
 
 void ssl_init(void)
@@ -510,6 +807,9 @@ void ssl_init(void)
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
 	ssl_initialized = 1;
+#ifdef NETSSL_WITH_WORKERS
+	ssl_workers_start();
+#endif /* NETSSL_WITH_WORKERS */
 
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
@@ -642,6 +942,9 @@ void ssl_init(void)
 	}
 
 	ssl_initialized = 1;
+#ifdef NETSSL_WITH_WORKERS
+	ssl_workers_start();
+#endif /* NETSSL_WITH_WORKERS */
 #else /* WITH_OPENSSL | WITH_NSS */
 	upslogx(LOG_ERR, "ssl_init called but SSL wasn't compiled in");
 #endif /* WITH_OPENSSL | WITH_NSS */
@@ -744,6 +1047,10 @@ void ssl_finish(nut_ctype_t *client)
 
 void ssl_cleanup(void)
 {
+#ifdef NETSSL_WITH_WORKERS
+	ssl_workers_end();
+#endif /* NETSSL_WITH_WORKERS */
+
 #ifdef WITH_OPENSSL
 	if (ssl_ctx) {
 		SSL_CTX_free(ssl_ctx);
@@ -32,6 +32,7 @@ extern char	*certfile;
 extern char	*certname;
 extern char	*certpasswd;
 extern int	disable_weak_ssl;
+extern int	ssl_handshake_workers;
 #ifdef WITH_CLIENT_CERTIFICATE_VALIDATION
 extern int certrequest;
 #endif /* WITH_CLIENT_CERTIFICATE_VALIDATION */
@@ -54,6 +55,22 @@ ssize_t ssl_write(nut_ctype_t *client, const char *buf, size_t buflen);
 
 void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg);
 
+/* TLS handshakes can be done by a pool of worker threads (see the
+ * SSL_HANDSHAKE_WORKERS option), so they do not block the main loop */
+#if defined(WITH_SSL) && defined(HAVE_PTHREAD) && !defined(WIN32)
+# define NETSSL_WITH_WORKERS 1
+#endif
+
+#ifdef NETSSL_WITH_WORKERS
+/* descriptor to watch for handshakes completed by the workers,
+ * or -1 if the pool is not running */
+int ssl_handshake_notify_fd(void);
+
+/* pick up the next client whose handshake is done (or failed),
+ * NULL if there are none at the moment */
+nut_ctype_t *ssl_handshake_done(void);
+#endif	/* NETSSL_WITH_WORKERS */
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -0,0 +1,411 @@
+/* netwatch.c - change notifications (WATCH) for upsd clients
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Clients which WATCH a UPS get the values which changed pushed to
+ * them, instead of polling for them.  Each change of a value bumps
+ * watch_seq, and the node of the value (as well as the UPS) remembers
+ * it.  For each watch, we only remember up to which change it was
+ * updated: whatever changed after that is sent in the next update.
+ * So updates which are held back (by the INTERVAL of a watch, or
+ * because the client did not read the previous one yet) simply cover
+ * all of the changes meanwhile, with only the latest values, and a
+ * client which reconnects can ask to be updated from where it was
+ * (SINCE the last change it had seen).
+ */
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+#include "user.h"		/* for user_checkaction */
+#include "neterr.h"
+
+#include "netwatch.h"
+
+/* the counter starts at a value derived from the start time, so that
+ * the numbers given out by an earlier instance of upsd are not taken
+ * for ours (it would need a million changes per second to catch up) */
+uintmax_t	watch_seq = 0;
+static uintmax_t	watch_seq_base = 0;
+
+void watch_init(void)
+{
+	watch_seq = watch_seq_base = (uintmax_t)time(NULL) << 20;
+}
+
+/* a value shown to clients changed */
+void watch_changed(upstype_t *ups, st_tree_t *node)
+{
+	node->watchseq = ups->watchseq = ++watch_seq;
+}
+
+/* the data of the UPS became stale or unavailable, or good again */
+void watch_ups_changed(upstype_t *ups)
+{
+	ups->watchseq = ++watch_seq;
+}
+
+static watch_t *watch_find(nut_ctype_t *client, const char *upsname)
+{
+	watch_t	*w;
+
+	for (w = client->watches; w; w = w->next) {
+		if (!strcmp(w->upsname, upsname)) {
+			return w;
+		}
+	}
+
+	return NULL;
+}
+
+static void watch_del(nut_ctype_t *client, watch_t *target)
+{
+	watch_t	**wp;
+	size_t	i;
+
+	for (wp = &client->watches; *wp; wp = &(*wp)->next) {
+		if (*wp == target) {
+			*wp = target->next;
+			break;
+		}
+	}
+
+	for (i = 0; i < target->numvars; i++) {
+		free(target->vars[i]);
+	}
+
+	free(target->vars);
+	free(target->upsname);
+	free(target);
+}
+
+static int watch_sendvar(nut_ctype_t *client, const upstype_t *ups,
+	const st_tree_t *node)
+{
+	const char	*val = sstate_getnodeval(ups, node);
+
+	/* not available right now (see sstate_getnodeval) */
+	if (!val) {
+		return 1;
+	}
+
+	/* status is always a special case */
+	if (ups->fsd == 1 && !strcasecmp(node->var, "ups.status")) {
+		return sendback(client, "VAR %s %s \"FSD %s\"\n",
+			ups->name, node->var, val);
+	}
+
+	return sendback(client, "VAR %s %s \"%s\"\n", ups->name, node->var, val);
+}
+
+/* all of the values which changed since the last update */
+static int watch_dump(const st_tree_t *node, nut_ctype_t *client,
+	const upstype_t *ups, uintmax_t since)
+{
+	if (!node) {
+		return 1;
+	}
+
+	if (!watch_dump(node->left, client, ups, since)) {
+		return 0;
+	}
+
+	if (node->watchseq > since && !watch_sendvar(client, ups, node)) {
+		return 0;
+	}
+
+	return watch_dump(node->right, client, ups, since);
+}
+
+/* send one update for this watch; returns 0 if that failed */
+static int watch_update(nut_ctype_t *client, watch_t *w, const upstype_t *ups,
+	time_t now)
+{
+	int	ret, stale = (INVALID_FD(ups->sock_fd) || ups->stale);
+	size_t	i;
+
+	/* the values could have changed while they were not available */
+	if (w->stale && !stale) {
+		w->sentseq = 0;
+	}
+
+	client->sendbuf_hold++;
+
+	ret = sendback(client, "BEGIN WATCH %s\n", ups->name);
+
+	if (ret && stale) {
+		ret = send_err(client, INVALID_FD(ups->sock_fd)
+			? NUT_ERR_DRIVER_NOT_CONNECTED : NUT_ERR_DATA_STALE);
+	} else if (ret && w->numvars) {
+		for (i = 0; ret && i < w->numvars; i++) {
+			const st_tree_t	*node = state_tree_find(ups->inforoot, w->vars[i]);
+
+			if (node && node->watchseq > w->sentseq) {
+				ret = watch_sendvar(client, ups, node);
+			}
+		}
+	} else if (ret) {
+		ret = watch_dump(ups->inforoot, client, ups, w->sentseq);
+	}
+
+	if (ret) {
+		/* the client is up to date as of the latest change anywhere */
+		ret = sendback(client, "END WATCH %s %" PRIuMAX "\n",
+			ups->name, watch_seq);
+	}
+
+	client->sendbuf_hold--;
+
+	if (!client->sendbuf_hold && client->sendbuf_len) {
+		sendback_flush(client);
+	}
+
+	w->sentseq = watch_seq;
+	w->stale = stale;
+	w->lastsent = now;
+
+	return ret;
+}
+
+/* is there something to tell about this UPS, which is due now? */
+static int watch_due(const watch_t *w, const upstype_t *ups, time_t now)
+{
+	int	stale = (INVALID_FD(ups->sock_fd) || ups->stale);
+	size_t	i;
+
+	if (now < w->lastsent + w->interval) {
+		return 0;
+	}
+
+	if (stale != w->stale) {
+		return 1;
+	}
+
+	if (stale || ups->watchseq <= w->sentseq) {
+		return 0;
+	}
+
+	if (!w->numvars) {
+		return 1;
+	}
+
+	/* only the changes of the watched values count */
+	for (i = 0; i < w->numvars; i++) {
+		const st_tree_t	*node = state_tree_find(ups->inforoot, w->vars[i]);
+
+		if (node && node->watchseq > w->sentseq) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+size_t watch_send(nut_ctype_t *client, time_t now)
+{
+	watch_t	*w;
+	size_t	sent = 0;
+
+	for (w = client->watches; w; w = w->next) {
+		const upstype_t	*ups;
+
+		/* the client did not read the previous update yet: the
+		 * next one can wait, and cover what changes meanwhile */
+		if (client->sendbuf_len) {
+			break;
+		}
+
+		/* gone with a reload? the client will notice the silence */
+		if ((ups = get_ups_ptr(w->upsname)) == NULL) {
+			continue;
+		}
+
+		if (!watch_due(w, ups, now)) {
+			continue;
+		}
+
+		if (!watch_update(client, w, ups, now)) {
+			break;
+		}
+
+		sent++;
+	}
+
+	return sent;
+}
+
+time_t watch_next(const nut_ctype_t *client)
+{
+	const watch_t	*w;
+	time_t	next = 0;
+
+	for (w = client->watches; w; w = w->next) {
+		const upstype_t	*ups = get_ups_ptr(w->upsname);
+
+		if (!ups || !w->interval || !watch_due(w, ups, w->lastsent + w->interval)) {
+			continue;
+		}
+
+		if (!next || w->lastsent + w->interval < next) {
+			next = w->lastsent + w->interval;
+		}
+	}
+
+	return next;
+}
+
+void watch_free(nut_ctype_t *client)
+{
+	while (client->watches) {
+		watch_del(client, client->watches);
+	}
+}
+
+/* parse a decimal change number, as given out in END WATCH */
+static int watch_parse_seq(const char *str, uintmax_t *seq)
+{
+	uintmax_t	val = 0;
+
+	if (!*str) {
+		return 0;
+	}
+
+	for (; *str; str++) {
+		if (*str < '0' || *str > '9' || val > (UINTMAX_MAX - 9) / 10) {
+			return 0;
+		}
+
+		val = val * 10 + (uintmax_t)(*str - '0');
+	}
+
+	*seq = val;
+	return 1;
+}
+
+/* WATCH <upsname> [INTERVAL <seconds>] [SINCE <seq>] [<varname> ...] */
+void net_watch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	const upstype_t	*ups;
+	watch_t	*w;
+	size_t	i;
+	int	interval = 0;
+	uintmax_t	since = 0;
+	time_t	now;
+
+	if (numarg < 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	/* make sure this user is allowed to watch */
+	if (!user_checkaction(client->username, client->password, "WATCH")) {
+		send_err(client, NUT_ERR_ACCESS_DENIED);
+		return;
+	}
+
+	/* options come first, variable names have dots */
+	for (i = 1; i + 1 < numarg; i += 2) {
+		if (!strcasecmp(arg[i], "INTERVAL")) {
+			if (!str_to_int_strict(arg[i + 1], &interval, 10) || interval < 0) {
+				send_err(client, NUT_ERR_INVALID_VALUE);
+				return;
+			}
+			continue;
+		}
+
+		if (!strcasecmp(arg[i], "SINCE")) {
+			if (!watch_parse_seq(arg[i + 1], &since)) {
+				send_err(client, NUT_ERR_INVALID_VALUE);
+				return;
+			}
+			continue;
+		}
+
+		break;
+	}
+
+	/* a new WATCH of the same UPS replaces the earlier one */
+	if ((w = watch_find(client, ups->name)) != NULL) {
+		watch_del(client, w);
+	}
+
+	w = xcalloc(1, sizeof(*w));
+	w->upsname = xstrdup(ups->name);
+	w->interval = (time_t)interval;
+
+	/* resume from the last change the client has seen (if we know it),
+	 * otherwise start with all of the values */
+	if (since >= watch_seq_base && since <= watch_seq) {
+		w->sentseq = since;
+	}
+
+	if (i < numarg) {
+		w->numvars = numarg - i;
+		w->vars = xcalloc(w->numvars, sizeof(*w->vars));
+
+		for (w->numvars = 0; i < numarg; i++) {
+			w->vars[w->numvars++] = xstrdup(arg[i]);
+		}
+	}
+
+	w->next = client->watches;
+	client->watches = w;
+
+	upsdebugx(2, "%s: %s watches UPS [%s] (%" PRIuSIZE " variables, interval %d, since %" PRIuMAX ")",
+		__func__, client->addr, ups->name, w->numvars, interval, w->sentseq);
+
+	if (!sendback(client, "OK\n")) {
+		return;
+	}
+
+	/* the first update comes right away, then whenever there are changes */
+	time(&now);
+	watch_update(client, w, ups, now);
+}
+
+/* UNWATCH [<upsname>] */
+void net_unwatch(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+	watch_t	*w;
+
+	if (numarg > 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (numarg == 0) {
+		watch_free(client);
+		sendback(client, "OK\n");
+		return;
+	}
+
+	if ((w = watch_find(client, arg[0])) == NULL) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	watch_del(client, w);
+	sendback(client, "OK\n");
+}
@@ -0,0 +1,69 @@
+/* netwatch.h - change notifications (WATCH) for upsd clients
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_NETWATCH_H_SEEN
+#define NUT_NETWATCH_H_SEEN 1
+
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* one WATCH of a client */
+typedef struct watch_s {
+	char	*upsname;
+	char	**vars;			/* names to watch, all of them if none */
+	size_t	numvars;
+	time_t	interval;		/* minimum delay between updates */
+	time_t	lastsent;
+	uintmax_t	sentseq;	/* changes up to this one were sent */
+	int	stale;			/* client was told that data is stale */
+	struct watch_s	*next;
+} watch_t;
+
+/* counter of value changes of all UPSes, see sstate_setinfo() */
+extern uintmax_t	watch_seq;
+
+void watch_init(void);
+
+/* a value shown to clients changed, see WATCH */
+void watch_changed(upstype_t *ups, st_tree_t *node);
+void watch_ups_changed(upstype_t *ups);
+
+void net_watch(nut_ctype_t *client, size_t numarg, const char **arg);
+void net_unwatch(nut_ctype_t *client, size_t numarg, const char **arg);
+
+/* push the updates which are due for this client, returns how many
+ * batches were sent */
+size_t watch_send(nut_ctype_t *client, time_t now);
+
+/* when will an update which is held back by the client's INTERVAL be
+ * due? returns 0 if none is */
+time_t watch_next(const nut_ctype_t *client);
+
+void watch_free(nut_ctype_t *client);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_NETWATCH_H_SEEN */
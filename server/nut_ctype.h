@@ -38,6 +38,7 @@
 #endif
 
 #include "parseconf.h"
+#include "nut_stdint.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -57,6 +58,9 @@ typedef struct nut_ctype_s {
 	 * (disabled by default) */
 	int	tracking;
 
+	/* UPSes to push changes of, see netwatch.c */
+	struct watch_s	*watches;
+
 #ifdef	WITH_OPENSSL
 	SSL	*ssl;
 #elif defined(WITH_NSS)
@@ -65,9 +69,23 @@ typedef struct nut_ctype_s {
 	void *ssl;
 #endif
 	int	ssl_connected;
+	int	ssl_handshaking;	/* owned by a TLS worker thread for now */
+	struct nut_ctype_s	*ssl_queue_next;	/* in the TLS workers' queues */
 
 	PCONF_CTX_t	ctx;
 
+	/* pending output, collected by sendback() while a request
+	 * is processed and written out by sendback_flush() */
+	char	*sendbuf;
+	size_t	sendbuf_len;
+	size_t	sendbuf_size;
+	int	sendbuf_hold;
+	int	sendbuf_pollout;	/* event loop also waits to write */
+
+	/* debug counters: protocol lines vs. write() calls done */
+	uintmax_t	sendback_lines;
+	uintmax_t	sendback_writes;
+
 	/* doubly linked list */
 	struct nut_ctype_s	*prev;
 	struct nut_ctype_s	*next;
@@ -27,6 +27,8 @@
 #include "sstate.h"
 #include "upsd.h"
 #include "upstype.h"
+#include "nut_ctype.h"
+#include "netwatch.h"
 #include "nut_stdint.h"
 
 #include <fcntl.h>
@@ -38,118 +40,477 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #endif	/* !WIN32 */
+#ifdef ST_SHM_SUPPORTED
+#include <sys/mman.h>
+#endif	/* ST_SHM_SUPPORTED */
 
-static int parse_args(upstype_t *ups, size_t numargs, char **arg)
+static void sstate_shm_unmap(upstype_t *ups)
 {
-	if (numargs < 1)
+#ifdef ST_SHM_SUPPORTED
+	if (ups->shm) {
+		munmap((void *)ups->shm, ups->shmsize);
+	}
+#endif	/* ST_SHM_SUPPORTED */
+
+	ups->shm = NULL;
+	ups->shmsize = 0;
+}
+
+/* map the segment the driver publishes its values in, which is named
+ * like its socket with ".shm" appended; this is done again whenever the
+ * driver says it has moved on to a bigger one */
+static int sstate_shm_map(upstype_t *ups)
+{
+#ifdef ST_SHM_SUPPORTED
+	char	fn[NUT_PATH_MAX + 1];
+	struct stat	st;
+	void	*map;
+	int	fd;
+
+	sstate_shm_unmap(ups);
+
+	snprintf(fn, sizeof(fn), "%s.shm", ups->fn);
+
+	if ((fd = open(fn, O_RDONLY)) < 0) {
+		upslog_with_errno(LOG_WARNING, "UPS [%s]: can't open shared state file %s",
+			ups->name, fn);
 		return 0;
+	}
 
-	if (!strcasecmp(arg[0], "PONG")) {
-		upsdebugx(3, "%s: Got PONG from UPS [%s]", __func__, ups->name);
-		return 1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(st_shm_header_t)) {
+		upslogx(LOG_WARNING, "UPS [%s]: shared state file %s is too short",
+			ups->name, fn);
+		close(fd);
+		return 0;
 	}
 
-	if (!strcasecmp(arg[0], "DUMPDONE")) {
-		upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
-		ups->dumpdone = 1;
-		return 1;
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		upslog_with_errno(LOG_WARNING, "UPS [%s]: can't map shared state file %s",
+			ups->name, fn);
+		return 0;
 	}
 
-	if (!strcasecmp(arg[0], "DATASTALE")) {
-		upsdebugx(3, "%s: UPS [%s]: data is STALE now", __func__, ups->name);
-		ups->data_ok = 0;
-		return 1;
+	if (!st_shm_valid(map, (size_t)st.st_size)) {
+		upslogx(LOG_WARNING, "UPS [%s]: shared state file %s is not in a format we know",
+			ups->name, fn);
+		munmap(map, (size_t)st.st_size);
+		return 0;
 	}
 
-	if (!strcasecmp(arg[0], "DATAOK")) {
-		upsdebugx(3, "%s: UPS [%s]: data is NOT STALE now", __func__, ups->name);
-		ups->data_ok = 1;
-		return 1;
+	ups->shm = map;
+	ups->shmsize = (size_t)st.st_size;
+
+	upsdebugx(2, "%s: UPS [%s]: mapped %s with %" PRIu32 " slots",
+		__func__, ups->name, fn, ups->shm->numslots);
+
+	return 1;
+#else	/* !ST_SHM_SUPPORTED */
+	upslogx(LOG_WARNING, "UPS [%s]: shared state is not supported in this build",
+		ups->name);
+	return 0;
+#endif	/* !ST_SHM_SUPPORTED */
+}
+
+/* a value from the driver: kept here, or only a note of which slot of
+ * the shared segment has it (then the value kept here is left empty) */
+static void sstate_setinfo(upstype_t *ups, const char *var, const char *val, size_t shmslot)
+{
+	st_tree_t	*node;
+	int	changed = state_setinfo(&ups->inforoot, var, val);
+
+	if ((node = state_tree_find(ups->inforoot, var)) != NULL) {
+		node->shmslot = shmslot;
+
+		/* a value in the shared segment is only announced when it changed */
+		if (changed || shmslot) {
+			watch_changed(ups, node);
+		}
 	}
+}
 
-	if (numargs < 2)
+static int parse_args(upstype_t *ups, size_t numargs, char **arg)
+{
+	if (numargs < 1)
 		return 0;
 
-	/* FIXME: all these should return their state_...() value! */
-	/* ADDCMD <cmdname> */
-	if (!strcasecmp(arg[0], "ADDCMD")) {
-		state_addcmd(&ups->cmdlist, arg[1]);
+	/* only the commands of the same length and first letter are tried */
+	switch (str_key(arg[0]))
+	{
+	case STR_KEY(4, 'P'):
+		if (!strcasecmp(arg[0], "PONG")) {
+			upsdebugx(3, "%s: Got PONG from UPS [%s]", __func__, ups->name);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(8, 'D'):
+		if (!strcasecmp(arg[0], "DUMPDONE")) {
+			upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
+			ups->dumpdone = 1;
+			return 1;
+		}
+
+		/* DELRANGE <varname> <minvalue> <maxvalue> */
+		if (!strcasecmp(arg[0], "DELRANGE") && numargs >= 4) {
+			state_delrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
+			return 1;
+		}
+		break;
+
+	case STR_KEY(9, 'D'):
+		if (!strcasecmp(arg[0], "DATASTALE")) {
+			upsdebugx(3, "%s: UPS [%s]: data is STALE now", __func__, ups->name);
+			ups->data_ok = 0;
+			return 1;
+		}
+		break;
+
+	case STR_KEY(6, 'D'):
+		if (!strcasecmp(arg[0], "DATAOK")) {
+			upsdebugx(3, "%s: UPS [%s]: data is NOT STALE now", __func__, ups->name);
+			ups->data_ok = 1;
+			return 1;
+		}
+
+		/* FIXME: all these should return their state_...() value! */
+		/* DELCMD <cmdname> */
+		if (!strcasecmp(arg[0], "DELCMD") && numargs >= 2) {
+			state_delcmd(&ups->cmdlist, arg[1]);
+			return 1;
+		}
+		break;
+
+	/* PROTOCOL <SHM <version>|BINARY <version>|TEXT>: the driver
+	 * accepted (or not) our request to switch, binary frames follow
+	 * right after this; drivers which publish values in a shared
+	 * segment say so again when they move on to a bigger one */
+	case STR_KEY(8, 'P'):
+		if (strcasecmp(arg[0], "PROTOCOL") || numargs < 2)
+			break;
+
+		if (!strcasecmp(arg[1], "SHM")) {
+			upsdebugx(2, "%s: UPS [%s]: driver publishes values in shared memory, version %s",
+				__func__, ups->name, numargs > 2 ? arg[2] : "?");
+			ups->binary = 1;
+
+			if (!sstate_shm_map(ups)) {
+				/* see sstate_readline() */
+				ups->shmfailed = 1;
+			}
+		} else if (!strcasecmp(arg[1], "BINARY")) {
+			upsdebugx(2, "%s: UPS [%s]: driver speaks binary protocol version %s",
+				__func__, ups->name, numargs > 2 ? arg[2] : "?");
+			ups->binary = 1;
+
+			/* values come in the frames (again) */
+			sstate_shm_unmap(ups);
+		} else {
+			upsdebugx(2, "%s: UPS [%s]: driver stays with the text protocol",
+				__func__, ups->name);
+		}
 		return 1;
+
+	case STR_KEY(6, 'A'):
+		/* ADDCMD <cmdname> */
+		if (!strcasecmp(arg[0], "ADDCMD") && numargs >= 2) {
+			state_addcmd(&ups->cmdlist, arg[1]);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(7, 'D'):
+		/* DELINFO <var> */
+		if (!strcasecmp(arg[0], "DELINFO") && numargs >= 2) {
+			state_delinfo(&ups->inforoot, arg[1]);
+			return 1;
+		}
+
+		/* DELENUM <varname> <enumval> */
+		if (!strcasecmp(arg[0], "DELENUM") && numargs >= 3) {
+			state_delenum(ups->inforoot, arg[1], arg[2]);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(8, 'S'):
+		/* SETFLAGS <varname> <flags>... */
+		if (!strcasecmp(arg[0], "SETFLAGS") && numargs >= 3) {
+			state_setflags(ups->inforoot, arg[1], numargs - 2, &arg[2]);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(7, 'S'):
+		/* SETINFO <varname> <value> */
+		if (!strcasecmp(arg[0], "SETINFO") && numargs >= 3) {
+			sstate_setinfo(ups, arg[1], arg[2], 0);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(7, 'A'):
+		/* ADDENUM <varname> <enumval> */
+		if (!strcasecmp(arg[0], "ADDENUM") && numargs >= 3) {
+			state_addenum(ups->inforoot, arg[1], arg[2]);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(6, 'S'):
+		/* SETAUX <varname> <auxval> */
+		if (!strcasecmp(arg[0], "SETAUX") && numargs >= 3) {
+			state_setaux(ups->inforoot, arg[1], arg[2]);
+			return 1;
+		}
+		break;
+
+	case STR_KEY(8, 'T'):
+		/* TRACKING <id> <status> */
+		if (!strcasecmp(arg[0], "TRACKING") && numargs >= 3) {
+			tracking_set(arg[1], arg[2]);
+			upsdebugx(1, "%s: TRACKING: ID %s status %s", __func__, arg[1], arg[2]);
+
+			/* log actual result of instcmd / setvar */
+			if (strncmp(arg[2], "PENDING", 7) != 0) {
+				upslogx(LOG_INFO, "tracking ID: %s\tresult: %s", arg[1], tracking_get(arg[1]));
+			}
+			return 1;
+		}
+		break;
+
+	case STR_KEY(8, 'A'):
+		/* ADDRANGE <varname> <minvalue> <maxvalue> */
+		if (!strcasecmp(arg[0], "ADDRANGE") && numargs >= 4) {
+			state_addrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
+			return 1;
+		}
+		break;
+
+	default:
+		break;
 	}
 
-	/* DELCMD <cmdname> */
-	if (!strcasecmp(arg[0], "DELCMD")) {
-		state_delcmd(&ups->cmdlist, arg[1]);
-		return 1;
+	return 0;
+}
+
+/* feed one line of the text protocol through the parser; returns the
+ * amount of bytes used, which is less than len if the driver switched
+ * to binary frames after a line, or -1 after a parse error */
+static ssize_t sstate_parse_text(upstype_t *ups, const char *buf, size_t len)
+{
+	size_t	i, used;
+
+	for (i = 0; i < len; i += used) {
+
+		switch (pconf_chunk(&ups->sock_ctx, buf + i, len - i, &used))
+		{
+		case 1:
+			/* set the 'last heard' time to now for later staleness checks */
+			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
+				time(&ups->last_heard);
+			}
+
+			if (ups->binary) {
+				/* the rest is framed */
+				return (ssize_t)(i + used);
+			}
+			continue;
+
+		case 0:
+			continue;	/* haven't gotten a line yet */
+
+		default:
+			/* parse error */
+			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
+			return -1;
+		}
 	}
 
-	/* DELINFO <var> */
-	if (!strcasecmp(arg[0], "DELINFO")) {
-		state_delinfo(&ups->inforoot, arg[1]);
+	return (ssize_t)len;
+}
+
+static const char *sstate_binvar(upstype_t *ups, size_t id)
+{
+	if (id >= ups->numbinvars || !ups->binvars[id]) {
+		upslogx(LOG_NOTICE, "UPS [%s]: driver used undefined variable ID %" PRIuSIZE,
+			ups->name, id);
+		return NULL;
+	}
+
+	return ups->binvars[id];
+}
+
+/* apply one record of a binary frame, the same way parse_args() does it
+ * for a line of text; returns 0 if the record did not make sense */
+static int sstate_bin_apply(upstype_t *ups, const st_bin_rec_t *rec)
+{
+	const char	*var = NULL;
+	char	num[SMALLBUF];
+
+	switch (rec->op)
+	{
+	case ST_BIN_DEFINE:
+		if (rec->id >= ups->numbinvars) {
+			size_t	n = ups->numbinvars ? ups->numbinvars : 64;
+
+			while (rec->id >= n)
+				n *= 2;
+
+			ups->binvars = xrealloc(ups->binvars, n * sizeof(*ups->binvars));
+			memset(ups->binvars + ups->numbinvars, 0,
+				(n - ups->numbinvars) * sizeof(*ups->binvars));
+			ups->numbinvars = n;
+		}
+
+		free(ups->binvars[rec->id]);
+		ups->binvars[rec->id] = xstrdup(rec->str);
+		return 1;
+
+	case ST_BIN_ADDCMD:
+		state_addcmd(&ups->cmdlist, rec->str);
+		return 1;
+
+	case ST_BIN_DELCMD:
+		state_delcmd(&ups->cmdlist, rec->str);
 		return 1;
+
+	case ST_BIN_TEXT:
+		/* everything else is sent as it would be in text mode */
+		return (sstate_parse_text(ups, rec->str, strlen(rec->str)) >= 0
+			&& sstate_parse_text(ups, "\n", 1) >= 0);
+
+	default:
+		break;
 	}
 
-	if (numargs < 3)
+	if ((var = sstate_binvar(ups, rec->id)) == NULL)
 		return 0;
 
-	/* SETFLAGS <varname> <flags>... */
-	if (!strcasecmp(arg[0], "SETFLAGS")) {
-		state_setflags(ups->inforoot, arg[1], numargs - 2, &arg[2]);
+	switch (rec->op)
+	{
+	case ST_BIN_SETINFO:
+		sstate_setinfo(ups, var, rec->str, 0);
 		return 1;
-	}
 
-	/* SETINFO <varname> <value> */
-	if (!strcasecmp(arg[0], "SETINFO")) {
-		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+	case ST_BIN_SHMINFO:
+		sstate_setinfo(ups, var, "", rec->id + 1);
 		return 1;
-	}
 
-	/* ADDENUM <varname> <enumval> */
-	if (!strcasecmp(arg[0], "ADDENUM")) {
-		state_addenum(ups->inforoot, arg[1], arg[2]);
+	case ST_BIN_DELINFO:
+		state_delinfo(&ups->inforoot, var);
 		return 1;
-	}
 
-	/* DELENUM <varname> <enumval> */
-	if (!strcasecmp(arg[0], "DELENUM")) {
-		state_delenum(ups->inforoot, arg[1], arg[2]);
+	case ST_BIN_ADDENUM:
+		state_addenum(ups->inforoot, var, rec->str);
 		return 1;
-	}
 
-	/* SETAUX <varname> <auxval> */
-	if (!strcasecmp(arg[0], "SETAUX")) {
-		state_setaux(ups->inforoot, arg[1], arg[2]);
+	case ST_BIN_DELENUM:
+		state_delenum(ups->inforoot, var, rec->str);
+		return 1;
+
+	case ST_BIN_ADDRANGE:
+		state_addrange(ups->inforoot, var, (int)rec->num1, (int)rec->num2);
 		return 1;
-	}
 
-	/* TRACKING <id> <status> */
-	if (!strcasecmp(arg[0], "TRACKING")) {
-		tracking_set(arg[1], arg[2]);
-		upsdebugx(1, "%s: TRACKING: ID %s status %s", __func__, arg[1], arg[2]);
+	case ST_BIN_DELRANGE:
+		state_delrange(ups->inforoot, var, (int)rec->num1, (int)rec->num2);
+		return 1;
 
-		/* log actual result of instcmd / setvar */
-		if (strncmp(arg[2], "PENDING", 7) != 0) {
-			upslogx(LOG_INFO, "tracking ID: %s\tresult: %s", arg[1], tracking_get(arg[1]));
+	case ST_BIN_SETAUX:
+		snprintf(num, sizeof(num), "%ld", rec->num1);
+		state_setaux(ups->inforoot, var, num);
+		return 1;
+
+	case ST_BIN_SETFLAGS:
+		{
+			char	*flags[3];
+			size_t	numflags = 0;
+
+			if (rec->num1 & ST_FLAG_RW)
+				flags[numflags++] = "RW";
+			if (rec->num1 & ST_FLAG_STRING)
+				flags[numflags++] = "STRING";
+			if (rec->num1 & ST_FLAG_NUMBER)
+				flags[numflags++] = "NUMBER";
+
+			state_setflags(ups->inforoot, var, numflags, flags);
 		}
 		return 1;
-	}
 
-	if (numargs < 4)
+	default:
 		return 0;
+	}
+}
 
-	/* ADDRANGE <varname> <minvalue> <maxvalue> */
-	if (!strcasecmp(arg[0], "ADDRANGE")) {
-		state_addrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
-		return 1;
+/* take in data from a driver which speaks binary frames (already placed
+ * in ups->binbuf), and apply all of the complete frames in place;
+ * returns 0 if the driver sent garbage and was disconnected */
+static int sstate_bin_process(upstype_t *ups)
+{
+	st_bin_buf_t	*bb = &ups->binbuf;
+	size_t	start = 0;
+
+	while (bb->len - start >= ST_BIN_HEADER_LEN) {
+		const unsigned char	*payload = bb->data + start + ST_BIN_HEADER_LEN;
+		size_t	len = st_bin_frame_len(bb->data + start), pos = 0;
+		st_bin_rec_t	rec;
+		int	ret;
+
+		if (len > ST_BIN_FRAME_MAX) {
+			upslogx(LOG_WARNING, "UPS [%s]: driver sent a frame of %" PRIuSIZE
+				" bytes, disconnecting", ups->name, len);
+			sstate_disconnect(ups);
+			return 0;
+		}
+
+		if (bb->len - start - ST_BIN_HEADER_LEN < len)
+			break;	/* wait for the rest */
+
+		upsdebugx(5, "%s: UPS [%s]: frame of %" PRIuSIZE " bytes",
+			__func__, ups->name, len);
+
+		while ((ret = st_bin_next(payload, len, &pos, &rec)) > 0) {
+			if (sstate_bin_apply(ups, &rec)) {
+				time(&ups->last_heard);
+			}
+		}
+
+		if (ret < 0) {
+			upslogx(LOG_WARNING, "UPS [%s]: malformed frame from driver, disconnecting",
+				ups->name);
+			sstate_disconnect(ups);
+			return 0;
+		}
+
+		start += ST_BIN_HEADER_LEN + len;
 	}
 
-	/* DELRANGE <varname> <minvalue> <maxvalue> */
-	if (!strcasecmp(arg[0], "DELRANGE")) {
-		state_delrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
-		return 1;
+	/* keep the incomplete tail for the next read */
+	if (start) {
+		memmove(bb->data, bb->data + start, bb->len - start);
+		bb->len -= start;
 	}
 
-	return 0;
+	return 1;
+}
+
+static void sstate_bin_append(upstype_t *ups, const char *buf, size_t len)
+{
+	st_bin_buf_t	*bb = &ups->binbuf;
+
+	if (bb->len + len > bb->size) {
+		while (bb->len + len > bb->size)
+			bb->size = bb->size ? bb->size * 2 : LARGEBUF;
+		bb->data = xrealloc(bb->data, bb->size);
+	}
+
+	memcpy(bb->data + bb->len, buf, len);
+	bb->len += len;
+
+	sstate_bin_process(ups);
 }
 
 /* nothing fancy - just make the driver say something back to us */
@@ -190,14 +551,55 @@ static void sendping(upstype_t *ups)
 	time(&ups->last_ping);
 }
 
+/* the initial request to a driver: ask for binary frames or a shared
+ * segment if configured (a driver which does not know about them just
+ * ignores that line), and for a dump of everything it knows */
+static void sstate_dumpcmd(char *buf, size_t bufsize)
+{
+#ifdef ST_SHM_SUPPORTED
+	if (driver_protocol == DRIVER_PROTOCOL_SHM) {
+		snprintf(buf, bufsize, "PROTOCOL SHM %d\nDUMPALL\n",
+			ST_SHM_VERSION);
+		return;
+	}
+#endif	/* ST_SHM_SUPPORTED */
+
+	if (driver_protocol != DRIVER_PROTOCOL_TEXT) {
+		snprintf(buf, bufsize, "PROTOCOL BINARY %d\nDUMPALL\n",
+			ST_BIN_PROTOCOL_VERSION);
+	} else {
+		snprintf(buf, bufsize, "DUMPALL\n");
+	}
+}
+
+/* if the shared segment of a driver could not be mapped, ask it for the
+ * values in binary frames instead (not right when it happens, as this
+ * may disconnect the driver while its data is being parsed) */
+static void sstate_shm_fallback(upstype_t *ups)
+{
+	char	cmd[SMALLBUF];
+
+	if (!ups->shmfailed || INVALID_FD(ups->sock_fd)) {
+		return;
+	}
+
+	ups->shmfailed = 0;
+	upslogx(LOG_WARNING, "UPS [%s]: falling back to the binary driver protocol",
+		ups->name);
+
+	snprintf(cmd, sizeof(cmd), "PROTOCOL BINARY %d\nDUMPALL\n",
+		ST_BIN_PROTOCOL_VERSION);
+	sstate_sendline(ups, cmd);
+}
+
 /* interface */
 
 TYPE_FD sstate_connect(upstype_t *ups)
 {
 	TYPE_FD	fd;
+	char	dumpcmd[SMALLBUF];
 #ifndef WIN32
-	const char	*dumpcmd = "DUMPALL\n";
-	size_t	dumpcmdlen = strlen(dumpcmd);
+	size_t	dumpcmdlen;
 	ssize_t	ret;
 	struct sockaddr_un	sa;
 
@@ -266,6 +668,8 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	}
 
 	/* get a dump started so we have a fresh set of data */
+	sstate_dumpcmd(dumpcmd, sizeof(dumpcmd));
+	dumpcmdlen = strlen(dumpcmd);
 	ret = write(fd, dumpcmd, dumpcmdlen);
 
 	if ((ret < 1) || (ret != (ssize_t)dumpcmdlen))  {
@@ -276,7 +680,6 @@ TYPE_FD sstate_connect(upstype_t *ups)
 
 #else	/* WIN32 */
 	char pipename[NUT_PATH_MAX];
-	const char	*dumpcmd = "DUMPALL\n";
 	BOOL  result = FALSE;
 	DWORD bytesWritten;
 
@@ -308,6 +711,7 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	}
 
 	/* get a dump started so we have a fresh set of data */
+	sstate_dumpcmd(dumpcmd, sizeof(dumpcmd));
 	bytesWritten = 0;
 
 	result = WriteFile(fd, dumpcmd, strlen(dumpcmd), &bytesWritten, NULL);
@@ -327,6 +731,9 @@ TYPE_FD sstate_connect(upstype_t *ups)
 
 	pconf_init(&ups->sock_ctx, NULL);
 
+	/* until the driver says otherwise */
+	ups->binary = 0;
+	ups->shmfailed = 0;
 	ups->dumpdone = 0;
 	ups->stale = 0;
 
@@ -349,9 +756,13 @@ void sstate_disconnect(upstype_t *ups)
 
 	sstate_infofree(ups);
 	sstate_cmdfree(ups);
+	sstate_binfree(ups);
 
 	pconf_finish(&ups->sock_ctx);
 
+	/* for those who WATCH it */
+	watch_ups_changed(ups);
+
 #ifndef WIN32
 	close(ups->sock_fd);
 #else	/* WIN32 */
@@ -363,16 +774,30 @@ void sstate_disconnect(upstype_t *ups)
 
 void sstate_readline(upstype_t *ups)
 {
-	ssize_t	i, ret;
+	ssize_t	ret, used;
 
 #ifndef WIN32
-	char	buf[SMALLBUF];
+	char	buf[SMALLBUF], *rbuf = buf;
+	size_t	rlen = sizeof(buf);
 
 	if ((!ups) || INVALID_FD(ups->sock_fd)) {
 		return;
 	}
 
-	ret = read(ups->sock_fd, buf, sizeof(buf));
+	if (ups->binary) {
+		/* read frames straight into the buffer they are parsed from */
+		st_bin_buf_t	*bb = &ups->binbuf;
+
+		if (bb->size - bb->len < LARGEBUF) {
+			bb->size = bb->size ? bb->size * 2 : LARGEBUF;
+			bb->data = xrealloc(bb->data, bb->size);
+		}
+
+		rbuf = (char *)bb->data + bb->len;
+		rlen = bb->size - bb->len;
+	}
+
+	ret = read(ups->sock_fd, rbuf, rlen);
 
 	if (ret < 0) {
 		switch(errno)
@@ -387,6 +812,13 @@ void sstate_readline(upstype_t *ups)
 			return;
 		}
 	}
+
+	if (ups->binary) {
+		ups->binbuf.len += (size_t)ret;
+		sstate_bin_process(ups);
+		sstate_shm_fallback(ups);
+		return;
+	}
 #else	/* WIN32 */
 	if ((!ups) || INVALID_FD(ups->sock_fd)) {
 		return;
@@ -399,37 +831,67 @@ void sstate_readline(upstype_t *ups)
 	ret = bytesRead;
 #endif	/* WIN32 */
 
-	for (i = 0; i < ret; i++) {
-
-		switch (pconf_char(&ups->sock_ctx, buf[i]))
-		{
-		case 1:
-			/* set the 'last heard' time to now for later staleness checks */
-			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
-				time(&ups->last_heard);
-			}
-			continue;
-
-		case 0:
-			continue;	/* haven't gotten a line yet */
+	if (ups->binary) {
+		used = 0;
+	} else {
+		used = sstate_parse_text(ups, buf, (size_t)ret);
+	}
 
-		default:
-			/* parse error */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
-			return;
-		}
+	/* whatever follows the switch to (or arrives in) binary mode */
+	if (used >= 0 && used < ret && ups->binary) {
+		sstate_bin_append(ups, buf + used, (size_t)(ret - used));
 	}
 
+	sstate_shm_fallback(ups);
+
 #ifdef WIN32
-	/* Restart async read */
-	memset(ups->buf,0,sizeof(ups->buf));
-	ReadFile( ups->sock_fd, ups->buf, sizeof(ups->buf)-1,NULL, &(ups->read_overlapped)); /* -1 to be sure to have a trailing 0 */
+	/* Restart async read, if the data above did not cause a disconnection */
+	if (VALID_FD(ups->sock_fd)) {
+		memset(ups->buf,0,sizeof(ups->buf));
+		ReadFile( ups->sock_fd, ups->buf, sizeof(ups->buf)-1,NULL, &(ups->read_overlapped)); /* -1 to be sure to have a trailing 0 */
+	}
 #endif	/* WIN32 */
 }
 
 const char *sstate_getinfo(const upstype_t *ups, const char *var)
 {
-	return state_getinfo(ups->inforoot, var);
+	const st_tree_t	*node = state_tree_find(ups->inforoot, var);
+
+	if (!node) {
+		return NULL;
+	}
+
+	return sstate_getnodeval(ups, node);
+}
+
+/* the value of a variable as it is sent to clients (escaped), which
+ * may have to be copied out of the shared segment of the driver into
+ * a buffer that is reused by the next call; NULL if that failed */
+const char *sstate_getnodeval(const upstype_t *ups, const st_tree_t *node)
+{
+#ifdef ST_SHM_SUPPORTED
+	static char	raw[ST_MAX_VALUE_LEN], safe[ST_MAX_VALUE_LEN * 2];
+
+	if (!node->shmslot) {
+		return node->val;
+	}
+
+	/* in between segments, or falling back to frames */
+	if (!ups->shm || node->shmslot > ups->shm->numslots) {
+		return NULL;
+	}
+
+	if (!st_shm_read(st_shm_slot(ups->shm, node->shmslot - 1), raw, sizeof(raw))) {
+		upsdebugx(1, "%s: UPS [%s]: %s kept changing while being read",
+			__func__, ups->name, node->var);
+		return NULL;
+	}
+
+	return pconf_encode(raw, safe, sizeof(safe));
+#else	/* !ST_SHM_SUPPORTED */
+	NUT_UNUSED_VARIABLE(ups);
+	return node->shmslot ? NULL : node->val;
+#endif	/* !ST_SHM_SUPPORTED */
 }
 
 int sstate_getflags(const upstype_t *ups, const char *var)
@@ -508,6 +970,27 @@ void sstate_cmdfree(upstype_t *ups)
 	ups->cmdlist = NULL;
 }
 
+/* release the binary protocol buffers, interned names and shared
+ * segment of <ups> */
+void sstate_binfree(upstype_t *ups)
+{
+	size_t	i;
+
+	for (i = 0; i < ups->numbinvars; i++) {
+		free(ups->binvars[i]);
+	}
+
+	free(ups->binvars);
+	ups->binvars = NULL;
+	ups->numbinvars = 0;
+
+	st_bin_free(&ups->binbuf);
+	ups->binary = 0;
+
+	sstate_shm_unmap(ups);
+	ups->shmfailed = 0;
+}
+
 int sstate_sendline(upstype_t *ups, const char *buf)
 {
 	ssize_t	ret;
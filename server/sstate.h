@@ -38,8 +38,10 @@ extern "C" {
 
 TYPE_FD sstate_connect(upstype_t *ups);
 void sstate_disconnect(upstype_t *ups);
+void sstate_binfree(upstype_t *ups);
 void sstate_readline(upstype_t *ups);
 const char *sstate_getinfo(const upstype_t *ups, const char *var);
+const char *sstate_getnodeval(const upstype_t *ups, const st_tree_t *node);
 int sstate_getflags(const upstype_t *ups, const char *var);
 long sstate_getaux(const upstype_t *ups, const char *var);
 const enum_t *sstate_getenumlist(const upstype_t *ups, const char *var);
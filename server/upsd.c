@@ -45,6 +45,11 @@
 #  include <signal.h>
 /* #include <poll.h> */
 # endif
+
+# if (defined HAVE_SYS_EPOLL_H) && (defined HAVE_EPOLL_CREATE1) && HAVE_EPOLL_CREATE1
+#  include <sys/epoll.h>
+#  define UPSD_WITH_EPOLL 1
+# endif
 #else	/* WIN32 */
 /* Those 2 files for support of getaddrinfo, getnameinfo and freeaddrinfo
    on Windows 2000 and older versions */
@@ -82,6 +87,9 @@ int	maxage = 15;
 /* default to 1h before cleaning up status tracking entries */
 int	tracking_delay = 3600;
 
+/* what to ask drivers for: text, binary frames or shared memory (DRIVER_PROTOCOL) */
+int	driver_protocol = DRIVER_PROTOCOL_TEXT;
+
 /*
  * Preloaded to ALLOW_NO_DEVICE from upsd.conf or environment variable
  * (with higher prio for envvar); defaults to disabled for legacy compat.
@@ -114,6 +122,10 @@ static stype_t	*firstaddr = NULL;
 
 static int 	opt_af = AF_UNSPEC;
 
+/* debug counters of protocol lines sent to (already disconnected)
+ * clients vs. the write() calls it took to deliver them */
+static uintmax_t	sendback_lines_total = 0, sendback_writes_total = 0;
+
 typedef enum {
 	DRIVER = 1,
 	CLIENT,
@@ -121,14 +133,29 @@ typedef enum {
 #ifdef WIN32
 	,NAMED_PIPE
 #endif	/* WIN32 */
+#ifdef NETSSL_WITH_WORKERS
+	,HANDSHAKE	/* TLS worker threads have news */
+#endif	/* NETSSL_WITH_WORKERS */
 
 } handler_type_t;
 
 typedef struct {
 	handler_type_t	type;
 	void		*data;
+	uint32_t	gen;	/* registration generation (epoll) */
 } handler_t;
 
+/* shed clients after this many seconds of inactivity */
+/* FIXME: create an upsd.conf parameter (CLIENT_INACTIVITY_DELAY) */
+#define CLIENT_INACTIVITY_DELAY	60
+
+/* how long to wait in poll() if nothing is due earlier;
+ * disconnected drivers are also retried at this pace */
+#define MAINLOOP_TIMEOUT_MS	2000
+
+/* upper bound of the computed epoll_wait() timeout */
+#define MAINLOOP_TIMEOUT_MAX	60
+
 /* Commands and settings status tracking */
 
 /* general enable/disable status info for commands and settings
@@ -158,6 +185,30 @@ static HANDLE		mutex = INVALID_HANDLE_VALUE;
 #endif	/* WIN32 */
 static handler_t	*handler = NULL;
 
+#ifdef UPSD_WITH_EPOLL
+/* With epoll(), descriptors are registered once when a connection is
+ * opened (and dropped by the kernel when it is closed), so there is no
+ * need to walk every client on each loop cycle. Events carry the FD and
+ * a registration generation, checked against evhandler[FD] to ignore
+ * late events for a descriptor number that was closed and reused.
+ * If epoll is not usable at run-time, poll() is used as before.
+ */
+static int	epoll_fd = -1;
+static handler_t	*evhandler = NULL;
+static size_t	evhandler_size = 0;
+static uint32_t	evhandler_gen = 0;
+
+/* when to next look for inactive clients */
+static time_t	next_client_sweep = 0;
+#endif	/* UPSD_WITH_EPOLL */
+
+/* for pushing the changes which clients WATCH, see clients_watch() */
+static uintmax_t	watch_seq_pushed = 0;
+static time_t	watch_next_push = 0;
+
+/* count of connected clients, to honour maxconn when accepting */
+static nfds_t	numclients = 0;
+
 	/* pid file */
 static char	pidfn[NUT_PATH_MAX];
 
@@ -203,6 +254,7 @@ static void ups_data_stale(upstype_t *ups)
 	}
 
 	ups->stale = 1;
+	watch_ups_changed(ups);
 
 	upslogx(LOG_NOTICE, "Data for UPS [%s] is stale - check driver", ups->name);
 }
@@ -215,6 +267,7 @@ static void ups_data_ok(upstype_t *ups)
 	}
 
 	ups->stale = 0;
+	watch_ups_changed(ups);
 
 	upslogx(LOG_NOTICE, "UPS [%s] data is no longer stale", ups->name);
 }
@@ -529,6 +582,154 @@ static void setuptcp(stype_t *server)
 	return;
 }
 
+#ifdef UPSD_WITH_EPOLL
+/* start watching a descriptor for the given events
+ * returns 0 on success, -1 if it could not be registered
+ */
+static int evloop_register(int fd, handler_type_t type, void *data, uint32_t events)
+{
+	struct epoll_event	ev;
+
+	if (epoll_fd < 0 || fd < 0) {
+		return -1;
+	}
+
+	if ((size_t)fd >= evhandler_size) {
+		size_t	newsize = evhandler_size ? evhandler_size : 64;
+
+		while (newsize <= (size_t)fd) {
+			newsize *= 2;
+		}
+
+		evhandler = xrealloc(evhandler, newsize * sizeof(*evhandler));
+		memset(evhandler + evhandler_size, 0,
+			(newsize - evhandler_size) * sizeof(*evhandler));
+		evhandler_size = newsize;
+	}
+
+	evhandler[fd].type = type;
+	evhandler[fd].data = data;
+	evhandler[fd].gen = ++evhandler_gen;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)evhandler[fd].gen << 32) | (uint32_t)fd;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0
+	 || (errno == EEXIST && epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+	) {
+		upsdebugx(3, "%s: watching FD %d (type %d)", __func__, fd, type);
+		return 0;
+	}
+
+	upslog_with_errno(LOG_ERR, "%s: epoll_ctl() failed for FD %d", __func__, fd);
+	evhandler[fd].type = 0;
+	evhandler[fd].data = NULL;
+
+	return -1;
+}
+
+/* change the events watched for an already registered descriptor */
+static void evloop_modify(int fd, uint32_t events)
+{
+	struct epoll_event	ev;
+
+	if (epoll_fd < 0 || fd < 0 || (size_t)fd >= evhandler_size
+	 || !evhandler[fd].type
+	) {
+		return;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)evhandler[fd].gen << 32) | (uint32_t)fd;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+		upslog_with_errno(LOG_ERR, "%s: epoll_ctl() failed for FD %d", __func__, fd);
+	}
+}
+
+/* stop watching a descriptor which is about to be closed */
+static void evloop_unregister(int fd)
+{
+	if (epoll_fd < 0 || fd < 0 || (size_t)fd >= evhandler_size) {
+		return;
+	}
+
+	if (evhandler[fd].type) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	}
+
+	evhandler[fd].type = 0;
+	evhandler[fd].data = NULL;
+}
+
+/* set up the epoll backend and register the listening sockets;
+ * drivers and clients are added as they get connected */
+static void evloop_init(void)
+{
+	stype_t	*server;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epoll_fd < 0) {
+		upslog_with_errno(LOG_WARNING, "epoll_create1() failed, falling back to poll()");
+		return;
+	}
+
+	for (server = firstaddr; server; server = server->next) {
+		if (INVALID_FD_SOCK(server->sock_fd)) {
+			continue;
+		}
+
+		if (evloop_register(server->sock_fd, SERVER, server, EPOLLIN) < 0) {
+			fatalx(EXIT_FAILURE, "Could not watch listening socket for %s port %s",
+				server->addr, server->port);
+		}
+	}
+
+#ifdef NETSSL_WITH_WORKERS
+	if (ssl_handshake_notify_fd() >= 0
+	 && evloop_register(ssl_handshake_notify_fd(), HANDSHAKE, NULL, EPOLLIN) < 0
+	) {
+		fatalx(EXIT_FAILURE, "Could not watch TLS worker notifications");
+	}
+#endif	/* NETSSL_WITH_WORKERS */
+
+	upsdebugx(1, "%s: using epoll() for the main loop", __func__);
+}
+
+static void evloop_free(void)
+{
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+
+	free(evhandler);
+	evhandler = NULL;
+	evhandler_size = 0;
+}
+#endif	/* UPSD_WITH_EPOLL */
+
+/* follow whether the client has output pending for the event loop */
+static void client_update_events(nut_ctype_t *client)
+{
+	int	want = (client->sendbuf_len > 0);
+
+	if (want == client->sendbuf_pollout) {
+		return;
+	}
+
+#ifdef UPSD_WITH_EPOLL
+	if (epoll_fd >= 0) {
+		evloop_modify(client->sock_fd, EPOLLIN | (want ? EPOLLOUT : 0));
+	}
+#endif	/* UPSD_WITH_EPOLL */
+
+	client->sendbuf_pollout = want;
+}
+
 /* decrement the login counter for this ups */
 static void declogins(const char *upsname)
 {
@@ -555,8 +756,33 @@ static void client_disconnect(nut_ctype_t *client)
 		return;
 	}
 
+#ifdef NETSSL_WITH_WORKERS
+	if (client->ssl_handshaking) {
+		/* a worker thread has it now: cut the handshake short,
+		 * the client is dropped when the worker hands it back */
+		upsdebugx(2, "Disconnect from %s (after its TLS handshake)", client->addr);
+		shutdown(client->sock_fd, 2);
+		client->last_heard = 0;
+		return;
+	}
+#endif	/* NETSSL_WITH_WORKERS */
+
 	upsdebugx(2, "Disconnect from %s", client->addr);
 
+	/* best-effort delivery of e.g. "OK Goodbye" */
+	if (client->sendbuf_len) {
+		sendback_flush(client);
+	}
+
+	upsdebugx(3, "%s: sent %" PRIuMAX " lines to %s in %" PRIuMAX " write calls",
+		__func__, client->sendback_lines, client->addr, client->sendback_writes);
+	sendback_lines_total += client->sendback_lines;
+	sendback_writes_total += client->sendback_writes;
+
+#ifdef UPSD_WITH_EPOLL
+	evloop_unregister(client->sock_fd);
+#endif	/* UPSD_WITH_EPOLL */
+
 	shutdown(client->sock_fd, 2);
 	close(client->sock_fd);
 
@@ -586,21 +812,101 @@ static void client_disconnect(nut_ctype_t *client)
 		/* lastclient = client->prev; */
 	}
 
+	watch_free(client);
+
 	free(client->addr);
 	free(client->loginups);
 	free(client->password);
 	free(client->username);
+	free(client->sendbuf);
 	free(client);
 
+	if (numclients > 0) {
+		numclients--;
+	}
+
 	return;
 }
 
-/* send the buffer <sendbuf> of length <sendlen> to host <dest>
- * returns effectively a boolean: 0 = failed, 1 = sent ok
+/* write out whatever output is pending for this client
+ * returns 1 if everything was sent, 0 if some data is left for a later
+ * attempt (e.g. non-blocking socket is full), -1 on failure
  */
-int sendback(nut_ctype_t *client, const char *fmt, ...)
+int sendback_flush(nut_ctype_t *client)
 {
 	ssize_t	res;
+	size_t	sent = 0;
+
+	if (!client) {
+		return -1;
+	}
+
+	while (sent < client->sendbuf_len) {
+		size_t	len = client->sendbuf_len - sent;
+
+		/* System write() and our ssl_write() have a loophole that they write a
+		 * size_t amount of bytes and upon success return that in ssize_t value
+		 */
+		assert(len < SSIZE_MAX);
+
+#ifdef WITH_SSL
+		if (client->ssl) {
+			res = ssl_write(client, client->sendbuf + sent, len);
+		} else
+#endif /* WITH_SSL */
+		{
+			res = write(client->sock_fd, client->sendbuf + sent, len);
+		}
+
+		client->sendback_writes++;
+
+		if (res > 0) {
+			sent += (size_t)res;
+			continue;
+		}
+
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (res < 0 && (errno == EAGAIN
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+			|| errno == EWOULDBLOCK
+#endif
+		)) {
+			break;
+		}
+
+		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+		client->sendbuf_len = 0;
+		client->last_heard = 0;
+		return -1;	/* failed */
+	}
+
+	upsdebugx(3, "%s: [destfd=%d] sent %" PRIuSIZE " of %" PRIuSIZE
+		" bytes; so far %" PRIuMAX " lines in %" PRIuMAX " writes",
+		__func__, client->sock_fd, sent, client->sendbuf_len,
+		client->sendback_lines, client->sendback_writes);
+
+	if (sent < client->sendbuf_len) {
+		/* keep the rest for when the socket is writable again */
+		memmove(client->sendbuf, client->sendbuf + sent, client->sendbuf_len - sent);
+		client->sendbuf_len -= sent;
+		return 0;
+	}
+
+	client->sendbuf_len = 0;
+	return 1;	/* OK */
+}
+
+/* format a protocol line for host <client>, it is queued while
+ * a request is being handled (so a whole response goes out in
+ * as few writes as possible) or is sent right away otherwise
+ * returns effectively a boolean: 0 = failed, 1 = sent (or queued) ok
+ */
+int sendback(nut_ctype_t *client, const char *fmt, ...)
+{
+	int	res;
 	size_t	len;
 	char	ans[NUT_NET_ANSWER_MAX+1];
 	va_list	ap;
@@ -610,37 +916,50 @@ int sendback(nut_ctype_t *client, const char *fmt, ...)
 	}
 
 	va_start(ap, fmt);
-	vsnprintf(ans, sizeof(ans), fmt, ap);
+	res = vsnprintf(ans, sizeof(ans), fmt, ap);
 	va_end(ap);
 
+	if (res < 0) {
+		return 0;
+	}
+
 	len = strlen(ans);
 
-	/* System write() and our ssl_write() have a loophole that they write a
-	 * size_t amount of bytes and upon success return that in ssize_t value
-	 */
-	assert(len < SSIZE_MAX);
+	if (nut_debug_level >= 2) {
+		/* log without the trailing newline */
+		size_t	loglen = (len > 0 && ans[len - 1] == '\n') ? len - 1 : len;
 
-#ifdef WITH_SSL
-	if (client->ssl) {
-		res = ssl_write(client, ans, len);
-	} else
-#endif /* WITH_SSL */
-	{
-		res = write(client->sock_fd, ans, len);
-	}
-
-	{ /* scoping */
-		char * s = str_rtrim(ans, '\n');
-		upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%s]", client->sock_fd, len, s);
+		upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%.*s]",
+			client->sock_fd, len, (int)loglen, ans);
 	}
 
-	if (res < 0 || len != (size_t)res) {
-		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+	if (client->sendbuf_len + len > NUT_NET_SENDBUF_MAX) {
+		upslogx(LOG_NOTICE, "Client %s does not read its responses, dropping it",
+			client->addr);
+		client->sendbuf_len = 0;
 		client->last_heard = 0;
 		return 0;	/* failed */
 	}
 
-	return 1;	/* OK */
+	if (client->sendbuf_size < client->sendbuf_len + len) {
+		client->sendbuf_size = client->sendbuf_len + len;
+		if (client->sendbuf_size < SMALLBUF) {
+			client->sendbuf_size = SMALLBUF;
+		} else if (client->sendbuf_size < 2 * client->sendbuf_len) {
+			client->sendbuf_size = 2 * client->sendbuf_len;
+		}
+		client->sendbuf = xrealloc(client->sendbuf, client->sendbuf_size);
+	}
+
+	memcpy(client->sendbuf + client->sendbuf_len, ans, len);
+	client->sendbuf_len += len;
+	client->sendback_lines++;
+
+	if (client->sendbuf_hold && client->sendbuf_len < NUT_NET_SENDBUF_FLUSH) {
+		return 1;	/* queued, flushed when the request is done */
+	}
+
+	return (sendback_flush(client) >= 0);
 }
 
 /* just a simple wrapper for now */
@@ -701,6 +1020,63 @@ int ups_available(const upstype_t *ups, nut_ctype_t *client)
 	return 1;
 }
 
+/* push the changes this client watches for (see netwatch.c); returns 0
+ * if it was disconnected meanwhile (e.g. it does not read what we send) */
+static int client_watch(nut_ctype_t *client, time_t now)
+{
+	time_t	next;
+
+	if (!client->watches) {
+		return 1;
+	}
+
+	watch_send(client, now);
+
+	if (!client->last_heard) {
+		client_disconnect(client);
+		return 0;
+	}
+
+	client_update_events(client);
+
+	/* anything held back by an INTERVAL? */
+	next = watch_next(client);
+	if (next && (!watch_next_push || next < watch_next_push)) {
+		watch_next_push = next;
+	}
+
+	return 1;
+}
+
+/* push the changes which clients watch for, if there were any since
+ * the last time, or some which were held back are due now */
+static void clients_watch(time_t now)
+{
+	nut_ctype_t	*client, *cnext;
+
+	if (watch_seq == watch_seq_pushed
+	 && (!watch_next_push || now < watch_next_push)
+	) {
+		return;
+	}
+
+	watch_seq_pushed = watch_seq;
+	watch_next_push = 0;
+
+	for (client = firstclient; client; client = cnext) {
+		cnext = client->next;
+
+#ifdef NETSSL_WITH_WORKERS
+		/* a TLS worker has it for now */
+		if (client->ssl_handshaking) {
+			continue;
+		}
+#endif	/* NETSSL_WITH_WORKERS */
+
+		client_watch(client, now);
+	}
+}
+
 /* check flags and access for an incoming command from the network */
 static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
 	const char **arg)
@@ -787,11 +1163,10 @@ static void parse_net(nut_ctype_t *client)
 		return;
 	}
 
-	for (i = 0; netcmds[i].name; i++) {
-		if (!strcasecmp(netcmds[i].name, client->ctx.arglist[0])) {
-			check_command(i, client, client->ctx.numargs, (const char **) client->ctx.arglist);
-			return;
-		}
+	i = netcmd_find(client->ctx.arglist[0]);
+	if (i >= 0) {
+		check_command(i, client, client->ctx.numargs, (const char **) client->ctx.arglist);
+		return;
 	}
 
 	/* fallthrough = not matched by any entry in netcmds */
@@ -799,6 +1174,26 @@ static void parse_net(nut_ctype_t *client)
 	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
 }
 
+/* how many descriptors (of maxconn) are taken by drivers and listeners */
+static nfds_t count_reserved_fds(void)
+{
+	nfds_t	count = 0;
+	upstype_t	*ups;
+	stype_t	*server;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		count++;
+	}
+
+	for (server = firstaddr; server; server = server->next) {
+		if (VALID_FD_SOCK(server->sock_fd)) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
 /* answer incoming tcp connections */
 static void client_connect(stype_t *server)
 {
@@ -818,6 +1213,27 @@ static void client_connect(stype_t *server)
 		return;
 	}
 
+	/* drivers and listeners take up their slots in maxconn too */
+	if (numclients >= maxconn || maxconn - numclients <= count_reserved_fds()) {
+		static time_t	last_warned = 0;
+		time_t	now;
+
+		/* rate-limit complaints - don't spam the syslog */
+		time(&now);
+		if (difftime(now, last_warned) > CLIENT_INACTIVITY_DELAY) {
+			upslogx(LOG_WARNING, "Rejecting connection from %s: "
+				"MAXCONN (%" PRIdMAX ") reached, %" PRIdMAX " clients connected",
+				inet_ntopSS(&csock), (intmax_t)maxconn, (intmax_t)numclients);
+			last_warned = now;
+		} else {
+			upsdebugx(1, "Rejecting connection from %s: MAXCONN reached",
+				inet_ntopSS(&csock));
+		}
+
+		close(fd);
+		return;
+	}
+
 	client = xcalloc(1, sizeof(*client));
 
 	client->sock_fd = fd;
@@ -846,6 +1262,14 @@ static void client_connect(stype_t *server)
 	}
 
 	firstclient = client;
+	numclients++;
+
+#ifdef UPSD_WITH_EPOLL
+	if (epoll_fd >= 0 && evloop_register(fd, CLIENT, client, EPOLLIN) < 0) {
+		client_disconnect(client);
+		return;
+	}
+#endif	/* UPSD_WITH_EPOLL */
 
 /*
 	if (lastclient) {
@@ -862,7 +1286,7 @@ static void client_connect(stype_t *server)
 static void client_readline(nut_ctype_t *client)
 {
 	char	buf[SMALLBUF];
-	int	i;
+	size_t	i, used;
 	ssize_t	ret;
 
 #ifdef WITH_SSL
@@ -886,15 +1310,25 @@ static void client_readline(nut_ctype_t *client)
 		return;
 	}
 
+	/* collect responses to all requests in this chunk,
+	 * and send them out together below */
+	client->sendbuf_hold++;
+
 	/* fragment handling code */
-	for (i = 0; i < ret; i++) {
+	for (i = 0; i < (size_t)ret; i += used) {
 
-		/* add to the receive queue one by one */
-		switch (pconf_char(&client->ctx, buf[i]))
+		/* whole lines at once, a partial one is kept for the next read */
+		switch (pconf_chunk(&client->ctx, buf + i, (size_t)ret - i, &used))
 		{
 		case 1:
 			time(&client->last_heard);	/* command received */
 			parse_net(client);
+#ifdef NETSSL_WITH_WORKERS
+			/* STARTTLS handed the connection over to a worker */
+			if (client->ssl_handshaking) {
+				break;
+			}
+#endif	/* NETSSL_WITH_WORKERS */
 			continue;
 
 		case 0:
@@ -903,13 +1337,62 @@ static void client_readline(nut_ctype_t *client)
 		default:
 			/* parse error */
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
-			return;
+			break;
 		}
+
+		break;
+	}
+
+	client->sendbuf_hold--;
+
+#ifdef NETSSL_WITH_WORKERS
+	if (client->ssl_handshaking) {
+		/* not ours to watch until the handshake is done */
+# ifdef UPSD_WITH_EPOLL
+		evloop_unregister(client->sock_fd);
+# endif	/* UPSD_WITH_EPOLL */
+		client->sendbuf_pollout = 0;
+		return;
 	}
+#endif	/* NETSSL_WITH_WORKERS */
+
+	if (client->sendbuf_len) {
+		sendback_flush(client);
+	}
+
+	client_update_events(client);
 
 	return;
 }
 
+#ifdef NETSSL_WITH_WORKERS
+/* take back the clients whose TLS handshake was done by a worker */
+static void client_handshake_done(void)
+{
+	nut_ctype_t	*client;
+
+	while ((client = ssl_handshake_done()) != NULL) {
+		if (!client->last_heard || !client->ssl_connected) {
+			upsdebugx(2, "%s: TLS handshake with %s failed or was cut short",
+				__func__, client->addr);
+			client_disconnect(client);
+			continue;
+		}
+
+		upsdebugx(3, "%s: TLS handshake with %s is done", __func__, client->addr);
+		time(&client->last_heard);
+
+# ifdef UPSD_WITH_EPOLL
+		if (epoll_fd >= 0
+		 && evloop_register(client->sock_fd, CLIENT, client, EPOLLIN) < 0
+		) {
+			client_disconnect(client);
+		}
+# endif	/* UPSD_WITH_EPOLL */
+	}
+}
+#endif	/* NETSSL_WITH_WORKERS */
+
 void server_load(void)
 {
 	stype_t	*server;
@@ -1099,6 +1582,7 @@ static void driver_free(void)
 
 		sstate_infofree(ups);
 		sstate_cmdfree(ups);
+		sstate_binfree(ups);
 
 		pconf_finish(&ups->sock_ctx);
 
@@ -1124,9 +1608,18 @@ static void upsd_cleanup(void)
 
 	server_free();
 	client_free();
+
+	upsdebugx(1, "%s: sent %" PRIuMAX " protocol lines to clients "
+		"in %" PRIuMAX " write calls overall",
+		__func__, sendback_lines_total, sendback_writes_total);
+
 	driver_free();
 	tracking_free();
 
+#ifdef UPSD_WITH_EPOLL
+	evloop_free();
+#endif	/* UPSD_WITH_EPOLL */
+
 	free(statepath);
 	free(datapath);
 	free(certfile);
@@ -1310,6 +1803,26 @@ void tracking_cleanup(void)
 	}
 }
 
+#ifdef UPSD_WITH_EPOLL
+/* when will tracking_cleanup() next have something to do?
+ * returns 0 if there are no tracking entries */
+static time_t tracking_next_cleanup(void)
+{
+	tracking_t	*item;
+	time_t	next = 0;
+
+	for (item = tracking_list; item; item = item->next) {
+		time_t	t = item->request_time + tracking_delay + 1;
+
+		if (!next || t < next) {
+			next = t;
+		}
+	}
+
+	return next;
+}
+#endif	/* UPSD_WITH_EPOLL */
+
 /* get status of a specific tracking entry */
 char *tracking_get(const char *id)
 {
@@ -1411,6 +1924,237 @@ static void set_reload_flag(int sig)
 	reload_flag = 1;
 }
 
+#ifdef UPSD_WITH_EPOLL
+/* keep the earliest deadline which is still ahead of now */
+static void next_deadline(time_t *next, time_t now, time_t t)
+{
+	if (t > now && t < *next) {
+		*next = t;
+	}
+}
+
+/* service requests and check on new data, using epoll():
+ * only drivers are walked on each cycle (to reconnect them and to
+ * check their staleness), clients are registered when they connect
+ * and swept for inactivity only when one of them may have expired
+ */
+static void mainloop_epoll(time_t now)
+{
+	struct epoll_event	events[64];
+	int	ret, i, timeout;
+	time_t	next = now + MAINLOOP_TIMEOUT_MAX;
+	upstype_t	*ups;
+	nut_ctype_t	*client, *cnext;
+
+	/* scan through driver sockets */
+	for (ups = firstups; ups; ups = ups->next) {
+
+		/* see if we need to (re)connect to the socket */
+		if (INVALID_FD(ups->sock_fd)) {
+			/* the kernel forgot its registration upon close() */
+			ups->ev_fd = ERROR_FD;
+
+			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
+				"trying to reconnect",
+				__func__, ups->name);
+			ups->sock_fd = sstate_connect(ups);
+			if (INVALID_FD(ups->sock_fd)) {
+				upsdebugx(1, "%s: UPS [%s] is still not connected (FD %d)",
+					__func__, ups->name, ups->sock_fd);
+				/* retry at the same pace as with poll() */
+				next_deadline(&next, now, now + MAINLOOP_TIMEOUT_MS / 1000);
+				continue;
+			}
+
+			upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
+				__func__, ups->name, ups->sock_fd);
+		} else {
+			/* throw some warnings if it's not feeding us data any more */
+			if (sstate_dead(ups, maxage)) {
+				ups_data_stale(ups);
+			} else {
+				ups_data_ok(ups);
+			}
+		}
+
+		if (ups->ev_fd != ups->sock_fd) {
+			if (evloop_register(ups->sock_fd, DRIVER, ups, EPOLLIN) < 0) {
+				sstate_disconnect(ups);
+				continue;
+			}
+			ups->ev_fd = ups->sock_fd;
+		}
+
+		/* when sstate_dead() would ping the driver, or call it stale */
+		next_deadline(&next, now,
+			(ups->last_heard > ups->last_ping ? ups->last_heard : ups->last_ping)
+			+ maxage / 3 + 1);
+		next_deadline(&next, now, ups->last_heard + maxage + 1);
+	}
+
+	/* shed clients after a period of inactivity */
+	if (now >= next_client_sweep) {
+		next_client_sweep = now + CLIENT_INACTIVITY_DELAY + 1;
+
+		for (client = firstclient; client; client = cnext) {
+			cnext = client->next;
+
+#ifdef NETSSL_WITH_WORKERS
+			/* the worker enforces its own handshake timeout */
+			if (client->ssl_handshaking) {
+				continue;
+			}
+#endif	/* NETSSL_WITH_WORKERS */
+
+			/* a client which watches a UPS may just be listening */
+			if (client->watches && client->last_heard) {
+				continue;
+			}
+
+			if (difftime(now, client->last_heard) > CLIENT_INACTIVITY_DELAY) {
+				client_disconnect(client);
+				continue;
+			}
+
+			if (client->last_heard + CLIENT_INACTIVITY_DELAY + 1 < next_client_sweep) {
+				next_client_sweep = client->last_heard + CLIENT_INACTIVITY_DELAY + 1;
+			}
+		}
+	}
+	next_deadline(&next, now, next_client_sweep);
+
+	next_deadline(&next, now, tracking_next_cleanup());
+	next_deadline(&next, now, watch_next_push);
+
+	timeout = (next > now ? (int)(next - now) : 1) * 1000;
+
+	upsdebugx(2, "%s: waiting for events on %" PRIdMAX
+		" clients for up to %d ms", __func__, (intmax_t)numclients, timeout);
+
+	ret = epoll_wait(epoll_fd, events, (int)SIZEOF_ARRAY(events), timeout);
+
+	if (ret == 0) {
+		upsdebugx(2, "%s: no data available", __func__);
+		return;
+	}
+
+	if (ret < 0) {
+		upslog_with_errno(LOG_ERR, "%s", __func__);
+		return;
+	}
+
+	for (i = 0; i < ret; i++) {
+		int	fd = (int)(events[i].data.u64 & 0xFFFFFFFF);
+		uint32_t	gen = (uint32_t)(events[i].data.u64 >> 32);
+		uint32_t	revents = events[i].events;
+		void	*data;
+
+		/* not (or no longer) the descriptor this event was meant for? */
+		if ((size_t)fd >= evhandler_size || !evhandler[fd].type
+		 || evhandler[fd].gen != gen
+		) {
+			upsdebugx(5, "%s: ignoring late event for FD %d", __func__, fd);
+			continue;
+		}
+
+		/* NOTE: handlers may grow (realloc) evhandler[], do not keep pointers */
+		data = evhandler[fd].data;
+
+		switch (evhandler[fd].type)
+		{
+		case DRIVER:
+			ups = (upstype_t *)data;
+
+			/* closed (e.g. by a failed write) since the registration */
+			if (ups->sock_fd != fd) {
+				break;
+			}
+
+			if (revents & (EPOLLHUP|EPOLLERR)) {
+				sstate_disconnect(ups);
+			} else if (revents & EPOLLIN) {
+				sstate_readline(ups);
+			}
+			break;
+
+		case CLIENT:
+			client = (nut_ctype_t *)data;
+
+			if (revents & (EPOLLHUP|EPOLLERR)) {
+				client_disconnect(client);
+				break;
+			}
+
+			if (revents & EPOLLOUT) {
+				/* an update held back meanwhile can go now */
+				if (sendback_flush(client) > 0 && !client_watch(client, now)) {
+					break;
+				}
+			}
+
+			if (revents & EPOLLIN) {
+				client_readline(client);
+
+				/* was the client disconnected while reading? */
+				if (!evhandler[fd].type || evhandler[fd].gen != gen) {
+					break;
+				}
+			}
+
+			/* logged out or failed to write, no need to wait for a sweep */
+			if (!client->last_heard) {
+				client_disconnect(client);
+				break;
+			}
+
+			client_update_events(client);
+			break;
+
+		case SERVER:
+			if (revents & EPOLLIN) {
+				client_connect((stype_t *)data);
+			}
+			break;
+
+#ifdef NETSSL_WITH_WORKERS
+		case HANDSHAKE:
+			client_handshake_done();
+			break;
+#endif	/* NETSSL_WITH_WORKERS */
+
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic push
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
+# pragma GCC diagnostic ignored "-Wcovered-switch-default"
+#endif
+#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
+# pragma GCC diagnostic ignored "-Wunreachable-code"
+#endif
+/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcovered-switch-default"
+#pragma clang diagnostic ignored "-Wunreachable-code"
+#endif
+		/* All enum cases defined as of the time of coding
+		 * have been covered above. Handle later definitions,
+		 * memory corruptions and buggy inputs below...
+		 */
+		default:
+			upsdebugx(2, "%s: <unknown> has events 0x%x", __func__, revents);
+			break;
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
+# pragma GCC diagnostic pop
+#endif
+		}
+	}
+}
+#endif	/* UPSD_WITH_EPOLL */
+
 /* service requests and check on new data */
 static void mainloop(void)
 {
@@ -1443,6 +2187,16 @@ static void mainloop(void)
 	/* cleanup instcmd/setvar status tracking entries if needed */
 	tracking_cleanup();
 
+	/* changes from the drivers, for those who WATCH */
+	clients_watch(now);
+
+#ifdef UPSD_WITH_EPOLL
+	if (epoll_fd >= 0) {
+		mainloop_epoll(now);
+		return;
+	}
+#endif	/* UPSD_WITH_EPOLL */
+
 #ifndef WIN32
 	/* scan through driver sockets */
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
@@ -1484,21 +2238,37 @@ static void mainloop(void)
 
 		cnext = client->next;
 
-		if (difftime(now, client->last_heard) > 60) {
+#ifdef NETSSL_WITH_WORKERS
+		/* a TLS worker has it for now */
+		if (client->ssl_handshaking) {
+			continue;
+		}
+#endif	/* NETSSL_WITH_WORKERS */
+
+		/* a client which watches a UPS may just be listening */
+		if ((!client->watches || !client->last_heard)
+		 && difftime(now, client->last_heard) > CLIENT_INACTIVITY_DELAY
+		) {
 			/* shed clients after 1 minute of inactivity */
-			/* FIXME: create an upsd.conf parameter (CLIENT_INACTIVITY_DELAY) */
 			client_disconnect(client);
 			continue;
 		}
 
 		if (nfds >= maxconn) {
-			/* ignore clients that we are unable to handle */
+			/* should not happen, client_connect() honours maxconn */
+			upsdebugx(1, "%s: ignoring client %s beyond maxconn",
+				__func__, client->addr);
 			continue;
 		}
 
 		fds[nfds].fd = client->sock_fd;
 		fds[nfds].events = POLLIN;
 
+		/* wait to write out the rest of a response, if any */
+		if (client->sendbuf_len) {
+			fds[nfds].events |= POLLOUT;
+		}
+
 		handler[nfds].type = CLIENT;
 		handler[nfds].data = client;
 
@@ -1521,9 +2291,21 @@ static void mainloop(void)
 		nfds++;
 	}
 
+#ifdef NETSSL_WITH_WORKERS
+	if (ssl_handshake_notify_fd() >= 0 && nfds < maxconn) {
+		fds[nfds].fd = ssl_handshake_notify_fd();
+		fds[nfds].events = POLLIN;
+
+		handler[nfds].type = HANDSHAKE;
+		handler[nfds].data = NULL;
+
+		nfds++;
+	}
+#endif	/* NETSSL_WITH_WORKERS */
+
 	upsdebugx(2, "%s: polling %" PRIdMAX " filedescriptors", __func__, (intmax_t)nfds);
 
-	ret = poll(fds, nfds, 2000);
+	ret = poll(fds, nfds, MAINLOOP_TIMEOUT_MS);
 
 	if (ret == 0) {
 		upsdebugx(2, "%s: no data available", __func__);
@@ -1550,6 +2332,11 @@ static void mainloop(void)
 			case SERVER:
 				upsdebugx(2, "%s: server disconnected", __func__);
 				break;
+#ifdef NETSSL_WITH_WORKERS
+			case HANDSHAKE:
+				upsdebugx(2, "%s: TLS worker notification pipe failed", __func__);
+				break;
+#endif	/* NETSSL_WITH_WORKERS */
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
@@ -1585,6 +2372,16 @@ static void mainloop(void)
 			continue;
 		}
 
+		if ((fds[i].revents & POLLOUT) && handler[i].type == CLIENT) {
+			/* an update held back meanwhile can go now */
+			if (sendback_flush((nut_ctype_t *)handler[i].data) > 0
+			 && !client_watch((nut_ctype_t *)handler[i].data, now)
+			) {
+				continue;
+			}
+			client_update_events((nut_ctype_t *)handler[i].data);
+		}
+
 		if (fds[i].revents & POLLIN) {
 
 			switch(handler[i].type)
@@ -1598,6 +2395,11 @@ static void mainloop(void)
 			case SERVER:
 				client_connect((stype_t *)handler[i].data);
 				break;
+#ifdef NETSSL_WITH_WORKERS
+			case HANDSHAKE:
+				client_handshake_done();
+				break;
+#endif	/* NETSSL_WITH_WORKERS */
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
@@ -1675,7 +2477,10 @@ static void mainloop(void)
 
 		cnext = client->next;
 
-		if (difftime(now, client->last_heard) > 60) {
+		/* a client which watches a UPS may just be listening */
+		if ((!client->watches || !client->last_heard)
+		 && difftime(now, client->last_heard) > 60
+		) {
 			/* shed clients after 1 minute of inactivity */
 			client_disconnect(client);
 			continue;
@@ -2274,6 +3079,7 @@ int main(int argc, char **argv)
 	} /* scope */
 
 	/* start server */
+	watch_init();
 	server_load();
 
 	become_user(new_uid);
@@ -2325,6 +3131,10 @@ int main(int argc, char **argv)
 	/* initialize SSL (keyfile must be readable by nut user) */
 	ssl_init();
 
+#ifdef UPSD_WITH_EPOLL
+	evloop_init();
+#endif	/* UPSD_WITH_EPOLL */
+
 	upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 
 	while (!exit_flag) {
@@ -52,6 +52,18 @@ typedef unsigned long int nfds_t;
 
 #define NUT_NET_ANSWER_MAX SMALLBUF
 
+/* write out pending client output once it grows this large,
+ * even if a response is still being collected */
+#define NUT_NET_SENDBUF_FLUSH	(64 * 1024)
+
+/* drop clients which do not read back their responses in time */
+#define NUT_NET_SENDBUF_MAX	(16 * NUT_NET_SENDBUF_FLUSH)
+
+/* values of DRIVER_PROTOCOL, see sstate_dumpcmd() */
+#define DRIVER_PROTOCOL_TEXT	0
+#define DRIVER_PROTOCOL_BINARY	1
+#define DRIVER_PROTOCOL_SHM	2
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -68,6 +80,7 @@ void listen_add(const char *addr, const char *port);
 void kick_login_clients(const char *upsname);
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
+int sendback_flush(nut_ctype_t *client);
 int send_err(nut_ctype_t *client, const char *errtype);
 
 void server_load(void);
@@ -99,6 +112,7 @@ int tracking_is_enabled(void);
 
 /* declarations from upsd.c */
 extern int		maxage, tracking_delay, allow_no_device, allow_not_all_listeners;
+extern int		driver_protocol;
 extern nfds_t		maxconn;
 extern char		*statepath, *datapath;
 extern upstype_t	*firstups;
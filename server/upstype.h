@@ -24,6 +24,7 @@
 
 #include "parseconf.h"
 #include "common.h"
+#include "state.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -37,6 +38,7 @@ typedef struct upstype_s {
 	char			*fn;	/* base filename of UPS socket (or part of pipe name in WIN32) as "drivername-upsname" */
 	char			*desc;
 	TYPE_FD			sock_fd;
+	TYPE_FD			ev_fd;	/* sock_fd as registered with the upsd event loop, if any */
 #ifdef WIN32
 	char 			buf[SMALLBUF];
 	OVERLAPPED		read_overlapped;
@@ -48,8 +50,16 @@ typedef struct upstype_s {
 	time_t			last_ping;
 	time_t			last_connfail;
 	PCONF_CTX_t		sock_ctx;
+	int			binary;		/* driver sends binary frames, see DRIVER_PROTOCOL */
+	st_bin_buf_t		binbuf;		/* frame(s) being received */
+	char			**binvars;	/* variable names interned by the driver */
+	size_t			numbinvars;
+	st_shm_header_t		*shm;		/* values published by the driver, for DRIVER_PROTOCOL shm */
+	size_t			shmsize;
+	int			shmfailed;	/* could not map it, ask for values in frames */
 	struct st_tree_s	*inforoot;
 	struct cmdlist_s	*cmdlist;
+	uintmax_t		watchseq;	/* last change of a value, see netwatch.c */
 
 	int	numlogins;
 	int	fsd;		/* forced shutdown in effect? */
@@ -325,17 +325,19 @@ int user_checkaction(const char *un, const char *pw, const char *action)
 /* FIXME: Protocol update needed to handle master/primary alias (in action and in protocol) */
 static void set_upsmon_type(char *type)
 {
-	/* primary: login, master, fsd */
+	/* primary: login, master, fsd, watch */
 	if (!strcasecmp(type, "master") || !strcasecmp(type, "primary")) {
 		user_add_action("login");
 		user_add_action("master"); /* Note: this is linked to "MASTER" API command permission */
 		user_add_action("fsd");
+		user_add_action("watch");
 		return;
 	}
 
-	/* secondary: just login */
+	/* secondary: login, watch */
 	if (!strcasecmp(type, "slave") || !strcasecmp(type, "secondary")) {
 		user_add_action("login");
+		user_add_action("watch");
 		return;
 	}
 
@@ -318,6 +318,7 @@ PID_UPSSCHED=""
 PID_DUMMYUPS=""
 PID_DUMMYUPS1=""
 PID_DUMMYUPS2=""
+PID_SNMPD=""
 
 # Stash it for some later decisions
 TESTDIR_CALLER="${TESTDIR-}"
@@ -399,10 +400,10 @@ stop_daemons() {
         PID_UPSSCHED_NOW="`head -1 "$NUT_PIDPATH/upssched.pid"`"
     fi
 
-    if [ -n "$PID_UPSD$PID_UPSMON$PID_DUMMYUPS$PID_DUMMYUPS1$PID_DUMMYUPS2$PID_UPSSCHED$PID_UPSSCHED_NOW" ] ; then
+    if [ -n "$PID_UPSD$PID_UPSMON$PID_DUMMYUPS$PID_DUMMYUPS1$PID_DUMMYUPS2$PID_UPSSCHED$PID_UPSSCHED_NOW$PID_SNMPD" ] ; then
         log_info "Stopping test daemons"
-        kill -15 $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW 2>/dev/null || return 0
-        wait $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW || true
+        kill -15 $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW $PID_SNMPD 2>/dev/null || return 0
+        wait $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW $PID_SNMPD || true
     fi
 
     PID_UPSD=""
@@ -411,6 +412,7 @@ stop_daemons() {
     PID_DUMMYUPS=""
     PID_DUMMYUPS1=""
     PID_DUMMYUPS2=""
+    PID_SNMPD=""
 
     unset PID_UPSSCHED_NOW
 }
@@ -1622,6 +1624,352 @@ testcases_sandbox_nutscanner() {
     testcase_sandbox_nutscanner_list
 }
 
+isTestableTLSLoad() {
+    # We build the test client, but need upsd with OpenSSL and a way
+    # to make a certificate for it:
+    if [ x"${TOP_BUILDDIR}" = x ] \
+    || [ ! -x "${TOP_BUILDDIR}/tests/nuttlsloadtest" ] \
+    ; then
+        log_warn "SKIP: ${TOP_BUILDDIR}/tests/nuttlsloadtest: Not found"
+        return 1
+    fi
+    if ! grep -E '^#define WITH_OPENSSL 1' "${TOP_BUILDDIR}/include/config.h" >/dev/null 2>/dev/null ; then
+        log_warn "SKIP: TLS load test: upsd was not built with OpenSSL"
+        return 1
+    fi
+    if ! (command -v openssl) >/dev/null 2>/dev/null ; then
+        log_warn "SKIP: TLS load test: no openssl program to make a certificate with"
+        return 1
+    fi
+    return 0
+}
+
+# Sets DRIVER_DUMP to what clients can see of the UPS2 data set (which
+# is static, in dummy-once mode) via upsd
+driver_protocol_dump() {
+    DRIVER_DUMP="`upsc UPS2@localhost:$NUT_PORT 2>/dev/null | grep -v '^driver\.state:'`
+`upsrw UPS2@localhost:$NUT_PORT 2>/dev/null`
+`upscmd -l UPS2@localhost:$NUT_PORT 2>/dev/null`"
+}
+
+# Restarts upsd with DRIVER_PROTOCOL set to $1, and checks that clients
+# get the same data as with the (default) text protocol
+driver_protocol_check() {
+    DRIVER_PROTOCOL="$1"
+    TESTCASE="testcase_sandbox_driver_protocol_$1"
+
+    if [ x"${TOP_SRCDIR}" = x ]; then
+        log_warn "[$TESTCASE] SKIP: needs the UPS2 data set from TOP_SRCDIR"
+        return 0
+    fi
+
+    log_separator
+    log_info "[$TESTCASE] Check that upsd gets the same data from drivers with DRIVER_PROTOCOL $DRIVER_PROTOCOL"
+
+    if [ x"$DRIVER_DUMP_TEXT" = x ]; then
+        driver_protocol_dump
+        DRIVER_DUMP_TEXT="$DRIVER_DUMP"
+    fi
+
+    echo "DRIVER_PROTOCOL $DRIVER_PROTOCOL" >> "$NUT_CONFPATH/upsd.conf" \
+    || die "Failed to populate temporary FS structure for the NIT: upsd.conf"
+
+    # Drivers are asked for the protocol when upsd connects to them
+    log_info "[$TESTCASE] Restarting upsd with DRIVER_PROTOCOL $DRIVER_PROTOCOL"
+    if isPidAlive "$PID_UPSD" ; then
+        kill -15 $PID_UPSD 2>/dev/null
+        wait $PID_UPSD
+    fi
+    PID_UPSD=""
+    upsd_start_loop "$TESTCASE"
+
+    COUNTDOWN=30
+    while [ "$COUNTDOWN" -gt 0 ]; do
+        runcmd upsc UPS2@localhost:$NUT_PORT ups.status \
+        && [ x"$CMDOUT" != x"WAIT" ] && break
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+    done
+
+    driver_protocol_dump
+
+    if [ -n "$DRIVER_DUMP_TEXT" ] \
+    && echo "$DRIVER_DUMP_TEXT" | grep -E '^device\.model: ' >/dev/null \
+    && [ x"$DRIVER_DUMP_TEXT" = x"$DRIVER_DUMP" ] \
+    ; then
+        log_info "[$TESTCASE] PASSED: same data with text and $DRIVER_PROTOCOL driver protocols"
+        PASSED="`expr $PASSED + 1`"
+    else
+        log_error "[$TESTCASE] got different data with the $DRIVER_PROTOCOL driver protocol:"
+        echo "=== text:"
+        echo "$DRIVER_DUMP_TEXT"
+        echo "=== $DRIVER_PROTOCOL:"
+        echo "$DRIVER_DUMP"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS $TESTCASE"
+    fi
+}
+
+testcase_sandbox_driver_protocol_binary() {
+    driver_protocol_check binary
+}
+
+testcase_sandbox_driver_protocol_shm() {
+    # Falls back to binary frames where not supported
+    driver_protocol_check shm
+
+    case "`uname -s`" in
+        MINGW*|MSYS*|CYGWIN*|Windows*)
+            log_warn "[testcase_sandbox_driver_protocol_shm] SKIP: no shared state files on Windows"
+            return 0 ;;
+    esac
+
+    # The values should be published next to the driver socket
+    if ls "$NUT_STATEPATH"/*UPS2.shm >/dev/null 2>&1 ; then
+        log_info "[testcase_sandbox_driver_protocol_shm] PASSED: driver published a shared state file"
+        PASSED="`expr $PASSED + 1`"
+    else
+        log_error "[testcase_sandbox_driver_protocol_shm] driver did not publish a shared state file"
+        ls -la "$NUT_STATEPATH" || true
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_driver_protocol_shm"
+    fi
+}
+
+isTestableSNMPBatching() {
+    # Needs the snmp-ups driver, and an SNMP agent to talk to
+    if ! (command -v snmp-ups) >/dev/null 2>/dev/null ; then
+        log_warn "SKIP: snmp-ups driver: Not found"
+        return 1
+    fi
+    if ! (command -v snmpd) >/dev/null 2>/dev/null ; then
+        log_warn "SKIP: SNMP batching test: no snmpd program to serve the data"
+        return 1
+    fi
+    return 0
+}
+
+# Runs snmp-ups in data dump mode against the test snmpd, with the
+# given snmp_max_varbinds (and optionally snmp_max_inflight) setting;
+# sets SNMP_REQUESTS to the amount of requests sent in the last update
+# cycle, and SNMP_DUMP to the data
+snmp_batching_run() {
+    SNMP_REQUESTS=""
+    SNMP_DUMP=""
+
+    runcmd snmp-ups -D -s nit-snmp -d 6 -i 1 \
+        -x port="127.0.0.1:$NUT_PORT" -x mibs=ietf -x snmp_version=v2c \
+        -x pollfreq=1 -x snmp_retries=1 -x snmp_timeout=1 \
+        -x snmp_max_varbinds="$1" -x snmp_max_inflight="${2-1}"
+
+    SNMP_REQUESTS="`echo "$CMDERR" | sed -n 's/^.*snmp_ups_walk: sent \([0-9]*\) SNMP requests for.*$/\1/p' | tail -1`"
+    SNMP_DUMP="`echo "$CMDOUT" | grep -E '^(battery|input|output|ups)\.' | sort`"
+}
+
+testcase_sandbox_snmp_batching() {
+    isTestableSNMPBatching || return 0
+
+    log_separator
+    log_info "[testcase_sandbox_snmp_batching] Check that batched SNMP polling needs fewer requests for the same data"
+
+    # snmpd uses UDP, so the TCP port of upsd is free there
+    mkdir -p "$NUT_STATEPATH/snmpd" || die "Failed to populate temporary FS structure for the NIT: snmpd"
+    cat > "$NUT_CONFPATH/snmpd.conf" << EOF
+agentaddress udp:127.0.0.1:$NUT_PORT
+rocommunity public 127.0.0.1
+override .1.3.6.1.2.1.33.1.1.1.0 octet_str "NIT"
+override .1.3.6.1.2.1.33.1.1.2.0 octet_str "Batched SNMP test"
+override .1.3.6.1.2.1.33.1.2.1.0 integer 2
+override .1.3.6.1.2.1.33.1.2.2.0 integer 0
+override .1.3.6.1.2.1.33.1.2.3.0 integer 42
+override .1.3.6.1.2.1.33.1.2.4.0 integer 100
+override .1.3.6.1.2.1.33.1.2.5.0 integer 273
+override .1.3.6.1.2.1.33.1.2.7.0 integer 25
+override .1.3.6.1.2.1.33.1.4.1.0 integer 3
+override .1.3.6.1.2.1.33.1.4.2.0 integer 500
+EOF
+    [ $? = 0 ] || die "Failed to populate temporary FS structure for the NIT: snmpd.conf"
+
+    SNMP_PERSISTENT_DIR="$NUT_STATEPATH/snmpd" \
+    snmpd -f -C -c "$NUT_CONFPATH/snmpd.conf" -Lf "$NUT_STATEPATH/snmpd.log" \
+        -p "$NUT_PIDPATH/snmpd.pid" &
+    PID_SNMPD="$!"
+    sleep 3
+
+    if ! isPidAlive "$PID_SNMPD" ; then
+        log_warn "[testcase_sandbox_snmp_batching] SKIP: could not start snmpd"
+        cat "$NUT_STATEPATH/snmpd.log" 2>/dev/null || true
+        return 0
+    fi
+
+    snmp_batching_run 0
+    SNMP_REQUESTS_SINGLE="$SNMP_REQUESTS"
+    SNMP_DUMP_SINGLE="$SNMP_DUMP"
+
+    snmp_batching_run 16
+    SNMP_REQUESTS_BATCHED="$SNMP_REQUESTS"
+    SNMP_DUMP_BATCHED="$SNMP_DUMP"
+
+    # Same requests as one by one, but sent without waiting for responses
+    snmp_batching_run 1 4
+    SNMP_REQUESTS_ASYNC="$SNMP_REQUESTS"
+    SNMP_DUMP_ASYNC="$SNMP_DUMP"
+
+    kill -15 $PID_SNMPD 2>/dev/null
+    wait $PID_SNMPD
+    PID_SNMPD=""
+
+    log_info "[testcase_sandbox_snmp_batching] Requests in an update cycle: ${SNMP_REQUESTS_SINGLE:-?} one by one, ${SNMP_REQUESTS_BATCHED:-?} batched, ${SNMP_REQUESTS_ASYNC:-?} asynchronous"
+
+    if [ -n "$SNMP_REQUESTS_SINGLE" ] && [ -n "$SNMP_REQUESTS_BATCHED" ] \
+    && [ "$SNMP_REQUESTS_BATCHED" -lt "$SNMP_REQUESTS_SINGLE" ] \
+    && echo "$SNMP_DUMP_SINGLE" | grep -E '^battery\.charge: 100$' >/dev/null \
+    && [ x"$SNMP_DUMP_SINGLE" = x"$SNMP_DUMP_BATCHED" ] \
+    && [ x"$SNMP_DUMP_SINGLE" = x"$SNMP_DUMP_ASYNC" ] \
+    ; then
+        log_info "[testcase_sandbox_snmp_batching] PASSED: same data with fewer requests, or without waiting for each"
+        PASSED="`expr $PASSED + 1`"
+    else
+        log_error "[testcase_sandbox_snmp_batching] batched polling did not reduce requests or changed the data:"
+        echo "=== one by one:"
+        echo "$SNMP_DUMP_SINGLE"
+        echo "=== batched:"
+        echo "$SNMP_DUMP_BATCHED"
+        echo "=== asynchronous:"
+        echo "$SNMP_DUMP_ASYNC"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_snmp_batching"
+    fi
+}
+
+testcase_sandbox_tls_handshake_load() {
+    isTestableTLSLoad || return 0
+
+    log_separator
+    log_info "[testcase_sandbox_tls_handshake_load] Check that upsd answers promptly while many clients stall in TLS handshakes"
+
+    rm -f "$NUT_CONFPATH/upsd.pem" "$NUT_CONFPATH/upsd.key" || true
+    if ! openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+        -keyout "$NUT_CONFPATH/upsd.key" -out "$NUT_CONFPATH/upsd.pem" >/dev/null 2>/dev/null \
+    || ! cat "$NUT_CONFPATH/upsd.key" >> "$NUT_CONFPATH/upsd.pem" \
+    ; then
+        log_warn "[testcase_sandbox_tls_handshake_load] SKIP: could not make a certificate"
+        return 0
+    fi
+    rm -f "$NUT_CONFPATH/upsd.key"
+
+    if [ "`id -u`" = 0 ]; then
+        # Unprivileged upsd (after de-elevation) must read it
+        chmod 644 "$NUT_CONFPATH/upsd.pem"
+    else
+        chmod 600 "$NUT_CONFPATH/upsd.pem"
+    fi
+
+    cat >> "$NUT_CONFPATH/upsd.conf" << EOF
+CERTFILE "$NUT_CONFPATH/upsd.pem"
+SSL_HANDSHAKE_WORKERS 4
+EOF
+    [ $? = 0 ] || die "Failed to populate temporary FS structure for the NIT: upsd.conf"
+
+    # Certificates are only loaded when upsd starts
+    log_info "[testcase_sandbox_tls_handshake_load] Restarting upsd with TLS support"
+    if isPidAlive "$PID_UPSD" ; then
+        kill -15 $PID_UPSD 2>/dev/null
+        wait $PID_UPSD
+    fi
+    PID_UPSD=""
+    upsd_start_loop "testcase_sandbox_tls_handshake_load"
+
+    COUNTDOWN=30
+    while [ "$COUNTDOWN" -gt 0 ]; do
+        runcmd upsc dummy@localhost:$NUT_PORT ups.status && break
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+    done
+
+    runcmd env NUT_PORT="$NUT_PORT" "${TOP_BUILDDIR}/tests/nuttlsloadtest" dummy
+    echo "$CMDOUT"
+    case "$CMDRES" in
+        0)
+            log_info "[testcase_sandbox_tls_handshake_load] PASSED: upsd was not held up by TLS handshakes"
+            PASSED="`expr $PASSED + 1`"
+            ;;
+        77)
+            log_warn "[testcase_sandbox_tls_handshake_load] SKIP: $CMDOUT"
+            ;;
+        *)
+            log_error "[testcase_sandbox_tls_handshake_load] upsd was held up by TLS handshakes, check above"
+            FAILED="`expr $FAILED + 1`"
+            FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_tls_handshake_load"
+            ;;
+    esac
+}
+
+testcase_sandbox_tls_cpp_pool() {
+    # Follows testcase_sandbox_tls_handshake_load(), which restarted
+    # upsd with a certificate
+    if [ x"${TOP_BUILDDIR}" = x ] \
+    || [ ! -x "${TOP_BUILDDIR}/tests/nutclientpooltest" ] \
+    ; then
+        log_warn "[testcase_sandbox_tls_cpp_pool] SKIP: ${TOP_BUILDDIR}/tests/nutclientpooltest: Not found"
+        return 0
+    fi
+
+    if ! grep -E '^CERTFILE' "$NUT_CONFPATH/upsd.conf" >/dev/null 2>/dev/null ; then
+        log_warn "[testcase_sandbox_tls_cpp_pool] SKIP: upsd was not set up for TLS"
+        return 0
+    fi
+
+    log_separator
+    log_info "[testcase_sandbox_tls_cpp_pool] Check that C++ clients share logged in connections from a pool, and pipeline requests through a reactor, with and without TLS"
+
+    runcmd env NUT_PORT="$NUT_PORT" "${TOP_BUILDDIR}/tests/nutclientpooltest" dummy
+    echo "$CMDOUT"
+    case "$CMDRES" in
+        0)
+            log_info "[testcase_sandbox_tls_cpp_pool] PASSED: pooled and pipelining clients worked"
+            PASSED="`expr $PASSED + 1`"
+            ;;
+        77)
+            log_warn "[testcase_sandbox_tls_cpp_pool] SKIP: $CMDOUT"
+            ;;
+        *)
+            log_error "[testcase_sandbox_tls_cpp_pool] pooled clients failed, check above"
+            FAILED="`expr $FAILED + 1`"
+            FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_tls_cpp_pool"
+            ;;
+    esac
+}
+
+testcase_sandbox_watch() {
+    if [ x"${TOP_BUILDDIR}" = x ] \
+    || [ ! -x "${TOP_BUILDDIR}/tests/nutwatchtest" ] \
+    ; then
+        log_warn "[testcase_sandbox_watch] SKIP: ${TOP_BUILDDIR}/tests/nutwatchtest: Not found"
+        return 0
+    fi
+
+    log_info "[testcase_sandbox_watch] Check that upsd pushes changed values to clients which WATCH a UPS"
+
+    # UPS2 is static (dummy-once), so the only change is the one we make
+    runcmd env NUT_PORT="$NUT_PORT" "${TOP_BUILDDIR}/tests/nutwatchtest" UPS2 outlet.1.desc
+    echo "$CMDOUT"
+    case "$CMDRES" in
+        0)
+            log_info "[testcase_sandbox_watch] PASSED: changes were pushed to the client"
+            PASSED="`expr $PASSED + 1`"
+            ;;
+        77)
+            log_warn "[testcase_sandbox_watch] SKIP: $CMDOUT"
+            ;;
+        *)
+            log_error "[testcase_sandbox_watch] changes were not pushed as expected, check above"
+            FAILED="`expr $FAILED + 1`"
+            FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_watch"
+            ;;
+    esac
+}
+
 ####################################
 
 # TODO: Some upsmon tests?
@@ -1681,6 +2029,12 @@ testgroup_sandbox() {
     testcases_sandbox_python
     testcases_sandbox_cppnit
     testcases_sandbox_nutscanner
+    testcase_sandbox_driver_protocol_binary
+    testcase_sandbox_driver_protocol_shm
+    testcase_sandbox_snmp_batching
+    testcase_sandbox_watch
+    testcase_sandbox_tls_handshake_load
+    testcase_sandbox_tls_cpp_pool
 
     log_separator
     sandbox_forget_configs
@@ -1713,6 +2067,42 @@ testgroup_sandbox_cppnit_simple_admin() {
     sandbox_forget_configs
 }
 
+testgroup_sandbox_driver_protocol() {
+    # Arrange for quick test iterations
+    testcase_sandbox_start_drivers_after_upsd
+    testcase_sandbox_driver_protocol_binary
+    testcase_sandbox_driver_protocol_shm
+
+    log_separator
+    sandbox_forget_configs
+}
+
+testgroup_sandbox_snmp() {
+    testcase_sandbox_snmp_batching
+
+    log_separator
+    sandbox_forget_configs
+}
+
+testgroup_sandbox_tls() {
+    # Arrange for quick test iterations
+    testcase_sandbox_start_drivers_after_upsd
+    testcase_sandbox_tls_handshake_load
+    testcase_sandbox_tls_cpp_pool
+
+    log_separator
+    sandbox_forget_configs
+}
+
+testgroup_sandbox_watch() {
+    # Arrange for quick test iterations
+    testcase_sandbox_start_drivers_after_upsd
+    testcase_sandbox_watch
+
+    log_separator
+    sandbox_forget_configs
+}
+
 testgroup_sandbox_nutscanner() {
     # Arrange for quick test iterations
     testcase_sandbox_start_drivers_after_upsd
@@ -1739,6 +2129,10 @@ case "${NIT_CASE}" in
     cppnit) testgroup_sandbox_cppnit ;;
     python) testgroup_sandbox_python ;;
     nutscanner|nut-scanner) testgroup_sandbox_nutscanner ;;
+    tls) testgroup_sandbox_tls ;;
+    snmp) testgroup_sandbox_snmp ;;
+    driver_protocol) testgroup_sandbox_driver_protocol ;;
+    watch) testgroup_sandbox_watch ;;
     testcase_*|testgroup_*|testcases_*|testgroups_*)
         log_warn "========================================================"
         log_warn "You asked to run just a specific testcase* or testgroup*"
@@ -81,6 +81,7 @@ class NutActiveClientTest : public CppUnit::TestFixture
 		CPPUNIT_TEST( test_query_ver );
 		CPPUNIT_TEST( test_list_ups );
 		CPPUNIT_TEST( test_list_ups_clients );
+		CPPUNIT_TEST( test_get_multi );
 		CPPUNIT_TEST( test_auth_user );
 		CPPUNIT_TEST( test_auth_primary );
 	CPPUNIT_TEST_SUITE_END();
@@ -100,6 +101,7 @@ public:
 	void test_query_ver();
 	void test_list_ups();
 	void test_list_ups_clients();
+	void test_get_multi();
 	void test_auth_user();
 	void test_auth_primary();
 };
@@ -312,6 +314,57 @@ void NutActiveClientTest::test_list_ups_clients() {
 		noException);
 }
 
+void NutActiveClientTest::test_get_multi() {
+	nut::TcpClient c("localhost", NUT_PORT);
+	std::map<std::string, std::set<std::string> > req;
+	std::map<std::string, std::map<std::string, std::vector<std::string> > > multi, single;
+	bool noException = true;
+
+	try {
+		std::set<std::string> devs = c.getDeviceNames();
+		for (std::set<std::string>::iterator it = devs.begin();
+			it != devs.end(); it++
+		) {
+			req[*it].insert("device.type");
+			req[*it].insert("driver.name");
+			req[*it].insert("no.such.variable");
+		}
+
+		/* One GET VARS request, vs. one GET VAR for each */
+		multi = c.getDevicesVariableValues(req);
+		single = c.Client::getDevicesVariableValues(req);
+		std::cerr << "[D] Got values of " << multi.size()
+			<< " devices with one request" << std::endl;
+	}
+	catch(nut::NutException& ex)
+	{
+		std::cerr << "[D] Could not get several variables: " << ex.what() << std::endl;
+		noException = false;
+	}
+
+	c.logout();
+	c.disconnect();
+
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to get several variables with TcpClient: threw NutException",
+		noException);
+
+	CPPUNIT_ASSERT_MESSAGE(
+		"Values got with one request differ from those got one by one",
+		multi == single);
+
+	for (std::map<std::string, std::set<std::string> >::iterator it = req.begin();
+		it != req.end(); it++
+	) {
+		CPPUNIT_ASSERT_MESSAGE(
+			"Missing the device.type of a device",
+			multi[it->first].count("device.type") == 1);
+		CPPUNIT_ASSERT_MESSAGE(
+			"Got a value for a variable which does not exist",
+			multi[it->first].count("no.such.variable") == 0);
+	}
+}
+
 void NutActiveClientTest::test_auth_user() {
 	if (NUT_USER.empty()) {
 		std::cerr << "[D] SKIPPING test_auth_user()" << std::endl;
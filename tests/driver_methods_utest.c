@@ -69,6 +69,7 @@ static int report_0_means_pass(int i) {
 
 int main(int argc, char **argv) {
 	const char	*valueStr = NULL;
+	char	fmtbuf[16];
 
 	NUT_UNUSED_VARIABLE(argc);
 	NUT_UNUSED_VARIABLE(argv);
@@ -367,6 +368,85 @@ int main(int argc, char **argv) {
 	report_0_means_pass(strcmp(valueStr, "OB LB FSD"));
 	printf(" test for ups.status with FSD token set and now committed: '%s'; got OB LB FSD?\n", NUT_STRARG(valueStr));
 
+	/* Test cases #21+#22+#23+#24 (dynamic formatting strings)
+	 * Validation results are remembered for the same strings, but
+	 * not for a buffer which was reused for another string.
+	 */
+	snprintf(fmtbuf, sizeof(fmtbuf), "%s", "%d");
+
+	/* #21 */
+	dstate_setinfo_dynamic("test.value", fmtbuf, "%d", 42);
+	valueStr = dstate_getinfo("test.value");
+	report_0_means_pass(strcmp(NUT_STRARG(valueStr), "42"));
+	printf(" test for dstate_setinfo_dynamic() with a valid formatting string: '%s'; got 42?\n", NUT_STRARG(valueStr));
+
+	/* #22 */
+	dstate_setinfo_dynamic("test.value", fmtbuf, "%d", 43);
+	valueStr = dstate_getinfo("test.value");
+	report_0_means_pass(strcmp(NUT_STRARG(valueStr), "43"));
+	printf(" test for dstate_setinfo_dynamic() with the same formatting string again: '%s'; got 43?\n", NUT_STRARG(valueStr));
+
+	snprintf(fmtbuf, sizeof(fmtbuf), "%s", "%s");
+
+	/* #23 */
+	report_0_means_pass(dstate_setinfo_dynamic("test.value", fmtbuf, "%d", 44) != -1);
+	valueStr = dstate_getinfo("test.value");
+	printf(" test for dstate_setinfo_dynamic() with the buffer now holding an invalid formatting string: '%s'; refused?\n", NUT_STRARG(valueStr));
+
+	/* #24 */
+	report_0_means_pass(dstate_setinfo_dynamic("test.value", fmtbuf, "%d", 45) != -1);
+	valueStr = dstate_getinfo("test.value");
+	printf(" test for dstate_setinfo_dynamic() with the same invalid formatting string again: '%s'; refused?\n", NUT_STRARG(valueStr));
+
+	dstate_delinfo("test.value");
+
+	/* Refresh classes scheduled by the driver core:
+	 * by default, status and fast metrics are due in each update,
+	 * static data never, and slow metrics once their interval passed.
+	 */
+	/* #25 */
+	refresh_set_interval(REFRESH_SLOW, 3600);
+	refresh_begin();
+	report_0_means_pass(!(refresh_due(REFRESH_STATUS) && refresh_due(REFRESH_FAST)
+		&& !refresh_due(REFRESH_SLOW) && !refresh_due(REFRESH_STATIC)));
+	printf(" test for refresh_due() of the classes right after setting intervals: %d %d %d %d; got 1 1 0 0?\n",
+		refresh_due(REFRESH_STATUS), refresh_due(REFRESH_FAST),
+		refresh_due(REFRESH_SLOW), refresh_due(REFRESH_STATIC));
+
+	/* #26 */
+	refresh_request(REFRESH_SLOW);
+	refresh_begin();
+	report_0_means_pass(!refresh_due(REFRESH_SLOW));
+	printf(" test for refresh_due() after refresh_request(): %d; got 1?\n",
+		refresh_due(REFRESH_SLOW));
+
+	/* #27 */
+	refresh_done(REFRESH_SLOW);
+	refresh_begin();
+	report_0_means_pass(refresh_due(REFRESH_SLOW));
+	printf(" test for refresh_due() after refresh_done(): %d; got 0?\n",
+		refresh_due(REFRESH_SLOW));
+
+	/* #28: due in the update nearest to the deadline (within half a poll interval) */
+	refresh_set_interval(REFRESH_STATIC, 0.5);
+	refresh_begin();
+	report_0_means_pass(!refresh_due(REFRESH_STATIC));
+	printf(" test for refresh_due() half a poll interval before the deadline: %d; got 1?\n",
+		refresh_due(REFRESH_STATIC));
+	refresh_set_interval(REFRESH_STATIC, -1);
+
+	/* #29: a refresh which began over a poll interval past its deadline */
+	poll_interval = 0;
+	refresh_set_interval(REFRESH_SLOW, 0.001);
+	usleep(20000);
+	refresh_begin();
+	refresh_done(REFRESH_SLOW);
+	valueStr = dstate_getinfo("driver.update.late");
+	report_0_means_pass(strcmp(NUT_STRARG(valueStr), "1"));
+	printf(" test for driver.update.late after a late refresh: '%s'; got 1?\n", NUT_STRARG(valueStr));
+	poll_interval = 2;
+	refresh_set_interval(REFRESH_SLOW, 0);
+
 	/* Clear testing state before finishing. */
 	alarm_init();
 	alarm_commit();
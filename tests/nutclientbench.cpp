@@ -0,0 +1,452 @@
+/* nutclientbench.cpp - test and micro-benchmark the reading of replies
+ * in the C++ client: nut::TcpClient::getDevicesVariableValues() over
+ * many devices, served by a minimal fake upsd in odd-sized chunks, and
+ * the same with asynchronous requests on several connections, whose
+ * replies are read by one nut::TcpClientReactor
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"
+#include "nutclient.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <unistd.h>
+
+/* Devices of a big monitoring setup, each with a lot of data points */
+static const size_t NUM_DEVS = 64;
+static const size_t NUM_VARS = 200;
+static const int NUM_ROUNDS = 20;
+
+/* Connections of the asynchronous part, and their rounds */
+static const size_t NUM_CONNS = 4;
+static const int NUM_ASYNC_ROUNDS = 5;
+
+/* The server sends the replies in pieces of this size, so that lines
+ * are split between reads at different places */
+static const size_t CHUNK_LEN = 1000;
+
+static std::string devName(size_t dev)
+{
+	std::ostringstream os;
+	os << "dev" << dev;
+	return os.str();
+}
+
+static std::string varName(size_t var)
+{
+	std::ostringstream os;
+	os << "outlet." << (var / 8 + 1) << ".point." << (var % 8);
+	return os.str();
+}
+
+/* The value as sent (quoted and escaped) and as it should be parsed */
+static std::string varValue(size_t dev, size_t var, bool escaped)
+{
+	std::ostringstream os;
+	if (var % 50 == 7)
+	{
+		// Some have quotes and backslashes in them
+		if (escaped)
+			os << "\"model \\\"" << dev << "\\\" \\\\ " << var << "\"";
+		else
+			os << "model \"" << dev << "\" \\ " << var;
+	}
+	else if (var % 50 == 9)
+	{
+		// Some have no quotes at all
+		os << dev * 1000 + var;
+	}
+	else
+	{
+		if (escaped)
+			os << "\"value " << dev << " " << var << "\"";
+		else
+			os << "value " << dev << " " << var;
+	}
+	return os.str();
+}
+
+static void writeAll(int fd, const std::string& reply)
+{
+	for (size_t off = 0; off < reply.size(); )
+	{
+		size_t len = reply.size() - off;
+		if (len > CHUNK_LEN)
+			len = CHUNK_LEN;
+
+		ssize_t ret = write(fd, reply.data() + off, len);
+		if (ret < 1)
+			_exit(EXIT_FAILURE);
+		off += static_cast<size_t>(ret);
+	}
+}
+
+/* A minimal upsd: answers LIST VAR and GET VAR requests of one
+ * connection until the client hangs up */
+static void serveConn(int fd, const std::vector<std::string>& replies)
+{
+	std::string req;
+	char c;
+	while (read(fd, &c, 1) == 1)
+	{
+		if (c != '\n')
+		{
+			req += c;
+			continue;
+		}
+
+		// Any value will do: it is the request, which is checked
+		if (req.compare(0, 8, "GET VAR ") == 0)
+		{
+			writeAll(fd, "VAR " + req.substr(8) + " \"" + req.substr(8) + "\"\n");
+			req.clear();
+			continue;
+		}
+
+		size_t dev = NUM_DEVS;
+		if (req.compare(0, 12, "LIST VAR dev") == 0)
+			dev = static_cast<size_t>(strtoul(req.c_str() + 12, nullptr, 10));
+		req.clear();
+
+		if (dev >= NUM_DEVS)
+		{
+			writeAll(fd, "ERR UNKNOWN-UPS\n");
+			continue;
+		}
+
+		writeAll(fd, replies[dev]);
+	}
+
+	close(fd);
+	_exit(EXIT_SUCCESS);
+}
+
+/* Serves the connection of the synchronous part, then NUM_CONNS more */
+static void serve(int lfd)
+{
+	// Prepared in advance, to only measure the client
+	std::vector<std::string> replies(NUM_DEVS);
+	for (size_t dev = 0; dev < NUM_DEVS; dev++)
+	{
+		std::string name = devName(dev);
+		replies[dev] = "BEGIN LIST VAR " + name + "\n";
+		for (size_t var = 0; var < NUM_VARS; var++)
+		{
+			replies[dev] += "VAR " + name + " " + varName(var) + " " + varValue(dev, var, true) + "\n";
+		}
+		replies[dev] += "END LIST VAR " + name + "\n";
+	}
+
+	size_t conns = 0;
+	for (; conns < 1 + NUM_CONNS; conns++)
+	{
+		int fd = accept(lfd, nullptr, nullptr);
+		if (fd < 0)
+			break;
+
+		pid_t pid = fork();
+		if (pid == 0)
+			serveConn(fd, replies);
+		close(fd);
+		if (pid < 0)
+			break;
+	}
+
+	int status, ret = (conns == 1 + NUM_CONNS) ? EXIT_SUCCESS : EXIT_FAILURE;
+	while (wait(&status) > 0)
+	{
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			ret = EXIT_FAILURE;
+	}
+	_exit(ret);
+}
+
+/* Check one reply, returns the amount of errors */
+static int check(const std::map<std::string, std::map<std::string, std::vector<std::string> > >& res)
+{
+	int errors = 0;
+
+	if (res.size() != NUM_DEVS)
+	{
+		std::cout << "FAIL: got " << res.size() << " of " << NUM_DEVS << " devices" << std::endl;
+		return 1;
+	}
+
+	for (size_t dev = 0; dev < NUM_DEVS && errors < 5; dev++)
+	{
+		std::map<std::string, std::map<std::string, std::vector<std::string> > >::const_iterator it = res.find(devName(dev));
+		if (it == res.end() || it->second.size() != NUM_VARS)
+		{
+			std::cout << "FAIL: variables of " << devName(dev) << " are missing" << std::endl;
+			errors++;
+			continue;
+		}
+
+		for (size_t var = 0; var < NUM_VARS && errors < 5; var++)
+		{
+			std::map<std::string, std::vector<std::string> >::const_iterator it2 = it->second.find(varName(var));
+			std::string expected = varValue(dev, var, false);
+			if (it2 == it->second.end() || it2->second.size() != 1 || it2->second[0] != expected)
+			{
+				std::cout << "FAIL: " << devName(dev) << " " << varName(var)
+					<< " is not [" << expected << "]" << std::endl;
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+typedef std::map<std::string, std::vector<std::string> > Values;
+
+/* Requests in flight on NUM_CONNS connections at once, returns the
+ * amount of errors */
+static int runAsync(uint16_t port)
+{
+	nut::TcpClientReactor reactor;
+	std::vector<std::unique_ptr<nut::TcpClient> > clients;
+	int errors = 0, round;
+	double d = 0;
+
+	for (size_t conn = 0; conn < NUM_CONNS; conn++)
+	{
+		clients.push_back(std::unique_ptr<nut::TcpClient>(new nut::TcpClient("127.0.0.1", port)));
+		reactor.add(*clients.back());
+	}
+	std::thread thread([&reactor]() { reactor.run(); });
+
+	try
+	{
+		for (round = 0; round < NUM_ASYNC_ROUNDS && !errors; round++)
+		{
+			std::vector<std::vector<std::future<Values> > > replies(NUM_CONNS);
+			std::vector<std::future<Values> > unknown;
+			std::vector<std::future<std::vector<std::string> > > single;
+			std::vector<std::map<std::string, Values> > res(NUM_CONNS);
+			struct timeval start, now;
+
+			gettimeofday(&start, nullptr);
+			for (size_t dev = 0; dev < NUM_DEVS; dev++)
+			{
+				for (size_t conn = 0; conn < NUM_CONNS; conn++)
+				{
+					replies[conn].push_back(clients[conn]->getDeviceVariableValuesAsync(devName(dev)));
+				}
+
+				// Some failing, and some other requests in between
+				if (dev % 16 == 0)
+				{
+					unknown.push_back(clients[dev % NUM_CONNS]->getDeviceVariableValuesAsync("nosuchdev"));
+					single.push_back(clients[dev % NUM_CONNS]->getDeviceVariableValueAsync(devName(dev), "ups.status"));
+				}
+			}
+			for (size_t conn = 0; conn < NUM_CONNS; conn++)
+			{
+				for (size_t dev = 0; dev < NUM_DEVS; dev++)
+				{
+					res[conn][devName(dev)] = replies[conn][dev].get();
+				}
+			}
+			gettimeofday(&now, nullptr);
+			d += static_cast<double>(now.tv_sec - start.tv_sec)
+				+ static_cast<double>(now.tv_usec - start.tv_usec) / 1000000.0;
+
+			for (size_t conn = 0; conn < NUM_CONNS; conn++)
+			{
+				errors += check(res[conn]);
+			}
+			for (size_t n = 0; n < unknown.size(); n++)
+			{
+				try
+				{
+					unknown[n].get();
+					std::cout << "FAIL: got variables of an unknown device" << std::endl;
+					errors++;
+				}
+				catch (nut::NutException& ex)
+				{
+					if (ex.str() != "UNKNOWN-UPS")
+					{
+						std::cout << "FAIL: unknown device gave [" << ex.str() << "]" << std::endl;
+						errors++;
+					}
+				}
+			}
+			for (size_t n = 0; n < single.size(); n++)
+			{
+				std::vector<std::string> val = single[n].get();
+				std::string expected = devName(n * 16) + " ups.status";
+				if (val.size() != 1 || val[0] != expected)
+				{
+					std::cout << "FAIL: single value is not [" << expected << "]" << std::endl;
+					errors++;
+				}
+			}
+		}
+
+		std::cout << "=== async:\t" << NUM_CONNS << " connections x " << NUM_DEVS
+			<< " devices x " << NUM_VARS << " vars x " << round << " rounds in "
+			<< d << " sec" << std::endl;
+
+		// The blocking methods wait for the reactor to read their reply...
+		if (clients[0]->getDeviceVariableValue("dev1", "ups.status").size() != 1)
+		{
+			std::cout << "FAIL: blocking call with a reactor" << std::endl;
+			errors++;
+		}
+	}
+	catch (nut::NutException& ex)
+	{
+		std::cout << "FAIL: " << ex.what() << std::endl;
+		errors++;
+	}
+
+	reactor.stop();
+	thread.join();
+
+	// ... or read it themselves, and those of earlier requests
+	reactor.remove(*clients[1]);
+	std::future<Values> earlier = clients[1]->getDeviceVariableValuesAsync("dev2");
+	if (clients[1]->getDeviceVariableValue("dev3", "ups.status").size() != 1
+	 || earlier.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+	 || earlier.get().size() != NUM_VARS
+	) {
+		std::cout << "FAIL: blocking call without a reactor" << std::endl;
+		errors++;
+	}
+
+	return errors;
+}
+
+int main(void)
+{
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int lfd, errors = 0, status, round;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = 0;
+
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+	 || bind(lfd, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa)) < 0
+	 || listen(lfd, static_cast<int>(1 + NUM_CONNS)) < 0
+	 || getsockname(lfd, reinterpret_cast<struct sockaddr *>(&sa), &salen) < 0
+	) {
+		std::cout << "SKIP: can not listen on the loopback interface" << std::endl;
+		return 77;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		std::cout << "SKIP: can not fork the server" << std::endl;
+		return 77;
+	}
+	if (pid == 0)
+	{
+		serve(lfd);
+	}
+	close(lfd);
+
+	std::set<std::string> devs;
+	for (size_t dev = 0; dev < NUM_DEVS; dev++)
+	{
+		devs.insert(devName(dev));
+	}
+
+	try
+	{
+		nut::TcpClient client("127.0.0.1", ntohs(sa.sin_port));
+		double d = 0;
+
+		for (round = 0; round < NUM_ROUNDS && !errors; round++)
+		{
+			struct timeval start, now;
+
+			// Only the fetching counts, not the checking
+			gettimeofday(&start, nullptr);
+			std::map<std::string, std::map<std::string, std::vector<std::string> > > res =
+				client.getDevicesVariableValues(devs);
+			gettimeofday(&now, nullptr);
+			d += static_cast<double>(now.tv_sec - start.tv_sec)
+				+ static_cast<double>(now.tv_usec - start.tv_usec) / 1000000.0;
+
+			errors += check(res);
+		}
+
+		std::cout << "=== getDevicesVariableValues:\t" << NUM_DEVS << " devices x "
+			<< NUM_VARS << " vars x " << round << " rounds in " << d
+			<< " sec" << std::endl;
+	}
+	catch (nut::NutException& ex)
+	{
+		std::cout << "FAIL: " << ex.what() << std::endl;
+		errors++;
+	}
+
+	try
+	{
+		errors += runAsync(ntohs(sa.sin_port));
+	}
+	catch (nut::NutException& ex)
+	{
+		std::cout << "FAIL: " << ex.what() << std::endl;
+		errors++;
+	}
+
+	// The clients hung up when they went out of scope (the server may
+	// still be waiting for some which never came)
+	if (errors)
+		kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) != pid
+	 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS
+	) {
+		std::cout << "FAIL: the server did not finish cleanly" << std::endl;
+		errors++;
+	}
+
+	if (errors)
+		std::cout << "nutclientbench collected " << errors << " errors" << std::endl;
+
+	return (errors != 0);
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	std::cout << "SKIP: nutclientbench is not implemented for WIN32" << std::endl;
+	return 77;
+}
+
+#endif	/* WIN32 */
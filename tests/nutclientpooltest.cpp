@@ -0,0 +1,489 @@
+/* nutclientpooltest.cpp - check that nut::TcpClientPool shares connected
+ * and logged in clients between threads, and that nut::TcpClientReactor
+ * reads the replies to requests which threads pipeline on one client,
+ * in plain text and over TLS, without being held up by a server which
+ * stops in the middle of a TLS record
+
+   This is not a stand-alone test: it is started by the NIT suite
+   against a sandboxed upsd with TLS support (with NUT_PORT in the
+   environment), see tests/NIT/nit.sh testcase_sandbox_tls_cpp_pool().
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"
+#include "nutclient.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <mutex>
+
+#ifndef WIN32
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <netdb.h>
+# include <poll.h>
+# include <unistd.h>
+#endif
+
+static const size_t NUM_THREADS = 8;
+static const size_t NUM_QUERIES = 25;
+static const size_t MAX_CLIENTS = 3;
+static const size_t NUM_PIPELINED = 20;
+
+static std::atomic<int> errors(0);
+
+static void worker(nut::TcpClientPool* pool, const std::string& ups, bool ssl)
+{
+	for (size_t n = 0; n < NUM_QUERIES; n++)
+	{
+		try
+		{
+			nut::TcpClientPool::Lease client = pool->acquire();
+
+			if (client->isSsl() != ssl)
+			{
+				std::cout << "FAIL: connection is " << (ssl ? "not " : "")
+					<< "encrypted" << std::endl;
+				errors++;
+			}
+
+			std::vector<std::string> val = client->getDeviceVariableValue(ups, "ups.status");
+			if (val.empty() || val[0].empty())
+			{
+				std::cout << "FAIL: no ups.status of " << ups << std::endl;
+				errors++;
+			}
+		}
+		catch (nut::NutException& ex)
+		{
+			std::cout << "FAIL: " << ex.what() << std::endl;
+			errors++;
+			return;
+		}
+	}
+}
+
+static void run(const std::string& port, const std::string& ups,
+	const std::string& user, const std::string& pass, nut::SslMode mode)
+{
+	bool ssl = (mode != nut::SSLMODE_NONE);
+	nut::TcpClientPool pool("localhost", static_cast<uint16_t>(atoi(port.c_str())), MAX_CLIENTS);
+	std::vector<std::thread> threads;
+
+	pool.setCredentials(user, pass);
+	pool.setSsl(mode);
+	pool.setTimeout(10);
+
+	for (size_t n = 0; n < NUM_THREADS; n++)
+	{
+		threads.push_back(std::thread(worker, &pool, ups, ssl));
+	}
+	for (size_t n = 0; n < threads.size(); n++)
+	{
+		threads[n].join();
+	}
+
+	// All of them were given back, and no more were made than allowed
+	size_t idle = pool.idle();
+	if (idle < 1 || idle > MAX_CLIENTS)
+	{
+		std::cout << "FAIL: " << idle << " clients left in the pool" << std::endl;
+		errors++;
+	}
+
+	std::cout << "=== " << (ssl ? "TLS" : "plain text") << ": "
+		<< NUM_THREADS << " threads x " << NUM_QUERIES << " queries over "
+		<< idle << " connections" << std::endl;
+}
+
+/* Each thread sends its requests at once, before getting their replies,
+ * while the other threads write to the same connection and the reactor
+ * reads from it (a TLS session must not be used for both at once) */
+static void pipeliner(nut::TcpClient* client, const std::string& ups, size_t id)
+{
+	for (size_t n = 0; n < NUM_QUERIES; n++)
+	{
+		try
+		{
+			std::vector<std::future<std::vector<std::string> > > replies;
+
+			for (size_t i = 0; i < NUM_PIPELINED; i++)
+			{
+				replies.push_back(client->getDeviceVariableValueAsync(ups,
+					(i % 2) ? "ups.status" : "device.type"));
+			}
+			for (size_t i = 0; i < replies.size(); i++)
+			{
+				std::vector<std::string> val = replies[i].get();
+				if (val.empty() || val[0].empty() || ((i % 2) == 0 && val[0] != "ups"))
+				{
+					std::cout << "FAIL: thread " << id << " got a wrong reply #"
+						<< i << std::endl;
+					errors++;
+				}
+			}
+
+			// Blocking calls wait for the reactor to read their reply too
+			if (client->getDeviceVariableValue(ups, "device.type") != std::vector<std::string>(1, "ups"))
+			{
+				std::cout << "FAIL: thread " << id << " got a wrong blocking reply" << std::endl;
+				errors++;
+			}
+		}
+		catch (nut::NutException& ex)
+		{
+			std::cout << "FAIL: " << ex.what() << std::endl;
+			errors++;
+			return;
+		}
+	}
+}
+
+static void pipeline(const std::string& port, const std::string& ups, nut::SslMode mode)
+{
+	bool ssl = (mode != nut::SSLMODE_NONE);
+	nut::TcpClient client;
+	nut::TcpClientReactor reactor;
+	std::vector<std::thread> threads;
+
+	try
+	{
+		client.setSsl(mode);
+		client.setTimeout(10);
+		client.connect("localhost", static_cast<uint16_t>(atoi(port.c_str())));
+	}
+	catch (nut::NutException& ex)
+	{
+		std::cout << "FAIL: connect: " << ex.what() << std::endl;
+		errors++;
+		return;
+	}
+	if (client.isSsl() != ssl)
+	{
+		std::cout << "FAIL: pipelined connection is " << (ssl ? "not " : "")
+			<< "encrypted" << std::endl;
+		errors++;
+	}
+
+	reactor.add(client);
+	std::thread loop(&nut::TcpClientReactor::run, &reactor);
+
+	for (size_t n = 0; n < NUM_THREADS; n++)
+	{
+		threads.push_back(std::thread(pipeliner, &client, ups, n));
+	}
+	for (size_t n = 0; n < threads.size(); n++)
+	{
+		threads[n].join();
+	}
+
+	// Neither needs the reactor to be idle
+	reactor.remove(client);
+	reactor.stop();
+	loop.join();
+
+	std::cout << "=== " << (ssl ? "TLS" : "plain text") << ": "
+		<< NUM_THREADS << " threads x " << NUM_QUERIES << " x " << NUM_PIPELINED
+		<< " pipelined queries over one connection" << std::endl;
+}
+
+#if (defined WITH_SSL) && !(defined WIN32)
+/* Forwards one connection to upsd; once stalled, it passes on only the
+ * first bytes of what upsd says next (a part of a TLS record) and keeps
+ * the rest until released */
+class StallingProxy
+{
+public:
+	StallingProxy(const std::string& port):
+	_port(port), _listen(-1), _state(PASS), _quit(false)
+	{
+		struct sockaddr_in sa;
+		socklen_t len = sizeof(sa);
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		_listen = socket(AF_INET, SOCK_STREAM, 0);
+		if (_listen < 0
+		 || bind(_listen, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) < 0
+		 || listen(_listen, 1) < 0
+		 || getsockname(_listen, reinterpret_cast<struct sockaddr*>(&sa), &len) < 0
+		) {
+			throw nut::IOException("Can not set up the proxy");
+		}
+		_proxyPort = ntohs(sa.sin_port);
+		_thread = std::thread(&StallingProxy::forward, this);
+	}
+
+	~StallingProxy()
+	{
+		_quit = true;
+		_thread.join();
+		close(_listen);
+	}
+
+	uint16_t port()const {return _proxyPort;}
+	void stall() {_state = ARMED;}
+	void release() {_state = PASS;}
+
+private:
+	enum {PASS, ARMED, HOLDING};
+
+	static int connectUpsd(const std::string& port)
+	{
+		struct addrinfo hints, *res, *ai;
+		int fd = -1;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo("localhost", port.c_str(), &hints, &res) != 0)
+			return -1;
+		for (ai = res; ai && fd < 0; ai = ai->ai_next)
+		{
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+			{
+				close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(res);
+		return fd;
+	}
+
+	void forward()
+	{
+		struct pollfd pfd[2];
+		std::string held;
+		char buf[4096];
+		int client = -1, upsd = -1;
+
+		pfd[0].fd = _listen;
+		pfd[0].events = POLLIN;
+		while (!_quit && client < 0)
+		{
+			if (poll(pfd, 1, 20) > 0)
+			{
+				client = accept(_listen, nullptr, nullptr);
+			}
+		}
+		if (client >= 0)
+		{
+			upsd = connectUpsd(_port);
+		}
+
+		pfd[0].fd = client;
+		pfd[1].fd = upsd;
+		pfd[0].events = pfd[1].events = POLLIN;
+		while (!_quit && client >= 0 && upsd >= 0)
+		{
+			if (_state == PASS && !held.empty())
+			{
+				if (write(client, held.data(), held.size()) < 0)
+					break;
+				held.clear();
+			}
+			if (poll(pfd, 2, 20) < 1)
+				continue;
+
+			if (pfd[0].revents)
+			{
+				ssize_t n = read(client, buf, sizeof(buf));
+				if (n <= 0 || write(upsd, buf, static_cast<size_t>(n)) != n)
+					break;
+			}
+			if (pfd[1].revents)
+			{
+				ssize_t n = read(upsd, buf, sizeof(buf));
+				size_t pass = static_cast<size_t>(n);
+				if (n <= 0)
+					break;
+				if (_state == ARMED)
+				{
+					// the record header and a bit of its data
+					pass = std::min(pass, static_cast<size_t>(8));
+					_state = HOLDING;
+				}
+				else if (_state == HOLDING)
+				{
+					pass = 0;
+				}
+				held.append(buf + pass, static_cast<size_t>(n) - pass);
+				if (pass && write(client, buf, pass) < 0)
+					break;
+			}
+		}
+
+		if (client >= 0)
+			close(client);
+		if (upsd >= 0)
+			close(upsd);
+	}
+
+	std::string _port;
+	int _listen;
+	uint16_t _proxyPort;
+	std::atomic<int> _state;
+	std::atomic<bool> _quit;
+	std::thread _thread;
+};
+
+typedef std::future<std::vector<std::string> > ValueFuture;
+
+static bool gotValue(ValueFuture& reply, const std::string& value, int seconds)
+{
+	try
+	{
+		return reply.wait_for(std::chrono::seconds(seconds)) == std::future_status::ready
+			&& reply.get() == std::vector<std::string>(1, value);
+	}
+	catch (nut::NutException& ex)
+	{
+		std::cout << "FAIL: " << ex.what() << std::endl;
+		return false;
+	}
+}
+
+/* A client whose server stops in the middle of a TLS record (with no
+ * timeout set) must hold up neither the other clients of the reactor
+ * nor stop() */
+static void stall(const std::string& port, const std::string& ups)
+{
+	StallingProxy proxy(port);
+	nut::TcpClient stalled, other;
+	nut::TcpClientReactor reactor;
+	ValueFuture reply;
+
+	try
+	{
+		stalled.setSsl(nut::SSLMODE_FORCE);
+		stalled.connect("127.0.0.1", proxy.port());
+		other.setSsl(nut::SSLMODE_FORCE);
+		other.setTimeout(5);
+		other.connect("localhost", static_cast<uint16_t>(atoi(port.c_str())));
+	}
+	catch (nut::NutException& ex)
+	{
+		std::cout << "FAIL: connect: " << ex.what() << std::endl;
+		errors++;
+		return;
+	}
+
+	reactor.add(stalled);
+	reactor.add(other);
+	std::thread loop(&nut::TcpClientReactor::run, &reactor);
+
+	// (what the session sends after the handshake is read by now)
+	reply = stalled.getDeviceVariableValueAsync(ups, "device.type");
+	if (!gotValue(reply, "ups", 10))
+	{
+		std::cout << "FAIL: no reply through the proxy" << std::endl;
+		errors++;
+	}
+
+	proxy.stall();
+	reply = stalled.getDeviceVariableValueAsync(ups, "device.type");
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	for (size_t n = 0; n < NUM_QUERIES; n++)
+	{
+		try
+		{
+			if (other.getDeviceVariableValue(ups, "device.type") != std::vector<std::string>(1, "ups"))
+			{
+				std::cout << "FAIL: wrong reply next to a stalled client" << std::endl;
+				errors++;
+			}
+		}
+		catch (nut::NutException& ex)
+		{
+			std::cout << "FAIL: next to a stalled client: " << ex.what() << std::endl;
+			errors++;
+			break;
+		}
+	}
+
+	proxy.release();
+	if (!gotValue(reply, "ups", 10))
+	{
+		std::cout << "FAIL: no reply once the rest of the record came" << std::endl;
+		errors++;
+	}
+
+	proxy.stall();
+	reply = stalled.getDeviceVariableValueAsync(ups, "device.type");
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	std::promise<void> stopped;
+	std::future<void> joined = stopped.get_future();
+	std::thread stopper([&reactor, &loop, &stopped]{
+		reactor.stop();
+		loop.join();
+		stopped.set_value();
+	});
+	if (joined.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+	{
+		std::cout << "FAIL: the reactor could not be stopped" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	stopper.join();
+
+	reactor.remove(stalled);
+	reactor.remove(other);
+
+	std::cout << "=== TLS: " << NUM_QUERIES
+		<< " queries next to a client stalled in the middle of a record" << std::endl;
+}
+#endif	/* WITH_SSL && !WIN32 */
+
+int main(int argc, char **argv)
+{
+	const char *port = getenv("NUT_PORT");
+	std::string ups = (argc > 1) ? argv[1] : "dummy";
+	std::string user = (argc > 3) ? argv[2] : "dummy-admin";
+	std::string pass = (argc > 3) ? argv[3] : "P@ssW0rdAdm";
+
+	if (!port || !*port)
+	{
+		std::cout << "SKIP: NUT_PORT is not set, run this from the NIT suite" << std::endl;
+		return 77;
+	}
+
+	run(port, ups, user, pass, nut::SSLMODE_NONE);
+	pipeline(port, ups, nut::SSLMODE_NONE);
+
+#ifdef WITH_SSL
+	run(port, ups, user, pass, nut::SSLMODE_FORCE);
+	pipeline(port, ups, nut::SSLMODE_FORCE);
+# ifndef WIN32
+	stall(port, ups);
+# endif
+#else
+	std::cout << "SKIP: TLS part, the client was built without SSL support" << std::endl;
+#endif
+
+	if (errors)
+		std::cout << "nutclientpooltest collected " << errors << " errors" << std::endl;
+
+	return (errors != 0);
+}
@@ -79,6 +79,7 @@ class NutClientTest : public CppUnit::TestFixture
 		CPPUNIT_TEST( test_copy_assignment_var );
 
 		CPPUNIT_TEST( test_nutclientstub_dev );
+		CPPUNIT_TEST( test_nutclientstub_async );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -99,6 +100,7 @@ public:
 	void test_copy_assignment_var();
 
 	void test_nutclientstub_dev();
+	void test_nutclientstub_async();
 };
 
 // Registers the fixture into the 'registry'
@@ -545,6 +547,51 @@ void NutClientTest::test_nutclientstub_dev() {
 		!noException);
 }
 
+void NutClientTest::test_nutclientstub_async() {
+	nut::MemClientStub c;
+
+	// The stub makes the requests right away
+	std::future<TrackingID> id = c.setDeviceVariableAsync("ups_1", "name_1", "value_1");
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed stub async client: set is not ready",
+		id.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed stub async client: set failed",
+		id.get().empty());
+
+	std::future<ListValue> value = c.getDeviceVariableValueAsync("ups_1", "name_1");
+	std::future<ListObject> values = c.getDeviceVariableValuesAsync("ups_1");
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed stub async client: get is not ready",
+		value.wait_for(std::chrono::seconds(0)) == std::future_status::ready
+		&& values.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+
+	ListValue v = value.get();
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed stub async client: bad value",
+		v.size() == 1 && v[0] == std::string("value_1"));
+
+	ListObject o = values.get();
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed stub async client: bad values",
+		o.size() == 1 && o["name_1"].size() == 1 && o["name_1"][0] == std::string("value_1"));
+
+	// Exceptions are delivered through the future
+	bool noException = true;
+	std::future<TrackingID> cmd = c.executeDeviceCommandAsync("ups_1", "cmd_1");
+	try {
+		cmd.get();
+	}
+	catch(nut::NutException& ex)
+	{
+		NUT_UNUSED_VARIABLE(ex);
+		noException = false;
+	}
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed stub async client: throw no exception",
+		!noException);
+}
+
 } // namespace nut {}
 
 #if (defined __clang__) && (defined HAVE_PRAGMA_CLANG_DIAGNOSTIC_IGNORED_DEPRECATED_DECLARATIONS)
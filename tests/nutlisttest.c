@@ -0,0 +1,278 @@
+/*  nutlisttest.c - test and micro-benchmark the reading of replies in
+ *  upsclient: a LIST VAR of a couple thousand variables (as served for
+ *  a large ePDU) from a minimal fake upsd, received in odd-sized chunks
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "upsclient.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+
+#define UPSNAME		"bench"
+#define NUM_VARS	2000
+#define NUM_ROUNDS	50
+
+/* the server sends the reply in pieces of this size, so that lines are
+ * split between reads at different places */
+#define CHUNK_LEN	1000
+
+/* one of the lines is longer than the old 512 byte line buffer (the
+ * value itself still fits the word length limit of parseconf) */
+#define LONG_VAR	1234
+#define LONG_LEN	500
+
+static void make_value(size_t i, char *buf, size_t buflen)
+{
+	if (i == LONG_VAR) {
+		size_t	j;
+
+		for (j = 0; j < LONG_LEN && j + 1 < buflen; j++) {
+			buf[j] = (char)('a' + j % 26);
+		}
+		buf[j] = '\0';
+		return;
+	}
+
+	snprintf(buf, buflen, "value %" PRIuSIZE, i * 7);
+}
+
+/* the whole reply to LIST VAR */
+static char *make_reply(size_t *len)
+{
+	size_t	size = NUM_VARS * 64 + LONG_LEN + SMALLBUF, used = 0, i;
+	char	*reply = xcalloc(1, size), val[LONG_LEN + 1];
+
+	used += (size_t)snprintf(reply, size, "BEGIN LIST VAR %s\n", UPSNAME);
+
+	for (i = 0; i < NUM_VARS; i++) {
+		make_value(i, val, sizeof(val));
+		used += (size_t)snprintf(reply + used, size - used,
+			"VAR %s outlet.%" PRIuSIZE ".point.%" PRIuSIZE " \"%s\"\n",
+			UPSNAME, i / 32 + 1, i % 32, val);
+	}
+
+	used += (size_t)snprintf(reply + used, size - used, "END LIST VAR %s\n", UPSNAME);
+
+	*len = used;
+	return reply;
+}
+
+/* a minimal upsd: answers each LIST VAR request until the client hangs up */
+static void serve(int lfd)
+{
+	char	req[SMALLBUF], *reply;
+	size_t	replylen, reqlen = 0, off;
+	int	fd;
+	ssize_t	ret;
+
+	if ((fd = accept(lfd, NULL, NULL)) < 0) {
+		_exit(EXIT_FAILURE);
+	}
+
+	reply = make_reply(&replylen);
+
+	for (;;) {
+		if ((ret = read(fd, req + reqlen, 1)) != 1) {
+			break;
+		}
+
+		if (req[reqlen] != '\n') {
+			if (reqlen + 2 < sizeof(req)) {
+				reqlen++;
+			}
+			continue;
+		}
+
+		req[reqlen] = '\0';
+		reqlen = 0;
+
+		if (!strcmp(req, "LOGOUT")) {
+			ret = write(fd, "OK Goodbye\n", 11);
+			break;
+		}
+
+		if (strcmp(req, "LIST VAR " UPSNAME)) {
+			if (write(fd, "ERR UNKNOWN-COMMAND\n", 20) != 20) {
+				break;
+			}
+			continue;
+		}
+
+		for (off = 0; off < replylen; off += (size_t)ret) {
+			size_t	len = replylen - off;
+
+			if (len > CHUNK_LEN) {
+				len = CHUNK_LEN;
+			}
+
+			if ((ret = write(fd, reply + off, len)) < 1) {
+				_exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	free(reply);
+	close(fd);
+	_exit(EXIT_SUCCESS);
+}
+
+static double elapsed(const struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return difftimeval(now, *start);
+}
+
+/* read and check one LIST VAR reply, returns the amount of errors */
+static int list_vars(UPSCONN_t *ups)
+{
+	const char	*query[] = { "VAR", UPSNAME };
+	char	**answer, name[SMALLBUF], val[LONG_LEN + 1];
+	size_t	numa, count = 0;
+	int	ret, errors = 0;
+
+	if (upscli_list_start(ups, 2, query) < 0) {
+		printf("FAIL: LIST VAR: %s\n", upscli_strerror(ups));
+		return 1;
+	}
+
+	while ((ret = upscli_list_next(ups, 2, query, &numa, &answer)) == 1) {
+		if (numa < 4) {
+			printf("FAIL: item %" PRIuSIZE " has %" PRIuSIZE " words\n", count, numa);
+			errors++;
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "outlet.%" PRIuSIZE ".point.%" PRIuSIZE,
+			count / 32 + 1, count % 32);
+		make_value(count, val, sizeof(val));
+
+		if (strcmp(answer[2], name) || strcmp(answer[3], val)) {
+			if (errors < 5) {
+				printf("FAIL: item %" PRIuSIZE " is [%s] = [%.40s], expected [%s] = [%.40s]\n",
+					count, answer[2], answer[3], name, val);
+			}
+			errors++;
+		}
+
+		count++;
+	}
+
+	if (ret < 0) {
+		printf("FAIL: LIST VAR cut short: %s\n", upscli_strerror(ups));
+		errors++;
+	}
+
+	if (count != NUM_VARS) {
+		printf("FAIL: got %" PRIuSIZE " of %d variables\n", count, NUM_VARS);
+		errors++;
+	}
+
+	return errors;
+}
+
+int main(void)
+{
+	struct sockaddr_in	sa;
+	socklen_t	salen = sizeof(sa);
+	UPSCONN_t	ups;
+	struct timeval	start;
+	int	lfd, errors = 0, i, status;
+	pid_t	pid;
+	double	d;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = 0;
+
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+	 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+	 || listen(lfd, 1) < 0
+	 || getsockname(lfd, (struct sockaddr *)&sa, &salen) < 0
+	) {
+		printf("SKIP: can not listen on the loopback interface\n");
+		return 77;
+	}
+
+	if ((pid = fork()) < 0) {
+		printf("SKIP: can not fork the server\n");
+		return 77;
+	}
+
+	if (pid == 0) {
+		serve(lfd);
+	}
+
+	close(lfd);
+
+	if (upscli_connect(&ups, "127.0.0.1", ntohs(sa.sin_port), 0) < 0) {
+		printf("FAIL: could not connect: %s\n", upscli_strerror(&ups));
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < NUM_ROUNDS && !errors; i++) {
+		errors += list_vars(&ups);
+	}
+
+	d = elapsed(&start);
+	printf("=== list:\t%d vars x %d rounds in %f sec\n", NUM_VARS, i, d);
+
+	upscli_disconnect(&ups);
+
+	if (waitpid(pid, &status, 0) != pid
+	 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS
+	) {
+		printf("FAIL: the server did not finish cleanly\n");
+		errors++;
+	}
+
+	upscli_cleanup();
+
+	if (errors)
+		printf("nutlisttest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("SKIP: nutlisttest is not implemented for WIN32\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
@@ -0,0 +1,303 @@
+/*  nutpconftest.c - test and micro-benchmark the parsing of socket input
+ *  by parseconf: pconf_chunk() must split the lines into the same words
+ *  as pconf_char() does a character at a time, however the input is cut
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "parseconf.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* what the parser made of some input: the words of each line, separated
+ * by '|' (and lines by '\n'), or "ERR" for a parse error */
+typedef struct {
+	char	*text;
+	size_t	len, size;
+} result_t;
+
+static void result_add(result_t *res, const char *str, size_t len)
+{
+	if (res->len + len + 1 > res->size) {
+		res->size = (res->len + len + 1) * 2;
+		res->text = xrealloc(res->text, res->size);
+	}
+
+	memcpy(res->text + res->len, str, len);
+	res->len += len;
+	res->text[res->len] = '\0';
+}
+
+static void result_line(result_t *res, PCONF_CTX_t *ctx, int ret)
+{
+	size_t	i;
+
+	if (ret < 0) {
+		result_add(res, "ERR\n", 4);
+		return;
+	}
+
+	for (i = 0; i < ctx->numargs; i++) {
+		result_add(res, ctx->arglist[i], strlen(ctx->arglist[i]));
+		result_add(res, "|", 1);
+	}
+	result_add(res, "\n", 1);
+}
+
+/* the reference: a character at a time */
+static void parse_char(const char *in, size_t len, result_t *res)
+{
+	PCONF_CTX_t	ctx;
+	size_t	i;
+	int	ret;
+
+	pconf_init(&ctx, NULL);
+	res->len = 0;
+	result_add(res, "", 0);
+
+	for (i = 0; i < len; i++) {
+		if ((ret = pconf_char(&ctx, in[i])) != 0) {
+			result_line(res, &ctx, ret);
+		}
+	}
+
+	pconf_finish(&ctx);
+}
+
+/* in chunks of up to chunklen bytes (of random lengths if 0), like the
+ * socket readers get them */
+static void parse_chunk(const char *in, size_t len, size_t chunklen, result_t *res)
+{
+	PCONF_CTX_t	ctx;
+	size_t	off, end, used;
+	int	ret;
+
+	pconf_init(&ctx, NULL);
+	res->len = 0;
+	result_add(res, "", 0);
+
+	for (off = 0; off < len; off = end) {
+		end = off + (chunklen ? chunklen : 1 + (size_t)rand() % 97);
+		if (end > len) {
+			end = len;
+		}
+
+		while (off < end) {
+			if ((ret = pconf_chunk(&ctx, in + off, end - off, &used)) != 0) {
+				result_line(res, &ctx, ret);
+			}
+			off += used;
+		}
+	}
+
+	pconf_finish(&ctx);
+}
+
+static int compare(const char *what, const char *in, size_t len, size_t chunklen)
+{
+	static result_t	ref, res;
+
+	parse_char(in, len, &ref);
+	parse_chunk(in, len, chunklen, &res);
+
+	if (ref.len == res.len && !memcmp(ref.text, res.text, ref.len)) {
+		return 0;
+	}
+
+	printf("FAIL: %s in chunks of %" PRIuSIZE ":\n[%.*s]\nparsed as\n[%s]\ninstead of\n[%s]\n",
+		what, chunklen, (int)(len > 200 ? 200 : len), in, res.text, ref.text);
+	return 1;
+}
+
+/* odd cases the state machine has to be asked about */
+static const char	*odd_lines[] = {
+	"SETINFO ups.status \"OL CHRG\"\n",
+	"  leading   spaces\tand tabs \r\n",
+	"a=b c = d ==\n",
+	"=start x\\=y \"a\"b \"a\"=\n",
+	"word#comment\n# a comment line\n",
+	"\"quoted # hash\" is an error\n",
+	"esc\\ aped \"q\\\"uote\" back\\\\slash \"\\#\"\n",
+	"ab\"cd \"\" \"\"x \"\n",
+	"joined \\\nwith the next line\n",
+	"\"quoted\nover two lines\"\n",
+	"trailing backslash\\\nnext\n",
+	"high\x80" "bit ctl\x01x del\x7f \"in\tquotes\" esc\\\x02\n",
+	"\n   \n\t\n",
+	"SETINFO x \"unbalanced\n",
+	"the end without a newline",
+	NULL
+};
+
+/* random text from the characters which matter */
+static size_t random_text(char *buf, size_t len)
+{
+	static const char	chars[] = "ab  \"\"\\#=\t\n\x01\x90\r";
+	size_t	i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = chars[(size_t)rand() % (sizeof(chars) - 1)];
+	}
+	return len;
+}
+
+/* what drivers send to upsd: a dump of the values of a large device */
+static size_t driver_dump(char **buf)
+{
+	size_t	size = 1024 * 1024, used = 0, i;
+
+	*buf = xcalloc(1, size);
+
+	for (i = 0; used + 256 < size; i++) {
+		used += (size_t)snprintf(*buf + used, size - used,
+			"SETINFO outlet.%" PRIuSIZE ".realpower \"%" PRIuSIZE "\"\n"
+			"SETINFO outlet.%" PRIuSIZE ".desc \"Outlet %" PRIuSIZE " \\\"rack\\\"\"\n"
+			"ADDENUM input.transfer.low \"%" PRIuSIZE "\"\n",
+			i % 48, i * 7, i % 48, i % 48, i % 200);
+		if (i % 100 == 99) {
+			used += (size_t)snprintf(*buf + used, size - used, "DUMPDONE\nPONG\n");
+		}
+	}
+
+	return used;
+}
+
+static double elapsed(const struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return difftimeval(now, *start);
+}
+
+/* parse the dump a few times in read()-sized chunks, returns the lines */
+static size_t bench(const char *in, size_t len, int chunked, double *d)
+{
+	PCONF_CTX_t	ctx;
+	struct timeval	start;
+	size_t	lines = 0, off, end, used, i;
+	int	round;
+
+	pconf_init(&ctx, NULL);
+	gettimeofday(&start, NULL);
+
+	for (round = 0; round < 10; round++) {
+		for (off = 0; off < len; off = end) {
+			end = off + SMALLBUF;
+			if (end > len) {
+				end = len;
+			}
+
+			if (!chunked) {
+				for (i = off; i < end; i++) {
+					if (pconf_char(&ctx, in[i]) == 1) {
+						lines++;
+					}
+				}
+				continue;
+			}
+
+			for (i = off; i < end; i += used) {
+				if (pconf_chunk(&ctx, in + i, end - i, &used) == 1) {
+					lines++;
+				}
+			}
+		}
+	}
+
+	*d = elapsed(&start);
+	pconf_finish(&ctx);
+	return lines;
+}
+
+int main(void)
+{
+	char	buf[4096], *dump, name[SMALLBUF];
+	size_t	len, n, chunklen, lines_char, lines_chunk;
+	int	errors = 0, i;
+	double	d_char, d_chunk;
+
+	srand(42);
+
+#ifndef WIN32
+	/* addchar() complains of every character it refuses, and there are
+	 * a lot of them below */
+	if (!freopen("/dev/null", "w", stderr)) {
+		printf("WARNING: can not silence stderr\n");
+	}
+#endif
+
+	/* every odd case, on its own and all in a row, cut everywhere */
+	for (n = 0; odd_lines[n]; n++) {
+		for (chunklen = 1; chunklen <= strlen(odd_lines[n]) + 1; chunklen++) {
+			errors += compare("odd line", odd_lines[n], strlen(odd_lines[n]), chunklen);
+		}
+	}
+	for (len = 0, n = 0; odd_lines[n]; n++) {
+		len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s", odd_lines[n]);
+	}
+	for (chunklen = 0; chunklen <= len; chunklen++) {
+		errors += compare("odd lines", buf, len, chunklen);
+	}
+
+	/* words over the length limit, and lines over the word limit */
+	memset(buf, 'w', 1500);
+	memcpy(buf + 700, "\\ x", 3);
+	buf[1000] = '"';
+	buf[1499] = '"';
+	buf[1500] = '\n';
+	errors += compare("long words", buf, 1501, 0);
+	errors += compare("long words", buf, 1501, SMALLBUF);
+
+	for (len = 0, n = 0; n < 40; n++) {
+		len += (size_t)snprintf(buf + len, sizeof(buf) - len, "arg%" PRIuSIZE " ", n);
+	}
+	buf[len++] = '\n';
+	errors += compare("many words", buf, len, SMALLBUF);
+
+	/* and whatever comes */
+	for (i = 0; i < 20000 && errors < 5; i++) {
+		len = random_text(buf, 1 + (size_t)rand() % 300);
+		snprintf(name, sizeof(name), "random text %d", i);
+		errors += compare(name, buf, len, (size_t)i % 5 == 0 ? 0 : 1 + (size_t)rand() % len);
+	}
+
+	/* the speed of it */
+	len = driver_dump(&dump);
+	errors += compare("driver dump", dump, len, SMALLBUF);
+
+	lines_char = bench(dump, len, 0, &d_char);
+	lines_chunk = bench(dump, len, 1, &d_chunk);
+	printf("=== pconf_char:\t%" PRIuSIZE " lines in %f sec\n", lines_char, d_char);
+	printf("=== pconf_chunk:\t%" PRIuSIZE " lines in %f sec\n", lines_chunk, d_chunk);
+
+	if (lines_char != lines_chunk) {
+		printf("FAIL: %" PRIuSIZE " lines instead of %" PRIuSIZE "\n", lines_chunk, lines_char);
+		errors++;
+	}
+
+	free(dump);
+
+	if (errors)
+		printf("nutpconftest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
@@ -0,0 +1,285 @@
+/*  nutserialtest.c - test the buffered reads of drivers/serial.c over a
+ *  pseudo-terminal: bytes which came after a reply must be kept for the
+ *  next read, and replies to pipelined queries must be told apart
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "main.h"
+#include "serial.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+# include <fcntl.h>
+# include <termios.h>
+#endif
+
+/* driver description structure */
+upsdrv_info_t upsdrv_info = {
+	"Mock driver for serial unit tests",
+	"0.01",
+	"",
+	DRV_EXPERIMENTAL,
+	{ NULL }
+};
+
+void upsdrv_cleanup(void) {}
+void upsdrv_shutdown(void) {}
+
+#ifndef WIN32
+
+static int	errors = 0;
+
+/* the UPS end of the pseudo-terminal, and the driver end */
+static int	master = -1, slave = -1;
+
+static char	alerts[16];
+static size_t	alerts_count = 0;
+
+static void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		errors++;
+	} else {
+		printf("PASS: %s\n", what);
+	}
+}
+
+static void ups_says(const void *data, size_t len)
+{
+	if (write(master, data, len) != (ssize_t)len) {
+		fatal_with_errno(EXIT_FAILURE, "write to pseudo-terminal");
+	}
+}
+
+static void alert_handler(char ch)
+{
+	if (alerts_count < sizeof(alerts) - 1) {
+		alerts[alerts_count++] = ch;
+	}
+}
+
+/* frames of: 0xAB, payload length, payload, sum of the payload bytes */
+static ssize_t frame_checksum(const unsigned char *data, size_t len, void *arg)
+{
+	size_t	i, need;
+	unsigned char	sum = 0;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	if (data[0] != 0xAB) {
+		return -1;
+	}
+
+	if (len < 2) {
+		return 0;
+	}
+
+	need = (size_t)data[1] + 3;
+	if (len < need) {
+		return 0;
+	}
+
+	for (i = 2; i < need - 1; i++) {
+		sum = (unsigned char)(sum + data[i]);
+	}
+
+	return (sum == data[need - 1]) ? (ssize_t)need : -1;
+}
+
+static void open_pty(void)
+{
+	struct termios	tio;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		fatal_with_errno(EXIT_FAILURE, "posix_openpt");
+	}
+
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		fatal_with_errno(EXIT_FAILURE, "open %s", ptsname(master));
+	}
+
+	/* what the drivers get from ser_open() */
+	if (tcgetattr(slave, &tio)) {
+		fatal_with_errno(EXIT_FAILURE, "tcgetattr");
+	}
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(slave, TCSANOW, &tio)) {
+		fatal_with_errno(EXIT_FAILURE, "tcsetattr");
+	}
+}
+
+static void test_lines(void)
+{
+	char	buf[64];
+	ssize_t	ret;
+
+	/* two replies in one chunk: the second must not be lost */
+	ups_says("(230.0\r(231.5\r", 14);
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 6 && !strcmp(buf, "(230.0"), "first of two lines read at once");
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 6 && !strcmp(buf, "(231.5"), "second line kept for the next read");
+
+	/* ignored chars, and alerts coming before and after a reply */
+	ups_says("\n!OK\r$", 6);
+	ret = ser_get_line_alert(slave, buf, sizeof(buf), '\r', "\n", "!$",
+		alert_handler, 1, 0);
+	check(ret == 2 && !strcmp(buf, "OK") && alerts_count == 1 && alerts[0] == '!',
+		"alert before a line handled, ignored char skipped");
+	ups_says("XY\r", 3);
+	ret = ser_get_line_alert(slave, buf, sizeof(buf), '\r', "\n", "!$",
+		alert_handler, 1, 0);
+	check(ret == 2 && !strcmp(buf, "XY") && alerts_count == 2 && alerts[1] == '$',
+		"alert kept after a line handled with the next one");
+
+	/* NUL is never part of a line */
+	ups_says("N\0U\r", 4);
+	ret = ser_get_line_alert(slave, buf, sizeof(buf), '\r', "", "",
+		alert_handler, 1, 0);
+	check(ret == 2 && !strcmp(buf, "NU") && alerts_count == 2,
+		"NUL ignored");
+
+	/* a line which does not fit is cut, its rest discarded */
+	ups_says("ABCDEFG\rHI\r", 11);
+	ret = ser_get_line(slave, buf, 4, '\r', "", 1, 0);
+	check(ret == 3 && !strcmp(buf, "ABC"), "long line cut to the buffer");
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 2 && !strcmp(buf, "HI"), "rest of a long line discarded");
+
+	/* nothing came */
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 0, 100000);
+	check(ret == 0, "timeout with nothing to read");
+}
+
+static void test_bytes(void)
+{
+	char	buf[64];
+	ssize_t	ret;
+
+	ups_says("xyz123", 6);
+	ret = ser_get_char(slave, buf, 1, 0);
+	check(ret == 1 && buf[0] == 'x', "single char read");
+	memset(buf, 0, sizeof(buf));
+	ret = ser_get_buf_len(slave, buf, 5, 1, 0);
+	check(ret == 5 && !memcmp(buf, "yz123", 5), "chars kept by ser_get_char() read first");
+
+	/* flushing drops what was kept too */
+	ups_says("A\rB\r", 4);
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 1 && !strcmp(buf, "A"), "line before flush");
+	ser_flush_io(slave);
+	ups_says("C\r", 2);
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 1 && !strcmp(buf, "C"), "flush dropped the kept line");
+
+	/* and so does probing another speed */
+	ups_says("D\rE\r", 4);
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 1 && !strcmp(buf, "D"), "line before speed change");
+	ser_set_speed_nf(slave, ptsname(master), B9600);
+	ups_says("F\r", 2);
+	ret = ser_get_line(slave, buf, sizeof(buf), '\r', "", 1, 0);
+	check(ret == 1 && !strcmp(buf, "F"), "speed change dropped the kept line");
+}
+
+static void test_frames(void)
+{
+	char	eol = '\r';
+	size_t	fixed = 4, lens[4];
+	unsigned char	buf[64];
+	const unsigned char	framed[] = {
+		0x00, 0x13,				/* line noise */
+		0xAB, 0x02, 0x10, 0x20, 0x30,		/* good */
+		0xAB, 0x01, 0x55, 0x00,			/* bad checksum */
+		0xAB, 0x01, 0x07, 0x07			/* good */
+	};
+	ssize_t	ret;
+
+	/* three queries sent at once, their replies read in one go */
+	ups_says("R1\rR22\rR333\r", 12);
+	ret = ser_get_frames(slave, buf, sizeof(buf), lens, 3,
+		ser_frame_endchar, &eol, 1, 0);
+	check(ret == 3 && lens[0] == 3 && lens[1] == 4 && lens[2] == 5
+		&& !memcmp(buf, "R1\rR22\rR333\r", 12), "pipelined replies split by endchar");
+
+	/* fewer replies than expected */
+	ups_says("R4\r", 3);
+	ret = ser_get_frames(slave, buf, sizeof(buf), lens, 2,
+		ser_frame_endchar, &eol, 0, 200000);
+	check(ret == 1 && lens[0] == 3, "missing reply reported as such");
+
+	ups_says("abcdefgh", 8);
+	ret = ser_get_frame(slave, buf, sizeof(buf), ser_frame_length, &fixed, 1, 0);
+	check(ret == 4 && !memcmp(buf, "abcd", 4), "fixed length reply");
+	ret = ser_get_frame(slave, buf, sizeof(buf), ser_frame_length, &fixed, 1, 0);
+	check(ret == 4 && !memcmp(buf, "efgh", 4), "next fixed length reply kept");
+
+	/* resync over noise and a corrupted reply */
+	ups_says(framed, sizeof(framed));
+	ret = ser_get_frame(slave, buf, sizeof(buf), frame_checksum, NULL, 1, 0);
+	check(ret == 5 && buf[0] == 0xAB && buf[4] == 0x30, "checksummed reply after noise");
+	ret = ser_get_frame(slave, buf, sizeof(buf), frame_checksum, NULL, 1, 0);
+	check(ret == 4 && buf[2] == 0x07, "corrupted reply skipped");
+
+	/* a reply larger than the buffer */
+	ups_says("0123456789\r", 11);
+	ret = ser_get_frame(slave, buf, 4, ser_frame_endchar, &eol, 1, 0);
+	check(ret < 0, "reply larger than the buffer refused");
+	ser_flush_io(slave);
+}
+
+int main(int argc, char **argv)
+{
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	open_pty();
+
+	test_lines();
+	test_bytes();
+	test_frames();
+
+	ser_close(slave, ptsname(master));
+	close(master);
+
+	printf("%d error(s)\n", errors);
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else	/* WIN32 */
+
+int main(int argc, char **argv)
+{
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	printf("SKIP: no pseudo-terminals on this platform\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
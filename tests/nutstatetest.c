@@ -0,0 +1,335 @@
+/*  nutstatetest.c - test and micro-benchmark the common state tree
+ *  (insert, lookup, sorted dump and delete of a few thousand variables),
+ *  and the binary framing of the driver socket protocol
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "state.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Outlets with a few dozen data points each, as on a daisy-chained ePDU */
+#define NUM_OUTLETS	96
+#define NUM_POINTS	32
+#define NUM_VARS	(NUM_OUTLETS * NUM_POINTS)
+#define NUM_ROUNDS	50
+
+static char	varnames[NUM_VARS][SMALLBUF];
+
+static double elapsed(const st_tree_timespec_t *start)
+{
+	st_tree_timespec_t	now;
+
+	state_get_timestamp(&now);
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	return difftimespec(now, *start);
+#else
+	return difftimeval(now, *start);
+#endif
+}
+
+/* walk the tree in order like "LIST VAR" would, checking the sort
+ * order and AVL balance on the way; returns the amount of nodes */
+static size_t check_dump(const st_tree_t *node, const char **prev, int *errors)
+{
+	size_t	count = 0, hl, hr;
+
+	if (!node)
+		return 0;
+
+	count += check_dump(node->left, prev, errors);
+
+	if (*prev && strcasecmp(*prev, node->var) >= 0) {
+		printf("FAIL: [%s] listed after [%s]\n", node->var, *prev);
+		(*errors)++;
+	}
+	*prev = node->var;
+
+	hl = node->left ? node->left->height : 0;
+	hr = node->right ? node->right->height : 0;
+	if (hl > hr + 1 || hr > hl + 1 || node->height != (hl > hr ? hl : hr) + 1) {
+		printf("FAIL: [%s] is not balanced: height=%" PRIuSIZE
+			" left=%" PRIuSIZE " right=%" PRIuSIZE "\n",
+			node->var, node->height, hl, hr);
+		(*errors)++;
+	}
+
+	count++;
+	count += check_dump(node->right, prev, errors);
+
+	return count;
+}
+
+/* encode a few records of each kind and decode them back */
+static int check_bin_frame(void)
+{
+	st_bin_buf_t	buf;
+	st_bin_rec_t	rec;
+	size_t	pos = 0, len;
+	int	errors = 0, ret;
+	const unsigned char	*payload;
+
+	memset(&buf, 0, sizeof(buf));
+	st_bin_add(&buf, ST_BIN_DEFINE, 0, "outlet.1.status", 0, 0);
+	st_bin_add(&buf, ST_BIN_SETINFO, 0, "on \"quoted\" \\ value", 0, 0);
+	st_bin_add(&buf, ST_BIN_ADDRANGE, 0, NULL, -5, 70000);
+	st_bin_add(&buf, ST_BIN_SETFLAGS, 0, NULL, ST_FLAG_RW | ST_FLAG_STRING, 0);
+	st_bin_add(&buf, ST_BIN_ADDCMD, 0, "load.off", 0, 0);
+	st_bin_add(&buf, ST_BIN_TEXT, 0, "DUMPDONE", 0, 0);
+	st_bin_finish(&buf);
+
+	len = st_bin_frame_len(buf.data);
+	payload = buf.data + ST_BIN_HEADER_LEN;
+	if (len + ST_BIN_HEADER_LEN != buf.len) {
+		printf("FAIL: frame header says %" PRIuSIZE " bytes for %" PRIuSIZE "\n",
+			len, buf.len - ST_BIN_HEADER_LEN);
+		errors++;
+	}
+
+	if (st_bin_next(payload, len, &pos, &rec) != 1
+	 || rec.op != ST_BIN_DEFINE || rec.id != 0 || strcmp(rec.str, "outlet.1.status")
+	) {
+		printf("FAIL: DEFINE record\n");
+		errors++;
+	}
+	if (st_bin_next(payload, len, &pos, &rec) != 1
+	 || rec.op != ST_BIN_SETINFO || strcmp(rec.str, "on \"quoted\" \\ value")
+	) {
+		printf("FAIL: SETINFO record\n");
+		errors++;
+	}
+	if (st_bin_next(payload, len, &pos, &rec) != 1
+	 || rec.op != ST_BIN_ADDRANGE || rec.num1 != -5 || rec.num2 != 70000
+	) {
+		printf("FAIL: ADDRANGE record\n");
+		errors++;
+	}
+	if (st_bin_next(payload, len, &pos, &rec) != 1
+	 || rec.op != ST_BIN_SETFLAGS || rec.num1 != (ST_FLAG_RW | ST_FLAG_STRING)
+	) {
+		printf("FAIL: SETFLAGS record\n");
+		errors++;
+	}
+	if (st_bin_next(payload, len, &pos, &rec) != 1
+	 || rec.op != ST_BIN_ADDCMD || strcmp(rec.str, "load.off")
+	) {
+		printf("FAIL: ADDCMD record\n");
+		errors++;
+	}
+	if (st_bin_next(payload, len, &pos, &rec) != 1
+	 || rec.op != ST_BIN_TEXT || strcmp(rec.str, "DUMPDONE")
+	) {
+		printf("FAIL: TEXT record\n");
+		errors++;
+	}
+	if (st_bin_next(payload, len, &pos, &rec) != 0) {
+		printf("FAIL: records past the end of the frame\n");
+		errors++;
+	}
+
+	/* a cut-off record must not be read past the end */
+	pos = 0;
+	while ((ret = st_bin_next(payload, len - 3, &pos, &rec)) > 0)
+		;
+	if (ret != -1) {
+		printf("FAIL: truncated frame was not detected\n");
+		errors++;
+	}
+
+	st_bin_free(&buf);
+
+	return errors;
+}
+
+#ifdef ST_SHM_SUPPORTED
+static int check_shm_slots(void)
+{
+	size_t	numslots = ST_SHM_MIN_SLOTS, size = st_shm_size(numslots);
+	st_shm_header_t	*hdr = xcalloc(1, size);
+	st_shm_slot_t	*slot;
+	char	val[ST_MAX_VALUE_LEN], big[ST_MAX_VALUE_LEN * 2];
+	int	errors = 0;
+
+	if (st_shm_valid(hdr, size)) {
+		printf("FAIL: segment without a header was accepted\n");
+		errors++;
+	}
+
+	st_shm_init(hdr, numslots);
+	if (!st_shm_valid(hdr, size) || st_shm_valid(hdr, size - 1)) {
+		printf("FAIL: segment header check\n");
+		errors++;
+	}
+
+	slot = st_shm_slot(hdr, numslots - 1);
+	if ((char *)(slot + 1) != (char *)hdr + size) {
+		printf("FAIL: last slot is not at the end of the segment\n");
+		errors++;
+	}
+
+	st_shm_write(slot, "OL CHRG");
+	if (!st_shm_read(slot, val, sizeof(val)) || strcmp(val, "OL CHRG") || (slot->seq & 1)) {
+		printf("FAIL: slot round trip\n");
+		errors++;
+	}
+
+	/* values are cut to the size of a slot */
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	st_shm_write(slot, big);
+	if (!st_shm_read(slot, val, sizeof(val)) || strlen(val) != ST_MAX_VALUE_LEN - 1) {
+		printf("FAIL: long value in a slot\n");
+		errors++;
+	}
+
+	/* a writer which never finishes makes readers give up */
+	slot->seq++;
+	if (st_shm_read(slot, val, sizeof(val))) {
+		printf("FAIL: value was read while being written\n");
+		errors++;
+	}
+
+	free(hdr);
+
+	return errors;
+}
+#endif	/* ST_SHM_SUPPORTED */
+
+int main(void)
+{
+	st_tree_t	*root = NULL;
+	st_tree_timespec_t	start;
+	const char	*prev;
+	size_t	i, j, count, maxheight;
+	int	errors = 0;
+	double	d;
+
+	/* mostly sorted insertion order, as drivers do it */
+	for (i = 0; i < NUM_OUTLETS; i++) {
+		for (j = 0; j < NUM_POINTS; j++) {
+			snprintf(varnames[i * NUM_POINTS + j], sizeof(varnames[0]),
+				"outlet.%" PRIuSIZE ".point%02" PRIuSIZE, i + 1, j);
+		}
+	}
+
+	state_get_timestamp(&start);
+	for (i = 0; i < NUM_VARS; i++) {
+		if (state_setinfo(&root, varnames[i], "1") != 1) {
+			printf("FAIL: could not add [%s]\n", varnames[i]);
+			errors++;
+		}
+	}
+	d = elapsed(&start);
+	printf("=== insert:\t%d vars in %f sec\n", NUM_VARS, d);
+
+	/* a balanced tree of N nodes is below 1.45*log2(N) in height */
+	for (maxheight = 0, i = NUM_VARS; i; i >>= 1)
+		maxheight++;
+	maxheight = maxheight * 3 / 2;
+	if (!root || root->height > maxheight) {
+		printf("FAIL: tree height %" PRIuSIZE " exceeds %" PRIuSIZE "\n",
+			root ? root->height : 0, maxheight);
+		errors++;
+	}
+
+	state_get_timestamp(&start);
+	for (j = 0; j < NUM_ROUNDS; j++) {
+		for (i = 0; i < NUM_VARS; i++) {
+			const char	*val = state_getinfo(root, varnames[i]);
+
+			if (!val || strcmp(val, "1")) {
+				printf("FAIL: lookup of [%s] returned [%s]\n",
+					varnames[i], NUT_STRARG(val));
+				errors++;
+			}
+		}
+	}
+	d = elapsed(&start);
+	printf("=== lookup:\t%d vars x %d rounds in %f sec\n",
+		NUM_VARS, NUM_ROUNDS, d);
+
+	/* case-insensitive lookups and updates, as used by the protocol */
+	if (!state_getinfo(root, "OUTLET.1.POINT00")) {
+		printf("FAIL: case-insensitive lookup\n");
+		errors++;
+	}
+	if (state_setinfo(&root, "Outlet.1.Point00", "2") != 1
+	 || strcmp(state_getinfo(root, "outlet.1.point00"), "2")
+	) {
+		printf("FAIL: case-insensitive update\n");
+		errors++;
+	}
+
+	state_get_timestamp(&start);
+	for (j = 0; j < NUM_ROUNDS; j++) {
+		prev = NULL;
+		count = check_dump(root, &prev, &errors);
+		if (count != NUM_VARS) {
+			printf("FAIL: dumped %" PRIuSIZE " vars instead of %d\n",
+				count, NUM_VARS);
+			errors++;
+		}
+		if (errors)
+			break;
+	}
+	d = elapsed(&start);
+	printf("=== dump:\t%d vars x %d rounds in %f sec\n",
+		NUM_VARS, NUM_ROUNDS, d);
+
+	/* drop every other variable, the tree must stay sorted and balanced */
+	state_get_timestamp(&start);
+	for (i = 0; i < NUM_VARS; i += 2) {
+		if (state_delinfo(&root, varnames[i]) != 1) {
+			printf("FAIL: could not delete [%s]\n", varnames[i]);
+			errors++;
+		}
+	}
+	d = elapsed(&start);
+	printf("=== delete:\t%d vars in %f sec\n", NUM_VARS / 2, d);
+
+	prev = NULL;
+	count = check_dump(root, &prev, &errors);
+	if (count != NUM_VARS / 2) {
+		printf("FAIL: %" PRIuSIZE " vars remain instead of %d\n",
+			count, NUM_VARS / 2);
+		errors++;
+	}
+	for (i = 0; i < NUM_VARS; i++) {
+		if ((state_getinfo(root, varnames[i]) == NULL) != !(i % 2)) {
+			printf("FAIL: [%s] is %s after deletion\n", varnames[i],
+				(i % 2) ? "missing" : "still present");
+			errors++;
+		}
+	}
+
+	state_infofree(root);
+
+	errors += check_bin_frame();
+#ifdef ST_SHM_SUPPORTED
+	errors += check_shm_slots();
+#endif	/* ST_SHM_SUPPORTED */
+
+	if (errors)
+		printf("nutstatetest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
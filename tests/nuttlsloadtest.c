@@ -0,0 +1,235 @@
+/*  nuttlsloadtest.c - check that upsd keeps answering promptly while
+ *  many clients are stuck in the middle of a STARTTLS handshake
+ *
+ *  This is not a stand-alone test: it is started by the NIT suite
+ *  against a sandboxed upsd (with NUT_PORT in the environment), see
+ *  tests/NIT/nit.sh testcase_sandbox_tls_handshake_load().
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "timehead.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+
+/* how many clients to leave hanging in each round */
+static const size_t	stages[] = { 0, 1, 4, 16, 64 };
+
+/* queries per round on the probing connection */
+#define NUM_PROBES	20
+
+/* give up waiting for a reply after this long */
+#define REPLY_TIMEOUT_MS	10000
+
+/* a probe answered slower than this means upsd was held up */
+#define MAX_LATENCY_MS	1000
+
+static int tcp_connect(const char *host, const char *port)
+{
+	struct addrinfo	hints, *res, *ai;
+	int	fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* send a request and read one line of reply (without the newline)
+ * returns 0 on success, -1 on failure or timeout */
+static int query(int fd, const char *req, char *buf, size_t buflen)
+{
+	size_t	len = 0;
+	struct pollfd	pfd;
+
+	if (write(fd, req, strlen(req)) != (ssize_t)strlen(req)) {
+		return -1;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (len + 1 < buflen) {
+		pfd.revents = 0;
+		if (poll(&pfd, 1, REPLY_TIMEOUT_MS) < 1) {
+			return -1;
+		}
+
+		if (read(fd, buf + len, 1) != 1) {
+			return -1;
+		}
+
+		if (buf[len] == '\n') {
+			break;
+		}
+		len++;
+	}
+
+	buf[len] = '\0';
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char	*host = "localhost", *port = getenv("NUT_PORT");
+	const char	*upsname = (argc > 1) ? argv[1] : "dummy";
+	char	req[SMALLBUF], buf[LARGEBUF];
+	int	probe, *stalled;
+	size_t	numstalled = 0, stage, i;
+	struct timeval	start, now;
+	double	d, sum, max, worst = 0;
+	int	errors = 0;
+
+	if (!port || !*port) {
+		printf("SKIP: NUT_PORT is not set, run this from the NIT suite\n");
+		return 77;
+	}
+
+	stalled = xcalloc(stages[SIZEOF_ARRAY(stages) - 1], sizeof(*stalled));
+
+	probe = tcp_connect(host, port);
+	if (probe < 0) {
+		printf("FAIL: could not connect to upsd at %s port %s\n", host, port);
+		free(stalled);
+		return 1;
+	}
+
+	snprintf(req, sizeof(req), "GET VAR %s ups.status\n", upsname);
+
+	for (stage = 0; stage < SIZEOF_ARRAY(stages); stage++) {
+		/* clients which ask for TLS and then never say "Hello" */
+		while (numstalled < stages[stage]) {
+			int	fd = tcp_connect(host, port);
+
+			if (fd < 0) {
+				printf("FAIL: could not connect stalled client #%" PRIuSIZE "\n",
+					numstalled);
+				errors++;
+				break;
+			}
+			stalled[numstalled++] = fd;
+
+			if (query(fd, "STARTTLS\n", buf, sizeof(buf)) != 0) {
+				printf("FAIL: no reply to STARTTLS from upsd for client #%" PRIuSIZE
+					" (still busy with the handshake of another client?)\n",
+					numstalled);
+				errors++;
+				break;
+			}
+
+			if (strcmp(buf, "OK STARTTLS")) {
+				printf("SKIP: upsd does not do STARTTLS: %s\n", buf);
+				errors = -1;
+				break;
+			}
+		}
+
+		if (errors) {
+			break;
+		}
+
+		sum = max = 0;
+		for (i = 0; i < NUM_PROBES; i++) {
+			gettimeofday(&start, NULL);
+			if (query(probe, req, buf, sizeof(buf)) != 0) {
+				printf("FAIL: no reply to [%.*s] with %" PRIuSIZE " stalled TLS clients\n",
+					(int)strlen(req) - 1, req, numstalled);
+				errors++;
+				break;
+			}
+			gettimeofday(&now, NULL);
+
+			d = difftimeval(now, start) * 1000.0;
+			sum += d;
+			if (d > max) {
+				max = d;
+			}
+		}
+
+		if (errors) {
+			break;
+		}
+
+		printf("=== %" PRIuSIZE " stalled TLS clients:\t"
+			"avg %.3f ms\tmax %.3f ms\t(%s)\n",
+			numstalled, sum / NUM_PROBES, max, buf);
+
+		if (max > worst) {
+			worst = max;
+		}
+	}
+
+	close(probe);
+	for (i = 0; i < numstalled; i++) {
+		close(stalled[i]);
+	}
+	free(stalled);
+
+	if (errors < 0) {
+		return 77;
+	}
+
+	if (!errors && worst > MAX_LATENCY_MS) {
+		printf("FAIL: upsd took up to %.3f ms to answer\n", worst);
+		errors++;
+	}
+
+	if (errors)
+		printf("nuttlsloadtest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("SKIP: nuttlsloadtest is not implemented for WIN32\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
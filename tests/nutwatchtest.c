@@ -0,0 +1,347 @@
+/*  nutwatchtest.c - check that upsd pushes changed values to clients
+ *  which WATCH a UPS, and that they can resume after a reconnection
+ *
+ *  This is not a stand-alone test: it is started by the NIT suite
+ *  against a sandboxed upsd (with NUT_PORT in the environment), see
+ *  tests/NIT/nit.sh testcase_sandbox_watch().
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+
+/* give up waiting for a reply (or a pushed update) after this long */
+#define REPLY_TIMEOUT_MS	10000
+
+/* the value we change (and restore) to see it pushed */
+#define TEST_VALUE	"NIT watch test"
+
+static int tcp_connect(const char *host, const char *port)
+{
+	struct addrinfo	hints, *res, *ai;
+	int	fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* read one line (without the newline), returns 0 on success,
+ * -1 on failure or timeout */
+static int readline(int fd, char *buf, size_t buflen)
+{
+	size_t	len = 0;
+	struct pollfd	pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (len + 1 < buflen) {
+		pfd.revents = 0;
+		if (poll(&pfd, 1, REPLY_TIMEOUT_MS) < 1) {
+			return -1;
+		}
+
+		if (read(fd, buf + len, 1) != 1) {
+			return -1;
+		}
+
+		if (buf[len] == '\n') {
+			break;
+		}
+		len++;
+	}
+
+	buf[len] = '\0';
+	return 0;
+}
+
+/* send a request and read one line of reply */
+static int query(int fd, const char *req, char *buf, size_t buflen)
+{
+	if (write(fd, req, strlen(req)) != (ssize_t)strlen(req)) {
+		return -1;
+	}
+
+	return readline(fd, buf, buflen);
+}
+
+/* send a request which should be answered with OK */
+static int query_ok(int fd, const char *req)
+{
+	char	buf[LARGEBUF];
+
+	if (query(fd, req, buf, sizeof(buf)) != 0) {
+		printf("FAIL: no reply to [%.*s]\n", (int)strlen(req) - 1, req);
+		return 0;
+	}
+
+	if (strncmp(buf, "OK", 2)) {
+		printf("FAIL: [%.*s] got [%s]\n", (int)strlen(req) - 1, req, buf);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int login(int fd, const char *user, const char *pass)
+{
+	char	req[SMALLBUF];
+
+	snprintf(req, sizeof(req), "USERNAME %s\n", user);
+	if (!query_ok(fd, req)) {
+		return 0;
+	}
+
+	snprintf(req, sizeof(req), "PASSWORD \"%s\"\n", pass);
+	return query_ok(fd, req);
+}
+
+/* read one update (BEGIN WATCH ... END WATCH) for the UPS; the value of
+ * the variable (if it was sent) goes to val, the change number to seq,
+ * returns the number of values sent or -1 on error */
+static int read_update(int fd, const char *upsname, const char *varname,
+	char *val, size_t vallen, uintmax_t *seq)
+{
+	char	buf[LARGEBUF], prefix[SMALLBUF];
+	int	count = 0;
+	size_t	plen;
+
+	if (readline(fd, buf, sizeof(buf)) != 0) {
+		printf("FAIL: no update pushed for %s\n", upsname);
+		return -1;
+	}
+
+	snprintf(prefix, sizeof(prefix), "BEGIN WATCH %s", upsname);
+	if (strcmp(buf, prefix)) {
+		printf("FAIL: expected [%s], got [%s]\n", prefix, buf);
+		return -1;
+	}
+
+	snprintf(prefix, sizeof(prefix), "VAR %s %s \"", upsname, varname);
+	plen = strlen(prefix);
+
+	for (;;) {
+		if (readline(fd, buf, sizeof(buf)) != 0) {
+			printf("FAIL: update for %s was cut short\n", upsname);
+			return -1;
+		}
+
+		if (!strncmp(buf, "END WATCH ", 10)) {
+			const char	*p = strrchr(buf, ' ');
+
+			*seq = strtoumax(p + 1, NULL, 10);
+			return count;
+		}
+
+		if (strncmp(buf, "VAR ", 4)) {
+			printf("FAIL: unexpected line in update: [%s]\n", buf);
+			return -1;
+		}
+
+		count++;
+
+		if (!strncmp(buf, prefix, plen) && strlen(buf) > plen) {
+			snprintf(val, vallen, "%.*s",
+				(int)(strlen(buf) - plen - 1), buf + plen);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char	*host = "localhost", *port = getenv("NUT_PORT");
+	const char	*upsname = (argc > 1) ? argv[1] : "UPS2";
+	const char	*varname = (argc > 2) ? argv[2] : "outlet.1.desc";
+	const char	*watchuser = (argc > 4) ? argv[3] : "dummy-admin";
+	const char	*watchpass = (argc > 4) ? argv[4] : "P@ssW0rdAdm";
+	const char	*setuser = (argc > 6) ? argv[5] : "admin";
+	const char	*setpass = (argc > 6) ? argv[6] : "mypass";
+	char	req[LARGEBUF], buf[LARGEBUF], orig[LARGEBUF], val[LARGEBUF];
+	int	watcher = -1, setter = -1, errors = 0, n;
+	uintmax_t	seq1 = 0, seq2 = 0, seq3 = 0;
+
+	if (!port || !*port) {
+		printf("SKIP: NUT_PORT is not set, run this from the NIT suite\n");
+		return 77;
+	}
+
+	watcher = tcp_connect(host, port);
+	setter = tcp_connect(host, port);
+	if (watcher < 0 || setter < 0) {
+		printf("FAIL: could not connect to upsd at %s port %s\n", host, port);
+		errors++;
+		goto done;
+	}
+
+	/* not without a login */
+	snprintf(req, sizeof(req), "WATCH %s\n", upsname);
+	if (query(watcher, req, buf, sizeof(buf)) != 0
+	 || strcmp(buf, "ERR USERNAME-REQUIRED")
+	) {
+		/* older upsd (not a failure of this test) */
+		if (!strcmp(buf, "ERR UNKNOWN-COMMAND")) {
+			printf("SKIP: upsd does not know WATCH\n");
+			errors = -1;
+			goto done;
+		}
+		printf("FAIL: WATCH without a login got [%s]\n", buf);
+		errors++;
+	}
+
+	if (!login(watcher, watchuser, watchpass)
+	 || !login(setter, setuser, setpass)
+	) {
+		errors++;
+		goto done;
+	}
+
+	/* the first update has the current value */
+	snprintf(req, sizeof(req), "WATCH %s %s\n", upsname, varname);
+	orig[0] = '\0';
+	if (!query_ok(watcher, req)
+	 || read_update(watcher, upsname, varname, orig, sizeof(orig), &seq1) != 1
+	) {
+		printf("FAIL: first update did not have %s\n", varname);
+		errors++;
+		goto done;
+	}
+	printf("=== watching %s %s: [%s] as of change %" PRIuMAX "\n",
+		upsname, varname, orig, seq1);
+
+	/* a change is pushed, without asking */
+	snprintf(req, sizeof(req), "SET VAR %s %s \"%s\"\n",
+		upsname, varname, TEST_VALUE);
+	if (!query_ok(setter, req)) {
+		errors++;
+		goto done;
+	}
+
+	val[0] = '\0';
+	if ((n = read_update(watcher, upsname, varname, val, sizeof(val), &seq2)) < 0) {
+		errors++;
+		goto done;
+	}
+	if (n != 1 || strcmp(val, TEST_VALUE) || seq2 <= seq1) {
+		printf("FAIL: pushed update had %d values, [%s] as of change %" PRIuMAX "\n",
+			n, val, seq2);
+		errors++;
+	} else {
+		printf("=== pushed: [%s] as of change %" PRIuMAX "\n", val, seq2);
+	}
+
+	/* resuming where we were: nothing new to tell */
+	close(watcher);
+	watcher = tcp_connect(host, port);
+	if (watcher < 0 || !login(watcher, watchuser, watchpass)) {
+		errors++;
+		goto done;
+	}
+
+	snprintf(req, sizeof(req), "WATCH %s SINCE %" PRIuMAX " %s\n",
+		upsname, seq2, varname);
+	if (!query_ok(watcher, req)
+	 || (n = read_update(watcher, upsname, varname, val, sizeof(val), &seq3)) != 0
+	) {
+		printf("FAIL: resumed watch did not start with an empty update\n");
+		errors++;
+	}
+
+	/* a change number we did not give out means "send everything" */
+	snprintf(req, sizeof(req), "WATCH %s SINCE 1 %s\n", upsname, varname);
+	if (!query_ok(watcher, req)
+	 || (n = read_update(watcher, upsname, varname, val, sizeof(val), &seq3)) != 1
+	) {
+		printf("FAIL: watch with an unknown change number did not send the value\n");
+		errors++;
+	}
+
+	if (!query_ok(watcher, "UNWATCH\n")) {
+		errors++;
+	}
+
+	snprintf(req, sizeof(req), "UNWATCH %s\n", upsname);
+	if (query(watcher, req, buf, sizeof(buf)) != 0 || strcmp(buf, "ERR UNKNOWN-UPS")) {
+		printf("FAIL: UNWATCH of a UPS not watched got [%s]\n", buf);
+		errors++;
+	}
+
+	/* leave things as we found them */
+	snprintf(req, sizeof(req), "SET VAR %s %s \"%s\"\n", upsname, varname, orig);
+	if (!query_ok(setter, req)) {
+		errors++;
+	}
+
+done:
+	if (watcher >= 0) {
+		close(watcher);
+	}
+	if (setter >= 0) {
+		close(setter);
+	}
+
+	if (errors < 0) {
+		return 77;
+	}
+
+	if (errors)
+		printf("nutwatchtest collected %i errors\n", errors);
+
+	return (errors != 0);
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("SKIP: nutwatchtest is not implemented for WIN32\n");
+	return 77;
+}
+
+#endif	/* WIN32 */